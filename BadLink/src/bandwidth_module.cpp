@@ -1,21 +1,29 @@
 #define NOMINMAX
 #include "bandwidth_module.h"
+#include "gso.h"
+#include <algorithm>
 
 namespace BadLink {
 
     BandwidthModule::BandwidthModule()
-        : last_refill_time_(std::chrono::steady_clock::now())
+        : last_refill_time_(Now())
         , available_bytes_(0)
         , max_burst_bytes_(125000) {  // 1 second worth at 1Mbps
+        htb_.SetLinkRate(bandwidth_kbps_.load());
+        policer_.Configure(bandwidth_kbps_.load(), PolicerConfig{});
     }
 
     BandwidthModule::~BandwidthModule() = default;
 
     void BandwidthModule::SetBandwidthLimit(uint32_t kbps) {
         bandwidth_kbps_.store(kbps);
-        std::lock_guard<std::mutex> lock(bucket_mutex_);
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
         // Update burst size to 1 second worth of data
         max_burst_bytes_ = (kbps * 1000.0) / 8.0;
+        htb_.SetLinkRate(kbps);
+        if (policer_.GetCommittedRate() != kbps) {
+            policer_.Configure(kbps, policer_.GetConfig());
+        }
     }
 
     uint32_t BandwidthModule::GetBandwidthLimit() const {
@@ -25,12 +33,19 @@ namespace BadLink {
     void BandwidthModule::SetEnabled(bool enabled) {
         enabled_.store(enabled);
         if (enabled) {
-            std::lock_guard<std::mutex> lock(bucket_mutex_);
-            last_refill_time_ = std::chrono::steady_clock::now();
+            std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+            last_refill_time_ = Now();
             available_bytes_ = max_burst_bytes_ / 2;  // Start with half bucket
+            cross_traffic_.Restart();   // No background arrived while nothing was shaped
         }
     }
 
+    void BandwidthModule::SetClock(const SimulationClock& clock) {
+        SimulationModule::SetClock(clock);
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        last_refill_time_ = Now();
+    }
+
     bool BandwidthModule::IsEnabled() const {
         return enabled_.load();
     }
@@ -43,6 +58,100 @@ namespace BadLink {
         outbound_enabled_.store(enabled);
     }
 
+    void BandwidthModule::SetFlowLimit(uint32_t kbps) {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        flow_shaper_.SetFlowRate(kbps);
+    }
+
+    uint32_t BandwidthModule::GetFlowLimit() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return flow_shaper_.GetFlowRate();
+    }
+
+    void BandwidthModule::SetSynRateLimit(uint32_t per_second) {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        flow_shaper_.SetSynRate(per_second);
+    }
+
+    uint32_t BandwidthModule::GetSynRateLimit() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return flow_shaper_.GetSynRate();
+    }
+
+    std::vector<FlowShaper::FlowStats> BandwidthModule::GetFlowBacklog(size_t max_flows) const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return flow_shaper_.GetBacklog(max_flows);
+    }
+
+    uint64_t BandwidthModule::GetFlowDrops() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return flow_shaper_.GetDrops();
+    }
+
+    uint64_t BandwidthModule::GetSynDrops() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return flow_shaper_.GetSynDrops();
+    }
+
+    void BandwidthModule::SetMode(BandwidthMode mode) {
+        if (mode_.exchange(mode) != mode) {
+            // The policer never asks for background, the shaper starts it afresh
+            std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+            cross_traffic_.Restart();
+        }
+    }
+
+    BandwidthMode BandwidthModule::GetMode() const {
+        return mode_.load();
+    }
+
+    void BandwidthModule::SetPolicer(const PolicerConfig& config) {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        if (policer_.GetConfig() != config) {
+            policer_.Configure(bandwidth_kbps_.load(), config);
+        }
+    }
+
+    PolicerConfig BandwidthModule::GetPolicer() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return policer_.GetConfig();
+    }
+
+    PolicerCounters BandwidthModule::GetPolicerCounters() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return policer_.GetCounters();
+    }
+
+    void BandwidthModule::SetCrossTraffic(const CrossTrafficConfig& config, Direction direction) {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        if (cross_traffic_.GetConfig() != config) {
+            cross_traffic_.Configure(config, DirectionIndex(direction));
+        }
+    }
+
+    CrossTrafficStats BandwidthModule::GetCrossTrafficStats() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        CrossTrafficStats stats = cross_stats_;
+        stats.backlog_bytes = static_cast<uint64_t>(virtual_backlog_);
+        return stats;
+    }
+
+    std::expected<void, std::string> BandwidthModule::SetTrafficClasses(const std::vector<TrafficClassConfig>& classes) {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        // Packets queued under the old classes finish through the FIFO
+        std::vector<SimulatedPacket> flushed;
+        auto result = htb_.Configure(classes, flushed);
+        for (auto& packet : flushed) {
+            PushQueue(std::move(packet));
+        }
+        return result;
+    }
+
+    std::vector<HtbScheduler::ClassStats> BandwidthModule::GetClassStats() const {
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
+        return htb_.GetStats(Now());
+    }
+
     std::vector<SimulatedPacket> BandwidthModule::ProcessBatch(
         std::vector<SimulatedPacket>&& packets) {
 
@@ -50,72 +159,215 @@ namespace BadLink {
             return std::move(packets);
         }
 
-        std::lock_guard<std::mutex> lock(bucket_mutex_);
-        RefillTokenBucket();
-
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
         std::vector<SimulatedPacket> output_packets;
 
-        // Add new packets to queue
-        for (auto&& packet : packets) {
-            if (ShouldProcess(packet.addr)) {
-                packet_queue_.push(std::move(packet));
-            }
-            else {
-                output_packets.push_back(std::move(packet));
+        // Policer decides every packet right here, nothing waits for the release thread
+        if (mode_.load() == BandwidthMode::Policer) {
+            const auto now = Now();
+            output_packets.reserve(packets.size());
+            for (auto&& packet : packets) {
+                if (ShouldProcess(packet)) {
+                    Police(std::move(packet), now, output_packets);
+                }
+                else {
+                    output_packets.push_back(std::move(packet));
+                }
             }
+            return output_packets;
         }
 
-        // Process queued packets with bandwidth limit
-        while (!packet_queue_.empty()) {
-            auto& front_packet = packet_queue_.front();
-            size_t packet_size = front_packet.data.size();
+        RefillTokenBucket();
+        AddCrossTraffic();
 
-            if (ConsumeTokens(packet_size)) {
-                output_packets.push_back(std::move(front_packet));
-                packet_queue_.pop();
+        // Per-flow caps and SYN policing first, flows whose tokens came due go ahead of new packets
+        const auto now = Now();
+        std::vector<SimulatedPacket> shaped;
+        flow_shaper_.Release(now, shaped);
+        for (auto&& packet : packets) {
+            if (ShouldProcess(packet)) {
+                flow_shaper_.Admit(std::move(packet), now, shaped);
             }
             else {
-                // Not enough bandwidth available
-                break;
+                output_packets.push_back(std::move(packet));
             }
         }
 
+        // Add new packets to queue
+        for (auto&& packet : shaped) {
+            Enqueue(std::move(packet), output_packets);
+        }
+
+        // Process queued packets with bandwidth limit
+        DrainQueue(output_packets);
         return output_packets;
     }
 
     std::vector<SimulatedPacket> BandwidthModule::GetReleasablePackets() {
-        if (!enabled_.load()) {
-            std::lock_guard<std::mutex> lock(bucket_mutex_);
+        // Disabled or switched to the policer: whatever the shaper still holds goes out
+        if (!enabled_.load() || mode_.load() == BandwidthMode::Policer) {
+            std::lock_guard<ContendedMutex> lock(bucket_mutex_);
             std::vector<SimulatedPacket> remaining;
+            flow_shaper_.Flush(remaining);
+            htb_.Flush(remaining);
             while (!packet_queue_.empty()) {
                 remaining.push_back(std::move(packet_queue_.front()));
                 packet_queue_.pop();
             }
+            virtual_ahead_ = {};
+            virtual_tail_ = 0;
+            virtual_backlog_ = 0;
             return remaining;
         }
 
-        std::lock_guard<std::mutex> lock(bucket_mutex_);
+        std::lock_guard<ContendedMutex> lock(bucket_mutex_);
         RefillTokenBucket();
+        AddCrossTraffic();
 
         std::vector<SimulatedPacket> output_packets;
 
+        std::vector<SimulatedPacket> shaped;
+        flow_shaper_.Release(Now(), shaped);
+        for (auto&& packet : shaped) {
+            Enqueue(std::move(packet), output_packets);
+        }
+
+        DrainQueue(output_packets);
+        return output_packets;
+    }
+
+    void BandwidthModule::Enqueue(SimulatedPacket&& packet, std::vector<SimulatedPacket>& output) {
+        if (htb_.IsActive()) {
+            // Classes pace segments, a super-packet would hold its class for its whole length
+            const auto now = Now();
+            if (packet.gso_size != 0) {
+                std::vector<SimulatedPacket> segments;
+                Gso::Segment(std::move(packet), segments);
+                for (auto& segment : segments) {
+                    htb_.Enqueue(std::move(segment), now);
+                }
+            }
+            else {
+                htb_.Enqueue(std::move(packet), now);
+            }
+            return;
+        }
+
+        if (packet.gso_size != 0) {
+            // A super-packet passes whole only if it fits right now, otherwise its
+            // segments are paced individually
+            if (packet_queue_.empty() && virtual_tail_ <= 0 && ConsumeTokens(packet.Size())) {
+                output.push_back(std::move(packet));
+                return;
+            }
+
+            std::vector<SimulatedPacket> segments;
+            Gso::Segment(std::move(packet), segments);
+            for (auto& segment : segments) {
+                PushQueue(std::move(segment));
+            }
+        }
+        else {
+            PushQueue(std::move(packet));
+        }
+    }
+
+    void BandwidthModule::PushQueue(SimulatedPacket&& packet) {
+        packet_queue_.push(std::move(packet));
+        virtual_ahead_.push(virtual_tail_);
+        virtual_tail_ = 0;
+    }
+
+    void BandwidthModule::AddCrossTraffic() {
+        double bytes = cross_traffic_.Arrivals(Now());
+        if (bytes <= 0) {
+            return;
+        }
+        cross_stats_.offered_bytes += static_cast<uint64_t>(bytes);
+
+        // The background sees the same queue as real traffic: up to a second of the link rate,
+        // beyond that its bytes are tail dropped
+        const double room = std::max(max_burst_bytes_ - virtual_backlog_, 0.0);
+        if (bytes > room) {
+            cross_stats_.dropped_bytes += static_cast<uint64_t>(bytes - room);
+            bytes = room;
+        }
+        virtual_tail_ += bytes;
+        virtual_backlog_ += bytes;
+    }
+
+    bool BandwidthModule::DrainVirtual(double& bytes) {
+        if (bytes <= 0) {
+            return true;
+        }
+
+        // Virtual bytes may go out partially, they are not packets
+        double sent = bytes;
+        if (bandwidth_kbps_.load() != 0) {
+            sent = std::clamp(available_bytes_, 0.0, bytes);
+            available_bytes_ -= sent;
+        }
+        htb_.ChargeLink(sent);     // Traffic classes get what the background leaves
+        bytes -= sent;
+        virtual_backlog_ = std::max(virtual_backlog_ - sent, 0.0);
+        cross_stats_.sent_bytes += static_cast<uint64_t>(sent);
+        return bytes <= 0;
+    }
+
+    void BandwidthModule::DrainQueue(std::vector<SimulatedPacket>& output) {
         while (!packet_queue_.empty()) {
+            if (!DrainVirtual(virtual_ahead_.front())) {
+                break;  // Still behind background bytes
+            }
+
             auto& front_packet = packet_queue_.front();
-            size_t packet_size = front_packet.data.size();
+            size_t packet_size = front_packet.Size();
 
             if (ConsumeTokens(packet_size)) {
-                output_packets.push_back(std::move(front_packet));
+                output.push_back(std::move(front_packet));
                 packet_queue_.pop();
+                virtual_ahead_.pop();
             }
             else {
+                // Not enough bandwidth available
                 break;
             }
         }
+        if (packet_queue_.empty()) {
+            DrainVirtual(virtual_tail_);
+        }
 
-        return output_packets;
+        // Leftovers of a previous class set go first, the classes share the link after them
+        if (packet_queue_.empty() && htb_.HasBacklog()) {
+            htb_.Dequeue(Now(), output);
+        }
     }
 
-    bool BandwidthModule::ShouldProcess(const WINDIVERT_ADDRESS& addr) const {
+    void BandwidthModule::Police(SimulatedPacket&& packet, std::chrono::steady_clock::time_point now,
+        std::vector<SimulatedPacket>& output) {
+        if (packet.gso_size != 0) {
+            // Marked per wire segment, a policer never sees super-packets
+            std::vector<SimulatedPacket> segments;
+            Gso::Segment(std::move(packet), segments);
+            for (auto& segment : segments) {
+                if (policer_.Passes(policer_.Mark(segment.Size(), now))) {
+                    output.push_back(std::move(segment));
+                }
+            }
+            return;
+        }
+
+        if (policer_.Passes(policer_.Mark(packet.Size(), now))) {
+            output.push_back(std::move(packet));
+        }
+    }
+
+    bool BandwidthModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::BANDWIDTH) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
         if (addr.Outbound && !outbound_enabled_.load()) {
             return false;
         }
@@ -126,7 +378,7 @@ namespace BadLink {
     }
 
     void BandwidthModule::RefillTokenBucket() {
-        const auto current_time = std::chrono::steady_clock::now();
+        const auto current_time = Now();
         const auto elapsed = current_time - last_refill_time_;
 
         // Need floating point for sub-millisecond precision
@@ -141,6 +393,9 @@ namespace BadLink {
     }
 
     bool BandwidthModule::ConsumeTokens(size_t bytes) {
+        if (bandwidth_kbps_.load() == 0) {
+            return true;    // No aggregate cap, only per-flow limits apply
+        }
         if (available_bytes_ >= bytes) {
             available_bytes_ -= bytes;
             return true;
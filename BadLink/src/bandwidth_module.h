@@ -1,7 +1,12 @@
 #ifndef BADLINK_SRC_BANDWIDTH_MODULE_H_
 #define BADLINK_SRC_BANDWIDTH_MODULE_H_
 
+#include "cross_traffic.h"
+#include "flow_shaper.h"
+#include "htb_scheduler.h"
 #include "simulation_module.h"
+#include "traffic_policer.h"
+#include "lock_stats.h"
 #include <atomic>
 #include <mutex>
 #include <queue>
@@ -14,10 +19,39 @@ namespace BadLink {
         BandwidthModule();
         ~BandwidthModule() override;
 
-        // Set bandwidth limit in kilobits per second
+        // Set bandwidth limit in kilobits per second, 0 leaves the total uncapped
         void SetBandwidthLimit(uint32_t kbps);
         uint32_t GetBandwidthLimit() const;
 
+        // Cap of every flow on its own in kilobits per second, 0 disables
+        void SetFlowLimit(uint32_t kbps);
+        uint32_t GetFlowLimit() const;
+
+        // New TCP connections allowed per second, 0 disables
+        void SetSynRateLimit(uint32_t per_second);
+        uint32_t GetSynRateLimit() const;
+
+        // Per-flow shaping state for the monitor
+        std::vector<FlowShaper::FlowStats> GetFlowBacklog(size_t max_flows) const;
+        uint64_t GetFlowDrops() const;
+        uint64_t GetSynDrops() const;
+
+        // Shaper queues excess traffic, policer drops it on arrival
+        void SetMode(BandwidthMode mode);
+        BandwidthMode GetMode() const;
+        void SetPolicer(const PolicerConfig& config);
+        PolicerConfig GetPolicer() const;
+        PolicerCounters GetPolicerCounters() const;
+
+        // Synthetic background load competing with real packets in the shaper queue
+        // `direction` is the one this shaper queues, each direction draws its own background
+        void SetCrossTraffic(const CrossTrafficConfig& config, Direction direction);
+        CrossTrafficStats GetCrossTrafficStats() const;
+
+        // Traffic classes sharing the total limit, empty goes back to a single FIFO
+        std::expected<void, std::string> SetTrafficClasses(const std::vector<TrafficClassConfig>& classes);
+        std::vector<HtbScheduler::ClassStats> GetClassStats() const;
+
         // Enable/disable the module
         void SetEnabled(bool enabled);
         bool IsEnabled() const override;
@@ -26,6 +60,9 @@ namespace BadLink {
         void SetInboundEnabled(bool enabled) override;
         void SetOutboundEnabled(bool enabled) override;
 
+        // Restarts the token bucket on the new clock's time
+        void SetClock(const SimulationClock& clock) override;
+
         // Process packets
         std::vector<SimulatedPacket> ProcessBatch(
             std::vector<SimulatedPacket>&& packets) override;
@@ -36,19 +73,43 @@ namespace BadLink {
         std::atomic<bool> inbound_enabled_{ true };
         std::atomic<bool> outbound_enabled_{ true };
         std::atomic<uint32_t> bandwidth_kbps_{ 1000 };  // Default 1 Mbps
+        std::atomic<BandwidthMode> mode_{ BandwidthMode::Shaper };
 
         // Token bucket for rate limiting
-        mutable std::mutex bucket_mutex_;
+        mutable ContendedMutex bucket_mutex_{ "Bandwidth bucket" };
         std::chrono::steady_clock::time_point last_refill_time_;
         double available_bytes_;
         double max_burst_bytes_;
 
-        // Packet queue
+        // Packet queue, each packet waits behind the virtual bytes queued ahead of it
         std::queue<SimulatedPacket> packet_queue_;
+        std::queue<double> virtual_ahead_;      // Parallel to packet_queue_
+        double virtual_tail_ = 0;               // Virtual bytes behind the last real packet
+
+        // Cross traffic feeding the virtual bytes, guarded by bucket_mutex_
+        CrossTraffic cross_traffic_;
+        double virtual_backlog_ = 0;
+        CrossTrafficStats cross_stats_;
+
+        // Per-flow caps run ahead of the aggregate bucket, guarded by bucket_mutex_
+        FlowShaper flow_shaper_;
+
+        // Replaces packet_queue_ while traffic classes are configured, guarded by bucket_mutex_
+        HtbScheduler htb_;
+
+        // Policer mode, committed rate follows bandwidth_kbps_, guarded by bucket_mutex_
+        TrafficPolicer policer_;
 
-        bool ShouldProcess(const WINDIVERT_ADDRESS& addr) const;
+        bool ShouldProcess(const SimulatedPacket& packet) const;
+        void Police(SimulatedPacket&& packet, std::chrono::steady_clock::time_point now,
+            std::vector<SimulatedPacket>& output);
         void RefillTokenBucket();
         bool ConsumeTokens(size_t bytes);
+        void Enqueue(SimulatedPacket&& packet, std::vector<SimulatedPacket>& output);
+        void PushQueue(SimulatedPacket&& packet);
+        void AddCrossTraffic();
+        bool DrainVirtual(double& bytes);
+        void DrainQueue(std::vector<SimulatedPacket>& output);
     };
 
 }
@@ -0,0 +1,78 @@
+#define NOMINMAX
+#include "module_benchmark.h"
+#include "scenario.h"
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+// BadLinkBench.exe, the headless benchmarks and self test in their own executable so the replaced
+// global operator new of module_benchmark.cpp never reaches the GUI, and so CI can run them without
+// the administrator rights BadLink.exe asks for
+
+namespace {
+
+    // One JSON line per result to `path` or the console, `run` takes the line writer
+    template <typename Run>
+    int RunBenchmark(const char* path, Run run) {
+        std::ofstream file;
+        if (path != nullptr) {
+            file.open(path);
+            if (!file) {
+                std::cerr << std::format("Cannot write {}\n", path);
+                return 1;
+            }
+        }
+        std::ostream& out = path != nullptr ? static_cast<std::ostream&>(file) : std::cout;
+
+        run([&](const auto& result) {
+            out << result.ToJson() << '\n';
+            out.flush();
+        });
+        return 0;
+    }
+
+    // Headless built-in scenarios, one line per check, exit code is the number of failed checks
+    int RunSelfTest() {
+        int failed = 0;
+        for (const auto& check : BadLink::RunBuiltInScenarios()) {
+            std::cout << std::format("{} {}, {}: {}\n", check.passed ? "PASS" : "FAIL", check.scenario, check.check,
+                check.detail);
+            failed += check.passed ? 0 : 1;
+        }
+        std::cout << std::format("{} failed\n", failed);
+        return failed;
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    // BadLinkBench.exe --self-test runs the Self Test scenarios, for CI
+    if (argc > 1 && std::string_view(argv[1]) == "--self-test") {
+        return RunSelfTest();
+    }
+
+    // BadLinkBench.exe --capture [file.jsonl] [packets per second] [filter] runs the capture engine
+    // on an in-memory source at 1 to 16 workers, unpaced unless a rate is given, capturing all unless filtered
+    if (argc > 1 && std::string_view(argv[1]) == "--capture") {
+        BadLink::CaptureBenchmarkSweep sweep;
+        if (argc > 3) {
+            sweep.offered_pps = std::strtoull(argv[3], nullptr, 10);
+        }
+        if (argc > 4) {
+            sweep.filter = argv[4];
+        }
+        return RunBenchmark(argc > 2 ? argv[2] : nullptr, [&](const auto& write) {
+            BadLink::RunCaptureBenchmarks(sweep, write);
+        });
+    }
+
+    // BadLinkBench.exe [file.jsonl] runs the module, filter and payload matcher benchmarks
+    return RunBenchmark(argc > 1 ? argv[1] : nullptr, [](const auto& write) {
+        BadLink::RunModuleBenchmarks({}, write);
+        BadLink::RunFilterBenchmarks(65536, write);
+        BadLink::RunMatcherBenchmarks(20000, write);
+    });
+}
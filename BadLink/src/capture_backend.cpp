@@ -0,0 +1,296 @@
+#define NOMINMAX
+#include "capture_backend.h"
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <thread>
+
+namespace BadLink {
+
+    std::expected<void, std::string> BackendFilter::Compile(const std::string& filter) {
+        auto program = FilterProgram::Compile(filter);
+        if (!program) {
+            return std::unexpected(std::format("Invalid filter: {}", program.error()));
+        }
+        program_.reset();
+        if (!program->MatchesAll()) {
+            program_ = std::move(*program);
+        }
+        return {};
+    }
+
+    void BackendFilter::Apply(uint8_t* buffer, UINT* received_length, WINDIVERT_ADDRESS* addresses, UINT* address_length) const {
+        if (!program_) {
+            return;
+        }
+
+        // The program reads parsed packets; the views and their byte vectors are reused across batches
+        thread_local std::vector<SimulatedPacket> packets;
+        thread_local std::vector<uint8_t> results;
+        thread_local std::vector<std::span<const uint8_t>> wire;
+
+        const size_t count = *address_length / sizeof(WINDIVERT_ADDRESS);
+        packets.resize(count);
+        wire.clear();
+        size_t offset = 0;
+        for (size_t i = 0; i < count; ++i) {
+            // Packets sit back to back, each one as long as its IP header says
+            const uint8_t* data = buffer + offset;
+            const size_t left = *received_length - offset;
+            size_t length = left;
+            if (left >= 20 && (data[0] >> 4) == 4) {
+                length = LoadBe16(data + 2);
+            }
+            else if (left >= 40 && (data[0] >> 4) == 6) {
+                length = static_cast<size_t>(LoadBe16(data + 4)) + 40;
+            }
+            length = std::min(length, left);
+            wire.emplace_back(data, length);
+            offset += length;
+
+            SimulatedPacket& packet = packets[i];
+            if (!packet.data || packet.data.use_count() > 1) {
+                packet.data = std::make_shared<std::vector<uint8_t>>();
+            }
+            packet.data->assign(data, data + length);
+            packet.addr = addresses[i];
+            packet.headers = ParseHeaders(*packet.data);
+        }
+
+        program_->Evaluate(packets, results);
+
+        // Compact in order; a kept packet only ever moves toward the front
+        uint8_t* out = buffer;
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (results[i] == 0) {
+                continue;
+            }
+            std::memmove(out, wire[i].data(), wire[i].size());
+            out += wire[i].size();
+            addresses[kept++] = addresses[i];
+        }
+        *received_length = static_cast<UINT>(out - buffer);
+        *address_length = static_cast<UINT>(kept * sizeof(WINDIVERT_ADDRESS));
+    }
+
+    WinDivertBackend::~WinDivertBackend() {
+        Close();
+    }
+
+    std::expected<void, std::string> WinDivertBackend::Open(const std::string& filter) {
+        handle_ = WinDivertOpen(filter.c_str(), WINDIVERT_LAYER_NETWORK, 0, 0);
+        if (handle_ == INVALID_HANDLE_VALUE) {
+            DWORD error = ::GetLastError();
+            return std::unexpected(std::format("Failed to open WinDivert: {}", error));
+        }
+        return {};
+    }
+
+    bool WinDivertBackend::Receive(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+        WINDIVERT_ADDRESS* addresses, UINT* address_length) {
+        return WinDivertRecvEx(handle_,
+            buffer,
+            buffer_length,
+            received_length,
+            0,  // flags
+            addresses,
+            address_length,
+            nullptr);  // No overlapped I/O for now
+    }
+
+    bool WinDivertBackend::Send(const uint8_t* buffer, UINT length,
+        const WINDIVERT_ADDRESS* addresses, UINT address_length) {
+        UINT send_len = 0;
+        return WinDivertSendEx(handle_,
+            buffer,
+            length,
+            &send_len,
+            0,  // flags
+            addresses,
+            address_length,
+            nullptr);
+    }
+
+    bool WinDivertBackend::SetParam(WINDIVERT_PARAM param, uint64_t value) {
+        return handle_ != INVALID_HANDLE_VALUE && WinDivertSetParam(handle_, param, value);
+    }
+
+    bool WinDivertBackend::GetParam(WINDIVERT_PARAM param, uint64_t* value) const {
+        return handle_ != INVALID_HANDLE_VALUE && WinDivertGetParam(handle_, param, value);
+    }
+
+    void WinDivertBackend::Shutdown() {
+        if (handle_ != INVALID_HANDLE_VALUE) {
+            WinDivertShutdown(handle_, WINDIVERT_SHUTDOWN_RECV);
+        }
+    }
+
+    void WinDivertBackend::Close() {
+        if (handle_ != INVALID_HANDLE_VALUE) {
+            WinDivertClose(handle_);
+            handle_ = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    MemoryBackend::MemoryBackend(std::vector<Packet> packets, uint32_t budget, uint64_t packets_per_second)
+        : packets_(std::move(packets))
+        , budget_(packets_.empty() ? 0 : budget)
+        , packets_per_second_(packets_per_second)
+        , received_at_(std::make_unique<std::atomic<Ticks>[]>(budget_))
+        , sent_at_(std::make_unique<std::atomic<Ticks>[]>(budget_)) {
+    }
+
+    std::expected<void, std::string> MemoryBackend::Open(const std::string& filter) {
+        if (auto compiled = filter_.Compile(filter); !compiled) {
+            return compiled;
+        }
+        shutdown_.store(false);
+        opened_.store(Now());
+        open_.store(true);
+        return {};
+    }
+
+    bool MemoryBackend::Receive(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+        WINDIVERT_ADDRESS* addresses, UINT* address_length) {
+        // Keep claiming until something passes the filter, like a driver blocking on matching traffic
+        const UINT address_capacity = *address_length;
+        do {
+            *address_length = address_capacity;
+            if (!Claim(buffer, buffer_length, received_length, addresses, address_length)) {
+                return false;
+            }
+            filter_.Apply(buffer, received_length, addresses, address_length);
+        } while (*address_length == 0);
+        return true;
+    }
+
+    bool MemoryBackend::Claim(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+        WINDIVERT_ADDRESS* addresses, UINT* address_length) {
+        const size_t capacity = *address_length / sizeof(WINDIVERT_ADDRESS);
+
+        // Claim as many due sequences as the buffers hold, other workers claim theirs concurrently
+        uint64_t first = next_.load();
+        size_t count = 0;
+        size_t bytes = 0;
+        while (true) {
+            const uint64_t available = Available(Now());
+            count = 0;
+            bytes = 0;
+            while (first + count < available && count < capacity) {
+                const size_t size = packets_[(first + count) % packets_.size()].data.size();
+                if (bytes + size > buffer_length) {
+                    break;
+                }
+                bytes += size;
+                ++count;
+            }
+            if (count != 0) {
+                if (next_.compare_exchange_weak(first, first + count)) {
+                    break;
+                }
+                continue;
+            }
+            if (first >= budget_ || packets_per_second_ == 0 || shutdown_.load()) {
+                break;
+            }
+
+            // Paced and ahead of schedule: wait for the next packet like a driver waits for traffic
+            const auto due = std::chrono::duration<double>(static_cast<double>(first) / packets_per_second_);
+            std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(opened_.load())
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(due)));
+            first = next_.load();
+        }
+
+        // Out of packets: block like an idle driver until the engine shuts down
+        if (count == 0) {
+            shutdown_.wait(false);
+            return false;
+        }
+
+        const Ticks now = Now();
+        Ticks unset = 0;
+        first_receive_.compare_exchange_strong(unset, now);
+
+        uint8_t* out = buffer;
+        for (size_t i = 0; i < count; ++i) {
+            const uint64_t sequence = first + i;
+            const Packet& packet = packets_[sequence % packets_.size()];
+            std::copy(packet.data.begin(), packet.data.end(), out);
+            out += packet.data.size();
+
+            WINDIVERT_ADDRESS& addr = addresses[i];
+            addr = {};
+            addr.Layer = WINDIVERT_LAYER_NETWORK;
+            addr.Outbound = packet.outbound ? 1 : 0;
+            addr.IPv6 = (packet.data[0] >> 4) == 6 ? 1 : 0;
+            addr.Network.IfIdx = 1;
+            addr.Network.SubIfIdx = static_cast<UINT32>(sequence);
+            received_at_[sequence].store(now);
+        }
+
+        *received_length = static_cast<UINT>(bytes);
+        *address_length = static_cast<UINT>(count * sizeof(WINDIVERT_ADDRESS));
+        return true;
+    }
+
+    bool MemoryBackend::Send(const uint8_t*, UINT length,
+        const WINDIVERT_ADDRESS* addresses, UINT address_length) {
+        if (!open_.load()) {
+            return false;
+        }
+
+        const Ticks now = Now();
+        const size_t count = address_length / sizeof(WINDIVERT_ADDRESS);
+        for (size_t i = 0; i < count; ++i) {
+            // Duplicates and fragments keep the time of the first copy out
+            const uint32_t sequence = addresses[i].Network.SubIfIdx;
+            if (sequence < budget_) {
+                Ticks unset = 0;
+                sent_at_[sequence].compare_exchange_strong(unset, now);
+            }
+        }
+        sent_.fetch_add(count);
+        sent_bytes_.fetch_add(length);
+
+        Ticks last = last_send_.load();
+        while (now > last && !last_send_.compare_exchange_weak(last, now)) {
+        }
+        return true;
+    }
+
+    uint64_t MemoryBackend::Available(Ticks now) const {
+        if (packets_per_second_ == 0) {
+            return budget_;
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::duration(now - opened_.load())).count();
+        return std::min<uint64_t>(budget_, static_cast<uint64_t>(elapsed * packets_per_second_) + 1);
+    }
+
+    void MemoryBackend::Shutdown() {
+        shutdown_.store(true);
+        shutdown_.notify_all();
+    }
+
+    std::vector<std::chrono::nanoseconds> MemoryBackend::GetLatencies() const {
+        std::vector<std::chrono::nanoseconds> latencies;
+        for (uint32_t sequence = 0; sequence < budget_; ++sequence) {
+            const Ticks sent = sent_at_[sequence].load();
+            const Ticks received = received_at_[sequence].load();
+            if (sent != 0 && received != 0) {
+                latencies.push_back(std::chrono::steady_clock::duration(sent - received));
+            }
+        }
+        return latencies;
+    }
+
+    std::chrono::nanoseconds MemoryBackend::GetActiveTime() const {
+        const Ticks first = first_receive_.load();
+        const Ticks last = last_send_.load();
+        if (first == 0 || last <= first) {
+            return {};
+        }
+        return std::chrono::steady_clock::duration(last - first);
+    }
+
+}
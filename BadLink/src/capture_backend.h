@@ -0,0 +1,151 @@
+#ifndef BADLINK_SRC_CAPTURE_BACKEND_H_
+#define BADLINK_SRC_CAPTURE_BACKEND_H_
+
+#include "packet_filter.h"
+#include <windivert.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace BadLink {
+
+    // Where the capture engine receives packets from and injects them back to
+    // Calls mirror WinDivert's batch calls: Receive fills `buffer` with back-to-back IP packets
+    // and `addresses` with one address each, Send takes packets laid out the same way
+    // Receive and Send are called from every worker and release thread at once
+    // Open takes a WinDivert filter string, backends without the driver apply it with BackendFilter
+    class CaptureBackend {
+    public:
+        virtual ~CaptureBackend() = default;
+
+        virtual std::expected<void, std::string> Open(const std::string& filter) = 0;
+        virtual bool IsOpen() const = 0;
+
+        // Blocks until packets arrive; false on failure with the reason in ::GetLastError(),
+        // and for good once Shutdown was called
+        // `address_length` is the addresses' capacity in bytes going in, what was filled coming out
+        virtual bool Receive(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+            WINDIVERT_ADDRESS* addresses, UINT* address_length) = 0;
+
+        virtual bool Send(const uint8_t* buffer, UINT length,
+            const WINDIVERT_ADDRESS* addresses, UINT address_length) = 0;
+
+        // Queue parameters and driver version, false where the backend has no such thing
+        virtual bool SetParam(WINDIVERT_PARAM param, uint64_t value) = 0;
+        virtual bool GetParam(WINDIVERT_PARAM param, uint64_t* value) const = 0;
+
+        // Shutdown unblocks Receive, Close releases what Open took
+        virtual void Shutdown() = 0;
+        virtual void Close() = 0;
+    };
+
+    // The capture filter for backends without a driver to run it: the WinDivert filter language
+    // compiled by FilterProgram, so filters and presets select the same packets on every backend
+    // Compile in Open, Apply to each batch Receive produces; a filter that folds to true costs nothing
+    class BackendFilter {
+    public:
+        std::expected<void, std::string> Compile(const std::string& filter);
+
+        // Drops the packets the filter rejects from a received batch, moving the rest to the front
+        // of `buffer` and `addresses` and shrinking both lengths to what is kept
+        // Safe to call from every worker at once
+        void Apply(uint8_t* buffer, UINT* received_length, WINDIVERT_ADDRESS* addresses, UINT* address_length) const;
+
+    private:
+        std::optional<FilterProgram> program_;      // Empty when every packet matches
+    };
+
+    // The WinDivert driver at the network layer, what the engine uses unless given another backend
+    class WinDivertBackend final : public CaptureBackend {
+    public:
+        ~WinDivertBackend() override;
+
+        std::expected<void, std::string> Open(const std::string& filter) override;
+        bool IsOpen() const override { return handle_ != INVALID_HANDLE_VALUE; }
+        bool Receive(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+            WINDIVERT_ADDRESS* addresses, UINT* address_length) override;
+        bool Send(const uint8_t* buffer, UINT length,
+            const WINDIVERT_ADDRESS* addresses, UINT address_length) override;
+        bool SetParam(WINDIVERT_PARAM param, uint64_t value) override;
+        bool GetParam(WINDIVERT_PARAM param, uint64_t* value) const override;
+        void Shutdown() override;
+        void Close() override;
+
+    private:
+        HANDLE handle_ = INVALID_HANDLE_VALUE;
+    };
+
+    // In-memory source and sink for driving the engine without a driver
+    // The source replays `packets` in turn, `budget` packets in all, at `packets_per_second`
+    // from Open or as fast as the workers ask with 0; the sink counts what comes back and when
+    // One backend serves one capture run
+    // The filter given to Open is applied with BackendFilter; packets it rejects still use up the
+    // budget, like traffic the driver leaves alone, and never come back
+    // Every packet carries its sequence number in the address's SubIfIdx, which nothing in the
+    // engine changes, so each delivery is timed against its own receive
+    class MemoryBackend final : public CaptureBackend {
+    public:
+        struct Packet {
+            std::vector<uint8_t> data;      // One IP packet
+            bool outbound = true;
+        };
+
+        MemoryBackend(std::vector<Packet> packets, uint32_t budget, uint64_t packets_per_second = 0);
+
+        std::expected<void, std::string> Open(const std::string& filter) override;
+        bool IsOpen() const override { return open_.load(); }
+        bool Receive(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+            WINDIVERT_ADDRESS* addresses, UINT* address_length) override;
+        bool Send(const uint8_t* buffer, UINT length,
+            const WINDIVERT_ADDRESS* addresses, UINT address_length) override;
+        bool SetParam(WINDIVERT_PARAM, uint64_t) override { return true; }
+        bool GetParam(WINDIVERT_PARAM, uint64_t*) const override { return false; }
+        void Shutdown() override;
+        void Close() override { open_.store(false); }
+
+        uint64_t GetReceived() const { return next_.load(); }      // Taken from the source so far, filtered or not
+        uint64_t GetSent() const { return sent_.load(); }           // Including duplicates
+        uint64_t GetSentBytes() const { return sent_bytes_.load(); }
+        bool IsExhausted() const { return GetReceived() == budget_; }
+
+        // Receive to first send of every sequence that came back, in sequence order
+        std::vector<std::chrono::nanoseconds> GetLatencies() const;
+
+        // From the first receive to the last send, zero before anything came back
+        std::chrono::nanoseconds GetActiveTime() const;
+
+    private:
+        using Ticks = std::chrono::steady_clock::rep;
+
+        static Ticks Now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+        // Sequences the source has made available by `now`
+        uint64_t Available(Ticks now) const;
+
+        // Receive before the filter
+        bool Claim(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+            WINDIVERT_ADDRESS* addresses, UINT* address_length);
+
+        std::vector<Packet> packets_;
+        BackendFilter filter_;
+        uint32_t budget_;
+        uint64_t packets_per_second_;
+        std::atomic<Ticks> opened_{ 0 };
+        std::atomic<bool> open_{ false };
+        std::atomic<bool> shutdown_{ false };
+        std::atomic<uint64_t> next_{ 0 };           // Next sequence, stops at the budget
+        std::atomic<uint64_t> sent_{ 0 };
+        std::atomic<uint64_t> sent_bytes_{ 0 };
+        std::atomic<Ticks> first_receive_{ 0 };
+        std::atomic<Ticks> last_send_{ 0 };
+        std::unique_ptr<std::atomic<Ticks>[]> received_at_;     // Per sequence, 0 until it happens
+        std::unique_ptr<std::atomic<Ticks>[]> sent_at_;
+    };
+
+}
+#endif  // BADLINK_SRC_CAPTURE_BACKEND_H_
@@ -0,0 +1,194 @@
+#include "checksum.h"
+#include "cpu_features.h"
+#include <algorithm>
+
+namespace BadLink {
+    namespace Checksum {
+
+        namespace {
+
+            // Bytes at even offsets are the high half of each 16-bit word, odd offsets the low half.
+            // Summing them separately avoids byte swapping and lets SIMD use plain byte sums
+            struct SplitSum {
+                uint64_t even = 0;
+                uint64_t odd = 0;
+            };
+
+            void SumScalar(const uint8_t* data, size_t size, SplitSum& sum) {
+                size_t i = 0;
+                for (; i + 1 < size; i += 2) {
+                    sum.even += data[i];
+                    sum.odd += data[i + 1];
+                }
+                if (i < size) {
+                    sum.even += data[i];
+                }
+            }
+
+#ifdef BADLINK_X64
+            // PSADBW against zero adds 8 bytes into a 64-bit lane, so the accumulators never overflow
+            // and one pass over a 64 KB packet stays bound by memory bandwidth
+            size_t SumSse2(const uint8_t* data, size_t size, SplitSum& sum) {
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i low_mask = _mm_set1_epi16(0x00FF);
+                __m128i even = zero;
+                __m128i odd = zero;
+
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16) {
+                    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                    even = _mm_add_epi64(even, _mm_sad_epu8(_mm_and_si128(v, low_mask), zero));
+                    odd = _mm_add_epi64(odd, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+                }
+
+                alignas(16) uint64_t lanes[2];
+                _mm_store_si128(reinterpret_cast<__m128i*>(lanes), even);
+                sum.even += lanes[0] + lanes[1];
+                _mm_store_si128(reinterpret_cast<__m128i*>(lanes), odd);
+                sum.odd += lanes[0] + lanes[1];
+                return i;
+            }
+
+            BADLINK_TARGET("avx2")
+            size_t SumAvx2(const uint8_t* data, size_t size, SplitSum& sum) {
+                const __m256i zero = _mm256_setzero_si256();
+                const __m256i low_mask = _mm256_set1_epi16(0x00FF);
+                __m256i even0 = zero, even1 = zero;
+                __m256i odd0 = zero, odd1 = zero;
+
+                // Two independent accumulator chains hide the PSADBW latency
+                size_t i = 0;
+                for (; i + 64 <= size; i += 64) {
+                    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+                    even0 = _mm256_add_epi64(even0, _mm256_sad_epu8(_mm256_and_si256(a, low_mask), zero));
+                    odd0 = _mm256_add_epi64(odd0, _mm256_sad_epu8(_mm256_srli_epi16(a, 8), zero));
+                    even1 = _mm256_add_epi64(even1, _mm256_sad_epu8(_mm256_and_si256(b, low_mask), zero));
+                    odd1 = _mm256_add_epi64(odd1, _mm256_sad_epu8(_mm256_srli_epi16(b, 8), zero));
+                }
+                for (; i + 32 <= size; i += 32) {
+                    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                    even0 = _mm256_add_epi64(even0, _mm256_sad_epu8(_mm256_and_si256(a, low_mask), zero));
+                    odd0 = _mm256_add_epi64(odd0, _mm256_sad_epu8(_mm256_srli_epi16(a, 8), zero));
+                }
+
+                alignas(32) uint64_t lanes[4];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(even0, even1));
+                sum.even += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(odd0, odd1));
+                sum.odd += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                return i;
+            }
+#endif
+
+            void WriteChecksum(uint8_t* field, uint64_t sum) {
+                StoreBe16(field, static_cast<uint16_t>(~Fold(sum)));
+            }
+        }
+
+        uint64_t Sum(std::span<const uint8_t> data, uint64_t initial) {
+            SplitSum sum;
+            const uint8_t* ptr = data.data();
+            size_t size = data.size();
+
+#ifdef BADLINK_X64
+            // Vector paths consume multiples of 16/32 bytes, which keeps even/odd parity intact
+            size_t done = 0;
+            if (size >= 64 && CpuFeatures::HasAvx2()) {
+                done = SumAvx2(ptr, size, sum);
+            }
+            else if (size >= 16) {
+                done = SumSse2(ptr, size, sum);
+            }
+            ptr += done;
+            size -= done;
+#endif
+            SumScalar(ptr, size, sum);
+            return initial + (sum.even << 8) + sum.odd;
+        }
+
+        uint16_t Fold(uint64_t sum) {
+            while (sum >> 16) {
+                sum = (sum & 0xFFFF) + (sum >> 16);
+            }
+            return static_cast<uint16_t>(sum);
+        }
+
+        void UpdateIPv4Header(std::span<uint8_t> packet, const PacketHeaders& headers) {
+            if (headers.ip_version != 4) {
+                return;
+            }
+
+            const size_t header_len = static_cast<size_t>(packet[0] & 0x0F) * 4;
+            StoreBe16(packet.data() + 10, 0);
+            WriteChecksum(packet.data() + 10, Sum(packet.first(header_len)));
+        }
+
+        bool UpdateTransport(std::span<uint8_t> packet, const PacketHeaders& headers) {
+            if (!headers.IsValid() || headers.is_fragment) {
+                return false;
+            }
+
+            // Trailing link padding is not part of the datagram
+            uint8_t* data = packet.data();
+            size_t ip_length = headers.ip_version == 4 ?
+                LoadBe16(data + 2) : static_cast<size_t>(LoadBe16(data + 4)) + 40;
+            ip_length = std::min(ip_length, packet.size());
+            if (ip_length < headers.l4_offset) {
+                return false;
+            }
+
+            const size_t l4_length = ip_length - headers.l4_offset;
+            size_t checksum_offset = 0;
+            bool pseudo_header = true;
+
+            switch (headers.protocol) {
+            case IpProtocol::TCP:
+                checksum_offset = 16;
+                break;
+            case IpProtocol::UDP:
+                checksum_offset = 6;
+                break;
+            case IpProtocol::ICMP:
+                checksum_offset = 2;
+                pseudo_header = false;
+                break;
+            case IpProtocol::ICMPV6:
+                checksum_offset = 2;
+                break;
+            default:
+                return false;
+            }
+
+            if (l4_length < checksum_offset + 2) {
+                return false;
+            }
+
+            uint8_t* field = data + headers.l4_offset + checksum_offset;
+            StoreBe16(field, 0);
+
+            uint64_t sum = 0;
+            if (pseudo_header) {
+                if (headers.ip_version == 4) {
+                    sum = Sum(packet.subspan(12, 8));
+                }
+                else {
+                    sum = Sum(packet.subspan(8, 32));
+                }
+                sum += headers.protocol;
+                sum += l4_length;
+            }
+
+            sum = Sum(packet.subspan(headers.l4_offset, l4_length), sum);
+            uint16_t result = static_cast<uint16_t>(~Fold(sum));
+
+            // UDP transmits a computed zero as all ones, zero means "no checksum"
+            if (headers.protocol == IpProtocol::UDP && result == 0) {
+                result = 0xFFFF;
+            }
+            StoreBe16(field, result);
+            return true;
+        }
+
+    }
+}
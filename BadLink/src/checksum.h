@@ -0,0 +1,46 @@
+#ifndef BADLINK_SRC_CHECKSUM_H_
+#define BADLINK_SRC_CHECKSUM_H_
+
+#include "packet_parser.h"
+#include <cstdint>
+#include <span>
+
+namespace BadLink {
+    namespace Checksum {
+
+        // Unfolded one's-complement sum of 16-bit big-endian words (RFC 1071)
+        // An odd trailing byte is padded with zero, so only the last span of a
+        // multi-part sum may have an odd length
+        [[nodiscard]] uint64_t Sum(std::span<const uint8_t> data, uint64_t initial = 0);
+
+        // Fold a wide sum into 16 bits (not inverted)
+        [[nodiscard]] uint16_t Fold(uint64_t sum);
+
+        // Final Internet checksum of a buffer
+        [[nodiscard]] inline uint16_t Compute(std::span<const uint8_t> data) {
+            return static_cast<uint16_t>(~Fold(Sum(data)));
+        }
+
+        // Incrementally update a stored checksum after one 16-bit word changed (RFC 1624 eqn. 3)
+        // HC' = ~(~HC + ~m + m'), a few ALU ops instead of re-summing the packet
+        [[nodiscard]] inline uint16_t Adjust(uint16_t checksum, uint16_t old_word, uint16_t new_word) {
+            const uint64_t sum = static_cast<uint16_t>(~checksum) +
+                static_cast<uint64_t>(static_cast<uint16_t>(~old_word)) + new_word;
+            return static_cast<uint16_t>(~Fold(sum));
+        }
+
+        // Adjust the checksum field at `field` in place for one changed word
+        inline void AdjustField(uint8_t* field, uint16_t old_word, uint16_t new_word) {
+            StoreBe16(field, Adjust(LoadBe16(field), old_word, new_word));
+        }
+
+        // Recompute the IPv4 header checksum in place (no-op for IPv6)
+        void UpdateIPv4Header(std::span<uint8_t> packet, const PacketHeaders& headers);
+
+        // Recompute the TCP/UDP/ICMP/ICMPv6 checksum in place, including the pseudo-header
+        // Returns false if the packet has no checksummed transport header
+        bool UpdateTransport(std::span<uint8_t> packet, const PacketHeaders& headers);
+
+    }
+}
+#endif  // BADLINK_SRC_CHECKSUM_H_
@@ -0,0 +1,138 @@
+#include "cidr.h"
+#include <charconv>
+#include <vector>
+
+namespace BadLink {
+
+    namespace {
+        using Address = std::array<uint8_t, 16>;
+
+        template <typename T>
+        std::optional<T> ParseNumber(std::string_view text, int base) {
+            T value{};
+            const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+            if (error != std::errc() || end != text.data() + text.size() || text.empty()) {
+                return std::nullopt;
+            }
+            return value;
+        }
+
+        std::optional<Address> ParseIPv4(std::string_view text) {
+            Address address{};
+            for (size_t i = 0; i < 4; ++i) {
+                const size_t dot = text.find('.');
+                const std::string_view part = i < 3 ? text.substr(0, dot) : text;
+                if ((i < 3 && dot == std::string_view::npos) || part.size() > 3) {
+                    return std::nullopt;
+                }
+                const auto value = ParseNumber<uint32_t>(part, 10);
+                if (!value || *value > 255) {
+                    return std::nullopt;
+                }
+                address[i] = static_cast<uint8_t>(*value);
+                text.remove_prefix(i < 3 ? dot + 1 : text.size());
+            }
+            return address;
+        }
+
+        bool ParseGroups(std::string_view groups, std::vector<uint16_t>& out) {
+            while (!groups.empty()) {
+                const size_t colon = groups.find(':');
+                const std::string_view group = groups.substr(0, colon);
+                const auto value = ParseNumber<uint16_t>(group, 16);
+                if (!value || group.size() > 4) {
+                    return false;
+                }
+                out.push_back(*value);
+                groups.remove_prefix(colon == std::string_view::npos ? groups.size() : colon + 1);
+                if (colon != std::string_view::npos && groups.empty()) {
+                    return false;   // Trailing single colon
+                }
+            }
+            return true;
+        }
+
+        std::optional<Address> ParseIPv6(std::string_view text) {
+            // "::" stands for the zero groups missing between head and tail
+            std::vector<uint16_t> head, tail;
+            const size_t gap = text.find("::");
+            if (gap == std::string_view::npos) {
+                if (!ParseGroups(text, head) || head.size() != 8) {
+                    return std::nullopt;
+                }
+            }
+            else if (!ParseGroups(text.substr(0, gap), head) || !ParseGroups(text.substr(gap + 2), tail) ||
+                head.size() + tail.size() > 7) {
+                return std::nullopt;
+            }
+
+            Address address{};
+            for (size_t i = 0; i < head.size(); ++i) {
+                address[i * 2] = static_cast<uint8_t>(head[i] >> 8);
+                address[i * 2 + 1] = static_cast<uint8_t>(head[i]);
+            }
+            const size_t tail_start = 8 - tail.size();
+            for (size_t i = 0; i < tail.size(); ++i) {
+                address[(tail_start + i) * 2] = static_cast<uint8_t>(tail[i] >> 8);
+                address[(tail_start + i) * 2 + 1] = static_cast<uint8_t>(tail[i]);
+            }
+            return address;
+        }
+    }
+
+    std::string_view TrimSpaces(std::string_view text) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    std::optional<Cidr> ParseCidr(std::string_view text) {
+        const size_t slash = text.find('/');
+        const std::string_view address_text = TrimSpaces(text.substr(0, slash));
+
+        Cidr cidr;
+        std::optional<Address> address;
+        if (address_text.find(':') != std::string_view::npos) {
+            cidr.version = 6;
+            address = ParseIPv6(address_text);
+        }
+        else {
+            cidr.version = 4;
+            address = ParseIPv4(address_text);
+        }
+        if (!address) {
+            return std::nullopt;
+        }
+
+        const size_t bits = cidr.version == 4 ? 32 : 128;
+        size_t prefix = bits;
+        if (slash != std::string_view::npos) {
+            const auto value = ParseNumber<size_t>(TrimSpaces(text.substr(slash + 1)), 10);
+            if (!value || *value > bits) {
+                return std::nullopt;
+            }
+            prefix = *value;
+        }
+
+        cidr.prefix_length = static_cast<uint8_t>(prefix);
+        cidr.address = *address;
+        for (size_t bit = prefix; bit < bits; ++bit) {
+            cidr.address[bit / 8] &= static_cast<uint8_t>(~(0x80 >> (bit % 8)));
+        }
+        return cidr;
+    }
+
+    std::array<uint8_t, 16> Cidr::Last() const {
+        std::array<uint8_t, 16> last = address;
+        const size_t bits = version == 4 ? 32 : 128;
+        for (size_t bit = prefix_length; bit < bits; ++bit) {
+            last[bit / 8] |= static_cast<uint8_t>(0x80 >> (bit % 8));
+        }
+        return last;
+    }
+
+}
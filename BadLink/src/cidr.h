@@ -0,0 +1,28 @@
+#ifndef BADLINK_SRC_CIDR_H_
+#define BADLINK_SRC_CIDR_H_
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace BadLink {
+
+    // Address prefix parsed from "a.b.c.d/n" or "2001:db8::/n"
+    struct Cidr {
+        uint8_t version = 0;                    // 4 or 6
+        uint8_t prefix_length = 0;
+        std::array<uint8_t, 16> address{};      // Network order, host bits cleared, IPv4 uses the first 4 bytes
+
+        // Last address covered by the prefix
+        std::array<uint8_t, 16> Last() const;
+    };
+
+    // A missing prefix length means a single address, no resolver or winsock involved
+    [[nodiscard]] std::optional<Cidr> ParseCidr(std::string_view text);
+
+    // Strip spaces and tabs at both ends
+    [[nodiscard]] std::string_view TrimSpaces(std::string_view text);
+
+}
+#endif  // BADLINK_SRC_CIDR_H_
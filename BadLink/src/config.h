@@ -1,12 +1,19 @@
 #ifndef BADLINK_SRC_CONFIG_H_
 #define BADLINK_SRC_CONFIG_H_
 
+#include <array>
 #include <filesystem>
 #include <fstream>
 #include <string>
 #include <vector>
 #include "toml.hpp"
 #include "network_capture.h"
+#include "packet_filter.h"
+#include "rule_classifier.h"
+#include "htb_scheduler.h"
+#include "link_chain.h"
+#include "simulation_module.h"
+#include "traffic_generator.h"
 #include "imgui.h"
 
 namespace BadLink {
@@ -42,30 +49,112 @@ namespace BadLink {
             }
         };
 
+        // Per-direction impairment values, e.g. a satellite downlink next to a narrow uplink
+        // While not asymmetric both directions use the outbound values
+        struct SimulationProfile {
+            bool asymmetric = false;
+            uint64_t seed = 0;      // Random seed, 0 picks a new one every capture
+            std::array<DirectionProfile, 2> directions;     // By Direction
+
+            const DirectionProfile& For(Direction direction) const {
+                return directions[asymmetric ? DirectionIndex(direction) : DirectionIndex(Direction::Outbound)];
+            }
+        };
+
         // Extended capture parameters with presets and hotkey
         struct Configuration {
             CaptureParameters params;
             std::vector<FilterPreset> filter_presets;
             HotkeyConfig capture_hotkey;
+            std::vector<ClassifierRule> rules;
+            uint32_t unmatched_modules = ModuleMask::ALL;
+            std::vector<TrafficClassConfig> traffic_classes;
+            SimulationProfile simulation;
+            std::vector<LinkConfig> links;
+            bool generator_enabled = false;     // Capture synthetic traffic instead of the network
+            TrafficProfile generator;
         };
 
+        inline const char* RuleDirectionToString(RuleDirection direction) {
+            switch (direction) {
+            case RuleDirection::Inbound: return "inbound";
+            case RuleDirection::Outbound: return "outbound";
+            default: return "any";
+            }
+        }
+
+        inline RuleDirection RuleDirectionFromString(std::string_view text) {
+            if (text == "inbound") return RuleDirection::Inbound;
+            if (text == "outbound") return RuleDirection::Outbound;
+            return RuleDirection::Any;
+        }
+
+        // Module list as a TOML array of names, e.g. ["loss", "latency"]
+        inline uint32_t ModulesFromArray(const toml::array& names) {
+            uint32_t modules = 0;
+            for (const auto& name : names) {
+                if (auto text = name.value<std::string>())
+                    modules |= ModuleMaskFromName(*text);
+            }
+            return modules;
+        }
+
+        inline toml::array ModulesToArray(uint32_t modules) {
+            toml::array names;
+            for (const auto& module : MODULE_NAMES) {
+                if (modules & module.bit)
+                    names.push_back(module.name);
+            }
+            return names;
+        }
+
+        // Simulation values of one direction, keys match the UI labels
+        inline void LoadDirectionProfile(const toml::table& table, DirectionProfile& profile) {
+            const DirectionProfile defaults;
+            profile.loss_rate = static_cast<float>(table["LossRate"].value_or(double{ defaults.loss_rate }));
+            profile.latency_ms = static_cast<int>(table["LatencyMs"].value_or(int64_t{ defaults.latency_ms }));
+            profile.jitter_min_ms = static_cast<int>(table["JitterMinMs"].value_or(int64_t{ defaults.jitter_min_ms }));
+            profile.jitter_max_ms = static_cast<int>(table["JitterMaxMs"].value_or(int64_t{ defaults.jitter_max_ms }));
+            profile.bandwidth_kbps = static_cast<int>(table["BandwidthKbps"].value_or(int64_t{ defaults.bandwidth_kbps }));
+            profile.duplicate_rate = static_cast<float>(table["DuplicateRate"].value_or(double{ defaults.duplicate_rate }));
+            profile.duplicate_count = static_cast<int>(table["DuplicateCount"].value_or(int64_t{ defaults.duplicate_count }));
+            profile.duplicate_delay_min_ms = static_cast<int>(table["DuplicateDelayMinMs"].value_or(int64_t{ defaults.duplicate_delay_min_ms }));
+            profile.duplicate_delay_max_ms = static_cast<int>(table["DuplicateDelayMaxMs"].value_or(int64_t{ defaults.duplicate_delay_max_ms }));
+            profile.corruption_ber = static_cast<float>(table["CorruptionBer"].value_or(double{ defaults.corruption_ber }));
+            profile.rewrite_hop_decrement = static_cast<int>(table["RewriteHopDecrement"].value_or(int64_t{ defaults.rewrite_hop_decrement }));
+            profile.rewrite_dscp = static_cast<int>(table["RewriteDscp"].value_or(int64_t{ defaults.rewrite_dscp }));
+            profile.rewrite_mss_clamp = static_cast<int>(table["RewriteMssClamp"].value_or(int64_t{ defaults.rewrite_mss_clamp }));
+            profile.reorder_rate = static_cast<float>(table["ReorderRate"].value_or(double{ defaults.reorder_rate }));
+            profile.reorder_gap = static_cast<int>(table["ReorderGap"].value_or(int64_t{ defaults.reorder_gap }));
+        }
+
+        inline toml::table SaveDirectionProfile(const DirectionProfile& profile) {
+            return toml::table{
+                {"LossRate", static_cast<double>(profile.loss_rate)},
+                {"LatencyMs", static_cast<int64_t>(profile.latency_ms)},
+                {"JitterMinMs", static_cast<int64_t>(profile.jitter_min_ms)},
+                {"JitterMaxMs", static_cast<int64_t>(profile.jitter_max_ms)},
+                {"BandwidthKbps", static_cast<int64_t>(profile.bandwidth_kbps)},
+                {"DuplicateRate", static_cast<double>(profile.duplicate_rate)},
+                {"DuplicateCount", static_cast<int64_t>(profile.duplicate_count)},
+                {"DuplicateDelayMinMs", static_cast<int64_t>(profile.duplicate_delay_min_ms)},
+                {"DuplicateDelayMaxMs", static_cast<int64_t>(profile.duplicate_delay_max_ms)},
+                {"CorruptionBer", static_cast<double>(profile.corruption_ber)},
+                {"RewriteHopDecrement", static_cast<int64_t>(profile.rewrite_hop_decrement)},
+                {"RewriteDscp", static_cast<int64_t>(profile.rewrite_dscp)},
+                {"RewriteMssClamp", static_cast<int64_t>(profile.rewrite_mss_clamp)},
+                {"ReorderRate", static_cast<double>(profile.reorder_rate)},
+                {"ReorderGap", static_cast<int64_t>(profile.reorder_gap)}
+            };
+        }
+
         // Default filter presets
         inline std::vector<FilterPreset> GetDefaultPresets() {
-            return {
-                {"All traffic", "true"},
-                {"TCP only", "tcp"},
-                {"UDP only", "udp"},
-                {"HTTP (port 80)", "tcp.DstPort == 80 or tcp.SrcPort == 80"},
-                {"HTTPS (port 443)", "tcp.DstPort == 443 or tcp.SrcPort == 443"},
-                {"DNS (port 53)", "udp.DstPort == 53 or udp.SrcPort == 53"},
-                {"Local network", "ip.DstAddr >= 192.168.0.0 and ip.DstAddr <= 192.168.255.255"},
-                {"IPv6 only", "ipv6"},
-                {"IPv4 only", "ip"},
-                {"Outbound only", "outbound"},
-                {"Inbound only", "inbound"},
-                {"Non-loopback", "!loopback"},
-                {"No traffic (test)", "false"}
-            };
+            std::vector<FilterPreset> presets;
+            for (const auto& preset : PRESET_FILTERS) {
+                presets.push_back({ std::string(preset.name), std::string(preset.expression) });
+            }
+            return presets;
         }
 
         // Load configuration from TOML file
@@ -141,6 +230,109 @@ namespace BadLink {
                     }
                 }
 
+                // Traffic rules, fields left out match any traffic
+                if (auto section = toml_config["Classifier"].as_table()) {
+                    if (auto names = (*section)["UnmatchedModules"].as_array())
+                        config.unmatched_modules = ModulesFromArray(*names);
+                }
+
+                config.rules.clear();
+                if (auto rules_array = toml_config["Rules"].as_array()) {
+                    for (const auto& rule_node : *rules_array) {
+                        if (auto rule_table = rule_node.as_table()) {
+                            ClassifierRule rule;
+                            rule.name = (*rule_table)["name"].value_or(std::string{});
+                            rule.src = (*rule_table)["src"].value_or(std::string{});
+                            rule.dst = (*rule_table)["dst"].value_or(std::string{});
+                            rule.src_ports = (*rule_table)["src_ports"].value_or(std::string{});
+                            rule.dst_ports = (*rule_table)["dst_ports"].value_or(std::string{});
+                            rule.protocol = (*rule_table)["protocol"].value_or(std::string{});
+                            rule.filter = (*rule_table)["filter"].value_or(std::string{});
+                            rule.content = (*rule_table)["content"].value_or(std::string{});
+                            rule.domains = (*rule_table)["domains"].value_or(std::string{});
+                            rule.traffic_class = (*rule_table)["class"].value_or(std::string{});
+                            rule.link = (*rule_table)["link"].value_or(std::string{});
+                            rule.direction = RuleDirectionFromString((*rule_table)["direction"].value_or(std::string{}));
+                            if (auto names = (*rule_table)["modules"].as_array())
+                                rule.modules = ModulesFromArray(*names);
+
+                            if (config.rules.size() < RuleClassifier::MAX_RULES) {
+                                config.rules.push_back(rule);
+                            }
+                        }
+                    }
+                }
+
+                // Bandwidth traffic classes, the last one takes unclassified traffic
+                config.traffic_classes.clear();
+                if (auto classes_array = toml_config["TrafficClasses"].as_array()) {
+                    for (const auto& class_node : *classes_array) {
+                        if (auto class_table = class_node.as_table()) {
+                            TrafficClassConfig traffic_class;
+                            traffic_class.name = (*class_table)["name"].value_or(std::string{});
+                            traffic_class.priority = static_cast<uint8_t>((*class_table)["priority"].value_or(int64_t{ 4 }));
+                            traffic_class.rate_kbps = static_cast<uint32_t>((*class_table)["rate_kbps"].value_or(int64_t{ 1000 }));
+                            traffic_class.ceil_kbps = static_cast<uint32_t>((*class_table)["ceil_kbps"].value_or(int64_t{ 0 }));
+                            traffic_class.weight = static_cast<uint32_t>((*class_table)["weight"].value_or(int64_t{ 1 }));
+                            traffic_class.dscp = (*class_table)["dscp"].value_or(std::string{});
+
+                            if (config.traffic_classes.size() < HtbScheduler::MAX_CLASSES) {
+                                config.traffic_classes.push_back(traffic_class);
+                            }
+                        }
+                    }
+                }
+
+                // Simulation values, one table per direction
+                config.simulation = SimulationProfile{};
+                if (auto section = toml_config["Simulation"].as_table()) {
+                    config.simulation.asymmetric = (*section)["Asymmetric"].value_or(false);
+                    config.simulation.seed = static_cast<uint64_t>((*section)["Seed"].value_or(int64_t{ 0 }));
+                    if (auto table = (*section)["Inbound"].as_table())
+                        LoadDirectionProfile(*table, config.simulation.directions[DirectionIndex(Direction::Inbound)]);
+                    if (auto table = (*section)["Outbound"].as_table())
+                        LoadDirectionProfile(*table, config.simulation.directions[DirectionIndex(Direction::Outbound)]);
+                }
+
+                // Named links, rules send traffic to them by name
+                config.links.clear();
+                if (auto links_array = toml_config["Links"].as_array()) {
+                    for (const auto& link_node : *links_array) {
+                        if (auto link_table = link_node.as_table()) {
+                            LinkConfig link;
+                            link.name = (*link_table)["name"].value_or(std::string{});
+                            if (auto names = (*link_table)["modules"].as_array())
+                                link.modules = ModulesFromArray(*names);
+                            if (auto table = (*link_table)["Inbound"].as_table())
+                                LoadDirectionProfile(*table, link.directions[DirectionIndex(Direction::Inbound)]);
+                            if (auto table = (*link_table)["Outbound"].as_table())
+                                LoadDirectionProfile(*table, link.directions[DirectionIndex(Direction::Outbound)]);
+
+                            if (config.links.size() < NetworkCapture::MAX_LINKS) {
+                                config.links.push_back(link);
+                            }
+                        }
+                    }
+                }
+
+                // Synthetic traffic
+                config.generator_enabled = false;
+                config.generator = TrafficProfile{};
+                if (auto section = toml_config["Generator"].as_table()) {
+                    TrafficProfile& generator = config.generator;
+                    config.generator_enabled = (*section)["Enabled"].value_or(false);
+                    generator.packets_per_second = (*section)["Mpps"].value_or(generator.packets_per_second / 1e6) * 1e6;
+                    generator.flows = static_cast<uint32_t>((*section)["Flows"].value_or(int64_t{ generator.flows }));
+                    generator.flow_size_shape = (*section)["FlowSizeShape"].value_or(generator.flow_size_shape);
+                    generator.flow_size_min = static_cast<uint32_t>((*section)["FlowSizeMin"].value_or(int64_t{ generator.flow_size_min }));
+                    generator.ipv6_share = (*section)["IPv6Share"].value_or(generator.ipv6_share);
+                    generator.tcp_share = (*section)["TcpShare"].value_or(generator.tcp_share);
+                    generator.outbound_share = (*section)["OutboundShare"].value_or(generator.outbound_share);
+                    generator.seed = static_cast<uint64_t>((*section)["Seed"].value_or(static_cast<int64_t>(generator.seed)));
+                    if (auto sizes = ParsePacketSizes((*section)["PacketSizes"].value_or(std::string{})))
+                        generator.packet_sizes = std::move(*sizes);
+                }
+
                 // Use defaults if no presets were loaded
                 if (config.filter_presets.empty()) {
                     config.filter_presets = GetDefaultPresets();
@@ -199,6 +391,89 @@ namespace BadLink {
                 }
                 toml_config.insert("FilterPresets", presets_array);
 
+                // Traffic rules
+                toml_config.insert("Classifier", toml::table{
+                    {"UnmatchedModules", ModulesToArray(config.unmatched_modules)}
+                    });
+
+                toml::array rules_array;
+                for (const auto& rule : config.rules) {
+                    toml::table rule_table;
+                    rule_table.insert("name", rule.name);
+                    rule_table.insert("src", rule.src);
+                    rule_table.insert("dst", rule.dst);
+                    rule_table.insert("src_ports", rule.src_ports);
+                    rule_table.insert("dst_ports", rule.dst_ports);
+                    rule_table.insert("protocol", rule.protocol);
+                    if (!rule.filter.empty()) {
+                        rule_table.insert("filter", rule.filter);
+                    }
+                    if (!rule.content.empty()) {
+                        rule_table.insert("content", rule.content);
+                    }
+                    if (!rule.domains.empty()) {
+                        rule_table.insert("domains", rule.domains);
+                    }
+                    if (!rule.traffic_class.empty()) {
+                        rule_table.insert("class", rule.traffic_class);
+                    }
+                    if (!rule.link.empty()) {
+                        rule_table.insert("link", rule.link);
+                    }
+                    rule_table.insert("direction", RuleDirectionToString(rule.direction));
+                    rule_table.insert("modules", ModulesToArray(rule.modules));
+                    rules_array.push_back(rule_table);
+                }
+                toml_config.insert("Rules", rules_array);
+
+                // Bandwidth traffic classes
+                toml::array classes_array;
+                for (const auto& traffic_class : config.traffic_classes) {
+                    toml::table class_table;
+                    class_table.insert("name", traffic_class.name);
+                    class_table.insert("priority", static_cast<int64_t>(traffic_class.priority));
+                    class_table.insert("rate_kbps", static_cast<int64_t>(traffic_class.rate_kbps));
+                    class_table.insert("ceil_kbps", static_cast<int64_t>(traffic_class.ceil_kbps));
+                    class_table.insert("weight", static_cast<int64_t>(traffic_class.weight));
+                    class_table.insert("dscp", traffic_class.dscp);
+                    classes_array.push_back(class_table);
+                }
+                toml_config.insert("TrafficClasses", classes_array);
+
+                // Simulation values
+                toml_config.insert("Simulation", toml::table{
+                    {"Asymmetric", config.simulation.asymmetric},
+                    {"Seed", static_cast<int64_t>(config.simulation.seed)},
+                    {"Inbound", SaveDirectionProfile(config.simulation.directions[DirectionIndex(Direction::Inbound)])},
+                    {"Outbound", SaveDirectionProfile(config.simulation.directions[DirectionIndex(Direction::Outbound)])}
+                    });
+
+                // Named links
+                toml::array links_array;
+                for (const auto& link : config.links) {
+                    links_array.push_back(toml::table{
+                        {"name", link.name},
+                        {"modules", ModulesToArray(link.modules)},
+                        {"Inbound", SaveDirectionProfile(link.directions[DirectionIndex(Direction::Inbound)])},
+                        {"Outbound", SaveDirectionProfile(link.directions[DirectionIndex(Direction::Outbound)])}
+                        });
+                }
+                toml_config.insert("Links", links_array);
+
+                // Synthetic traffic
+                toml_config.insert("Generator", toml::table{
+                    {"Enabled", config.generator_enabled},
+                    {"Mpps", config.generator.packets_per_second / 1e6},
+                    {"Flows", static_cast<int64_t>(config.generator.flows)},
+                    {"FlowSizeShape", config.generator.flow_size_shape},
+                    {"FlowSizeMin", static_cast<int64_t>(config.generator.flow_size_min)},
+                    {"IPv6Share", config.generator.ipv6_share},
+                    {"TcpShare", config.generator.tcp_share},
+                    {"OutboundShare", config.generator.outbound_share},
+                    {"PacketSizes", FormatPacketSizes(config.generator.packet_sizes)},
+                    {"Seed", static_cast<int64_t>(config.generator.seed)}
+                    });
+
                 // Write to file
                 std::ofstream file(CONFIG_FILE);
                 if (!file.is_open()) {
@@ -212,7 +487,62 @@ namespace BadLink {
                 file << "# Example:\n";
                 file << "# [[FilterPresets]]\n";
                 file << "# name = \"My Custom Filter\"\n";
-                file << "# filter = \"tcp.DstPort == 8080\"\n\n";
+                file << "# filter = \"tcp.DstPort == 8080\"\n";
+                file << "#\n";
+                file << "# Traffic rules pick which impairments apply to which flows, first match wins\n";
+                file << "# Modules: loss, rewrite, duplicate, corruption, mtu, reorder, jitter, bandwidth, latency\n";
+                file << "# [[Rules]]\n";
+                file << "# name = \"Game server\"\n";
+                file << "# dst = \"203.0.113.0/24\"\n";
+                file << "# dst_ports = \"27000-27100\"\n";
+                file << "# protocol = \"udp\"\n";
+                file << "# direction = \"outbound\"\n";
+                file << "# filter = \"udp.PayloadLength > 200\"     # optional, checked per packet\n";
+                file << "# content = \"|80 60|\"                      # optional, payload bytes, checked per flow\n";
+                file << "# domains = \"api.example.com, *.cdn.net\"   # optional, from DNS answers and TLS SNI\n";
+                file << "# class = \"Interactive\"                  # optional, bandwidth traffic class\n";
+                file << "# link = \"Satellite\"                     # optional, named link from [[Links]]\n";
+                file << "# modules = [\"loss\", \"latency\"]\n";
+                file << "#\n";
+                file << "# Traffic classes share the bandwidth limit: each gets its rate, spare capacity is lent\n";
+                file << "# up to ceil_kbps by priority (0 first), traffic no rule or DSCP claims uses the last class\n";
+                file << "# [[TrafficClasses]]\n";
+                file << "# name = \"Interactive\"\n";
+                file << "# priority = 0\n";
+                file << "# rate_kbps = 2000\n";
+                file << "# ceil_kbps = 10000\n";
+                file << "# weight = 1\n";
+                file << "# dscp = \"46, 32-40\"\n";
+                file << "#\n";
+                file << "# Simulation values per direction, Inbound is only used when Asymmetric is set\n";
+                file << "# [Simulation]\n";
+                file << "# Asymmetric = true\n";
+                file << "# Seed = 42             # Replays the same impairment decisions, 0 = new seed per capture\n";
+                file << "# [Simulation.Inbound]\n";
+                file << "# LatencyMs = 600\n";
+                file << "# BandwidthKbps = 20000\n";
+                file << "# [Simulation.Outbound]\n";
+                file << "# LatencyMs = 40\n";
+                file << "# BandwidthKbps = 2000\n";
+                file << "#\n";
+                file << "# Named links run their own impairments for the traffic rules send to them (mtu stays shared)\n";
+                file << "# [[Links]]\n";
+                file << "# name = \"Satellite\"\n";
+                file << "# modules = [\"latency\", \"bandwidth\"]\n";
+                file << "# [Links.Inbound]\n";
+                file << "# LatencyMs = 300\n";
+                file << "# BandwidthKbps = 20000\n";
+                file << "# [Links.Outbound]\n";
+                file << "# LatencyMs = 300\n";
+                file << "# BandwidthKbps = 2000\n";
+                file << "#\n";
+                file << "# Synthetic traffic replaces the capture while Enabled, no driver needed\n";
+                file << "# [Generator]\n";
+                file << "# Enabled = true\n";
+                file << "# Mpps = 2.5              # 0 = as fast as the workers take it\n";
+                file << "# Flows = 10000           # Active at once\n";
+                file << "# FlowSizeShape = 1.2     # Pareto shape of packets per flow, lower = heavier tail\n";
+                file << "# PacketSizes = \"64:7, 576:4, 1500:1\"   # bytes:weight\n\n";
                 file << toml_config;
 
                 return true;
@@ -0,0 +1,182 @@
+#include "corruption_module.h"
+#include "checksum.h"
+#include "gso.h"
+#include <algorithm>
+#include <cmath>
+
+namespace BadLink {
+
+    CorruptionModule::CorruptionModule() = default;
+    CorruptionModule::~CorruptionModule() = default;
+
+    void CorruptionModule::SetBitErrorRate(Direction direction, double bit_error_rate) {
+        bit_error_rate_[DirectionIndex(direction)].store(std::clamp(bit_error_rate, 0.0, 1.0));
+    }
+
+    double CorruptionModule::GetBitErrorRate(Direction direction) const {
+        return bit_error_rate_[DirectionIndex(direction)].load();
+    }
+
+    void CorruptionModule::SetFixChecksums(bool fix) {
+        fix_checksums_.store(fix);
+    }
+
+    bool CorruptionModule::GetFixChecksums() const {
+        return fix_checksums_.load();
+    }
+
+    uint64_t CorruptionModule::GetCorruptedPackets() const {
+        return corrupted_packets_.load();
+    }
+
+    uint64_t CorruptionModule::GetFlippedBits() const {
+        return flipped_bits_.load();
+    }
+
+    void CorruptionModule::SetEnabled(bool enabled) {
+        enabled_.store(enabled);
+    }
+
+    bool CorruptionModule::IsEnabled() const {
+        return enabled_.load();
+    }
+
+    void CorruptionModule::SetInboundEnabled(bool enabled) {
+        inbound_enabled_.store(enabled);
+    }
+
+    void CorruptionModule::SetOutboundEnabled(bool enabled) {
+        outbound_enabled_.store(enabled);
+    }
+
+    std::vector<SimulatedPacket> CorruptionModule::ProcessBatch(
+        std::vector<SimulatedPacket>&& packets) {
+
+        const PerDirection<double> rates{ bit_error_rate_[0].load(), bit_error_rate_[1].load() };
+        if (!enabled_.load() || (rates[0] <= 0.0 && rates[1] <= 0.0)) {
+            return std::move(packets);
+        }
+
+        const bool fix_checksums = fix_checksums_.load();
+        const PerDirection<double> log_clean{ std::log1p(-rates[0]), std::log1p(-rates[1]) };
+
+        std::vector<SimulatedPacket> output;
+        output.reserve(packets.size());
+
+        for (auto& packet : packets) {
+            const size_t direction = DirectionIndex(packet);
+            const double rate = rates[direction];
+            if (!ShouldProcess(packet) || packet.Size() == 0 || rate <= 0.0) {
+                output.push_back(std::move(packet));
+                continue;
+            }
+
+            // Gaps are memoryless, so each packet starts its own bit stream from its random stream
+            // and the decisions do not depend on which packets went through before it
+            // The price is one gap draw per packet, clean or not, see DrawGap
+            RandomStream random(RandomDomain::Corruption, packet.random_stream);
+            uint64_t bits_until_error = DrawGap(log_clean[direction], random);
+
+            // Checksums are per wire segment, so a super-packet about to be hit is split first,
+            // the segments continue the packet's bit stream
+            if (packet.gso_size != 0 && PayloadBits(packet) > bits_until_error) {
+                std::vector<SimulatedPacket> segments;
+                Gso::Segment(std::move(packet), segments);
+                for (auto& segment : segments) {
+                    CorruptPacket(segment, log_clean[direction], fix_checksums, bits_until_error, random);
+                    output.push_back(std::move(segment));
+                }
+                continue;
+            }
+
+            CorruptPacket(packet, log_clean[direction], fix_checksums, bits_until_error, random);
+            output.push_back(std::move(packet));
+        }
+
+        return output;
+    }
+
+    std::vector<SimulatedPacket> CorruptionModule::GetReleasablePackets() {
+        // Corruption doesn't delay packets, so nothing to release
+        return {};
+    }
+
+    bool CorruptionModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::CORRUPTION) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
+        if (addr.Outbound && !outbound_enabled_.load()) {
+            return false;
+        }
+        if (!addr.Outbound && !inbound_enabled_.load()) {
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t CorruptionModule::PayloadBits(const SimulatedPacket& packet) {
+        // Only the transport payload is corrupted, so the packet still routes and
+        // the damage shows up in the application's own integrity checks
+        const PacketHeaders& headers = packet.headers;
+        if (!headers.IsValid() || headers.payload_offset >= packet.Size()) {
+            return 0;
+        }
+        return static_cast<uint64_t>(packet.Size() - headers.payload_offset) * 8;
+    }
+
+    void CorruptionModule::CorruptPacket(SimulatedPacket& packet, double log_clean, bool fix_checksums,
+        uint64_t& bits_until_error, RandomStream& random) {
+        const uint64_t bits = PayloadBits(packet);
+        if (bits_until_error >= bits) {
+            // Clean packet: no copy, no parse of the payload
+            bits_until_error -= bits;
+            return;
+        }
+
+        // Copy-on-write so a duplicate sharing this buffer stays intact
+        const PacketHeaders& headers = packet.headers;
+        auto& data = packet.MutableData();
+
+        // Checksum offload leaves the field unset on outbound packets, compute it over the
+        // original bytes first so the corruption is still detectable after injection
+        const bool checksum_pending = headers.IsTcp() ? !packet.addr.TCPChecksum :
+            headers.IsUdp() ? !packet.addr.UDPChecksum : false;
+        if (!fix_checksums && checksum_pending) {
+            Checksum::UpdateTransport(data, headers);
+        }
+
+        uint64_t position = bits_until_error;
+        uint64_t flipped = 0;
+        while (position < bits) {
+            data[headers.payload_offset + position / 8] ^= static_cast<uint8_t>(0x80 >> (position % 8));
+            ++flipped;
+            position += 1 + DrawGap(log_clean, random);
+        }
+        bits_until_error = position - bits;
+
+        if (fix_checksums) {
+            Checksum::UpdateTransport(data, headers);
+        }
+
+        // Bytes are final now, stop the driver from recalculating checksums on send
+        packet.addr.TCPChecksum = headers.IsTcp() ? 1 : packet.addr.TCPChecksum;
+        packet.addr.UDPChecksum = headers.IsUdp() ? 1 : packet.addr.UDPChecksum;
+
+        corrupted_packets_.fetch_add(1);
+        flipped_bits_.fetch_add(flipped);
+    }
+
+    uint64_t CorruptionModule::DrawGap(double log_clean, RandomStream& random) {
+        if (std::isinf(log_clean)) {
+            return 0;   // Bit error rate 1, every bit flips
+        }
+
+        // Number of clean bits before the next error in a Bernoulli(p) bit stream,
+        // geometric by inversion; capped far beyond any packet so the cast stays defined
+        const double gap = std::floor(std::log(random.Uniform()) / log_clean);
+        return gap < 0x1p62 ? static_cast<uint64_t>(gap) : (1ull << 62);
+    }
+
+}
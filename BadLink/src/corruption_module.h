@@ -0,0 +1,64 @@
+#ifndef BADLINK_SRC_CORRUPTION_MODULE_H_
+#define BADLINK_SRC_CORRUPTION_MODULE_H_
+
+#include "simulation_module.h"
+#include "random_utils.h"
+#include <atomic>
+
+namespace BadLink {
+
+    class CorruptionModule : public SimulationModule {
+    public:
+        CorruptionModule();
+        ~CorruptionModule() override;
+
+        // Set bit error rate, probability that any single bit is flipped (0.0 - 1.0)
+        void SetBitErrorRate(Direction direction, double bit_error_rate);
+        double GetBitErrorRate(Direction direction) const;
+
+        // Recompute L3/L4 checksums after corrupting so packets pass kernel validation,
+        // otherwise corrupted packets keep the checksum of the original bytes
+        void SetFixChecksums(bool fix);
+        bool GetFixChecksums() const;
+
+        // Statistics
+        uint64_t GetCorruptedPackets() const;
+        uint64_t GetFlippedBits() const;
+
+        // Enable/disable the module
+        void SetEnabled(bool enabled);
+        bool IsEnabled() const override;
+
+        // Direction control
+        void SetInboundEnabled(bool enabled) override;
+        void SetOutboundEnabled(bool enabled) override;
+
+        // Process packets
+        std::vector<SimulatedPacket> ProcessBatch(
+            std::vector<SimulatedPacket>&& packets) override;
+        std::vector<SimulatedPacket> GetReleasablePackets() override;
+
+    private:
+        std::atomic<bool> enabled_{ false };
+        std::atomic<bool> inbound_enabled_{ true };
+        std::atomic<bool> outbound_enabled_{ true };
+        PerDirection<std::atomic<double>> bit_error_rate_{ 0.000001, 0.000001 };
+        std::atomic<bool> fix_checksums_{ true };
+
+        std::atomic<uint64_t> corrupted_packets_{ 0 };
+        std::atomic<uint64_t> flipped_bits_{ 0 };
+
+        bool ShouldProcess(const SimulatedPacket& packet) const;
+        // Geometric skipping: clean bits before the next error by inversion, so an error-free
+        // packet costs one Philox block and one logarithm, with no copy and no payload pass
+        // `log_clean` is log1p(-bit_error_rate), taken once per batch and direction
+        static uint64_t DrawGap(double log_clean, RandomStream& random);
+        static uint64_t PayloadBits(const SimulatedPacket& packet);
+
+        // Flip the bits that fall inside this packet, `bits_until_error` carries over to the next segment
+        void CorruptPacket(SimulatedPacket& packet, double log_clean, bool fix_checksums,
+            uint64_t& bits_until_error, RandomStream& random);
+    };
+
+}
+#endif  // BADLINK_SRC_CORRUPTION_MODULE_H_
@@ -0,0 +1,66 @@
+#ifndef BADLINK_SRC_CPU_FEATURES_H_
+#define BADLINK_SRC_CPU_FEATURES_H_
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define BADLINK_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// MSVC emits any intrinsic without per-function opt-in, GCC/Clang need a target attribute
+#if defined(_MSC_VER) && !defined(__clang__)
+#define BADLINK_TARGET(isa)
+#else
+#define BADLINK_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace BadLink {
+
+    // Runtime instruction set detection, results are cached on first use
+    class CpuFeatures {
+    public:
+        [[nodiscard]] static bool HasSsse3() { return Get().ssse3; }
+        [[nodiscard]] static bool HasSse42() { return Get().sse42; }
+        [[nodiscard]] static bool HasAvx2() { return Get().avx2; }
+
+    private:
+        struct Flags {
+            bool ssse3 = false;
+            bool sse42 = false;
+            bool avx2 = false;
+        };
+
+        static const Flags& Get() {
+            static const Flags flags = Detect();
+            return flags;
+        }
+
+        static Flags Detect() {
+            Flags flags;
+#if defined(BADLINK_X64) && defined(_MSC_VER)
+            int info[4] = {};
+            __cpuid(info, 1);
+            flags.ssse3 = (info[2] & (1 << 9)) != 0;
+            flags.sse42 = (info[2] & (1 << 20)) != 0;
+            const bool osxsave = (info[2] & (1 << 27)) != 0;
+            const bool avx = (info[2] & (1 << 28)) != 0;
+
+            // AVX2 also needs the OS to save YMM state on context switches
+            if (osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+                __cpuidex(info, 7, 0);
+                flags.avx2 = (info[1] & (1 << 5)) != 0;
+            }
+#elif defined(BADLINK_X64)
+            __builtin_cpu_init();
+            flags.ssse3 = __builtin_cpu_supports("ssse3");
+            flags.sse42 = __builtin_cpu_supports("sse4.2");
+            flags.avx2 = __builtin_cpu_supports("avx2");
+#endif
+            return flags;
+        }
+    };
+
+}
+#endif  // BADLINK_SRC_CPU_FEATURES_H_
@@ -0,0 +1,214 @@
+#define NOMINMAX
+#include "cross_traffic.h"
+#include "cidr.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <sstream>
+
+namespace BadLink {
+
+    namespace {
+        std::optional<uint32_t> ParseQuantity(std::string_view text, std::string_view unit) {
+            if (text.ends_with(unit)) {
+                text = TrimSpaces(text.substr(0, text.size() - unit.size()));
+            }
+            uint32_t value = 0;
+            const auto [ptr, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (error != std::errc() || ptr != text.data() + text.size() || text.empty()) {
+                return std::nullopt;
+            }
+            return value;
+        }
+    }
+
+    std::expected<std::vector<CrossTrafficStep>, std::string> CrossTraffic::ParseTrace(std::string_view text) {
+        std::vector<CrossTrafficStep> steps;
+
+        for (size_t line = 1; !text.empty(); ++line) {
+            const size_t line_end = text.find('\n');
+            std::string_view line_text = text.substr(0, line_end);
+            text.remove_prefix(line_end == std::string_view::npos ? text.size() : line_end + 1);
+
+            if (const size_t comment = line_text.find('#'); comment != std::string_view::npos) {
+                line_text = line_text.substr(0, comment);
+            }
+            if (!line_text.empty() && line_text.back() == '\r') {
+                line_text.remove_suffix(1);
+            }
+
+            while (!line_text.empty()) {
+                const size_t item_end = line_text.find(',');
+                const std::string_view item = TrimSpaces(line_text.substr(0, item_end));
+                line_text.remove_prefix(item_end == std::string_view::npos ? line_text.size() : item_end + 1);
+                if (item.empty()) {
+                    continue;
+                }
+
+                const size_t equals = item.find('=');
+                if (equals == std::string_view::npos) {
+                    return std::unexpected(std::format("Line {}: expected 'ms = kbps'", line));
+                }
+
+                const std::string_view duration_text = TrimSpaces(item.substr(0, equals));
+                const std::string_view rate_text = TrimSpaces(item.substr(equals + 1));
+                const auto duration = ParseQuantity(duration_text, "ms");
+                if (!duration || *duration == 0) {
+                    return std::unexpected(std::format("Line {}: invalid duration '{}'", line, duration_text));
+                }
+                const auto rate = ParseQuantity(rate_text, "kbps");
+                if (!rate) {
+                    return std::unexpected(std::format("Line {}: invalid rate '{}'", line, rate_text));
+                }
+                steps.push_back({ *duration, *rate });
+            }
+        }
+
+        if (steps.empty()) {
+            return std::unexpected(std::string("Trace has no steps"));
+        }
+        return steps;
+    }
+
+    std::expected<std::vector<CrossTrafficStep>, std::string> CrossTraffic::LoadTrace(const std::filesystem::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return std::unexpected(std::format("Cannot open '{}'", path.string()));
+        }
+
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        return ParseTrace(contents.str());
+    }
+
+    void CrossTraffic::Configure(const CrossTrafficConfig& config, uint64_t stream) {
+        config_ = config;
+        stream_ = stream;
+        trace_period_ms_ = 0;
+        for (const auto& step : config_.trace) {
+            trace_period_ms_ += step.duration_ms;
+        }
+        last_.reset();  // Restart on the next call
+    }
+
+    bool CrossTraffic::IsActive() const {
+        switch (config_.model) {
+        case CrossTrafficModel::Off: return false;
+        case CrossTrafficModel::Trace: return trace_period_ms_ != 0;
+        case CrossTrafficModel::Poisson: return config_.rate_kbps != 0 && config_.packet_bytes != 0;
+        default: return config_.rate_kbps != 0;
+        }
+    }
+
+    CrossTraffic::Clock::duration CrossTraffic::Exponential(double mean_seconds) {
+        // -mean * ln(u) rather than std::exponential_distribution, whose output is up to the library
+        const auto duration = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(-mean_seconds * std::log(rng_.Uniform())));
+        return std::max<Clock::duration>(duration, std::chrono::microseconds(1));
+    }
+
+    double CrossTraffic::TraceBytes(Clock::time_point from, Clock::time_point to) const {
+        const double period = trace_period_ms_ / 1000.0;
+        double start = std::chrono::duration<double>(from - started_).count();
+        double end = std::chrono::duration<double>(to - started_).count();
+
+        // Whole periods first, then what is left spans at most two passes over the steps
+        double bytes = 0;
+        const double cycles = std::floor(start / period);
+        start -= cycles * period;
+        end -= cycles * period;
+        if (end - start > period) {
+            double period_bytes = 0;
+            for (const auto& step : config_.trace) {
+                period_bytes += step.duration_ms / 1000.0 * BytesPerSecond(step.kbps);
+            }
+            const double whole = std::floor((end - start) / period);
+            bytes += whole * period_bytes;
+            end -= whole * period;
+        }
+
+        double offset = 0;
+        for (int pass = 0; pass < 2 && offset < end; ++pass) {
+            for (const auto& step : config_.trace) {
+                const double step_end = offset + step.duration_ms / 1000.0;
+                const double overlap = std::min(step_end, end) - std::max(offset, start);
+                if (overlap > 0) {
+                    bytes += overlap * BytesPerSecond(step.kbps);
+                }
+                offset = step_end;
+            }
+        }
+        return bytes;
+    }
+
+    double CrossTraffic::Arrivals(Clock::time_point now) {
+        if (!IsActive()) {
+            return 0;
+        }
+
+        const double rate = BytesPerSecond(config_.rate_kbps);
+        if (!last_) {
+            started_ = now;
+            last_ = now;
+            on_ = true;
+            rng_ = RandomStream(RandomDomain::CrossTraffic, stream_);
+            if (config_.model == CrossTrafficModel::OnOff) {
+                phase_end_ = now + Exponential(config_.on_ms / 1000.0);
+            }
+            else if (config_.model == CrossTrafficModel::Poisson) {
+                phase_end_ = now + Exponential(config_.packet_bytes / rate);
+            }
+            return 0;
+        }
+        const Clock::time_point last = *last_;
+        if (now <= last) {
+            return 0;
+        }
+
+        double bytes = 0;
+        switch (config_.model) {
+        case CrossTrafficModel::Constant:
+            bytes = rate * std::chrono::duration<double>(now - last).count();
+            break;
+
+        case CrossTrafficModel::OnOff: {
+            Clock::time_point from = last;
+            while (phase_end_ <= now) {
+                if (on_) {
+                    bytes += rate * std::chrono::duration<double>(phase_end_ - from).count();
+                }
+                from = phase_end_;
+                on_ = !on_;
+                phase_end_ += Exponential((on_ ? config_.on_ms : config_.off_ms) / 1000.0);
+            }
+            if (on_) {
+                bytes += rate * std::chrono::duration<double>(now - from).count();
+            }
+            break;
+        }
+
+        case CrossTrafficModel::Poisson: {
+            const double mean_gap = config_.packet_bytes / rate;
+            while (phase_end_ <= now) {
+                bytes += config_.packet_bytes;
+                phase_end_ += Exponential(mean_gap);
+            }
+            break;
+        }
+
+        case CrossTrafficModel::Trace:
+            bytes = TraceBytes(last, now);
+            break;
+
+        default:
+            break;
+        }
+
+        last_ = now;
+        return bytes;
+    }
+
+}
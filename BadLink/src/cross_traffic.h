@@ -0,0 +1,92 @@
+#ifndef BADLINK_SRC_CROSS_TRAFFIC_H_
+#define BADLINK_SRC_CROSS_TRAFFIC_H_
+
+#include "random_utils.h"
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    enum class CrossTrafficModel : uint8_t {
+        Off,
+        Constant,       // Steady rate
+        OnOff,          // Rate during on periods, on and off durations exponential around their means
+        Poisson,        // Packets of packet_bytes at Poisson arrival times, averaging the rate
+        Trace,          // Piecewise constant rate from a trace, repeated
+    };
+
+    // One trace step: `kbps` held for `duration_ms`
+    struct CrossTrafficStep {
+        uint32_t duration_ms = 0;
+        uint32_t kbps = 0;
+
+        bool operator==(const CrossTrafficStep&) const = default;
+    };
+
+    struct CrossTrafficConfig {
+        CrossTrafficModel model = CrossTrafficModel::Off;
+        uint32_t rate_kbps = 500;
+        uint32_t on_ms = 1000;
+        uint32_t off_ms = 1000;
+        uint32_t packet_bytes = 1200;
+        std::vector<CrossTrafficStep> trace;
+
+        bool operator==(const CrossTrafficConfig&) const = default;
+    };
+
+    // Background load as seen by the shaper, all in virtual bytes
+    struct CrossTrafficStats {
+        uint64_t offered_bytes = 0;
+        uint64_t sent_bytes = 0;
+        uint64_t dropped_bytes = 0;     // Arrived while the virtual backlog was full
+        uint64_t backlog_bytes = 0;
+    };
+
+    // Synthetic background sources for the bandwidth shaper
+    // Nothing is generated or injected: the model only says how many bytes other traffic
+    // would have offered, the shaper queues and drains them like real packets
+    // Not thread-safe, BandwidthModule calls it under its bucket lock
+    class CrossTraffic {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // "500ms = 2000kbps, 1000 = 0, 1500 = 8000", one step per item, units optional
+        // Items are separated by commas or newlines, '#' starts a comment
+        static std::expected<std::vector<CrossTrafficStep>, std::string> ParseTrace(std::string_view text);
+        static std::expected<std::vector<CrossTrafficStep>, std::string> LoadTrace(const std::filesystem::path& path);
+
+        // Restarts the model at its first on period or trace step
+        // `stream` separates the random draws of models running side by side, e.g. per direction
+        void Configure(const CrossTrafficConfig& config, uint64_t stream = 0);
+        const CrossTrafficConfig& GetConfig() const { return config_; }
+
+        // Starts the model over on the next call instead of catching up on the time since the last one
+        void Restart() { last_.reset(); }
+        bool IsActive() const;
+
+        // Bytes the background offered since the previous call, nothing on the first call
+        double Arrivals(Clock::time_point now);
+
+    private:
+        CrossTrafficConfig config_;
+        uint64_t trace_period_ms_ = 0;
+        Clock::time_point started_{};
+        std::optional<Clock::time_point> last_;        // Empty until the first call after a restart
+        Clock::time_point phase_end_{};     // On/off: end of the current period, Poisson: next arrival
+        bool on_ = true;
+        uint64_t stream_ = 0;
+        RandomStream rng_{ RandomDomain::CrossTraffic, 0 };    // Reseeded on every restart
+
+        double BytesPerSecond(uint32_t kbps) const { return (kbps * 1000.0) / 8.0; }
+        Clock::duration Exponential(double mean_seconds);
+        double TraceBytes(Clock::time_point from, Clock::time_point to) const;
+    };
+
+}
+#endif  // BADLINK_SRC_CROSS_TRAFFIC_H_
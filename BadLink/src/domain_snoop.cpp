@@ -0,0 +1,280 @@
+#define NOMINMAX
+#include "domain_snoop.h"
+#include "domain_trie.h"
+#include "packet_parser.h"
+#include "simulation_module.h"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace BadLink {
+
+    namespace {
+        constexpr uint16_t DNS_PORT = 53;
+        constexpr uint16_t DNS_TYPE_A = 1;
+        constexpr uint16_t DNS_TYPE_AAAA = 28;
+        constexpr uint16_t DNS_CLASS_IN = 1;
+        constexpr size_t DNS_HEADER_SIZE = 12;
+        constexpr size_t MAX_POINTER_JUMPS = 16;
+
+        // Name at `offset`, following compression pointers, `offset` ends up after the name
+        // as stored in place (after the first pointer if there is one)
+        std::optional<std::string> ReadName(std::span<const uint8_t> message, size_t& offset) {
+            std::string name;
+            size_t position = offset;
+            size_t jumps = 0;
+            bool jumped = false;
+
+            while (true) {
+                if (position >= message.size()) {
+                    return std::nullopt;
+                }
+                const uint8_t length = message[position];
+
+                if ((length & 0xC0) == 0xC0) {
+                    if (position + 1 >= message.size() || ++jumps > MAX_POINTER_JUMPS) {
+                        return std::nullopt;
+                    }
+                    if (!jumped) {
+                        offset = position + 2;
+                        jumped = true;
+                    }
+                    position = LoadBe16(message.data() + position) & 0x3FFF;
+                    continue;
+                }
+                if (length & 0xC0) {
+                    return std::nullopt;    // Reserved label types
+                }
+                if (length == 0) {
+                    if (!jumped) {
+                        offset = position + 1;
+                    }
+                    break;
+                }
+                if (position + 1 + length > message.size() || name.size() + length + 1 > 255) {
+                    return std::nullopt;
+                }
+
+                if (!name.empty()) {
+                    name.push_back('.');
+                }
+                name.append(reinterpret_cast<const char*>(message.data() + position + 1), length);
+                position += 1 + length;
+            }
+            return name;
+        }
+
+        // Advance past a name without decoding it
+        bool SkipName(std::span<const uint8_t> message, size_t& offset) {
+            while (offset < message.size()) {
+                const uint8_t length = message[offset];
+                if ((length & 0xC0) == 0xC0) {
+                    offset += 2;
+                    return offset <= message.size();
+                }
+                if (length & 0xC0) {
+                    return false;
+                }
+                offset += 1 + length;
+                if (length == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Bounds-checked cursor over a TLS ClientHello
+        struct Reader {
+            std::span<const uint8_t> data;
+            size_t offset = 0;
+
+            bool Has(size_t count) const { return offset + count <= data.size(); }
+            bool Skip(size_t count) {
+                offset += count;
+                return offset <= data.size();
+            }
+            std::optional<uint32_t> Read(size_t width) {
+                if (!Has(width)) {
+                    return std::nullopt;
+                }
+                uint32_t value = 0;
+                for (size_t i = 0; i < width; ++i) {
+                    value = (value << 8) | data[offset + i];
+                }
+                offset += width;
+                return value;
+            }
+        };
+    }
+
+    std::optional<DnsAnswer> ParseDnsResponse(std::span<const uint8_t> message) {
+        if (message.size() < DNS_HEADER_SIZE) {
+            return std::nullopt;
+        }
+
+        // Responses only (QR set) with RCODE 0 and exactly one question
+        const uint16_t flags = LoadBe16(message.data() + 2);
+        const uint16_t questions = LoadBe16(message.data() + 4);
+        const uint16_t answers = LoadBe16(message.data() + 6);
+        if ((flags & 0x8000) == 0 || (flags & 0x000F) != 0 || questions != 1 || answers == 0) {
+            return std::nullopt;
+        }
+
+        size_t offset = DNS_HEADER_SIZE;
+        const auto question = ReadName(message, offset);
+        if (!question || offset + 4 > message.size()) {
+            return std::nullopt;
+        }
+        offset += 4;    // QTYPE, QCLASS
+
+        DnsAnswer answer;
+        answer.name = NormalizeDomain(*question);
+        if (answer.name.empty()) {
+            return std::nullopt;
+        }
+
+        for (uint16_t i = 0; i < answers; ++i) {
+            if (!SkipName(message, offset) || offset + 10 > message.size()) {
+                break;
+            }
+            const uint16_t type = LoadBe16(message.data() + offset);
+            const uint16_t record_class = LoadBe16(message.data() + offset + 2);
+            const uint16_t length = LoadBe16(message.data() + offset + 8);
+            offset += 10;
+            if (offset + length > message.size()) {
+                break;
+            }
+
+            std::array<uint8_t, 16> address{};
+            if (record_class == DNS_CLASS_IN && type == DNS_TYPE_A && length == 4) {
+                std::memcpy(address.data(), message.data() + offset, 4);
+                answer.v4.push_back(address);
+            }
+            else if (record_class == DNS_CLASS_IN && type == DNS_TYPE_AAAA && length == 16) {
+                std::memcpy(address.data(), message.data() + offset, 16);
+                answer.v6.push_back(address);
+            }
+            offset += length;
+        }
+
+        if (answer.v4.empty() && answer.v6.empty()) {
+            return std::nullopt;
+        }
+        return answer;
+    }
+
+    std::optional<std::string> ParseTlsSni(std::span<const uint8_t> payload) {
+        // TLS record header: handshake (22), major version 3, length
+        Reader reader{ payload };
+        if (reader.Read(1) != 0x16 || reader.Read(1) != 0x03 || !reader.Skip(3)) {
+            return std::nullopt;
+        }
+
+        // Handshake header: ClientHello (1), 24-bit length
+        if (reader.Read(1) != 0x01 || !reader.Skip(3)) {
+            return std::nullopt;
+        }
+
+        // Legacy version and random, then the variable-length session id, cipher suites and compression methods
+        if (!reader.Skip(2 + 32)) {
+            return std::nullopt;
+        }
+        for (const size_t width : { 1, 2, 1 }) {
+            const auto length = reader.Read(width);
+            if (!length || !reader.Skip(*length)) {
+                return std::nullopt;
+            }
+        }
+
+        const auto extensions_length = reader.Read(2);
+        if (!extensions_length) {
+            return std::nullopt;
+        }
+        const size_t extensions_end = std::min(reader.offset + *extensions_length, payload.size());
+
+        while (reader.offset + 4 <= extensions_end) {
+            const uint32_t type = *reader.Read(2);
+            const uint32_t length = *reader.Read(2);
+            if (type != 0) {
+                if (!reader.Skip(length)) {
+                    return std::nullopt;
+                }
+                continue;
+            }
+
+            // server_name: list length, then entries of name type (0 = host_name) and name
+            const auto list_length = reader.Read(2);
+            const auto name_type = reader.Read(1);
+            const auto name_length = reader.Read(2);
+            if (!list_length || name_type != 0 || !name_length || !reader.Has(*name_length)) {
+                return std::nullopt;
+            }
+            const std::string_view name(reinterpret_cast<const char*>(payload.data() + reader.offset), *name_length);
+            std::string normalized = NormalizeDomain(name);
+            return normalized.empty() ? std::nullopt : std::optional(std::move(normalized));
+        }
+        return std::nullopt;
+    }
+
+    std::optional<DnsAnswer> SnoopDnsResponse(const SimulatedPacket& packet) {
+        const PacketHeaders& headers = packet.headers;
+        if (!headers.IsUdp() || packet.prefix_length > 0) {
+            return std::nullopt;
+        }
+
+        const auto bytes = packet.Bytes();
+        if (headers.payload_offset > bytes.size() || LoadBe16(bytes.data() + headers.l4_offset) != DNS_PORT) {
+            return std::nullopt;
+        }
+        return ParseDnsResponse(bytes.subspan(headers.payload_offset));
+    }
+
+    size_t DomainCache::KeyHash::operator()(const Key& key) const {
+        return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(key.data()), key.size()));
+    }
+
+    void DomainCache::Learn(const DnsAnswer& answer) {
+        for (const auto& address : answer.v4) {
+            Insert(4, address, answer.name);
+        }
+        for (const auto& address : answer.v6) {
+            Insert(6, address, answer.name);
+        }
+    }
+
+    const std::string* DomainCache::Find(uint8_t ip_version, const std::array<uint8_t, 16>& address) const {
+        Key key{};
+        key[0] = ip_version;
+        std::memcpy(key.data() + 1, address.data(), address.size());
+        const auto it = names_.find(key);
+        return it == names_.end() ? nullptr : &it->second;
+    }
+
+    void DomainCache::Insert(uint8_t ip_version, const std::array<uint8_t, 16>& address, const std::string& name) {
+        Key key{};
+        key[0] = ip_version;
+        std::memcpy(key.data() + 1, address.data(), address.size());
+
+        if (auto it = names_.find(key); it != names_.end()) {
+            it->second = name;
+            return;
+        }
+
+        if (order_.size() < MAX_ENTRIES) {
+            order_.push_back(key);
+        }
+        else {
+            names_.erase(order_[next_evict_]);
+            order_[next_evict_] = key;
+            next_evict_ = (next_evict_ + 1) % MAX_ENTRIES;
+        }
+        names_.emplace(key, name);
+    }
+
+    void DomainCache::Clear() {
+        names_.clear();
+        order_.clear();
+        next_evict_ = 0;
+    }
+
+}
@@ -0,0 +1,66 @@
+#ifndef BADLINK_SRC_DOMAIN_SNOOP_H_
+#define BADLINK_SRC_DOMAIN_SNOOP_H_
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace BadLink {
+
+    struct SimulatedPacket;
+
+    // Addresses a DNS response resolved its question name to
+    struct DnsAnswer {
+        std::string name;                           // Normalized question name
+        std::vector<std::array<uint8_t, 16>> v4;    // IPv4 uses the first 4 bytes
+        std::vector<std::array<uint8_t, 16>> v6;
+    };
+
+    // A and AAAA records of a DNS response message (UDP payload), CNAME chains are
+    // attributed to the question name, nullopt for queries, errors and malformed messages
+    [[nodiscard]] std::optional<DnsAnswer> ParseDnsResponse(std::span<const uint8_t> message);
+
+    // server_name of a TLS ClientHello at the start of a TCP payload, normalized
+    // nullopt if the payload is something else or the hello is cut off by the segment
+    [[nodiscard]] std::optional<std::string> ParseTlsSni(std::span<const uint8_t> payload);
+
+    // The response a packet carries if it is a DNS answer (UDP from source port 53)
+    // nullopt for everything else, cheap to call on every packet
+    [[nodiscard]] std::optional<DnsAnswer> SnoopDnsResponse(const SimulatedPacket& packet);
+
+    // Address to name map learned from snooped DNS responses, so a flow to an address can be
+    // attributed to the name the application resolved, the newest answer for an address wins
+    // Bounded, the oldest learned address is forgotten first, not thread-safe
+    class DomainCache {
+    public:
+        static constexpr size_t MAX_ENTRIES = 16384;
+
+        // Remember the addresses of a snooped response, see SnoopDnsResponse
+        void Learn(const DnsAnswer& answer);
+
+        // Name the address was resolved from, nullptr if unknown
+        const std::string* Find(uint8_t ip_version, const std::array<uint8_t, 16>& address) const;
+
+        size_t Size() const { return names_.size(); }
+        void Clear();
+
+    private:
+        using Key = std::array<uint8_t, 17>;    // Version byte + address
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+        };
+
+        std::unordered_map<Key, std::string, KeyHash> names_;
+        std::vector<Key> order_;                // Ring of insertion order for eviction
+        size_t next_evict_ = 0;
+
+        void Insert(uint8_t ip_version, const std::array<uint8_t, 16>& address, const std::string& name);
+    };
+
+}
+#endif  // BADLINK_SRC_DOMAIN_SNOOP_H_
@@ -0,0 +1,127 @@
+#define NOMINMAX
+#include "domain_trie.h"
+#include <algorithm>
+#include <format>
+#include <map>
+#include <memory>
+
+namespace BadLink {
+
+    std::string NormalizeDomain(std::string_view name) {
+        if (!name.empty() && name.back() == '.') {
+            name.remove_suffix(1);
+        }
+        if (name.empty() || name.size() > 253) {
+            return {};
+        }
+
+        std::string normalized;
+        normalized.reserve(name.size());
+        size_t label_length = 0;
+        for (const char c : name) {
+            if (c == '.') {
+                if (label_length == 0) {
+                    return {};
+                }
+                label_length = 0;
+                normalized.push_back(c);
+                continue;
+            }
+
+            const bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                c == '-' || c == '_';
+            if (!valid || ++label_length > 63) {
+                return {};
+            }
+            normalized.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c);
+        }
+        return label_length == 0 ? std::string{} : normalized;
+    }
+
+    std::expected<DomainTrie, std::string> DomainTrie::Build(const std::vector<Entry>& entries) {
+        // Pointer tree first, flattened breadth-first below
+        struct BuildNode {
+            std::map<std::string, std::unique_ptr<BuildNode>, std::less<>> children;
+            uint64_t bits = 0;
+            uint64_t subdomain_bits = 0;
+        };
+        BuildNode root;
+
+        for (const Entry& entry : entries) {
+            std::string_view pattern = entry.pattern;
+            const bool subdomains_only = pattern.starts_with("*.");
+            if (subdomains_only) {
+                pattern.remove_prefix(2);
+            }
+
+            const std::string name = NormalizeDomain(pattern);
+            if (name.empty()) {
+                return std::unexpected(std::format("Invalid domain '{}'", entry.pattern));
+            }
+
+            BuildNode* node = &root;
+            std::string_view rest = name;
+            while (!rest.empty()) {
+                const size_t dot = rest.rfind('.');
+                const std::string_view label = dot == std::string_view::npos ? rest : rest.substr(dot + 1);
+                rest = dot == std::string_view::npos ? std::string_view{} : rest.substr(0, dot);
+
+                auto it = node->children.find(label);
+                if (it == node->children.end()) {
+                    it = node->children.emplace(std::string(label), std::make_unique<BuildNode>()).first;
+                }
+                node = it->second.get();
+            }
+            (subdomains_only ? node->subdomain_bits : node->bits) |= entry.bits;
+        }
+
+        DomainTrie trie;
+        std::vector<const BuildNode*> queue{ &root };
+        for (size_t i = 0; i < queue.size(); ++i) {
+            const BuildNode* node = queue[i];
+            Node& flat = trie.nodes_[i];
+            flat.bits = node->bits;
+            flat.subdomain_bits = node->subdomain_bits;
+            flat.first_edge = static_cast<uint32_t>(trie.edges_.size());
+            flat.edge_count = static_cast<uint32_t>(node->children.size());
+
+            // std::map iterates in label order, which is what Match binary searches on
+            for (const auto& [label, child] : node->children) {
+                trie.edges_.push_back({ static_cast<uint32_t>(trie.labels_.size()),
+                    static_cast<uint32_t>(label.size()), static_cast<uint32_t>(queue.size()) });
+                trie.labels_ += label;
+                queue.push_back(child.get());
+                trie.nodes_.emplace_back();
+            }
+        }
+        return trie;
+    }
+
+    uint64_t DomainTrie::Match(std::string_view name) const {
+        uint64_t bits = nodes_[0].bits;
+        size_t node = 0;
+
+        while (!name.empty()) {
+            const size_t dot = name.rfind('.');
+            const std::string_view label = dot == std::string_view::npos ? name : name.substr(dot + 1);
+            name = dot == std::string_view::npos ? std::string_view{} : name.substr(0, dot);
+
+            const Node& current = nodes_[node];
+            const auto first = edges_.begin() + current.first_edge;
+            const auto last = first + current.edge_count;
+            const auto it = std::lower_bound(first, last, label,
+                [&](const Edge& edge, std::string_view value) { return Label(edge) < value; });
+            if (it == last || Label(*it) != label) {
+                break;
+            }
+
+            node = it->child;
+            bits |= nodes_[node].bits;
+            if (!name.empty()) {
+                bits |= nodes_[node].subdomain_bits;
+            }
+        }
+        return bits;
+    }
+
+}
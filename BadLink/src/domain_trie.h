@@ -0,0 +1,58 @@
+#ifndef BADLINK_SRC_DOMAIN_TRIE_H_
+#define BADLINK_SRC_DOMAIN_TRIE_H_
+
+#include <cstdint>
+#include <expected>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    // Lowercase without the trailing root dot, empty if the name is not a valid hostname
+    [[nodiscard]] std::string NormalizeDomain(std::string_view name);
+
+    // Domain suffix set keyed by reversed labels: "api.example.com" is stored as com -> example -> api
+    // "example.com" matches the name and every subdomain, "*.example.com" only subdomains
+    // Nodes and edges live in flat arrays with the labels in one string pool, children of a
+    // node are sorted so a lookup is one binary search per label of the queried name
+    class DomainTrie {
+    public:
+        struct Entry {
+            std::string pattern;
+            uint64_t bits = 0;      // Returned for names the pattern matches
+        };
+
+        static std::expected<DomainTrie, std::string> Build(const std::vector<Entry>& entries);
+
+        // OR of the bits of every pattern matching the (normalized) name
+        uint64_t Match(std::string_view name) const;
+
+        bool IsEmpty() const { return edges_.empty(); }
+        size_t GetNodeCount() const { return nodes_.size(); }
+
+    private:
+        struct Node {
+            uint32_t first_edge = 0;
+            uint32_t edge_count = 0;
+            uint64_t bits = 0;              // Patterns ending here: the name and its subdomains
+            uint64_t subdomain_bits = 0;    // "*." patterns ending here: subdomains only
+        };
+
+        struct Edge {
+            uint32_t label_offset;
+            uint32_t label_length;
+            uint32_t child;
+        };
+
+        std::vector<Node> nodes_{ Node{} };     // Node 0 is the root
+        std::vector<Edge> edges_;
+        std::string labels_;
+
+        std::string_view Label(const Edge& edge) const {
+            return std::string_view(labels_).substr(edge.label_offset, edge.label_length);
+        }
+    };
+
+}
+#endif  // BADLINK_SRC_DOMAIN_TRIE_H_
@@ -1,3 +1,4 @@
+#define NOMINMAX
 #include "duplicate_module.h"
 #include <algorithm>
 
@@ -6,20 +7,33 @@ namespace BadLink {
     DuplicateModule::DuplicateModule() = default;
     DuplicateModule::~DuplicateModule() = default;
 
-    void DuplicateModule::SetDuplicationRate(float duplication_percentage) {
-        duplication_rate_.store(std::clamp(duplication_percentage, 0.0f, 100.0f));
+    void DuplicateModule::SetDuplicationRate(Direction direction, float duplication_percentage) {
+        duplication_rate_[DirectionIndex(direction)].store(std::clamp(duplication_percentage, 0.0f, 100.0f));
     }
 
-    float DuplicateModule::GetDuplicationRate() const {
-        return duplication_rate_.load();
+    float DuplicateModule::GetDuplicationRate(Direction direction) const {
+        return duplication_rate_[DirectionIndex(direction)].load();
     }
 
-    void DuplicateModule::SetDuplicateCount(uint32_t count) {
-        duplicate_count_.store(std::clamp(count, 1u, 5u));
+    void DuplicateModule::SetDuplicateCount(Direction direction, uint32_t count) {
+        duplicate_count_[DirectionIndex(direction)].store(std::clamp(count, 1u, 5u));
     }
 
-    uint32_t DuplicateModule::GetDuplicateCount() const {
-        return duplicate_count_.load();
+    uint32_t DuplicateModule::GetDuplicateCount(Direction direction) const {
+        return duplicate_count_[DirectionIndex(direction)].load();
+    }
+
+    void DuplicateModule::SetDuplicateDelay(Direction direction, uint32_t min_ms, uint32_t max_ms) {
+        min_delay_ms_[DirectionIndex(direction)].store(std::min(min_ms, max_ms));
+        max_delay_ms_[DirectionIndex(direction)].store(std::max(min_ms, max_ms));
+    }
+
+    uint32_t DuplicateModule::GetMinDelay(Direction direction) const {
+        return min_delay_ms_[DirectionIndex(direction)].load();
+    }
+
+    uint32_t DuplicateModule::GetMaxDelay(Direction direction) const {
+        return max_delay_ms_[DirectionIndex(direction)].load();
     }
 
     void DuplicateModule::SetEnabled(bool enabled) {
@@ -38,6 +52,10 @@ namespace BadLink {
         outbound_enabled_.store(enabled);
     }
 
+    void DuplicateModule::SetReleaseSlot(std::chrono::microseconds slot) {
+        release_slot_.store(slot);
+    }
+
     std::vector<SimulatedPacket> DuplicateModule::ProcessBatch(
         std::vector<SimulatedPacket>&& packets) {
 
@@ -48,17 +66,36 @@ namespace BadLink {
         std::vector<SimulatedPacket> output_packets;
         output_packets.reserve(packets.size() * 2);  // Reserve space for duplicates
 
+        const PerDirection<Params> params{ LoadParams(0), LoadParams(1) };
+        const auto current_time = Now();
+
         for (auto&& packet : packets) {
             // Always include original packet
             output_packets.push_back(std::move(packet));
 
             // Check if we should duplicate this packet
-            if (ShouldProcess(output_packets.back().addr) && ShouldDuplicate()) {
-                const uint32_t count = duplicate_count_.load();
-                for (uint32_t i = 0; i < count; ++i) {
-                    // Create duplicate and deep copy the packet
+            const Params& direction = params[DirectionIndex(output_packets.back())];
+            RandomStream random(RandomDomain::Duplicate, output_packets.back().random_stream);
+            if (ShouldProcess(output_packets.back()) && ShouldDuplicate(direction.rate, random)) {
+                RandomStream delays(RandomDomain::DuplicateDelay, output_packets.back().random_stream);
+                for (uint32_t i = 0; i < direction.count; ++i) {
+                    // Duplicates share the original's payload buffer, only the header struct is copied
                     SimulatedPacket duplicate = output_packets.back();
-                    output_packets.push_back(std::move(duplicate));
+
+                    // Own stream, so later stages do not repeat the original's draws on the copy
+                    duplicate.random_stream = output_packets.back().random_stream.Child(i);
+
+                    if (direction.max_delay_ms > 0) {
+                        const uint32_t delay_ms = delays.Between(direction.min_delay_ms, direction.max_delay_ms);
+                        duplicate.release_time = AlignToSlot(current_time + std::chrono::milliseconds(delay_ms),
+                            release_slot_.load());
+
+                        std::lock_guard<ContendedMutex> lock(buffer_mutex_);
+                        delayed_packets_.push(std::move(duplicate));
+                    }
+                    else {
+                        output_packets.push_back(std::move(duplicate));
+                    }
                 }
             }
         }
@@ -67,10 +104,61 @@ namespace BadLink {
     }
 
     std::vector<SimulatedPacket> DuplicateModule::GetReleasablePackets() {
-        return {};  // Duplication doesn't delay packets
+        std::vector<SimulatedPacket> ready_packets;
+
+        if (!enabled_.load()) {
+            // If disabled, flush all delayed duplicates
+            std::lock_guard<ContendedMutex> lock(buffer_mutex_);
+            while (!delayed_packets_.empty()) {
+                ready_packets.push_back(std::move(const_cast<SimulatedPacket&>(delayed_packets_.top())));
+                delayed_packets_.pop();
+            }
+            return ready_packets;
+        }
+
+        const auto current_time = Now();
+
+        std::lock_guard<ContendedMutex> lock(buffer_mutex_);
+        while (!delayed_packets_.empty() && delayed_packets_.top().release_time <= current_time) {
+            ready_packets.push_back(std::move(const_cast<SimulatedPacket&>(delayed_packets_.top())));
+            delayed_packets_.pop();
+        }
+
+        return ready_packets;
     }
 
-    bool DuplicateModule::ShouldProcess(const WINDIVERT_ADDRESS& addr) const {
+    SimulationClock::time_point DuplicateModule::NextReleaseTime() const {
+        auto next = SimulationClock::time_point::max();
+        if (!enabled_.load()) {
+            return next;
+        }
+
+        const auto current_time = Now();
+        for (size_t direction = 0; direction < 2; ++direction) {
+            const Params params = LoadParams(direction);
+            if (params.rate > 0.0f && params.max_delay_ms > 0) {
+                next = std::min(next, current_time + std::chrono::milliseconds(params.min_delay_ms));
+            }
+        }
+
+        std::lock_guard<ContendedMutex> lock(buffer_mutex_);
+        if (!delayed_packets_.empty()) {
+            next = std::min(next, delayed_packets_.top().release_time);
+        }
+        return next;
+    }
+
+    DuplicateModule::Params DuplicateModule::LoadParams(size_t direction) const {
+        return { duplication_rate_[direction].load(), duplicate_count_[direction].load(),
+            min_delay_ms_[direction].load(), max_delay_ms_[direction].load() };
+    }
+
+    bool DuplicateModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::DUPLICATE) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
         if (addr.Outbound && !outbound_enabled_.load()) {
             return false;
         }
@@ -80,11 +168,10 @@ namespace BadLink {
         return true;
     }
 
-    bool DuplicateModule::ShouldDuplicate() const {
-        const float rate = duplication_rate_.load();
+    bool DuplicateModule::ShouldDuplicate(float rate, RandomStream& random) const {
         if (rate <= 0.0f) return false;
         if (rate >= 100.0f) return true;
-        return RandomUtils::GetPercentage() < rate;
+        return random.Percentage() < rate;
     }
 
 }
\ No newline at end of file
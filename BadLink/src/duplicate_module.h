@@ -3,7 +3,12 @@
 
 #include "simulation_module.h"
 #include "random_utils.h"
+#include "release_slots.h"
+#include "lock_stats.h"
 #include <atomic>
+#include <mutex>
+#include <queue>
+#include <chrono>
 
 namespace BadLink {
 
@@ -13,12 +18,22 @@ namespace BadLink {
         ~DuplicateModule() override;
 
         // Set duplication percentage (0.0 - 100.0)
-        void SetDuplicationRate(float duplication_percentage);
-        float GetDuplicationRate() const;
+        void SetDuplicationRate(Direction direction, float duplication_percentage);
+        float GetDuplicationRate(Direction direction) const;
 
         // Set number of duplicates per packet (1-5)
-        void SetDuplicateCount(uint32_t count);
-        uint32_t GetDuplicateCount() const;
+        void SetDuplicateCount(Direction direction, uint32_t count);
+        uint32_t GetDuplicateCount(Direction direction) const;
+
+        // Set delay range for duplicates in milliseconds (0/0 sends them with the original)
+        // A delayed copy is held here, then runs through the stages after this one, so it
+        // arrives that much after its original on top of the link's own latency
+        void SetDuplicateDelay(Direction direction, uint32_t min_ms, uint32_t max_ms);
+        uint32_t GetMinDelay(Direction direction) const;
+        uint32_t GetMaxDelay(Direction direction) const;
+
+        // Round delayed duplicates' release times up to slot boundaries, 0 disables
+        void SetReleaseSlot(std::chrono::microseconds slot);
 
         // Enable/disable the module
         void SetEnabled(bool enabled);
@@ -33,15 +48,41 @@ namespace BadLink {
             std::vector<SimulatedPacket>&& packets) override;
         std::vector<SimulatedPacket> GetReleasablePackets() override;
 
+        // Earliest time a delayed duplicate can fall due: the head of the queue, or the shortest
+        // configured delay from now for copies not made yet; time_point::max() when none are delayed
+        SimulationClock::time_point NextReleaseTime() const;
+
     private:
         std::atomic<bool> enabled_{ false };
         std::atomic<bool> inbound_enabled_{ true };
         std::atomic<bool> outbound_enabled_{ true };
-        std::atomic<float> duplication_rate_{ 0.0f };
-        std::atomic<uint32_t> duplicate_count_{ 1 };
+        PerDirection<std::atomic<float>> duplication_rate_{ 0.0f, 0.0f };
+        PerDirection<std::atomic<uint32_t>> duplicate_count_{ 1, 1 };
+        PerDirection<std::atomic<uint32_t>> min_delay_ms_{ 0, 0 };
+        PerDirection<std::atomic<uint32_t>> max_delay_ms_{ 0, 0 };
+        std::atomic<std::chrono::microseconds> release_slot_{ std::chrono::microseconds::zero() };
+
+        // Delayed duplicates, ordered by release time
+        struct PacketComparator {
+            bool operator()(const SimulatedPacket& a, const SimulatedPacket& b) const {
+                return a.release_time > b.release_time;
+            }
+        };
+
+        mutable ContendedMutex buffer_mutex_{ "Duplicate queue" };
+        std::priority_queue<SimulatedPacket, std::vector<SimulatedPacket>, PacketComparator> delayed_packets_;
+
+        // One direction's settings, loaded once per batch
+        struct Params {
+            float rate;
+            uint32_t count;
+            uint32_t min_delay_ms;
+            uint32_t max_delay_ms;
+        };
+        Params LoadParams(size_t direction) const;
 
-        bool ShouldProcess(const WINDIVERT_ADDRESS& addr) const;
-        bool ShouldDuplicate() const;
+        bool ShouldProcess(const SimulatedPacket& packet) const;
+        bool ShouldDuplicate(float rate, RandomStream& random) const;
     };
 
 }
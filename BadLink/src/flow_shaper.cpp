@@ -0,0 +1,188 @@
+#define NOMINMAX
+#include "flow_shaper.h"
+#include "packet_parser.h"
+#include <algorithm>
+
+namespace BadLink {
+
+    FlowShaper::FlowShaper(size_t capacity)
+        : buckets_(capacity) {
+    }
+
+    void FlowShaper::SetFlowRate(uint32_t kbps) {
+        flow_kbps_ = kbps;
+        flow_bytes_per_second_ = (kbps * 1000.0) / 8.0;
+        flow_burst_bytes_ = std::max(flow_bytes_per_second_ * std::chrono::duration<double>(BURST_TIME).count(),
+            MIN_BURST_BYTES);
+    }
+
+    void FlowShaper::SetSynRate(uint32_t per_second) {
+        if (per_second != syn_rate_) {
+            syn_rate_ = per_second;
+            syn_bucket_ = {};
+        }
+    }
+
+    bool FlowShaper::PoliceSyn(const SimulatedPacket& packet, Clock::time_point now) {
+        const PacketHeaders& headers = packet.headers;
+        if (syn_rate_ == 0 || !headers.IsTcp() || packet.prefix_length > 0) {
+            return true;
+        }
+
+        const auto bytes = packet.Bytes();
+        if (headers.l4_offset + 14u > bytes.size()) {
+            return true;
+        }
+        const uint8_t flags = bytes[headers.l4_offset + 13];
+        if ((flags & 0x12) != 0x02) {
+            return true;    // Only connection attempts: SYN set, ACK clear
+        }
+
+        // One token per connection, one second worth of burst
+        const double burst = std::max(1.0, static_cast<double>(syn_rate_));
+        if (!syn_bucket_.updated) {
+            syn_bucket_.tokens = burst;
+        }
+        else {
+            const double elapsed = std::chrono::duration<double>(now - *syn_bucket_.updated).count();
+            syn_bucket_.tokens = std::min(burst, syn_bucket_.tokens + elapsed * syn_rate_);
+        }
+        syn_bucket_.updated = now;
+
+        if (syn_bucket_.tokens < 1.0) {
+            ++syn_drops_;
+            return false;
+        }
+        syn_bucket_.tokens -= 1.0;
+        return true;
+    }
+
+    void FlowShaper::Refill(Bucket& bucket, Clock::time_point now) const {
+        if (!bucket.updated) {
+            bucket.tokens = flow_burst_bytes_;      // New flows start with a full burst
+        }
+        else {
+            const double elapsed = std::chrono::duration<double>(now - *bucket.updated).count();
+            bucket.tokens = std::min(flow_burst_bytes_, bucket.tokens + elapsed * flow_bytes_per_second_);
+        }
+        bucket.updated = now;
+    }
+
+    bool FlowShaper::Consume(Bucket& bucket, size_t bytes) const {
+        // Packets larger than the burst (super-packets) go once the bucket is full and leave it in debt
+        const double size = static_cast<double>(bytes);
+        if (bucket.tokens < std::min(size, flow_burst_bytes_)) {
+            return false;
+        }
+        bucket.tokens -= size;
+        return true;
+    }
+
+    void FlowShaper::Schedule(uint64_t key, const Backlog& backlog, Clock::time_point now) {
+        const double needed = std::min(static_cast<double>(backlog.packets.front().Size()), flow_burst_bytes_) -
+            backlog.bucket.tokens;
+        const double wait = flow_bytes_per_second_ > 0 ? std::max(needed, 0.0) / flow_bytes_per_second_ : 0.0;
+        ready_.emplace(now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wait)), key);
+    }
+
+    void FlowShaper::Admit(SimulatedPacket&& packet, Clock::time_point now, std::vector<SimulatedPacket>& out) {
+        if (!PoliceSyn(packet, now)) {
+            return;
+        }
+        if (flow_kbps_ == 0 || !packet.flow.IsValid()) {
+            out.push_back(std::move(packet));
+            return;
+        }
+
+        // A backlogged flow keeps FIFO order behind its queue
+        const uint64_t key = BacklogKey(packet.flow);
+        if (auto it = backlogs_.find(key); it != backlogs_.end()) {
+            Backlog& backlog = it->second;
+            if (backlog.packets.size() >= QUEUE_LIMIT) {
+                ++backlog.bucket.drops;
+                ++drops_;
+                return;
+            }
+            backlog.bytes += packet.Size();
+            backlog.packets.push_back(std::move(packet));
+            return;
+        }
+
+        Bucket& bucket = buckets_[packet.flow];
+        Refill(bucket, now);
+        if (Consume(bucket, packet.Size())) {
+            out.push_back(std::move(packet));
+            return;
+        }
+
+        Backlog& backlog = backlogs_[key];
+        backlog.handle = packet.flow;
+        backlog.key = FlowKey::FromPacket(packet.Bytes(), packet.headers, packet.addr.Outbound);
+        backlog.bucket = bucket;
+        backlog.bytes = packet.Size();
+        backlog.packets.push_back(std::move(packet));
+        Schedule(key, backlog, now);
+    }
+
+    void FlowShaper::Release(Clock::time_point now, std::vector<SimulatedPacket>& out) {
+        if (flow_kbps_ == 0) {
+            Flush(out);     // Cap switched off while flows were queued
+            return;
+        }
+
+        while (!ready_.empty() && ready_.top().first <= now) {
+            const uint64_t key = ready_.top().second;
+            ready_.pop();
+
+            auto it = backlogs_.find(key);
+            if (it == backlogs_.end()) {
+                continue;
+            }
+            Backlog& backlog = it->second;
+
+            Refill(backlog.bucket, now);
+            while (!backlog.packets.empty() && Consume(backlog.bucket, backlog.packets.front().Size())) {
+                backlog.bytes -= backlog.packets.front().Size();
+                out.push_back(std::move(backlog.packets.front()));
+                backlog.packets.pop_front();
+            }
+
+            if (backlog.packets.empty()) {
+                // Drained, the bucket goes back to the idle flow table unless the slot was evicted and
+                // reused meanwhile; writing through the stale handle would reset the new flow's bucket
+                if (Bucket* idle = buckets_.Find(backlog.handle)) {
+                    *idle = backlog.bucket;
+                }
+                backlogs_.erase(it);
+            }
+            else {
+                Schedule(key, backlog, now);
+            }
+        }
+    }
+
+    void FlowShaper::Flush(std::vector<SimulatedPacket>& out) {
+        for (auto& [key, backlog] : backlogs_) {
+            for (auto& packet : backlog.packets) {
+                out.push_back(std::move(packet));
+            }
+        }
+        backlogs_.clear();
+        ready_ = {};
+    }
+
+    std::vector<FlowShaper::FlowStats> FlowShaper::GetBacklog(size_t max_flows) const {
+        std::vector<FlowStats> stats;
+        stats.reserve(backlogs_.size());
+        for (const auto& [key, backlog] : backlogs_) {
+            stats.push_back({ backlog.key, backlog.packets.size(), backlog.bytes, backlog.bucket.drops });
+        }
+
+        const size_t count = std::min(max_flows, stats.size());
+        std::partial_sort(stats.begin(), stats.begin() + count, stats.end(),
+            [](const FlowStats& a, const FlowStats& b) { return a.queued_bytes > b.queued_bytes; });
+        stats.resize(count);
+        return stats;
+    }
+
+}
@@ -0,0 +1,106 @@
+#ifndef BADLINK_SRC_FLOW_SHAPER_H_
+#define BADLINK_SRC_FLOW_SHAPER_H_
+
+#include "flow_table.h"
+#include "simulation_module.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace BadLink {
+
+    // Per-flow rate caps and new-connection (SYN) policing
+    // Every flow has a token bucket in a PerFlow slot, refilled lazily from the elapsed time
+    // when the flow sends, so idle flows cost memory but no CPU
+    // Only flows over their cap get a queue and an entry in the ready-time heap, releases
+    // touch nothing but those backlogged flows
+    // Not thread-safe, BandwidthModule calls it under its bucket lock
+    class FlowShaper {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr size_t QUEUE_LIMIT = 256;                  // Packets queued per flow before tail drop
+        static constexpr std::chrono::milliseconds BURST_TIME{ 100 };
+        static constexpr double MIN_BURST_BYTES = 3000.0;           // Two full-size packets
+
+        explicit FlowShaper(size_t capacity = FlowTable::DEFAULT_CAPACITY);
+
+        // Cap in kilobits per second for every flow on its own, 0 disables
+        void SetFlowRate(uint32_t kbps);
+        uint32_t GetFlowRate() const { return flow_kbps_; }
+
+        // New TCP connections (SYN without ACK) allowed per second, excess SYNs are dropped, 0 disables
+        void SetSynRate(uint32_t per_second);
+        uint32_t GetSynRate() const { return syn_rate_; }
+
+        // Packets that may go on now are appended to `out`, the rest is queued or dropped
+        void Admit(SimulatedPacket&& packet, Clock::time_point now, std::vector<SimulatedPacket>& out);
+
+        // Queued packets whose flow has earned enough tokens by `now`
+        void Release(Clock::time_point now, std::vector<SimulatedPacket>& out);
+
+        // Everything still queued, in per-flow order
+        void Flush(std::vector<SimulatedPacket>& out);
+
+        bool HasBacklog() const { return !backlogs_.empty(); }
+
+        // Backlogged flows for the monitor, deepest queue first
+        struct FlowStats {
+            FlowKey key;
+            size_t queued_packets = 0;
+            size_t queued_bytes = 0;
+            uint64_t drops = 0;
+        };
+        std::vector<FlowStats> GetBacklog(size_t max_flows) const;
+
+        uint64_t GetDrops() const { return drops_; }
+        uint64_t GetSynDrops() const { return syn_drops_; }
+
+    private:
+        struct Bucket {
+            std::optional<Clock::time_point> updated;   // Empty until the flow sends for the first time
+            double tokens = 0;
+            uint64_t drops = 0;
+        };
+
+        // A flow over its cap carries its bucket here until the queue drains
+        struct Backlog {
+            FlowHandle handle;
+            FlowKey key;
+            Bucket bucket;
+            std::deque<SimulatedPacket> packets;
+            size_t bytes = 0;
+        };
+
+        using ReadyEntry = std::pair<Clock::time_point, uint64_t>;
+
+        uint32_t flow_kbps_ = 0;
+        double flow_bytes_per_second_ = 0;
+        double flow_burst_bytes_ = MIN_BURST_BYTES;
+
+        uint32_t syn_rate_ = 0;
+        Bucket syn_bucket_;
+
+        PerFlow<Bucket> buckets_;
+        std::unordered_map<uint64_t, Backlog> backlogs_;
+        std::priority_queue<ReadyEntry, std::vector<ReadyEntry>, std::greater<>> ready_;
+
+        uint64_t drops_ = 0;
+        uint64_t syn_drops_ = 0;
+
+        static uint64_t BacklogKey(FlowHandle handle) {
+            return (static_cast<uint64_t>(handle.index) << 32) | handle.generation;
+        }
+
+        bool PoliceSyn(const SimulatedPacket& packet, Clock::time_point now);
+        void Refill(Bucket& bucket, Clock::time_point now) const;
+        bool Consume(Bucket& bucket, size_t bytes) const;
+        void Schedule(uint64_t key, const Backlog& backlog, Clock::time_point now);
+    };
+
+}
+#endif  // BADLINK_SRC_FLOW_SHAPER_H_
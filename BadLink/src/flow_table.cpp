@@ -0,0 +1,335 @@
+#define NOMINMAX
+#include "flow_table.h"
+#include "cpu_features.h"
+#include "simulation_module.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace BadLink {
+
+    namespace {
+        // Reflected CRC32-C (Castagnoli) table for the portable path
+        constexpr std::array<uint32_t, 256> MakeCrc32cTable() {
+            std::array<uint32_t, 256> table{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0u);
+                }
+                table[i] = crc;
+            }
+            return table;
+        }
+
+        constexpr auto CRC32C_TABLE = MakeCrc32cTable();
+
+        // Payload bytes HashPacketContent looks at, enough to tell datagrams of equal length apart
+        constexpr size_t CONTENT_PAYLOAD_BYTES = 32;
+
+        uint32_t Crc32cScalar(const uint8_t* data, size_t length) {
+            uint32_t crc = 0xFFFFFFFFu;
+            for (size_t i = 0; i < length; ++i) {
+                crc = (crc >> 8) ^ CRC32C_TABLE[(crc ^ data[i]) & 0xFF];
+            }
+            return ~crc;
+        }
+
+#ifdef BADLINK_X64
+        BADLINK_TARGET("sse4.2")
+        uint32_t Crc32cSse42(const uint8_t* data, size_t length) {
+            uint64_t crc = 0xFFFFFFFFu;
+            size_t i = 0;
+            for (; i + 8 <= length; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+                crc = _mm_crc32_u64(crc, word);
+            }
+            for (; i < length; ++i) {
+                crc = _mm_crc32_u8(static_cast<uint32_t>(crc), data[i]);
+            }
+            return ~static_cast<uint32_t>(crc);
+        }
+#endif
+    }
+
+    FlowKey FlowKey::FromPacket(std::span<const uint8_t> packet, const PacketHeaders& headers, bool outbound) {
+        FlowKey key;
+        if (!headers.IsValid()) {
+            return key;
+        }
+
+        if (headers.ip_version == 4) {
+            std::memcpy(key.src_addr.data(), packet.data() + 12, 4);
+            std::memcpy(key.dst_addr.data(), packet.data() + 16, 4);
+        }
+        else {
+            std::memcpy(key.src_addr.data(), packet.data() + 8, 16);
+            std::memcpy(key.dst_addr.data(), packet.data() + 24, 16);
+        }
+
+        if ((headers.IsTcp() || headers.IsUdp()) && headers.l4_offset + 4u <= packet.size()) {
+            key.src_port = LoadBe16(packet.data() + headers.l4_offset);
+            key.dst_port = LoadBe16(packet.data() + headers.l4_offset + 2);
+        }
+
+        key.protocol = headers.protocol;
+        key.ip_version = headers.ip_version;
+        key.outbound = outbound ? 1 : 0;
+        return key;
+    }
+
+    uint32_t HashFlowKey(const FlowKey& key) {
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&key);
+#ifdef BADLINK_X64
+        if (CpuFeatures::HasSse42()) {
+            return Crc32cSse42(bytes, sizeof(key));
+        }
+#endif
+        return Crc32cScalar(bytes, sizeof(key));
+    }
+
+    uint64_t HashFlowKey64(const FlowKey& key) {
+        // Every word goes through the SplitMix64 finalizer, a bijection, chained over the key
+        std::array<uint64_t, sizeof(FlowKey) / sizeof(uint64_t)> words;
+        std::memcpy(words.data(), &key, sizeof(key));
+        uint64_t hash = GOLDEN_GAMMA;
+        for (const uint64_t word : words) {
+            hash = MixBits(hash ^ word);
+        }
+        return hash != 0 ? hash : 1;    // Stream 0 belongs to packets without a flow
+    }
+
+    uint64_t HashPacketContent(std::span<const uint8_t> packet, const PacketHeaders& headers) {
+        // Gathered into a zeroed block and hashed like a flow key, the total length goes first
+        std::array<uint64_t, 8> words{};
+        uint8_t* block = reinterpret_cast<uint8_t*>(words.data());
+        size_t used = sizeof(uint64_t);
+        words[0] = packet.size();
+        const auto take = [&](size_t offset, size_t length) {
+            if (offset < packet.size()) {
+                length = std::min({ length, packet.size() - offset, sizeof(words) - used });
+                std::memcpy(block + used, packet.data() + offset, length);
+                used += length;
+            }
+        };
+
+        if (!headers.IsValid()) {
+            take(0, sizeof(words));
+        }
+        else {
+            if (headers.ip_version == 4) {
+                take(4, 4);     // Identification, flags and fragment offset
+            }
+            if (headers.IsTcp()) {
+                take(headers.l4_offset + 4, 12);    // Sequence, acknowledgement, offset, flags, window
+            }
+            take(headers.payload_offset, CONTENT_PAYLOAD_BYTES);
+        }
+
+        uint64_t hash = GOLDEN_GAMMA;
+        for (const uint64_t word : words) {
+            hash = MixBits(hash ^ word);
+        }
+        return hash;
+    }
+
+    FlowTable::FlowTable(size_t capacity)
+        : capacity_(std::bit_ceil(std::max(capacity, PROBE_WINDOW)))
+        , mask_(capacity_ - 1)
+        , epoch_(std::chrono::steady_clock::now())
+        , meta_(capacity_)
+        , keys_(capacity_)
+        , streams_(capacity_)
+        , occurrences_(capacity_ * 2)
+        , incarnations_(capacity_ * 2) {
+    }
+
+    FlowHandle FlowTable::Acquire(const FlowKey& key, std::chrono::steady_clock::time_point now) {
+        std::lock_guard<ContendedMutex> lock(table_mutex_);
+        return AcquireLocked(key, ToMs(now));
+    }
+
+    void FlowTable::Classify(std::vector<SimulatedPacket>& packets, std::chrono::steady_clock::time_point now) {
+        const int64_t now_ms = ToMs(now);
+
+        std::lock_guard<ContendedMutex> lock(table_mutex_);
+        for (auto& packet : packets) {
+            packet.flow = AcquireLocked(
+                FlowKey::FromPacket(packet.Bytes(), packet.headers, packet.addr.Outbound), now_ms);
+
+            // Draws follow the packet's contents, not its position among the packets of its flow,
+            // which depends on how the flow was split across batches and threads
+            // Copies of the same content are told apart by occurrence, they are interchangeable
+            // so it does not matter which copy gets which count
+            const uint64_t stream = packet.flow.IsValid() ? streams_[packet.flow.index] : 0;
+            const uint64_t content = HashPacketContent(packet.Bytes(), packet.headers);
+            const uint32_t occurrence = CountOccurrenceLocked(occurrences_, MixBits(stream ^ content) | 1, now_ms);
+            packet.random_stream = { stream, MixBits(content + occurrence * GOLDEN_GAMMA) & ~(1ull << 63) };
+        }
+
+        // Idle eviction runs in small slices so no batch pays for a full sweep
+        ExpireLocked(now_ms, EXPIRE_SLICE);
+    }
+
+    size_t FlowTable::ExpireIdle(std::chrono::steady_clock::time_point now, size_t budget) {
+        std::lock_guard<ContendedMutex> lock(table_mutex_);
+        return ExpireLocked(ToMs(now), budget);
+    }
+
+    size_t FlowTable::ExpireLocked(int64_t now_ms, size_t budget) {
+        const int64_t timeout = idle_timeout_ms_.load();
+        size_t removed = 0;
+
+        for (size_t scanned = 0; scanned < budget; ++scanned) {
+            SlotMeta& meta = meta_[expire_cursor_];
+            if (IsOccupied(meta) && now_ms - meta.last_seen_ms > timeout) {
+                ++meta.generation;
+                ++removed;
+            }
+            expire_cursor_ = (expire_cursor_ + 1) & mask_;
+        }
+
+        active_flows_.fetch_sub(removed);
+        expirations_.fetch_add(removed);
+        return removed;
+    }
+
+    void FlowTable::Clear() {
+        std::lock_guard<ContendedMutex> lock(table_mutex_);
+        for (auto& meta : meta_) {
+            if (IsOccupied(meta)) {
+                ++meta.generation;
+            }
+        }
+        std::ranges::fill(occurrences_, Occurrence{});
+        std::ranges::fill(incarnations_, Occurrence{});
+        active_flows_.store(0);
+    }
+
+    bool FlowTable::IsCurrent(FlowHandle handle) const {
+        if (!handle.IsValid() || handle.index >= capacity_) {
+            return false;
+        }
+        std::lock_guard<ContendedMutex> lock(table_mutex_);
+        return meta_[handle.index].generation == handle.generation;
+    }
+
+    void FlowTable::SetIdleTimeout(std::chrono::milliseconds timeout) {
+        idle_timeout_ms_.store(timeout.count());
+    }
+
+    std::chrono::milliseconds FlowTable::GetIdleTimeout() const {
+        return std::chrono::milliseconds(idle_timeout_ms_.load());
+    }
+
+    size_t FlowTable::GetActiveFlows() const {
+        return active_flows_.load();
+    }
+
+    uint64_t FlowTable::GetEvictions() const {
+        return evictions_.load();
+    }
+
+    uint64_t FlowTable::GetExpirations() const {
+        return expirations_.load();
+    }
+
+    int64_t FlowTable::ToMs(std::chrono::steady_clock::time_point now) const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now - epoch_).count();
+    }
+
+    FlowHandle FlowTable::AcquireLocked(const FlowKey& key, int64_t now_ms) {
+        if (key.ip_version == 0) {
+            return {};
+        }
+
+        const uint32_t hash = HashFlowKey(key);
+        const size_t start = hash & mask_;
+        const int64_t timeout = idle_timeout_ms_.load();
+        size_t free_slot = capacity_;
+        size_t oldest_slot = capacity_;
+
+        // The whole window is always scanned, so freeing a slot needs no tombstone
+        for (size_t i = 0; i < PROBE_WINDOW; ++i) {
+            const size_t slot = (start + i) & mask_;
+            SlotMeta& meta = meta_[slot];
+
+            if (!IsOccupied(meta)) {
+                if (free_slot == capacity_) {
+                    free_slot = slot;
+                }
+                continue;
+            }
+            if (meta.hash == hash && keys_[slot] == key) {
+                if (now_ms - meta.last_seen_ms <= timeout) {
+                    meta.last_seen_ms = now_ms;
+                    return { static_cast<uint32_t>(slot), meta.generation };
+                }
+
+                // Idle past the timeout: expire it here whether or not the sweep got to it yet,
+                // so how many batches went by does not decide if the flow starts a new incarnation
+                ++meta.generation;
+                active_flows_.fetch_sub(1);
+                expirations_.fetch_add(1);
+                if (free_slot == capacity_) {
+                    free_slot = slot;
+                }
+                continue;
+            }
+            if (oldest_slot == capacity_ || meta.last_seen_ms < meta_[oldest_slot].last_seen_ms) {
+                oldest_slot = slot;
+            }
+        }
+
+        size_t slot = free_slot;
+        if (slot == capacity_) {
+            // Window full: replace the least recently seen flow, its handles go stale
+            slot = oldest_slot;
+            ++meta_[slot].generation;
+            active_flows_.fetch_sub(1);
+            evictions_.fetch_add(1);
+        }
+
+        SlotMeta& meta = meta_[slot];
+        ++meta.generation;
+        meta.hash = hash;
+        meta.last_seen_ms = now_ms;
+        keys_[slot] = key;
+
+        // A 5-tuple that comes back after eviction or expiry gets a new stream, or its packets
+        // would replay the draws of its last incarnation
+        // Counted per key, so the count follows the key's own history and not the slot it lands in
+        const uint64_t stream = HashFlowKey64(key);
+        const uint32_t incarnation = CountOccurrenceLocked(incarnations_, stream, now_ms);
+        streams_[slot] = incarnation == 0 ? stream : MixBits(stream + incarnation * GOLDEN_GAMMA) | 1;
+        active_flows_.fetch_add(1);
+        return { static_cast<uint32_t>(slot), meta.generation };
+    }
+
+    uint32_t FlowTable::CountOccurrenceLocked(std::vector<Occurrence>& table, uint64_t tag, int64_t now_ms) {
+        const size_t mask = table.size() - 1;
+        const size_t start = tag & mask;
+        size_t oldest_slot = start;
+
+        // Entries are never freed, so the tag cannot sit behind a free slot
+        for (size_t i = 0; i < PROBE_WINDOW; ++i) {
+            Occurrence& entry = table[(start + i) & mask];
+            if (entry.tag == tag) {
+                entry.last_seen_ms = now_ms;
+                return ++entry.count;
+            }
+            if (entry.tag == 0) {
+                oldest_slot = (start + i) & mask;
+                break;
+            }
+            if (entry.last_seen_ms < table[oldest_slot].last_seen_ms) {
+                oldest_slot = (start + i) & mask;
+            }
+        }
+
+        table[oldest_slot] = { tag, now_ms, 0 };
+        return 0;
+    }
+
+}
@@ -0,0 +1,167 @@
+#ifndef BADLINK_SRC_FLOW_TABLE_H_
+#define BADLINK_SRC_FLOW_TABLE_H_
+
+#include "packet_parser.h"
+#include "lock_stats.h"
+#include "random_utils.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace BadLink {
+
+    struct SimulatedPacket;
+
+    // 5-tuple plus direction, zero padded so it can be hashed and compared as raw words
+    struct FlowKey {
+        std::array<uint8_t, 16> src_addr{};     // IPv4 uses the first 4 bytes
+        std::array<uint8_t, 16> dst_addr{};
+        uint16_t src_port = 0;                  // 0 for protocols without ports and non-first fragments
+        uint16_t dst_port = 0;
+        uint8_t  protocol = 0;
+        uint8_t  ip_version = 0;
+        uint8_t  outbound = 0;
+        uint8_t  reserved = 0;
+
+        bool operator==(const FlowKey&) const = default;
+
+        // Extract the key from a parsed packet, ip_version stays 0 if the packet has none
+        static FlowKey FromPacket(std::span<const uint8_t> packet, const PacketHeaders& headers, bool outbound);
+    };
+    static_assert(sizeof(FlowKey) == 40, "FlowKey is hashed as five 64-bit words");
+
+    // Reference to a flow table slot, the generation detects slots reused by another flow
+    struct FlowHandle {
+        static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+        uint32_t index = INVALID_INDEX;
+        uint32_t generation = 0;
+
+        bool IsValid() const { return index != INVALID_INDEX; }
+    };
+
+    // CRC32-C of a flow key, SSE4.2 instruction when available
+    [[nodiscard]] uint32_t HashFlowKey(const FlowKey& key);
+
+    // 64-bit hash of a flow key, never 0, keys the flow's first random stream
+    // 32 bits would let flows collide at table capacity and share every random draw
+    [[nodiscard]] uint64_t HashFlowKey64(const FlowKey& key);
+
+    // Hash of what tells one packet of a flow from another: its length, the IPv4 ID and fragment
+    // field, TCP sequence, acknowledgement, flags and window, and the first payload bytes
+    // Keys the packet's random draws, so they follow the packet and not the order packets arrive in
+    [[nodiscard]] uint64_t HashPacketContent(std::span<const uint8_t> packet, const PacketHeaders& headers);
+
+    // Engine-wide flow table: open addressing over a fixed power-of-two array,
+    // a flow lives in one of PROBE_WINDOW consecutive slots after its hash
+    // Memory is bounded by the capacity, a full window evicts its least recently used flow
+    class FlowTable {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 65536;
+        static constexpr size_t PROBE_WINDOW = 8;
+
+        explicit FlowTable(size_t capacity = DEFAULT_CAPACITY);
+
+        // Look up or insert the flow, invalid handle if the key has no IP version
+        FlowHandle Acquire(const FlowKey& key, std::chrono::steady_clock::time_point now);
+
+        // Assign flow handles and random keys to a batch under one lock and expire a slice of idle slots
+        // A packet's key is its flow's stream and a sequence from HashPacketContent, so the same
+        // traffic gets the same draws however it is split across batches and worker threads
+        // Exact repeats (retransmissions, resent datagrams) are counted, each occurrence draws afresh
+        void Classify(std::vector<SimulatedPacket>& packets, std::chrono::steady_clock::time_point now);
+
+        // Scan up to `budget` slots for flows idle longer than the timeout, returns flows removed
+        size_t ExpireIdle(std::chrono::steady_clock::time_point now, size_t budget);
+
+        // Forget every flow, counted repeat and incarnation, their handles go stale
+        void Clear();
+
+        // True while the handle still refers to the flow it was issued for
+        bool IsCurrent(FlowHandle handle) const;
+
+        void SetIdleTimeout(std::chrono::milliseconds timeout);
+        std::chrono::milliseconds GetIdleTimeout() const;
+
+        size_t Capacity() const { return capacity_; }
+
+        // Statistics
+        size_t GetActiveFlows() const;
+        uint64_t GetEvictions() const;
+        uint64_t GetExpirations() const;
+
+    private:
+        static constexpr size_t EXPIRE_SLICE = 64;   // Slots scanned per classified batch
+
+        // Times a 64-bit tag was seen, open addressing like the flow slots
+        // Entries are never freed, a full window replaces its least recently seen tag
+        struct Occurrence {
+            uint64_t tag = 0;           // 0 while free
+            int64_t last_seen_ms = 0;
+            uint32_t count = 0;
+        };
+
+        // Hot metadata kept apart from the keys so a probe touches one or two cache lines
+        struct SlotMeta {
+            uint32_t hash = 0;
+            uint32_t generation = 0;    // Odd while occupied, even while free
+            int64_t last_seen_ms = 0;
+        };
+
+        const size_t capacity_;
+        const size_t mask_;
+        const std::chrono::steady_clock::time_point epoch_;
+
+        mutable ContendedMutex table_mutex_{ "Flow table" };
+        std::vector<SlotMeta> meta_;
+        std::vector<FlowKey> keys_;
+        std::vector<uint64_t> streams_;         // Per flow: stream from HashFlowKey64, packets without a flow use 0
+        std::vector<Occurrence> occurrences_;   // Exact repeats per stream and content hash
+        std::vector<Occurrence> incarnations_;  // Inserts per flow key, by HashFlowKey64
+        size_t expire_cursor_ = 0;
+
+        std::atomic<int64_t> idle_timeout_ms_{ 60000 };
+        std::atomic<size_t> active_flows_{ 0 };
+        std::atomic<uint64_t> evictions_{ 0 };
+        std::atomic<uint64_t> expirations_{ 0 };
+
+        int64_t ToMs(std::chrono::steady_clock::time_point now) const;
+        FlowHandle AcquireLocked(const FlowKey& key, int64_t now_ms);
+        size_t ExpireLocked(int64_t now_ms, size_t budget);
+        static uint32_t CountOccurrenceLocked(std::vector<Occurrence>& table, uint64_t tag, int64_t now_ms);     // 0 the first time
+        static bool IsOccupied(const SlotMeta& meta) { return (meta.generation & 1) != 0; }
+    };
+
+    // Per-flow state array indexed by flow handle, reset when a slot changes owner
+    // Size it with the table capacity, a lookup is one compare and an index
+    template <typename T>
+    class PerFlow {
+    public:
+        explicit PerFlow(size_t capacity = FlowTable::DEFAULT_CAPACITY)
+            : states_(capacity), generations_(capacity, 0) {
+        }
+
+        T& operator[](FlowHandle handle) {
+            if (generations_[handle.index] != handle.generation) {
+                states_[handle.index] = T{};
+                generations_[handle.index] = handle.generation;
+            }
+            return states_[handle.index];
+        }
+
+        // State stored for the handle's flow, nullptr once another flow took over the slot
+        T* Find(FlowHandle handle) {
+            return generations_[handle.index] == handle.generation ? &states_[handle.index] : nullptr;
+        }
+
+    private:
+        std::vector<T> states_;
+        std::vector<uint32_t> generations_;
+    };
+
+}
+#endif  // BADLINK_SRC_FLOW_TABLE_H_
@@ -0,0 +1,187 @@
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#include <iphlpapi.h>
+#include "gso.h"
+#include "checksum.h"
+#include <algorithm>
+#include <cstring>
+
+#pragma comment(lib, "iphlpapi.lib")
+
+namespace BadLink {
+    namespace Gso {
+
+        namespace {
+            constexpr uint8_t TCP_FLAG_FIN = 0x01;
+            constexpr uint8_t TCP_FLAG_PSH = 0x08;
+            constexpr uint8_t TCP_FLAG_CWR = 0x80;
+
+            size_t PayloadLength(std::span<const uint8_t> bytes, const PacketHeaders& headers) {
+                const size_t ip_length = headers.ip_version == 4 ?
+                    LoadBe16(bytes.data() + 2) : static_cast<size_t>(LoadBe16(bytes.data() + 4)) + 40;
+                const size_t length = std::min(ip_length, bytes.size());
+                return length > headers.payload_offset ? length - headers.payload_offset : 0;
+            }
+
+            // Transport checksum over a segment whose header lives in the prefix and payload in the slice
+            void WriteTransportChecksum(SimulatedPacket& segment, std::span<const uint8_t> payload) {
+                const PacketHeaders& headers = segment.headers;
+                uint8_t* header = segment.prefix.data();
+                uint8_t* field = header + headers.l4_offset + (headers.protocol == IpProtocol::TCP ? 16 : 6);
+                StoreBe16(field, 0);
+
+                const size_t l4_header_length = static_cast<size_t>(segment.prefix_length - headers.l4_offset);
+                const size_t l4_length = l4_header_length + payload.size();
+                uint64_t sum = headers.ip_version == 4 ?
+                    Checksum::Sum({ header + 12, 8 }) : Checksum::Sum({ header + 8, 32 });
+                sum += headers.protocol;
+                sum += l4_length;
+                sum = Checksum::Sum({ header + headers.l4_offset, l4_header_length }, sum);
+                sum = Checksum::Sum(payload, sum);
+
+                uint16_t result = static_cast<uint16_t>(~Checksum::Fold(sum));
+                if (headers.protocol == IpProtocol::UDP && result == 0) {
+                    result = 0xFFFF;
+                }
+                StoreBe16(field, result);
+            }
+        }
+
+        uint32_t InterfaceMtus::Get(uint32_t if_index, bool ipv6) {
+            const uint64_t key = (static_cast<uint64_t>(if_index) << 1) | (ipv6 ? 1 : 0);
+            std::lock_guard<ContendedMutex> lock(mutex_);
+            if (auto it = mtus_.find(key); it != mtus_.end()) {
+                return it->second;
+            }
+
+            MIB_IPINTERFACE_ROW row;
+            InitializeIpInterfaceEntry(&row);
+            row.Family = ipv6 ? AF_INET6 : AF_INET;
+            row.InterfaceIndex = if_index;
+            const uint32_t mtu = GetIpInterfaceEntry(&row) == NO_ERROR ? row.NlMtu : 0;
+            mtus_.emplace(key, mtu);
+            return mtu;
+        }
+
+        void Classify(SimulatedPacket& packet, uint32_t mtu, InterfaceMtus& interfaces) {
+            const PacketHeaders& headers = packet.headers;
+            if (!headers.IsTcp() || packet.addr.Loopback || packet.Size() <= mtu) {
+                return;
+            }
+
+            // Fits the adapter it came through: a real packet, not one offload coalesced
+            const uint32_t interface_mtu = interfaces.Get(packet.addr.Network.IfIdx, headers.ip_version == 6);
+            if (interface_mtu == 0 || packet.Size() <= interface_mtu) {
+                return;
+            }
+
+            // Headers must fit the inline prefix of a slice to be used as a template
+            if (headers.payload_offset > SimulatedPacket::MAX_PREFIX_LENGTH || mtu <= headers.payload_offset) {
+                return;
+            }
+
+            const size_t segment_payload = std::min<size_t>(mtu - headers.payload_offset, 0xFFFF);
+            if (PayloadLength(packet.Bytes(), headers) > segment_payload) {
+                packet.gso_size = static_cast<uint16_t>(segment_payload);
+            }
+        }
+
+        size_t SegmentCount(const SimulatedPacket& packet) {
+            if (packet.gso_size == 0) {
+                return 1;
+            }
+            const size_t payload = PayloadLength(packet.Bytes(), packet.headers);
+            return std::max<size_t>(1, (payload + packet.gso_size - 1) / packet.gso_size);
+        }
+
+        void Segment(SimulatedPacket&& packet, std::vector<SimulatedPacket>& output) {
+            if (packet.gso_size == 0) {
+                output.push_back(std::move(packet));
+                return;
+            }
+
+            // Super-packets are built at capture without a prefix, flatten anything else
+            if (packet.is_slice && packet.prefix_length > 0) {
+                packet.MutableData();
+            }
+
+            const PacketHeaders& headers = packet.headers;
+            const std::span<const uint8_t> bytes = packet.Bytes();
+            const size_t header_length = headers.payload_offset;
+            const size_t payload_length = PayloadLength(bytes, headers);
+            const size_t segment_payload = packet.gso_size;
+            const uint32_t ip_start = packet.is_slice ? packet.slice_offset : 0;
+            if (payload_length <= segment_payload) {
+                packet.gso_size = 0;
+                output.push_back(std::move(packet));
+                return;
+            }
+
+            const bool is_tcp = headers.protocol == IpProtocol::TCP;
+            const bool checksum_pending = is_tcp ? !packet.addr.TCPChecksum : !packet.addr.UDPChecksum;
+            const uint16_t ip_id = headers.ip_version == 4 ? LoadBe16(bytes.data() + 4) : 0;
+            const uint32_t sequence = is_tcp ? LoadBe32(bytes.data() + headers.l4_offset + 4) : 0;
+
+            for (size_t offset = 0, index = 0; offset < payload_length; offset += segment_payload, ++index) {
+                const size_t length = std::min(segment_payload, payload_length - offset);
+                const bool first = offset == 0;
+                const bool last = offset + length == payload_length;
+
+                SimulatedPacket segment;
+                segment.data = packet.data;
+                segment.addr = packet.addr;
+                segment.headers = headers;
+                segment.flow = packet.flow;
+                segment.modules = packet.modules;
+                segment.traffic_class = packet.traffic_class;
+                segment.link = packet.link;
+                segment.random_stream = packet.random_stream.Child(index);
+                segment.timestamp = packet.timestamp;
+                segment.release_time = packet.release_time;
+                segment.is_slice = true;
+                segment.prefix_length = static_cast<uint16_t>(header_length);
+                segment.slice_offset = static_cast<uint32_t>(ip_start + header_length + offset);
+                segment.slice_length = static_cast<uint32_t>(length);
+
+                // Header template patched per segment, the way the NIC would
+                uint8_t* header = segment.prefix.data();
+                std::memcpy(header, bytes.data(), header_length);
+                if (headers.ip_version == 4) {
+                    StoreBe16(header + 2, static_cast<uint16_t>(header_length + length));
+                    StoreBe16(header + 4, static_cast<uint16_t>(ip_id + index));
+                    const size_t ip_header_length = static_cast<size_t>(header[0] & 0x0F) * 4;
+                    StoreBe16(header + 10, 0);
+                    StoreBe16(header + 10, Checksum::Compute({ header, ip_header_length }));
+                    segment.addr.IPChecksum = 1;
+                }
+                else {
+                    StoreBe16(header + 4, static_cast<uint16_t>(header_length - 40 + length));
+                }
+
+                uint8_t* l4 = header + headers.l4_offset;
+                if (is_tcp) {
+                    StoreBe32(l4 + 4, sequence + static_cast<uint32_t>(offset));
+                    if (!last) {
+                        l4[13] &= static_cast<uint8_t>(~(TCP_FLAG_FIN | TCP_FLAG_PSH));
+                    }
+                    if (!first) {
+                        l4[13] &= static_cast<uint8_t>(~TCP_FLAG_CWR);
+                    }
+                }
+                else {
+                    StoreBe16(l4 + 4, static_cast<uint16_t>(header_length - headers.l4_offset + length));
+                }
+
+                // A pending checksum stays with the NIC's regular offload, a valid one is redone
+                if (!checksum_pending) {
+                    WriteTransportChecksum(segment, bytes.subspan(header_length + offset, length));
+                }
+
+                output.push_back(std::move(segment));
+            }
+        }
+
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef BADLINK_SRC_GSO_H_
+#define BADLINK_SRC_GSO_H_
+
+#include "lock_stats.h"
+#include "simulation_module.h"
+#include <unordered_map>
+#include <vector>
+
+namespace BadLink {
+    namespace Gso {
+
+        // MTUs of the adapters packets are captured on, looked up once per adapter and family
+        // A packet larger than its own adapter's MTU can only have come from offload (LSO on
+        // send, RSC on receive); anything else that big is a jumbo or loopback packet
+        class InterfaceMtus {
+        public:
+            // 0 when the adapter is unknown
+            uint32_t Get(uint32_t if_index, bool ipv6);
+
+        private:
+            ContendedMutex mutex_{ "Interface MTUs" };
+            std::unordered_map<uint64_t, uint32_t> mtus_;
+        };
+
+        // Mark a non-loopback TCP packet that offload coalesced as a super-packet when it is
+        // larger than the MTU, each wire segment carrying at most (mtu - headers) payload bytes
+        // UDP is never split, each datagram is one message to the application
+        void Classify(SimulatedPacket& packet, uint32_t mtu, InterfaceMtus& interfaces);
+
+        // Number of wire segments a packet stands for, 1 for normal packets
+        [[nodiscard]] size_t SegmentCount(const SimulatedPacket& packet);
+
+        // Split a super-packet into zero-copy slices of the original buffer, each with its own
+        // header built from the super-packet's template (length, IP ID, TCP sequence and flags)
+        // Normal packets are appended unchanged
+        void Segment(SimulatedPacket&& packet, std::vector<SimulatedPacket>& output);
+
+    }
+}
+#endif  // BADLINK_SRC_GSO_H_
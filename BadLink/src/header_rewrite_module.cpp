@@ -0,0 +1,265 @@
+#include "header_rewrite_module.h"
+#include "checksum.h"
+#include <algorithm>
+
+namespace BadLink {
+
+    namespace {
+        constexpr uint8_t TCP_FLAG_SYN = 0x02;
+        constexpr uint8_t TCP_OPTION_END = 0;
+        constexpr uint8_t TCP_OPTION_NOP = 1;
+        constexpr uint8_t TCP_OPTION_MSS = 2;
+
+        // Overwrite bytes covered by a checksum and patch it word by word, also when the
+        // bytes straddle a 16-bit boundary relative to the start of the checksummed area
+        void WriteWithChecksum(uint8_t* base, size_t size, size_t offset,
+            const uint8_t* bytes, size_t count, uint8_t* checksum_field) {
+
+            const size_t first_word = offset & ~static_cast<size_t>(1);
+            const size_t end_word = (offset + count + 1) & ~static_cast<size_t>(1);
+
+            // Odd trailing bytes are checksummed as if padded with zero
+            auto load_word = [&](size_t at) {
+                const uint8_t hi = base[at];
+                const uint8_t lo = at + 1 < size ? base[at + 1] : 0;
+                return static_cast<uint16_t>((hi << 8) | lo);
+            };
+
+            uint16_t old_words[4] = {};
+            for (size_t w = first_word, i = 0; w < end_word; w += 2, ++i) {
+                old_words[i] = load_word(w);
+            }
+
+            std::copy(bytes, bytes + count, base + offset);
+
+            if (checksum_field == nullptr) {
+                return;
+            }
+            for (size_t w = first_word, i = 0; w < end_word; w += 2, ++i) {
+                Checksum::AdjustField(checksum_field, old_words[i], load_word(w));
+            }
+        }
+    }
+
+    HeaderRewriteModule::HeaderRewriteModule() = default;
+    HeaderRewriteModule::~HeaderRewriteModule() = default;
+
+    void HeaderRewriteModule::SetHopDecrement(Direction direction, uint32_t hops) {
+        hop_decrement_[DirectionIndex(direction)].store(std::min(hops, 255u));
+    }
+
+    uint32_t HeaderRewriteModule::GetHopDecrement(Direction direction) const {
+        return hop_decrement_[DirectionIndex(direction)].load();
+    }
+
+    void HeaderRewriteModule::SetDscp(Direction direction, int dscp) {
+        dscp_[DirectionIndex(direction)].store(std::clamp(dscp, -1, 63));
+    }
+
+    int HeaderRewriteModule::GetDscp(Direction direction) const {
+        return dscp_[DirectionIndex(direction)].load();
+    }
+
+    void HeaderRewriteModule::SetMssClamp(Direction direction, uint32_t mss) {
+        mss_clamp_[DirectionIndex(direction)].store(std::min(mss, 65535u));
+    }
+
+    uint32_t HeaderRewriteModule::GetMssClamp(Direction direction) const {
+        return mss_clamp_[DirectionIndex(direction)].load();
+    }
+
+    uint64_t HeaderRewriteModule::GetRewrittenPackets() const {
+        return rewritten_packets_.load();
+    }
+
+    uint64_t HeaderRewriteModule::GetExpiredPackets() const {
+        return expired_packets_.load();
+    }
+
+    uint64_t HeaderRewriteModule::GetClampedSyns() const {
+        return clamped_syns_.load();
+    }
+
+    void HeaderRewriteModule::SetEnabled(bool enabled) {
+        enabled_.store(enabled);
+    }
+
+    bool HeaderRewriteModule::IsEnabled() const {
+        return enabled_.load();
+    }
+
+    void HeaderRewriteModule::SetInboundEnabled(bool enabled) {
+        inbound_enabled_.store(enabled);
+    }
+
+    void HeaderRewriteModule::SetOutboundEnabled(bool enabled) {
+        outbound_enabled_.store(enabled);
+    }
+
+    std::vector<SimulatedPacket> HeaderRewriteModule::ProcessBatch(
+        std::vector<SimulatedPacket>&& packets) {
+
+        if (!enabled_.load()) {
+            return std::move(packets);
+        }
+
+        const PerDirection<uint32_t> hop_decrements{ hop_decrement_[0].load(), hop_decrement_[1].load() };
+        const PerDirection<int> dscps{ dscp_[0].load(), dscp_[1].load() };
+        const PerDirection<uint32_t> mss_clamps{ mss_clamp_[0].load(), mss_clamp_[1].load() };
+        if (hop_decrements[0] == 0 && hop_decrements[1] == 0 && dscps[0] < 0 && dscps[1] < 0 &&
+            mss_clamps[0] == 0 && mss_clamps[1] == 0) {
+            return std::move(packets);
+        }
+
+        std::vector<SimulatedPacket> surviving_packets;
+        surviving_packets.reserve(packets.size());
+
+        for (auto&& packet : packets) {
+            const PacketHeaders& headers = packet.headers;
+            if (!ShouldProcess(packet) || !headers.IsValid()) {
+                surviving_packets.push_back(std::move(packet));
+                continue;
+            }
+
+            const size_t direction = DirectionIndex(packet);
+            const uint32_t hops = hop_decrements[direction];
+            const int dscp = dscps[direction];
+            const uint32_t mss = mss_clamps[direction];
+            const size_t mss_offset = mss > 0 ? FindMssToClamp(packet.Bytes(), headers, mss) : 0;
+            const bool ip_rewrite = hops > 0 || dscp >= 0;
+            if (!ip_rewrite && mss_offset == 0) {
+                surviving_packets.push_back(std::move(packet));
+                continue;
+            }
+
+            // Edits happen in place, only a buffer still shared with a duplicate gets copied
+            auto& data = packet.MutableData();
+
+            if (ip_rewrite) {
+                const bool alive = headers.ip_version == 4 ?
+                    RewriteIPv4(data.data(), packet.addr.IPChecksum, hops, dscp) :
+                    RewriteIPv6(data.data(), hops, dscp);
+                if (!alive) {
+                    // TTL exceeded in transit, dropped like a router would
+                    expired_packets_.fetch_add(1);
+                    continue;
+                }
+            }
+
+            if (mss_offset != 0) {
+                uint8_t value[2];
+                StoreBe16(value, static_cast<uint16_t>(mss));
+
+                // With checksum offload pending the NIC computes it from scratch
+                uint8_t* tcp = data.data() + headers.l4_offset;
+                WriteWithChecksum(tcp, data.size() - headers.l4_offset, mss_offset - headers.l4_offset,
+                    value, sizeof(value), packet.addr.TCPChecksum ? tcp + 16 : nullptr);
+                clamped_syns_.fetch_add(1);
+            }
+
+            rewritten_packets_.fetch_add(1);
+            surviving_packets.push_back(std::move(packet));
+        }
+
+        return surviving_packets;
+    }
+
+    std::vector<SimulatedPacket> HeaderRewriteModule::GetReleasablePackets() {
+        // Rewriting doesn't delay packets, so nothing to release
+        return {};
+    }
+
+    bool HeaderRewriteModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::HEADER_REWRITE) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
+        if (addr.Outbound && !outbound_enabled_.load()) {
+            return false;
+        }
+        if (!addr.Outbound && !inbound_enabled_.load()) {
+            return false;
+        }
+        return true;
+    }
+
+    size_t HeaderRewriteModule::FindMssToClamp(std::span<const uint8_t> data,
+        const PacketHeaders& headers, uint32_t mss) {
+
+        if (!headers.IsTcp() || headers.payload_offset < headers.l4_offset + 20) {
+            return 0;
+        }
+        if ((data[headers.l4_offset + 13] & TCP_FLAG_SYN) == 0) {
+            return 0;
+        }
+
+        // Walk the options between the fixed header and the payload
+        size_t i = headers.l4_offset + 20;
+        const size_t end = headers.payload_offset;
+        while (i < end) {
+            const uint8_t kind = data[i];
+            if (kind == TCP_OPTION_END) {
+                break;
+            }
+            if (kind == TCP_OPTION_NOP) {
+                ++i;
+                continue;
+            }
+            if (i + 1 >= end) {
+                break;
+            }
+
+            const uint8_t length = data[i + 1];
+            if (length < 2 || i + length > end) {
+                break;
+            }
+            if (kind == TCP_OPTION_MSS && length == 4) {
+                return LoadBe16(&data[i + 2]) > mss ? i + 2 : 0;
+            }
+            i += length;
+        }
+        return 0;
+    }
+
+    bool HeaderRewriteModule::RewriteIPv4(uint8_t* ip, bool checksum_valid, uint32_t hops, int dscp) {
+        // TTL shares a checksum word with the protocol, DSCP with version/IHL
+        uint8_t* checksum = checksum_valid ? ip + 10 : nullptr;
+
+        if (hops > 0) {
+            if (ip[8] <= hops) {
+                return false;
+            }
+            const uint8_t ttl = static_cast<uint8_t>(ip[8] - hops);
+            WriteWithChecksum(ip, 20, 8, &ttl, 1, checksum);
+        }
+
+        if (dscp >= 0) {
+            const uint8_t tos = static_cast<uint8_t>((dscp << 2) | (ip[1] & 0x03));  // Keep ECN bits
+            if (tos != ip[1]) {
+                WriteWithChecksum(ip, 20, 1, &tos, 1, checksum);
+            }
+        }
+        return true;
+    }
+
+    bool HeaderRewriteModule::RewriteIPv6(uint8_t* ip, uint32_t hops, int dscp) {
+        // IPv6 has no header checksum and neither field is in the pseudo-header
+        if (hops > 0) {
+            if (ip[7] <= hops) {
+                return false;
+            }
+            ip[7] = static_cast<uint8_t>(ip[7] - hops);
+        }
+
+        if (dscp >= 0) {
+            // Traffic class straddles the first two bytes: version(4) | class(8) | flow label(20)
+            const uint8_t traffic_class = static_cast<uint8_t>(((ip[0] & 0x0F) << 4) | (ip[1] >> 4));
+            const uint8_t remarked = static_cast<uint8_t>((dscp << 2) | (traffic_class & 0x03));
+            ip[0] = static_cast<uint8_t>((ip[0] & 0xF0) | (remarked >> 4));
+            ip[1] = static_cast<uint8_t>((ip[1] & 0x0F) | ((remarked & 0x0F) << 4));
+        }
+        return true;
+    }
+
+}
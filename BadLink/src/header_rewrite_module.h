@@ -0,0 +1,70 @@
+#ifndef BADLINK_SRC_HEADER_REWRITE_MODULE_H_
+#define BADLINK_SRC_HEADER_REWRITE_MODULE_H_
+
+#include "simulation_module.h"
+#include <atomic>
+
+namespace BadLink {
+
+    // Middlebox emulation: edits headers in the packet buffer and patches
+    // checksums incrementally, a rewrite costs a handful of stores
+    class HeaderRewriteModule : public SimulationModule {
+    public:
+        HeaderRewriteModule();
+        ~HeaderRewriteModule() override;
+
+        // Decrement IPv4 TTL / IPv6 hop limit by N (0 disables), packets reaching zero are dropped
+        void SetHopDecrement(Direction direction, uint32_t hops);
+        uint32_t GetHopDecrement(Direction direction) const;
+
+        // Remark DSCP (0-63), -1 keeps the original marking
+        void SetDscp(Direction direction, int dscp);
+        int GetDscp(Direction direction) const;
+
+        // Clamp the MSS option of TCP SYN packets (0 disables)
+        void SetMssClamp(Direction direction, uint32_t mss);
+        uint32_t GetMssClamp(Direction direction) const;
+
+        // Statistics
+        uint64_t GetRewrittenPackets() const;
+        uint64_t GetExpiredPackets() const;
+        uint64_t GetClampedSyns() const;
+
+        // Enable/disable the module
+        void SetEnabled(bool enabled);
+        bool IsEnabled() const override;
+
+        // Direction control
+        void SetInboundEnabled(bool enabled) override;
+        void SetOutboundEnabled(bool enabled) override;
+
+        // Process packets
+        std::vector<SimulatedPacket> ProcessBatch(
+            std::vector<SimulatedPacket>&& packets) override;
+        std::vector<SimulatedPacket> GetReleasablePackets() override;
+
+    private:
+        std::atomic<bool> enabled_{ false };
+        std::atomic<bool> inbound_enabled_{ true };
+        std::atomic<bool> outbound_enabled_{ true };
+        PerDirection<std::atomic<uint32_t>> hop_decrement_{ 0, 0 };
+        PerDirection<std::atomic<int>> dscp_{ -1, -1 };
+        PerDirection<std::atomic<uint32_t>> mss_clamp_{ 0, 0 };
+
+        std::atomic<uint64_t> rewritten_packets_{ 0 };
+        std::atomic<uint64_t> expired_packets_{ 0 };
+        std::atomic<uint64_t> clamped_syns_{ 0 };
+
+        bool ShouldProcess(const SimulatedPacket& packet) const;
+
+        // Offset of the MSS value in a SYN that needs clamping, 0 if none
+        static size_t FindMssToClamp(std::span<const uint8_t> data,
+            const PacketHeaders& headers, uint32_t mss);
+
+        // Returns false if the packet expired and must be dropped
+        static bool RewriteIPv4(uint8_t* ip, bool checksum_valid, uint32_t hops, int dscp);
+        static bool RewriteIPv6(uint8_t* ip, uint32_t hops, int dscp);
+    };
+
+}
+#endif  // BADLINK_SRC_HEADER_REWRITE_MODULE_H_
@@ -0,0 +1,396 @@
+#define NOMINMAX
+#include "htb_scheduler.h"
+#include "cidr.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <format>
+
+namespace BadLink {
+
+    namespace {
+        constexpr uint8_t NO_CLASS = 0xFF;
+        constexpr double MIN_BURST_BYTES = 3000.0;
+        constexpr double RATE_WINDOW_SECONDS = 1.0;
+
+        double BytesPerSecond(uint32_t kbps) {
+            return (kbps * 1000.0) / 8.0;
+        }
+
+        double BurstFor(double bytes_per_second) {
+            return std::max(bytes_per_second * std::chrono::duration<double>(HtbScheduler::BURST_TIME).count(),
+                MIN_BURST_BYTES);
+        }
+
+        std::optional<uint32_t> ParseDscpValue(std::string_view text) {
+            uint32_t value = 0;
+            const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (error != std::errc() || end != text.data() + text.size() || text.empty() || value > 63) {
+                return std::nullopt;
+            }
+            return value;
+        }
+
+        // "46, 32-47" as a 64-bit set
+        std::optional<uint64_t> ParseDscpSet(std::string_view text) {
+            uint64_t set = 0;
+            while (!text.empty()) {
+                const size_t comma = text.find(',');
+                const std::string_view item = TrimSpaces(text.substr(0, comma));
+                text.remove_prefix(comma == std::string_view::npos ? text.size() : comma + 1);
+                if (item.empty()) {
+                    continue;
+                }
+
+                const size_t dash = item.find('-');
+                const auto first = ParseDscpValue(TrimSpaces(item.substr(0, dash)));
+                const auto last = dash == std::string_view::npos ? first : ParseDscpValue(TrimSpaces(item.substr(dash + 1)));
+                if (!first || !last || *first > *last) {
+                    return std::nullopt;
+                }
+                for (uint32_t value = *first; value <= *last; ++value) {
+                    set |= uint64_t{ 1 } << value;
+                }
+            }
+            return set;
+        }
+
+        uint8_t DscpOf(const SimulatedPacket& packet) {
+            const uint8_t* ip = packet.is_slice && packet.prefix_length > 0 ? packet.prefix.data() : packet.Bytes().data();
+            if (ip == nullptr || packet.Size() < 2) {
+                return 0;
+            }
+            if ((ip[0] >> 4) == 6) {
+                return static_cast<uint8_t>((((ip[0] & 0x0F) << 4) | (ip[1] >> 4)) >> 2);
+            }
+            return static_cast<uint8_t>(ip[1] >> 2);
+        }
+    }
+
+    std::expected<void, std::string> HtbScheduler::Configure(const std::vector<TrafficClassConfig>& classes,
+        std::vector<SimulatedPacket>& flushed) {
+
+        if (classes.size() > MAX_CLASSES) {
+            return std::unexpected(std::format("Too many traffic classes ({}), the limit is {}", classes.size(), MAX_CLASSES));
+        }
+
+        std::vector<Class> built(classes.size());
+        std::array<uint8_t, 64> dscp_class;
+        dscp_class.fill(NO_CLASS);
+
+        for (size_t i = 0; i < classes.size(); ++i) {
+            const TrafficClassConfig& config = classes[i];
+            const std::string label = config.name.empty() ? std::format("#{}", i + 1) : config.name;
+
+            if (config.name.empty()) {
+                return std::unexpected(std::format("Traffic class {} needs a name", label));
+            }
+            for (size_t j = 0; j < i; ++j) {
+                if (classes[j].name == config.name) {
+                    return std::unexpected(std::format("Traffic class '{}' is defined twice", label));
+                }
+            }
+            if (config.priority >= PRIORITIES) {
+                return std::unexpected(std::format("Traffic class '{}': priority must be 0-{}", label, PRIORITIES - 1));
+            }
+            if (config.weight == 0 || config.weight > 100) {
+                return std::unexpected(std::format("Traffic class '{}': weight must be 1-100", label));
+            }
+            const uint32_t ceil_kbps = config.ceil_kbps == 0 ? config.rate_kbps : config.ceil_kbps;
+            if (ceil_kbps == 0) {
+                return std::unexpected(std::format("Traffic class '{}' needs a rate or a ceil", label));
+            }
+            if (ceil_kbps < config.rate_kbps) {
+                return std::unexpected(std::format("Traffic class '{}': ceil is below the rate", label));
+            }
+
+            const auto dscp = ParseDscpSet(config.dscp);
+            if (!dscp) {
+                return std::unexpected(std::format("Traffic class '{}': invalid DSCP list '{}'", label, config.dscp));
+            }
+            // First class claiming a DSCP value keeps it
+            for (uint64_t bits = *dscp; bits; bits &= bits - 1) {
+                uint8_t& owner = dscp_class[std::countr_zero(bits)];
+                if (owner == NO_CLASS) {
+                    owner = static_cast<uint8_t>(i);
+                }
+            }
+
+            Class& cls = built[i];
+            cls.config = config;
+            cls.config.ceil_kbps = ceil_kbps;
+            cls.rate.bytes_per_second = BytesPerSecond(config.rate_kbps);
+            cls.rate.burst = BurstFor(cls.rate.bytes_per_second);
+            cls.rate.tokens = config.rate_kbps ? cls.rate.burst : 0;
+            cls.ceil.bytes_per_second = BytesPerSecond(ceil_kbps);
+            cls.ceil.burst = BurstFor(cls.ceil.bytes_per_second);
+            cls.ceil.tokens = cls.ceil.burst;
+            cls.quantum = config.weight * QUANTUM_BYTES;
+        }
+
+        Flush(flushed);
+        classes_ = std::move(built);
+        dscp_class_ = dscp_class;
+        cursor_ = {};
+        return {};
+    }
+
+    void HtbScheduler::SetLinkRate(uint32_t kbps) {
+        link_.bytes_per_second = BytesPerSecond(kbps);
+        link_.burst = BurstFor(link_.bytes_per_second);
+        link_.tokens = std::min(link_.tokens, link_.burst);
+    }
+
+    void HtbScheduler::ChargeLink(double bytes) {
+        if (IsActive() && link_.bytes_per_second > 0) {
+            link_.tokens = std::max(link_.tokens - bytes, -link_.burst);
+        }
+    }
+
+    size_t HtbScheduler::ClassOf(const SimulatedPacket& packet) const {
+        if (packet.traffic_class != 0 && packet.traffic_class <= classes_.size()) {
+            return packet.traffic_class - 1u;   // Picked by a traffic rule
+        }
+        const uint8_t owner = dscp_class_[DscpOf(packet)];
+        return owner != NO_CLASS ? owner : classes_.size() - 1;
+    }
+
+    void HtbScheduler::Refill(Bucket& bucket, double seconds) {
+        bucket.tokens = std::min(bucket.burst, bucket.tokens + seconds * bucket.bytes_per_second);
+    }
+
+    void HtbScheduler::RefillClass(Class& cls, Clock::time_point now) {
+        if (cls.updated) {
+            const double seconds = std::chrono::duration<double>(now - *cls.updated).count();
+            Refill(cls.rate, seconds);
+            Refill(cls.ceil, seconds);
+        }
+        cls.updated = now;
+    }
+
+    const SimulatedPacket& HtbScheduler::Head(const Class& cls) const {
+        return cls.flows.at(cls.turn.front()).front();
+    }
+
+    SimulatedPacket HtbScheduler::PopHead(Class& cls) {
+        const uint64_t flow = cls.turn.front();
+        cls.turn.pop_front();
+
+        auto it = cls.flows.find(flow);
+        SimulatedPacket packet = std::move(it->second.front());
+        it->second.pop_front();
+        if (it->second.empty()) {
+            cls.flows.erase(it);
+        }
+        else {
+            cls.turn.push_back(flow);
+        }
+
+        --cls.backlog_packets;
+        cls.backlog_bytes -= packet.Size();
+        --backlog_packets_;
+        return packet;
+    }
+
+    void HtbScheduler::SetColor(uint32_t index, Color color) {
+        Class& cls = classes_[index];
+        const size_t priority = cls.config.priority;
+        const uint32_t bit = 1u << index;
+
+        green_[priority] &= ~bit;
+        yellow_[priority] &= ~bit;
+        if (color == Color::Green) {
+            green_[priority] |= bit;
+        }
+        else if (color == Color::Yellow) {
+            yellow_[priority] |= bit;
+        }
+
+        const uint8_t level = static_cast<uint8_t>(1u << priority);
+        green_levels_ = green_[priority] ? (green_levels_ | level) : (green_levels_ & ~level);
+        yellow_levels_ = yellow_[priority] ? (yellow_levels_ | level) : (yellow_levels_ & ~level);
+        cls.color = color;
+    }
+
+    void HtbScheduler::UpdateColor(uint32_t index, Clock::time_point now) {
+        Class& cls = classes_[index];
+        ++cls.event;    // Any pending wakeup is superseded
+        RefillClass(cls, now);
+
+        if (cls.backlog_packets == 0) {
+            cls.deficit = 0;
+            SetColor(index, Color::Idle);
+            return;
+        }
+
+        const double size = static_cast<double>(Head(cls).Size());
+        const double ceil_needed = std::min(size, cls.ceil.burst);
+        const double rate_needed = std::min(size, cls.rate.burst);
+
+        auto wake_in = [&](const Bucket& bucket, double needed) {
+            const double seconds = (needed - bucket.tokens) / bucket.bytes_per_second;
+            wakeups_.push({ now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)),
+                index, cls.event });
+        };
+
+        if (cls.ceil.tokens < ceil_needed) {
+            SetColor(index, Color::Red);
+            wake_in(cls.ceil, ceil_needed);
+        }
+        else if (cls.rate.bytes_per_second > 0 && cls.rate.tokens >= rate_needed) {
+            SetColor(index, Color::Green);
+        }
+        else {
+            SetColor(index, Color::Yellow);
+            if (cls.rate.bytes_per_second > 0) {
+                wake_in(cls.rate, rate_needed);     // Back to green once its own tokens suffice
+            }
+        }
+    }
+
+    uint32_t HtbScheduler::PickClass(uint32_t mask, size_t priority) {
+        // Deficit round robin: the class at the cursor sends while its deficit covers its head
+        // packet, otherwise it earns a quantum and the turn passes on
+        while (true) {
+            const uint32_t cursor = cursor_[priority];
+            const uint32_t ahead = cursor < 32 ? mask & (~0u << cursor) : 0;
+            const uint32_t index = static_cast<uint32_t>(std::countr_zero(ahead ? ahead : mask));
+
+            Class& cls = classes_[index];
+            if (cls.deficit >= static_cast<int64_t>(Head(cls).Size())) {
+                cursor_[priority] = index;
+                return index;
+            }
+            cls.deficit += cls.quantum;
+            cursor_[priority] = index + 1;
+        }
+    }
+
+    bool HtbScheduler::Enqueue(SimulatedPacket&& packet, Clock::time_point now) {
+        const uint32_t index = static_cast<uint32_t>(ClassOf(packet));
+        Class& cls = classes_[index];
+        if (cls.backlog_packets >= QUEUE_LIMIT) {
+            ++cls.drops;
+            return false;
+        }
+
+        const uint64_t flow = packet.flow.IsValid() ?
+            (static_cast<uint64_t>(packet.flow.index) << 32) | packet.flow.generation : UINT64_MAX;
+        auto& queue = cls.flows[flow];
+        if (queue.empty()) {
+            cls.turn.push_back(flow);
+        }
+        cls.backlog_bytes += packet.Size();
+        ++cls.backlog_packets;
+        ++backlog_packets_;
+        queue.push_back(std::move(packet));
+
+        if (cls.color == Color::Idle) {
+            UpdateColor(index, now);
+        }
+        return true;
+    }
+
+    void HtbScheduler::Dequeue(Clock::time_point now, std::vector<SimulatedPacket>& out) {
+        while (!wakeups_.empty() && wakeups_.top().time <= now) {
+            const Wakeup wakeup = wakeups_.top();
+            wakeups_.pop();
+            if (wakeup.class_index < classes_.size() && classes_[wakeup.class_index].event == wakeup.event) {
+                UpdateColor(wakeup.class_index, now);
+            }
+        }
+
+        const bool link_limited = link_.bytes_per_second > 0;
+        if (link_limited) {
+            if (link_updated_) {
+                Refill(link_, std::chrono::duration<double>(now - *link_updated_).count());
+            }
+            else {
+                link_.tokens = link_.burst;
+            }
+            link_updated_ = now;
+        }
+
+        while (green_levels_ || yellow_levels_) {
+            // Own-rate traffic of every priority goes before any borrowing
+            const bool borrowing = green_levels_ == 0;
+            const size_t priority = static_cast<size_t>(std::countr_zero(borrowing ? yellow_levels_ : green_levels_));
+            const uint32_t mask = borrowing ? yellow_[priority] : green_[priority];
+            const uint32_t index = PickClass(mask, priority);
+            Class& cls = classes_[index];
+
+            const double size = static_cast<double>(Head(cls).Size());
+            if (link_limited && link_.tokens < std::min(size, link_.burst)) {
+                break;  // Link busy, the next release tick retries
+            }
+
+            SimulatedPacket packet = PopHead(cls);
+            cls.deficit -= static_cast<int64_t>(size);
+            // Borrowed bytes are paid from the ceil only, as in Linux HTB, so a borrower keeps
+            // its guaranteed rate once the link gets busy
+            if (!borrowing) {
+                cls.rate.tokens -= size;
+            }
+            cls.ceil.tokens -= size;
+            if (link_limited) {
+                link_.tokens -= size;
+            }
+
+            // Exponential moving average of the sending rate
+            if (cls.rate_updated) {
+                const double elapsed = std::chrono::duration<double>(now - *cls.rate_updated).count();
+                cls.average_rate *= std::exp(-elapsed / RATE_WINDOW_SECONDS);
+            }
+            cls.average_rate += size / RATE_WINDOW_SECONDS;
+            cls.rate_updated = now;
+
+            ++cls.sent_packets;
+            cls.sent_bytes += static_cast<uint64_t>(size);
+            if (borrowing) {
+                cls.borrowed_bytes += static_cast<uint64_t>(size);
+            }
+
+            out.push_back(std::move(packet));
+            UpdateColor(index, now);
+        }
+    }
+
+    void HtbScheduler::Flush(std::vector<SimulatedPacket>& out) {
+        for (size_t i = 0; i < classes_.size(); ++i) {
+            Class& cls = classes_[i];
+            while (cls.backlog_packets != 0) {
+                out.push_back(PopHead(cls));
+            }
+            cls.deficit = 0;
+            ++cls.event;
+            SetColor(static_cast<uint32_t>(i), Color::Idle);
+        }
+        wakeups_ = {};
+    }
+
+    std::vector<HtbScheduler::ClassStats> HtbScheduler::GetStats(Clock::time_point now) const {
+        std::vector<ClassStats> stats;
+        stats.reserve(classes_.size());
+        for (const Class& cls : classes_) {
+            ClassStats& entry = stats.emplace_back();
+            entry.name = cls.config.name;
+            entry.priority = cls.config.priority;
+            entry.rate_kbps = cls.config.rate_kbps;
+            entry.ceil_kbps = cls.config.ceil_kbps;
+            double rate = cls.average_rate;
+            if (cls.rate_updated) {
+                rate *= std::exp(-std::chrono::duration<double>(now - *cls.rate_updated).count() / RATE_WINDOW_SECONDS);
+            }
+            entry.current_kbps = rate * 8.0 / 1000.0;
+            entry.sent_packets = cls.sent_packets;
+            entry.sent_bytes = cls.sent_bytes;
+            entry.borrowed_bytes = cls.borrowed_bytes;
+            entry.drops = cls.drops;
+            entry.backlog_packets = cls.backlog_packets;
+            entry.backlog_bytes = cls.backlog_bytes;
+        }
+        return stats;
+    }
+
+}
@@ -0,0 +1,149 @@
+#ifndef BADLINK_SRC_HTB_SCHEDULER_H_
+#define BADLINK_SRC_HTB_SCHEDULER_H_
+
+#include "simulation_module.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <optional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace BadLink {
+
+    // Traffic class as written by the user (TOML or UI)
+    struct TrafficClassConfig {
+        std::string name;
+        uint8_t priority = 4;       // 0 is served first, up to HtbScheduler::PRIORITIES - 1
+        uint32_t rate_kbps = 1000;  // Guaranteed rate
+        uint32_t ceil_kbps = 0;     // Rate reachable by borrowing unused link capacity, 0 = rate
+        uint32_t weight = 1;        // Share among classes of the same priority
+        std::string dscp;           // "46" or "32-47, 10", empty claims no DSCP
+    };
+
+    // HTB-style link sharing: link -> classes -> flows
+    // A class under its rate is green and sends on its own tokens, one over its rate but under
+    // its ceil is yellow and borrows link capacity, one over its ceil waits
+    // Green classes go first, then yellow ones, each by strict priority and within a priority
+    // by deficit round robin on their weights, flows inside a class take turns
+    // The backlogged classes of every priority and color sit in 32-bit masks, so picking the
+    // next class is a couple of bit scans regardless of how many classes exist
+    // Not thread-safe, BandwidthModule calls it under its bucket lock
+    class HtbScheduler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr size_t MAX_CLASSES = 32;
+        static constexpr size_t PRIORITIES = 8;
+        static constexpr size_t QUEUE_LIMIT = 1000;             // Packets per class before tail drop
+        static constexpr uint32_t QUANTUM_BYTES = 1514;         // DRR quantum per unit of weight
+        static constexpr std::chrono::milliseconds BURST_TIME{ 50 };
+
+        struct ClassStats {
+            std::string name;
+            uint8_t priority = 0;
+            uint32_t rate_kbps = 0;
+            uint32_t ceil_kbps = 0;
+            double current_kbps = 0;        // Moving average over about a second
+            uint64_t sent_packets = 0;
+            uint64_t sent_bytes = 0;
+            uint64_t borrowed_bytes = 0;    // Sent while over the guaranteed rate
+            uint64_t drops = 0;
+            size_t backlog_packets = 0;
+            size_t backlog_bytes = 0;
+        };
+
+        // Validate and install classes, queued packets of the old set are handed back in `flushed`
+        // Traffic no class claims goes to the last class
+        std::expected<void, std::string> Configure(const std::vector<TrafficClassConfig>& classes,
+            std::vector<SimulatedPacket>& flushed);
+
+        // Link rate all classes share, 0 = unlimited
+        void SetLinkRate(uint32_t kbps);
+
+        // Bytes something outside the classes sent on the link
+        void ChargeLink(double bytes);
+
+        bool IsActive() const { return !classes_.empty(); }
+        bool HasBacklog() const { return backlog_packets_ != 0; }
+
+        // Queue a packet in its class, false if the class queue was full and it was dropped
+        bool Enqueue(SimulatedPacket&& packet, Clock::time_point now);
+
+        // Send everything the link and the class buckets allow at `now`
+        void Dequeue(Clock::time_point now, std::vector<SimulatedPacket>& out);
+
+        void Flush(std::vector<SimulatedPacket>& out);
+
+        std::vector<ClassStats> GetStats(Clock::time_point now) const;
+
+    private:
+        enum class Color : uint8_t { Idle, Green, Yellow, Red };
+
+        struct Bucket {
+            double bytes_per_second = 0;
+            double burst = 0;
+            double tokens = 0;
+        };
+
+        struct Class {
+            TrafficClassConfig config;
+            Bucket rate;
+            Bucket ceil;
+            std::optional<Clock::time_point> updated;       // Empty until the first refill
+            uint32_t quantum = QUANTUM_BYTES;
+            int64_t deficit = 0;
+            Color color = Color::Idle;
+            uint32_t event = 0;             // Stale wakeups carry an older number
+
+            // Flows take turns: one packet from the flow at the front, then it goes to the back
+            std::unordered_map<uint64_t, std::deque<SimulatedPacket>> flows;
+            std::deque<uint64_t> turn;
+            size_t backlog_packets = 0;
+            size_t backlog_bytes = 0;
+
+            uint64_t sent_packets = 0;
+            uint64_t sent_bytes = 0;
+            uint64_t borrowed_bytes = 0;
+            uint64_t drops = 0;
+            double average_rate = 0;        // Bytes per second
+            std::optional<Clock::time_point> rate_updated;
+        };
+
+        // Time a class becomes eligible again: yellow to green or red to yellow
+        struct Wakeup {
+            Clock::time_point time;
+            uint32_t class_index;
+            uint32_t event;
+            bool operator>(const Wakeup& other) const { return time > other.time; }
+        };
+
+        std::vector<Class> classes_;
+        std::array<uint8_t, 64> dscp_class_{};          // Class index per DSCP value
+        std::array<uint32_t, PRIORITIES> green_{};      // Backlogged classes per priority
+        std::array<uint32_t, PRIORITIES> yellow_{};
+        uint8_t green_levels_ = 0;                      // Priorities with a green class
+        uint8_t yellow_levels_ = 0;
+        std::array<uint32_t, PRIORITIES> cursor_{};     // DRR position per priority
+        std::priority_queue<Wakeup, std::vector<Wakeup>, std::greater<>> wakeups_;
+
+        Bucket link_;
+        std::optional<Clock::time_point> link_updated_;
+        size_t backlog_packets_ = 0;
+
+        size_t ClassOf(const SimulatedPacket& packet) const;
+        static void Refill(Bucket& bucket, double seconds);
+        void RefillClass(Class& cls, Clock::time_point now);
+        void UpdateColor(uint32_t index, Clock::time_point now);
+        void SetColor(uint32_t index, Color color);
+        uint32_t PickClass(uint32_t mask, size_t priority);
+        SimulatedPacket PopHead(Class& cls);
+        const SimulatedPacket& Head(const Class& cls) const;
+    };
+
+}
+#endif  // BADLINK_SRC_HTB_SCHEDULER_H_
@@ -1,28 +1,25 @@
 #define NOMINMAX
 #include "jitter_module.h"
 #include <chrono>
-#include <random>
 #include <mutex>
 #include <queue>
 
 namespace BadLink {
 
-    thread_local std::mt19937 JitterModule::rng_{ std::random_device{}() };
-
     JitterModule::JitterModule() = default;
     JitterModule::~JitterModule() = default;
 
-    void JitterModule::SetJitterRange(uint32_t min_ms, uint32_t max_ms) {
-        min_jitter_ms_.store(std::min(min_ms, max_ms));
-        max_jitter_ms_.store(std::max(min_ms, max_ms));
+    void JitterModule::SetJitterRange(Direction direction, uint32_t min_ms, uint32_t max_ms) {
+        min_jitter_ms_[DirectionIndex(direction)].store(std::min(min_ms, max_ms));
+        max_jitter_ms_[DirectionIndex(direction)].store(std::max(min_ms, max_ms));
     }
 
-    uint32_t JitterModule::GetMinJitter() const {
-        return min_jitter_ms_.load();
+    uint32_t JitterModule::GetMinJitter(Direction direction) const {
+        return min_jitter_ms_[DirectionIndex(direction)].load();
     }
 
-    uint32_t JitterModule::GetMaxJitter() const {
-        return max_jitter_ms_.load();
+    uint32_t JitterModule::GetMaxJitter(Direction direction) const {
+        return max_jitter_ms_[DirectionIndex(direction)].load();
     }
 
     void JitterModule::SetEnabled(bool enabled) {
@@ -41,6 +38,10 @@ namespace BadLink {
         outbound_enabled_.store(enabled);
     }
 
+    void JitterModule::SetReleaseSlot(std::chrono::microseconds slot) {
+        release_slot_.store(slot);
+    }
+
     std::vector<SimulatedPacket> JitterModule::ProcessBatch(
         std::vector<SimulatedPacket>&& packets) {
 
@@ -49,17 +50,22 @@ namespace BadLink {
         }
 
         std::vector<SimulatedPacket> immediate_packets;
-        const auto current_time = std::chrono::steady_clock::now();
+        const auto current_time = Now();
+        const auto slot = release_slot_.load();
+        const PerDirection<uint32_t> min_ms{ min_jitter_ms_[0].load(), min_jitter_ms_[1].load() };
+        const PerDirection<uint32_t> max_ms{ max_jitter_ms_[0].load(), max_jitter_ms_[1].load() };
 
         for (auto&& packet : packets) {
-            if (ShouldProcess(packet.addr)) {
-                // Apply jitter delay between min and max milliseconds
-                uint32_t jitter_ms = GenerateJitter();
+            if (ShouldProcess(packet)) {
+                // Apply jitter delay between min and max milliseconds of the packet's direction
+                const size_t direction = DirectionIndex(packet);
+                uint32_t jitter_ms = RandomStream(RandomDomain::Jitter, packet.random_stream)
+                    .Between(min_ms[direction], max_ms[direction]);
                 std::chrono::milliseconds delay(jitter_ms);
 
-                packet.release_time = current_time + delay;
+                packet.release_time = AlignToSlot(current_time + delay, slot);
 
-                std::lock_guard<std::mutex> lock(buffer_mutex_);
+                std::lock_guard<ContendedMutex> lock(buffer_mutex_);
                 delayed_packets_.push(std::move(packet));
             }
             else {
@@ -74,7 +80,7 @@ namespace BadLink {
         std::vector<SimulatedPacket> ready_packets;
 
         if (!enabled_.load()) {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            std::lock_guard<ContendedMutex> lock(buffer_mutex_);
             while (!delayed_packets_.empty()) {
                 ready_packets.push_back(std::move(const_cast<SimulatedPacket&>(delayed_packets_.top())));
                 delayed_packets_.pop();
@@ -82,9 +88,9 @@ namespace BadLink {
             return ready_packets;
         }
 
-        const auto current_time = std::chrono::steady_clock::now();
+        const auto current_time = Now();
 
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        std::lock_guard<ContendedMutex> lock(buffer_mutex_);
         while (!delayed_packets_.empty() && delayed_packets_.top().release_time <= current_time) {
             ready_packets.push_back(std::move(const_cast<SimulatedPacket&>(delayed_packets_.top())));
             delayed_packets_.pop();
@@ -93,7 +99,12 @@ namespace BadLink {
         return ready_packets;
     }
 
-    bool JitterModule::ShouldProcess(const WINDIVERT_ADDRESS& addr) const {
+    bool JitterModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::JITTER) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
         if (addr.Outbound && !outbound_enabled_.load()) {
             return false;
         }
@@ -103,16 +114,4 @@ namespace BadLink {
         return true;
     }
 
-    uint32_t JitterModule::GenerateJitter() const {
-        const uint32_t min_ms = min_jitter_ms_.load();
-        const uint32_t max_ms = max_jitter_ms_.load();
-
-        if (min_ms == max_ms) {
-            return min_ms;
-        }
-
-        std::uniform_int_distribution<uint32_t> dist(min_ms, max_ms);
-        return dist(rng_);
-    }
-
 }
\ No newline at end of file
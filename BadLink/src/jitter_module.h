@@ -2,10 +2,12 @@
 #define BADLINK_SRC_JITTER_MODULE_H_
 
 #include "simulation_module.h"
+#include "random_utils.h"
+#include "release_slots.h"
+#include "lock_stats.h"
 #include <atomic>
 #include <mutex>
 #include <queue>
-#include <random>
 #include <chrono>
 
 namespace BadLink {
@@ -16,9 +18,12 @@ namespace BadLink {
         ~JitterModule() override;
 
         // Set jitter range in milliseconds
-        void SetJitterRange(uint32_t min_ms, uint32_t max_ms);
-        uint32_t GetMinJitter() const;
-        uint32_t GetMaxJitter() const;
+        void SetJitterRange(Direction direction, uint32_t min_ms, uint32_t max_ms);
+        uint32_t GetMinJitter(Direction direction) const;
+        uint32_t GetMaxJitter(Direction direction) const;
+
+        // Round release times up to slot boundaries, 0 disables
+        void SetReleaseSlot(std::chrono::microseconds slot);
 
         // Enable/disable the module
         void SetEnabled(bool enabled);
@@ -37,8 +42,9 @@ namespace BadLink {
         std::atomic<bool> enabled_{ false };
         std::atomic<bool> inbound_enabled_{ true };
         std::atomic<bool> outbound_enabled_{ true };
-        std::atomic<uint32_t> min_jitter_ms_{ 0 };
-        std::atomic<uint32_t> max_jitter_ms_{ 50 };
+        PerDirection<std::atomic<uint32_t>> min_jitter_ms_{ 0, 0 };
+        PerDirection<std::atomic<uint32_t>> max_jitter_ms_{ 50, 50 };
+        std::atomic<std::chrono::microseconds> release_slot_{ std::chrono::microseconds::zero() };
 
         // Priority queue for delayed packets
         struct PacketComparator {
@@ -47,15 +53,11 @@ namespace BadLink {
             }
         };
 
-        mutable std::mutex buffer_mutex_;
+        mutable ContendedMutex buffer_mutex_{ "Jitter queue" };
         std::priority_queue<SimulatedPacket, std::vector<SimulatedPacket>, PacketComparator> delayed_packets_;
 
-        // Thread-local random generator
-        thread_local static std::mt19937 rng_;
-
         static uint64_t GetCurrentTimeNs();
-        bool ShouldProcess(const WINDIVERT_ADDRESS& addr) const;
-        uint32_t GenerateJitter() const;
+        bool ShouldProcess(const SimulatedPacket& packet) const;
     };
 
 }
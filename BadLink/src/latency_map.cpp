@@ -0,0 +1,241 @@
+#define NOMINMAX
+#include "latency_map.h"
+#include "simulation_module.h"
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+
+namespace BadLink {
+
+    std::expected<LatencyMap, std::string> LatencyMap::Build(const std::vector<Entry>& entries,
+        std::optional<uint32_t> default_ms) {
+
+        LatencyMap map;
+        if (default_ms) {
+            map.values_[0] = *default_ms;
+        }
+
+        // Painting shorter prefixes first lets longer ones overwrite them, which is exactly LPM
+        std::vector<size_t> order(entries.size());
+        std::iota(order.begin(), order.end(), size_t{ 0 });
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return entries[a].prefix.prefix_length < entries[b].prefix.prefix_length;
+            });
+
+        const bool has_v4 = std::any_of(entries.begin(), entries.end(),
+            [](const Entry& entry) { return entry.prefix.version == 4; });
+        const bool has_v6 = std::any_of(entries.begin(), entries.end(),
+            [](const Entry& entry) { return entry.prefix.version == 6; });
+        if (has_v4) {
+            map.tbl24_.assign(size_t{ 1 } << 24, 0);
+        }
+        if (has_v6) {
+            map.trie_.emplace_back().fill(0);
+        }
+
+        std::unordered_map<uint32_t, uint16_t> value_index;
+        for (const size_t i : order) {
+            const Entry& entry = entries[i];
+
+            auto [it, inserted] = value_index.try_emplace(entry.latency_ms, static_cast<uint16_t>(map.values_.size()));
+            if (inserted) {
+                if (map.values_.size() > MAX_INDEX) {
+                    return std::unexpected(std::format("More than {} distinct latency values", MAX_INDEX));
+                }
+                map.values_.push_back(entry.latency_ms);
+            }
+
+            if (entry.prefix.version == 4) {
+                if (auto result = map.InsertV4(entry.prefix, it->second); !result) {
+                    return std::unexpected(result.error());
+                }
+            }
+            else {
+                map.InsertV6(entry.prefix, it->second);
+            }
+        }
+
+        map.prefix_count_ = entries.size();
+        return map;
+    }
+
+    std::expected<void, std::string> LatencyMap::InsertV4(const Cidr& prefix, uint16_t value) {
+        const uint32_t address = LoadBe32(prefix.address.data());
+
+        if (prefix.prefix_length <= 24) {
+            const size_t first = address >> 8;
+            const size_t count = size_t{ 1 } << (24 - prefix.prefix_length);
+            std::fill_n(tbl24_.begin() + first, count, value);
+            return {};
+        }
+
+        // Longer than /24: the /24 gets its own 256 entry group, seeded with what it covered so far
+        uint16_t& slot = tbl24_[address >> 8];
+        if ((slot & EXTENDED) == 0) {
+            const size_t group = tbl8_.size() / 256;
+            if (group > MAX_INDEX) {
+                return std::unexpected(std::format("More than {} IPv4 /24 blocks with longer prefixes", MAX_INDEX + 1));
+            }
+            tbl8_.resize(tbl8_.size() + 256, slot);
+            slot = static_cast<uint16_t>(EXTENDED | group);
+        }
+
+        const size_t group_start = static_cast<size_t>(slot & MAX_INDEX) * 256;
+        const size_t first = address & 0xFF;
+        const size_t count = size_t{ 1 } << (32 - prefix.prefix_length);
+        std::fill_n(tbl8_.begin() + group_start + first, count, value);
+        return {};
+    }
+
+    void LatencyMap::InsertV6(const Cidr& prefix, uint32_t value) {
+        size_t node = 0;
+        size_t level = 0;
+
+        // Walk whole bytes of the prefix, splitting leaves into child nodes on the way
+        while (prefix.prefix_length > 8 * (level + 1)) {
+            const uint8_t byte = prefix.address[level];
+            const uint32_t entry = trie_[node][byte];
+            if (entry & CHILD) {
+                node = entry & ~CHILD;
+            }
+            else {
+                const size_t child = trie_.size();
+                trie_.emplace_back().fill(entry);
+                trie_[node][byte] = static_cast<uint32_t>(CHILD | child);
+                node = child;
+            }
+            ++level;
+        }
+
+        // Remaining 0-8 bits cover a run of entries in the last node
+        const size_t bits = prefix.prefix_length - 8 * level;
+        const size_t first = prefix.address[level];
+        const size_t count = size_t{ 1 } << (8 - bits);
+        std::fill_n(trie_[node].begin() + first, count, value);
+    }
+
+    uint32_t LatencyMap::LookupV4(const uint8_t* address) const {
+        if (tbl24_.empty()) {
+            return values_[0];
+        }
+
+        uint16_t entry = tbl24_[(size_t{ address[0] } << 16) | (size_t{ address[1] } << 8) | address[2]];
+        if (entry & EXTENDED) {
+            entry = tbl8_[static_cast<size_t>(entry & MAX_INDEX) * 256 + address[3]];
+        }
+        return values_[entry];
+    }
+
+    uint32_t LatencyMap::LookupV6(const uint8_t* address) const {
+        if (trie_.empty()) {
+            return values_[0];
+        }
+
+        // A /128 is painted at the last level, so the walk never runs past byte 15
+        uint32_t entry = trie_[0][address[0]];
+        for (size_t level = 1; entry & CHILD; ++level) {
+            entry = trie_[entry & ~CHILD][address[level]];
+        }
+        return values_[entry];
+    }
+
+    uint32_t LatencyMap::Lookup(const SimulatedPacket& packet) const {
+        // Fragments carry their IP header in the prefix, everything else starts with it
+        const uint8_t* ip = packet.is_slice && packet.prefix_length > 0 ? packet.prefix.data() : packet.Bytes().data();
+        const size_t size = packet.Size();
+        if (ip == nullptr || size == 0) {
+            return values_[0];
+        }
+
+        const bool outbound = packet.addr.Outbound;
+        if ((ip[0] >> 4) == 4 && size >= 20) {
+            return LookupV4(ip + (outbound ? 16 : 12));
+        }
+        if ((ip[0] >> 4) == 6 && size >= 40) {
+            return LookupV6(ip + (outbound ? 24 : 8));
+        }
+        return values_[0];
+    }
+
+    std::optional<uint32_t> LatencyMap::GetDefault() const {
+        return values_[0] == NO_MATCH ? std::nullopt : std::optional(values_[0]);
+    }
+
+    size_t LatencyMap::GetMemoryBytes() const {
+        return values_.size() * sizeof(uint32_t) + tbl24_.size() * sizeof(uint16_t) +
+            tbl8_.size() * sizeof(uint16_t) + trie_.size() * sizeof(TrieNode);
+    }
+
+    std::expected<LatencyMap, std::string> LatencyMap::Parse(std::string_view text) {
+        std::vector<Entry> entries;
+        std::optional<uint32_t> default_ms;
+
+        for (size_t line = 1; !text.empty(); ++line) {
+            const size_t line_end = text.find('\n');
+            std::string_view line_text = text.substr(0, line_end);
+            text.remove_prefix(line_end == std::string_view::npos ? text.size() : line_end + 1);
+
+            if (const size_t comment = line_text.find('#'); comment != std::string_view::npos) {
+                line_text = line_text.substr(0, comment);
+            }
+            if (!line_text.empty() && line_text.back() == '\r') {
+                line_text.remove_suffix(1);
+            }
+
+            // A line holds one or more comma separated "key = value" items
+            while (!line_text.empty()) {
+                const size_t item_end = line_text.find(',');
+                const std::string_view item = TrimSpaces(line_text.substr(0, item_end));
+                line_text.remove_prefix(item_end == std::string_view::npos ? line_text.size() : item_end + 1);
+                if (item.empty()) {
+                    continue;
+                }
+
+                const size_t equals = item.find('=');
+                if (equals == std::string_view::npos) {
+                    return std::unexpected(std::format("Line {}: expected 'prefix = ms'", line));
+                }
+
+                const std::string_view key = TrimSpaces(item.substr(0, equals));
+                std::string_view value_text = TrimSpaces(item.substr(equals + 1));
+                if (value_text.ends_with("ms")) {
+                    value_text = TrimSpaces(value_text.substr(0, value_text.size() - 2));
+                }
+
+                uint32_t latency_ms = 0;
+                const auto [ptr, error] = std::from_chars(value_text.data(), value_text.data() + value_text.size(), latency_ms);
+                if (error != std::errc() || ptr != value_text.data() + value_text.size() || value_text.empty()) {
+                    return std::unexpected(std::format("Line {}: invalid latency '{}'", line, value_text));
+                }
+
+                if (key == "default") {
+                    default_ms = latency_ms;
+                }
+                else if (const auto prefix = ParseCidr(key)) {
+                    entries.push_back({ *prefix, latency_ms });
+                }
+                else {
+                    return std::unexpected(std::format("Line {}: invalid prefix '{}'", line, key));
+                }
+            }
+        }
+
+        return Build(entries, default_ms);
+    }
+
+    std::expected<LatencyMap, std::string> LatencyMap::LoadFile(const std::filesystem::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return std::unexpected(std::format("Cannot open '{}'", path.string()));
+        }
+
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        return Parse(contents.str());
+    }
+
+}
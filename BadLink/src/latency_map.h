@@ -0,0 +1,70 @@
+#ifndef BADLINK_SRC_LATENCY_MAP_H_
+#define BADLINK_SRC_LATENCY_MAP_H_
+
+#include "cidr.h"
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    struct SimulatedPacket;
+
+    // Per-destination latency table with longest-prefix-match lookup
+    // IPv4 uses DIR-24-8: one read in a 2^24 entry table, a second one for prefixes longer than /24
+    // IPv6 uses a multibit trie with 8-bit strides, one read per byte of the longest matching prefix
+    // Immutable once built, readers share it through a shared_ptr and a reload swaps the pointer
+    class LatencyMap {
+    public:
+        static constexpr uint32_t NO_MATCH = UINT32_MAX;
+
+        struct Entry {
+            Cidr prefix;
+            uint32_t latency_ms = 0;
+        };
+
+        // Later entries win over earlier ones with the same prefix
+        static std::expected<LatencyMap, std::string> Build(const std::vector<Entry>& entries,
+            std::optional<uint32_t> default_ms = std::nullopt);
+
+        // "10.1.0.0/16 = 80 ms, 2001:db8::/32 = 150, default = 20"
+        // Entries are separated by commas or newlines, '#' starts a comment
+        static std::expected<LatencyMap, std::string> Parse(std::string_view text);
+        static std::expected<LatencyMap, std::string> LoadFile(const std::filesystem::path& path);
+
+        // Latency for an address in network byte order, NO_MATCH without a prefix or default
+        uint32_t LookupV4(const uint8_t* address) const;
+        uint32_t LookupV6(const uint8_t* address) const;
+
+        // Latency towards the remote end of a packet: destination when outbound, source when inbound
+        uint32_t Lookup(const SimulatedPacket& packet) const;
+
+        size_t GetPrefixCount() const { return prefix_count_; }
+        std::optional<uint32_t> GetDefault() const;
+        size_t GetMemoryBytes() const;
+
+    private:
+        // tbl24 entries: value index, or tbl8 group with the EXTENDED bit set
+        static constexpr uint16_t EXTENDED = 0x8000;
+        static constexpr size_t MAX_INDEX = EXTENDED - 1;
+
+        // Trie node entries: value index, or child node with the CHILD bit set
+        static constexpr uint32_t CHILD = 0x80000000u;
+        using TrieNode = std::array<uint32_t, 256>;
+
+        std::vector<uint32_t> values_{ NO_MATCH };  // Latency per value index, index 0 is the default
+        std::vector<uint16_t> tbl24_;               // Empty when there are no IPv4 prefixes
+        std::vector<uint16_t> tbl8_;                // 256 entries per group
+        std::vector<TrieNode> trie_;                // Node 0 is the root, empty when there are no IPv6 prefixes
+        size_t prefix_count_ = 0;
+
+        std::expected<void, std::string> InsertV4(const Cidr& prefix, uint16_t value);
+        void InsertV6(const Cidr& prefix, uint32_t value);
+    };
+
+}
+#endif  // BADLINK_SRC_LATENCY_MAP_H_
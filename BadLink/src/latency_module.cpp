@@ -6,12 +6,24 @@ namespace BadLink {
     LatencyModule::LatencyModule() = default;
     LatencyModule::~LatencyModule() = default;
 
-    void LatencyModule::SetLatency(uint32_t latency_ms) {
-        latency_.store(std::chrono::milliseconds(latency_ms));
+    void LatencyModule::SetLatency(Direction direction, uint32_t latency_ms) {
+        latency_[DirectionIndex(direction)].store(std::chrono::milliseconds(latency_ms));
     }
 
-    uint32_t LatencyModule::GetLatency() const {
-        return static_cast<uint32_t>(latency_.load().count());
+    uint32_t LatencyModule::GetLatency(Direction direction) const {
+        return static_cast<uint32_t>(latency_[DirectionIndex(direction)].load().count());
+    }
+
+    void LatencyModule::SetLatencyMap(std::shared_ptr<const LatencyMap> map) {
+        latency_map_.store(std::move(map));
+    }
+
+    std::shared_ptr<const LatencyMap> LatencyModule::GetLatencyMap() const {
+        return latency_map_.load();
+    }
+
+    void LatencyModule::SetReleaseSlot(std::chrono::microseconds slot) {
+        release_slot_.store(slot);
     }
 
     void LatencyModule::SetEnabled(bool enabled) {
@@ -38,17 +50,26 @@ namespace BadLink {
         }
 
         std::vector<SimulatedPacket> immediate_packets;
-        const auto delay = latency_.load();
-        const auto current_time = std::chrono::steady_clock::now();
+        const PerDirection<std::chrono::milliseconds> delays{ latency_[0].load(), latency_[1].load() };
+        const auto map = latency_map_.load();
+        const auto slot = release_slot_.load();
+        const auto current_time = Now();
 
         for (auto&& packet : packets) {
-            bool should_delay = ShouldProcess(packet.addr);
+            bool should_delay = ShouldProcess(packet);
 
             if (should_delay) {
-                // Apply latency and set release time
-                packet.release_time = current_time + delay;
-
-                std::lock_guard<std::mutex> lock(buffer_mutex_);
+                // Apply latency and set release time, the map overrides the fixed delay where it matches
+                auto packet_delay = delays[DirectionIndex(packet)];
+                if (map) {
+                    const uint32_t mapped_ms = map->Lookup(packet);
+                    if (mapped_ms != LatencyMap::NO_MATCH) {
+                        packet_delay = std::chrono::milliseconds(mapped_ms);
+                    }
+                }
+                packet.release_time = AlignToSlot(current_time + packet_delay, slot);
+
+                std::lock_guard<ContendedMutex> lock(buffer_mutex_);
                 delayed_packets_.push(std::move(packet));
             }
             else {
@@ -65,7 +86,7 @@ namespace BadLink {
 
         if (!enabled_.load()) {
             // If disabled, flush all delayed packets
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            std::lock_guard<ContendedMutex> lock(buffer_mutex_);
             while (!delayed_packets_.empty()) {
                 ready_packets.push_back(std::move(const_cast<SimulatedPacket&>(delayed_packets_.top())));
                 delayed_packets_.pop();
@@ -73,9 +94,9 @@ namespace BadLink {
             return ready_packets;
         }
 
-        const auto current_time = std::chrono::steady_clock::now();
+        const auto current_time = Now();
 
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        std::lock_guard<ContendedMutex> lock(buffer_mutex_);
         while (!delayed_packets_.empty() &&
             delayed_packets_.top().release_time <= current_time) {
             ready_packets.push_back(std::move(const_cast<SimulatedPacket&>(delayed_packets_.top())));
@@ -85,7 +106,12 @@ namespace BadLink {
         return ready_packets;
     }
 
-    bool LatencyModule::ShouldProcess(const WINDIVERT_ADDRESS& addr) const {
+    bool LatencyModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::LATENCY) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
         if (addr.Outbound && !outbound_enabled_.load()) {
             return false;
         }
@@ -2,6 +2,9 @@
 #define BADLINK_SRC_LATENCY_MODULE_H_
 
 #include "simulation_module.h"
+#include "latency_map.h"
+#include "release_slots.h"
+#include "lock_stats.h"
 #include <atomic>
 #include <mutex>
 #include <queue>
@@ -15,8 +18,16 @@ namespace BadLink {
         LatencyModule();
         ~LatencyModule() override;
 
-        void SetLatency(uint32_t latency_ms);
-        uint32_t GetLatency() const;
+        void SetLatency(Direction direction, uint32_t latency_ms);
+        uint32_t GetLatency(Direction direction) const;
+
+        // Per-destination latencies, addresses the map doesn't cover keep the fixed latency
+        // Swapped atomically, a batch in flight finishes with the map it started with
+        void SetLatencyMap(std::shared_ptr<const LatencyMap> map);
+        std::shared_ptr<const LatencyMap> GetLatencyMap() const;
+
+        // Round release times up to slot boundaries, 0 disables
+        void SetReleaseSlot(std::chrono::microseconds slot);
 
         void SetEnabled(bool enabled);
         bool IsEnabled() const override;
@@ -44,12 +55,14 @@ namespace BadLink {
         std::atomic<bool> enabled_{ false };
         std::atomic<bool> inbound_enabled_{ true };
         std::atomic<bool> outbound_enabled_{ true };
-        std::atomic<std::chrono::milliseconds> latency_{ std::chrono::milliseconds::zero() };
+        PerDirection<std::atomic<std::chrono::milliseconds>> latency_{ std::chrono::milliseconds::zero(), std::chrono::milliseconds::zero() };
+        std::atomic<std::shared_ptr<const LatencyMap>> latency_map_;
+        std::atomic<std::chrono::microseconds> release_slot_{ std::chrono::microseconds::zero() };
 
-        mutable std::mutex buffer_mutex_;
+        mutable ContendedMutex buffer_mutex_{ "Latency queue" };
         PacketQueue delayed_packets_;
 
-        bool ShouldProcess(const WINDIVERT_ADDRESS& addr) const;
+        bool ShouldProcess(const SimulatedPacket& packet) const;
     };
 }
 #endif  // BADLINK_SRC_LATENCY_MODULE_H_
\ No newline at end of file
@@ -0,0 +1,222 @@
+#define NOMINMAX
+#include "link_chain.h"
+#include "bandwidth_module.h"
+#include "corruption_module.h"
+#include "duplicate_module.h"
+#include "header_rewrite_module.h"
+#include "jitter_module.h"
+#include "latency_module.h"
+#include "mtu_module.h"
+#include "out_of_order_module.h"
+#include "packet_loss_module.h"
+#include <iterator>
+
+namespace BadLink {
+
+    namespace {
+        void Append(std::vector<SimulatedPacket>& out, std::vector<SimulatedPacket>&& packets) {
+            if (out.empty()) {
+                out = std::move(packets);
+                return;
+            }
+            out.insert(out.end(), std::make_move_iterator(packets.begin()), std::make_move_iterator(packets.end()));
+        }
+    }
+
+    LinkChain::LinkChain()
+        : packet_loss(std::make_unique<PacketLossModule>())
+        , header_rewrite(std::make_unique<HeaderRewriteModule>())
+        , duplicate(std::make_unique<DuplicateModule>())
+        , corruption(std::make_unique<CorruptionModule>())
+        , out_of_order(std::make_unique<OutOfOrderModule>())
+        , jitter(std::make_unique<JitterModule>())
+        , bandwidth{ std::make_unique<BandwidthModule>(), std::make_unique<BandwidthModule>() }
+        , latency(std::make_unique<LatencyModule>()) {
+        // Upstream and downstream queue separately, each shaper only sees its own direction
+        bandwidth[DirectionIndex(Direction::Inbound)]->SetOutboundEnabled(false);
+        bandwidth[DirectionIndex(Direction::Outbound)]->SetInboundEnabled(false);
+    }
+
+    LinkChain::~LinkChain() = default;
+
+    void LinkChain::Configure(const LinkConfig& config) {
+        name = config.name;
+
+        for (const auto direction : { Direction::Inbound, Direction::Outbound }) {
+            const auto& values = config.directions[DirectionIndex(direction)];
+            packet_loss->SetLossRate(direction, values.loss_rate);
+            header_rewrite->SetHopDecrement(direction, static_cast<uint32_t>(values.rewrite_hop_decrement));
+            header_rewrite->SetDscp(direction, values.rewrite_dscp);
+            header_rewrite->SetMssClamp(direction, static_cast<uint32_t>(values.rewrite_mss_clamp));
+            duplicate->SetDuplicationRate(direction, values.duplicate_rate);
+            duplicate->SetDuplicateCount(direction, static_cast<uint32_t>(values.duplicate_count));
+            duplicate->SetDuplicateDelay(direction, static_cast<uint32_t>(values.duplicate_delay_min_ms),
+                static_cast<uint32_t>(values.duplicate_delay_max_ms));
+            corruption->SetBitErrorRate(direction, values.corruption_ber);
+            out_of_order->SetReorderRate(direction, values.reorder_rate);
+            out_of_order->SetReorderGap(direction, static_cast<uint32_t>(values.reorder_gap));
+            jitter->SetJitterRange(direction, static_cast<uint32_t>(values.jitter_min_ms),
+                static_cast<uint32_t>(values.jitter_max_ms));
+            bandwidth[DirectionIndex(direction)]->SetBandwidthLimit(static_cast<uint32_t>(values.bandwidth_kbps));
+            latency->SetLatency(direction, static_cast<uint32_t>(values.latency_ms));
+        }
+
+        packet_loss->SetEnabled((config.modules & ModuleMask::PACKET_LOSS) != 0);
+        header_rewrite->SetEnabled((config.modules & ModuleMask::HEADER_REWRITE) != 0);
+        duplicate->SetEnabled((config.modules & ModuleMask::DUPLICATE) != 0);
+        corruption->SetEnabled((config.modules & ModuleMask::CORRUPTION) != 0);
+        out_of_order->SetEnabled((config.modules & ModuleMask::OUT_OF_ORDER) != 0);
+        jitter->SetEnabled((config.modules & ModuleMask::JITTER) != 0);
+        for (auto& module : bandwidth) {
+            module->SetEnabled((config.modules & ModuleMask::BANDWIDTH) != 0);
+        }
+        latency->SetEnabled((config.modules & ModuleMask::LATENCY) != 0);
+    }
+
+    void LinkChain::SetCrossTraffic(const CrossTrafficConfig& config) {
+        for (const auto direction : { Direction::Inbound, Direction::Outbound }) {
+            bandwidth[DirectionIndex(direction)]->SetCrossTraffic(config, direction);
+        }
+    }
+
+    void LinkChain::SetClock(const SimulationClock& clock) {
+        packet_loss->SetClock(clock);
+        header_rewrite->SetClock(clock);
+        duplicate->SetClock(clock);
+        corruption->SetClock(clock);
+        out_of_order->SetClock(clock);
+        jitter->SetClock(clock);
+        for (auto& module : bandwidth) {
+            module->SetClock(clock);
+        }
+        latency->SetClock(clock);
+    }
+
+    std::vector<SimulatedPacket> LinkChain::Process(std::vector<SimulatedPacket>&& packets, MtuModule& mtu) {
+        packets_processed.fetch_add(packets.size());
+        for (const auto& packet : packets) {
+            bytes_processed.fetch_add(packet.Size());
+        }
+
+        // 1. Packet loss (drops packets)
+        if (packet_loss->IsEnabled()) {
+            packets = packet_loss->ProcessBatch(std::move(packets));
+        }
+
+        // 2. Header rewrite (TTL/DSCP/MSS in place, before duplicates share the buffer)
+        if (header_rewrite->IsEnabled()) {
+            packets = header_rewrite->ProcessBatch(std::move(packets));
+        }
+
+        // 3. Duplicate (creates duplicates)
+        if (duplicate->IsEnabled()) {
+            packets = duplicate->ProcessBatch(std::move(packets));
+        }
+
+        return ProcessAfterDuplicate(std::move(packets), mtu);
+    }
+
+    std::vector<SimulatedPacket> LinkChain::ProcessAfterDuplicate(std::vector<SimulatedPacket>&& packets, MtuModule& mtu) {
+        // 4. Corruption (flips bits, copy-on-write so duplicates differ)
+        if (corruption->IsEnabled()) {
+            packets = corruption->ProcessBatch(std::move(packets));
+        }
+
+        // 5. MTU (drops, fragments or answers with ICMP, fragments reference the original buffer)
+        if (mtu.IsEnabled()) {
+            packets = mtu.ProcessBatch(std::move(packets));
+        }
+
+        // 6. Out of order (reorders packets within each flow)
+        if (out_of_order->IsEnabled()) {
+            packets = out_of_order->ProcessBatch(std::move(packets));
+        }
+
+        return ProcessAfterReorder(std::move(packets));
+    }
+
+    std::vector<SimulatedPacket> LinkChain::ProcessAfterReorder(std::vector<SimulatedPacket>&& packets) {
+        // 7. Jitter (adds variable delay)
+        if (jitter->IsEnabled()) {
+            packets = jitter->ProcessBatch(std::move(packets));
+        }
+
+        // 8. Bandwidth limiting (rate limits, each direction through its own shaper)
+        for (auto& module : bandwidth) {
+            if (module->IsEnabled()) {
+                packets = module->ProcessBatch(std::move(packets));
+            }
+        }
+
+        // 9. Latency (adds fixed delay)
+        if (latency->IsEnabled()) {
+            packets = latency->ProcessBatch(std::move(packets));
+        }
+
+        return std::move(packets);
+    }
+
+    void LinkChain::ReleaseLatency(std::vector<SimulatedPacket>& out) {
+        Append(out, latency->GetReleasablePackets());
+    }
+
+    void LinkChain::ReleaseReorder(std::vector<SimulatedPacket>& out) {
+        auto held = out_of_order->GetReleasablePackets();
+        if (!held.empty()) {
+            Append(out, ProcessAfterReorder(std::move(held)));
+        }
+    }
+
+    void LinkChain::ReleaseJitter(std::vector<SimulatedPacket>& out) {
+        Append(out, jitter->GetReleasablePackets());
+    }
+
+    void LinkChain::ReleaseBandwidth(std::vector<SimulatedPacket>& out) {
+        for (auto& module : bandwidth) {
+            Append(out, module->GetReleasablePackets());
+        }
+    }
+
+    void LinkChain::ReleaseDuplicates(std::vector<SimulatedPacket>& out, MtuModule& mtu) {
+        auto due = duplicate->GetReleasablePackets();
+        if (!due.empty()) {
+            Append(out, ProcessAfterDuplicate(std::move(due), mtu));
+        }
+    }
+
+    SimulationClock::time_point LinkChain::NextDuplicateRelease() const {
+        return duplicate->NextReleaseTime();
+    }
+
+    void LinkChain::Clear() {
+        [[maybe_unused]] auto remaining_latency = latency->GetReleasablePackets();
+        [[maybe_unused]] auto remaining_jitter = jitter->GetReleasablePackets();
+        for (auto& module : bandwidth) {
+            [[maybe_unused]] auto remaining_bandwidth = module->GetReleasablePackets();
+        }
+        [[maybe_unused]] auto remaining_order = out_of_order->GetReleasablePackets();
+        [[maybe_unused]] auto remaining_duplicate = duplicate->GetReleasablePackets();
+    }
+
+    void LinkChain::Drain(std::vector<SimulatedPacket>& out) {
+        // A disabled stage hands back its whole queue instead of only what is due
+        duplicate->SetEnabled(false);
+        out_of_order->SetEnabled(false);
+        jitter->SetEnabled(false);
+        for (auto& module : bandwidth) {
+            module->SetEnabled(false);
+        }
+        latency->SetEnabled(false);
+
+        Append(out, out_of_order->GetReleasablePackets());
+        ReleaseJitter(out);
+        ReleaseBandwidth(out);
+        ReleaseLatency(out);
+        Append(out, duplicate->GetReleasablePackets());
+    }
+
+    bool LinkChain::IsBandwidthEnabled() const {
+        return bandwidth[0]->IsEnabled();
+    }
+
+}
@@ -0,0 +1,120 @@
+#ifndef BADLINK_SRC_LINK_CHAIN_H_
+#define BADLINK_SRC_LINK_CHAIN_H_
+
+#include "simulation_module.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace BadLink {
+
+    class PacketLossModule;
+    class HeaderRewriteModule;
+    class DuplicateModule;
+    class CorruptionModule;
+    class MtuModule;
+    class OutOfOrderModule;
+    class JitterModule;
+    class BandwidthModule;
+    class LatencyModule;
+    struct CrossTrafficConfig;
+
+    // Impairment values for one direction of a link
+    struct DirectionProfile {
+        float loss_rate = 0.0f;
+        int latency_ms = 0;
+        int jitter_min_ms = 0;
+        int jitter_max_ms = 50;
+        int bandwidth_kbps = 1000;
+        float duplicate_rate = 0.0f;
+        int duplicate_count = 1;
+        int duplicate_delay_min_ms = 0;
+        int duplicate_delay_max_ms = 0;
+        float corruption_ber = 0.000001f;
+        int rewrite_hop_decrement = 0;
+        int rewrite_dscp = -1;
+        int rewrite_mss_clamp = 0;
+        float reorder_rate = 0.0f;
+        int reorder_gap = 3;
+    };
+
+    // Named link hosted next to the main one, e.g. "satellite" for the address ranges a rule
+    // sends to it
+    struct LinkConfig {
+        std::string name;
+        uint32_t modules = 0;                           // Impairments the link applies, MTU stays link-wide
+        std::array<DirectionProfile, 2> directions;     // By Direction
+    };
+
+    // One link's impairment chain
+    // Every link owns its module instances (queues, token buckets, per-flow state), while the
+    // capture path and the release threads are shared by all links
+    struct LinkChain {
+        LinkChain();
+        ~LinkChain();
+
+        LinkChain(const LinkChain&) = delete;
+        LinkChain& operator=(const LinkChain&) = delete;
+
+        // Values and enable flags of a named link, the main link is driven by NetworkCapture's setters
+        void Configure(const LinkConfig& config);
+
+        // Background load of both shapers, each direction with its own random stream
+        void SetCrossTraffic(const CrossTrafficConfig& config);
+
+        // Time source of every stage, see SimulationModule::SetClock
+        // Under a VirtualClock one thread drives the chain: Process, advance the clock, Release
+        void SetClock(const SimulationClock& clock);
+
+        // Runs the enabled stages in order, `mtu` is the link-wide module shared by every chain
+        // Delayed packets come back through the Release calls
+        std::vector<SimulatedPacket> Process(std::vector<SimulatedPacket>&& packets, MtuModule& mtu);
+
+        // Packets due from the delaying stages, appended to `out`
+        void ReleaseLatency(std::vector<SimulatedPacket>& out);
+        void ReleaseJitter(std::vector<SimulatedPacket>& out);
+
+        // Packets a quiet flow held in the reorder stage too long, after jitter, shaper and latency
+        void ReleaseReorder(std::vector<SimulatedPacket>& out);
+        void ReleaseBandwidth(std::vector<SimulatedPacket>& out);
+
+        // Delayed duplicates that fell due continue from stage 4 (corruption) like their
+        // originals did, so they still pass MTU, reordering, jitter, the shaper and latency
+        void ReleaseDuplicates(std::vector<SimulatedPacket>& out, MtuModule& mtu);
+
+        // When the duplicate stage next has a copy due, see DuplicateModule::NextReleaseTime
+        SimulationClock::time_point NextDuplicateRelease() const;
+
+        // Drops the delayed packets when capture stops
+        void Clear();
+
+        // Switches the delaying stages off and appends everything they still hold to `out`, for a
+        // link that goes away while capturing. Stragglers that reach the chain later pass straight through
+        void Drain(std::vector<SimulatedPacket>& out);
+
+        bool IsBandwidthEnabled() const;
+
+        std::string name;       // Empty for the main link
+        std::atomic<uint64_t> packets_processed{ 0 };
+        std::atomic<uint64_t> bytes_processed{ 0 };
+
+        std::unique_ptr<PacketLossModule> packet_loss;
+        std::unique_ptr<HeaderRewriteModule> header_rewrite;
+        std::unique_ptr<DuplicateModule> duplicate;
+        std::unique_ptr<CorruptionModule> corruption;
+        std::unique_ptr<OutOfOrderModule> out_of_order;
+        std::unique_ptr<JitterModule> jitter;
+        std::array<std::unique_ptr<BandwidthModule>, 2> bandwidth;     // One shaper per direction, by Direction
+        std::unique_ptr<LatencyModule> latency;
+
+    private:
+        // Stages 4 to 9, everything after the duplicate stage, and 7 to 9 after the reorder stage
+        std::vector<SimulatedPacket> ProcessAfterDuplicate(std::vector<SimulatedPacket>&& packets, MtuModule& mtu);
+        std::vector<SimulatedPacket> ProcessAfterReorder(std::vector<SimulatedPacket>&& packets);
+    };
+
+}
+#endif  // BADLINK_SRC_LINK_CHAIN_H_
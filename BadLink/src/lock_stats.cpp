@@ -0,0 +1,97 @@
+#define NOMINMAX
+#include "lock_stats.h"
+#include <algorithm>
+#include <chrono>
+
+namespace BadLink {
+
+    namespace {
+        // Live mutexes, and what the destroyed ones counted under each name
+        struct Registry {
+            std::mutex mutex;
+            std::vector<ContendedMutex*> live;
+            std::vector<LockWaitStats> retired;
+        };
+
+        Registry& GetRegistry() {
+            static Registry registry;
+            return registry;
+        }
+
+        LockWaitStats& Entry(std::vector<LockWaitStats>& stats, std::string_view name) {
+            const auto it = std::ranges::find(stats, name, &LockWaitStats::name);
+            if (it != stats.end()) {
+                return *it;
+            }
+            return stats.emplace_back(LockWaitStats{ std::string(name) });
+        }
+
+        void Accumulate(LockWaitStats& total, const LockWaitStats& stats) {
+            total.acquisitions += stats.acquisitions;
+            total.contended += stats.contended;
+            total.wait_ns += stats.wait_ns;
+        }
+    }
+
+    ContendedMutex::ContendedMutex(std::string_view name) : name_(name) {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.live.push_back(this);
+        Entry(registry.retired, name_);     // Listed from the start, even before it is taken
+    }
+
+    ContendedMutex::~ContendedMutex() {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        std::erase(registry.live, this);
+        Accumulate(Entry(registry.retired, name_), Read());
+    }
+
+    void ContendedMutex::LockContended() {
+        const auto started = std::chrono::steady_clock::now();
+        mutex_.lock();
+        const auto waited = std::chrono::steady_clock::now() - started;
+        Add(contended_, 1);
+        Add(wait_ns_, std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+    }
+
+    LockWaitStats ContendedMutex::Read() const {
+        return { name_, acquisitions_.load(std::memory_order_relaxed), contended_.load(std::memory_order_relaxed),
+            wait_ns_.load(std::memory_order_relaxed) };
+    }
+
+    namespace LockStats {
+
+        std::vector<LockWaitStats> Snapshot() {
+            Registry& registry = GetRegistry();
+            std::vector<LockWaitStats> stats;
+            {
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                stats = registry.retired;
+                for (const ContendedMutex* mutex : registry.live) {
+                    Accumulate(Entry(stats, mutex->name_), mutex->Read());
+                }
+            }
+            std::ranges::sort(stats, {}, &LockWaitStats::name);
+            return stats;
+        }
+
+        void Reset() {
+            // A lock taken while this runs may keep its old count, reset between runs
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            for (auto& stats : registry.retired) {
+                stats.acquisitions = 0;
+                stats.contended = 0;
+                stats.wait_ns = 0;
+            }
+            for (ContendedMutex* mutex : registry.live) {
+                mutex->acquisitions_.store(0, std::memory_order_relaxed);
+                mutex->contended_.store(0, std::memory_order_relaxed);
+                mutex->wait_ns_.store(0, std::memory_order_relaxed);
+            }
+        }
+
+    }
+
+}
@@ -0,0 +1,76 @@
+#ifndef BADLINK_SRC_LOCK_STATS_H_
+#define BADLINK_SRC_LOCK_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    // How often the mutexes sharing one name were taken and how long threads blocked on them
+    struct LockWaitStats {
+        std::string name;
+        uint64_t acquisitions = 0;
+        uint64_t contended = 0;     // Acquisitions that found the mutex held
+        uint64_t wait_ns = 0;       // Time those spent blocked
+    };
+
+    class ContendedMutex;
+
+    namespace LockStats {
+
+        // Every name registered so far, in name order, live and destroyed mutexes summed up
+        [[nodiscard]] std::vector<LockWaitStats> Snapshot();
+
+        // Zeroes the counters, e.g. before a measured run
+        void Reset();
+
+    }
+
+    // std::mutex that records its lock waits under a name, e.g. every link's latency queue
+    // counts as one "Latency queue"
+    // Each mutex keeps its own counters next to the mutex and only the thread holding it writes
+    // them, so an uncontended lock adds a relaxed load and store on a line it already owns
+    // Only a lock that finds the mutex held reads the clock, Snapshot sums up the mutexes per name
+    class ContendedMutex {
+    public:
+        explicit ContendedMutex(std::string_view name);
+        ~ContendedMutex();
+
+        ContendedMutex(const ContendedMutex&) = delete;
+        ContendedMutex& operator=(const ContendedMutex&) = delete;
+
+        void lock() {
+            if (!mutex_.try_lock()) {
+                LockContended();
+            }
+            Add(acquisitions_, 1);
+        }
+
+        bool try_lock() { return mutex_.try_lock(); }
+        void unlock() { mutex_.unlock(); }
+
+    private:
+        friend std::vector<LockWaitStats> LockStats::Snapshot();
+        friend void LockStats::Reset();
+
+        // Single writer, the lock holder, so no read-modify-write is needed
+        static void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        void LockContended();
+        LockWaitStats Read() const;
+
+        std::mutex mutex_;
+        std::atomic<uint64_t> acquisitions_{ 0 };
+        std::atomic<uint64_t> contended_{ 0 };
+        std::atomic<uint64_t> wait_ns_{ 0 };
+        std::string name_;
+    };
+
+}
+#endif  // BADLINK_SRC_LOCK_STATS_H_
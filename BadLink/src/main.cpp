@@ -8,13 +8,25 @@
 #include <memory>
 #include <vector>
 #include <format>
+#include <chrono>
 #include <variant>
 #include <string>
+#include <algorithm>
+#include <string_view>
 
 #include "windivert.h"
 #include "config.h"
 
 #include "network_capture.h"
+#include "mtu_module.h"
+#include "traffic_policer.h"
+#include "cross_traffic.h"
+#include "release_slots.h"
+#include "outage_module.h"
+#include "latency_map.h"
+#include "link_chain.h"
+#include "scenario.h"
+#include "traffic_generator.h"
 
 namespace BadLink {
     constexpr int NUM_FRAMES_IN_FLIGHT = 2;
@@ -143,45 +155,138 @@ struct ApplicationState {
 
     // Simulation settings
     struct SimulationSettings {
+        // Values live in the configuration's simulation profile, this picks the direction the
+        // controls edit while it is asymmetric
+        int edit_direction = static_cast<int>(BadLink::Direction::Outbound);
+
         // Packet Loss
         bool packet_loss_enabled = false;
         bool packet_loss_inbound = true;
         bool packet_loss_outbound = true;
-        float packet_loss_rate = 0.0f;
 
         // Latency
         bool latency_enabled = false;
         bool latency_inbound = true;
         bool latency_outbound = true;
-        int latency_ms = 0;
+        char latency_map_spec[512] = "";        // Inline "prefix = ms, ..." list or a map file path
+        std::shared_ptr<const BadLink::LatencyMap> latency_map;
+        std::string latency_map_error;
 
         // Packet Duplication
         bool duplicate_enabled = false;
         bool duplicate_inbound = true;
         bool duplicate_outbound = true;
-        float duplicate_rate = 0.0f;
-        int duplicate_count = 1;
+
+        // Bit Corruption
+        bool corruption_enabled = false;
+        bool corruption_inbound = true;
+        bool corruption_outbound = true;
+        bool corruption_fix_checksums = true;
+
+        // Header Rewrite
+        bool rewrite_enabled = false;
+        bool rewrite_inbound = true;
+        bool rewrite_outbound = true;
+
+        // MTU Enforcement (size comes from the network parameters)
+        bool mtu_enabled = false;
+        bool mtu_inbound = true;
+        bool mtu_outbound = true;
+        int mtu_action = static_cast<int>(BadLink::MtuAction::Fragment);
+        bool mtu_reassembly = false;
 
         // Out of Order
         bool out_of_order_enabled = false;
         bool out_of_order_inbound = true;
         bool out_of_order_outbound = true;
-        float out_of_order_rate = 0.0f;
-        int reorder_gap = 3;
 
         // Jitter
         bool jitter_enabled = false;
         bool jitter_inbound = true;
         bool jitter_outbound = true;
-        int jitter_min_ms = 0;
-        int jitter_max_ms = 50;
 
         // Bandwidth Limiting
         bool bandwidth_enabled = false;
         bool bandwidth_inbound = true;
         bool bandwidth_outbound = true;
-        int bandwidth_kbps = 1000;
+        int bandwidth_flow_kbps = 0;    // 0 = no per-flow cap
+        int syn_rate = 0;               // New connections per second, 0 = unlimited
+        int bandwidth_mode = static_cast<int>(BadLink::BandwidthMode::Shaper);
+        int policer_mode = static_cast<int>(BadLink::PolicerMode::SingleRate);
+        int policer_committed_burst = 15000;
+        int policer_excess_burst = 30000;
+        int policer_peak_kbps = 2000;
+        bool policer_drop_exceeding = false;
+
+        // Virtual cross traffic in the shaper
+        BadLink::CrossTrafficConfig cross_traffic;
+        int cross_model = 0;
+        int cross_rate_kbps = 500;
+        int cross_on_ms = 1000;
+        int cross_off_ms = 1000;
+        int cross_packet_bytes = 1200;
+        char cross_trace_spec[512] = "";        // Inline "ms = kbps, ..." steps or a trace file path
+        std::string cross_trace_error;
+
+        // Link outages
+        bool outage_enabled = false;
+        bool outage_inbound = true;
+        bool outage_outbound = true;
+        int outage_schedule = static_cast<int>(BadLink::OutageSchedule::Periodic);
+        int outage_action = static_cast<int>(BadLink::OutageAction::Drop);
+        int outage_up_ms = 28000;
+        int outage_down_ms = 2000;
+        int outage_hold_limit = 10000;
+
+        // Slotted release of delayed packets
+        bool slots_enabled = false;
+        int slot_us = 1000;
+        int slot_max_packets = 64;
+        int slot_max_bytes = 65535;
     } simulation;
+
+    // Traffic rule editor (rules themselves live in config)
+    struct RuleForm {
+        char name[64] = "";
+        char src[64] = "";
+        char dst[64] = "";
+        char src_ports[16] = "";
+        char dst_ports[16] = "";
+        char protocol[16] = "";
+        char filter[256] = "";
+        char content[128] = "";
+        char domains[256] = "";
+        char traffic_class[64] = "";
+        char link[64] = "";
+        int direction = 0;
+        unsigned int modules = BadLink::ModuleMask::ALL;
+    } rule_form;
+    std::string rules_error;
+
+    // Bandwidth traffic class editor (classes live in config)
+    struct ClassForm {
+        char name[64] = "";
+        int priority = 4;
+        int rate_kbps = 1000;
+        int ceil_kbps = 0;
+        int weight = 1;
+        char dscp[64] = "";
+    } class_form;
+    std::string classes_error;
+
+    // Named link editor (links live in config, values are copied from the simulation profile)
+    struct LinkForm {
+        char name[64] = "";
+        unsigned int modules = BadLink::ModuleMask::LATENCY | BadLink::ModuleMask::BANDWIDTH;
+    } link_form;
+    std::string links_error;
+
+    // Built-in scenarios run through the module chain under virtual time
+    std::vector<BadLink::ScenarioCheck> self_test;
+
+    // Synthetic traffic packet size mix being edited (the profile lives in config)
+    char generator_sizes[256] = "";
+    std::string generator_error;
 };
 
 static WinDivertStatus CheckWinDivertStatus() {
@@ -228,6 +333,118 @@ static WinDivertStatus CheckWinDivertStatus() {
     return status;
 }
 
+// Compile the configured rules into the running capture, errors are shown in the rules section
+static void ApplyRules(ApplicationState& state) {
+    if (!state.capture) {
+        return;
+    }
+
+    auto result = state.capture->SetRules(state.config.rules, state.config.unmatched_modules);
+    state.rules_error = result.has_value() ? std::string{} : result.error();
+}
+
+static BadLink::PolicerConfig PolicerFromSettings(const ApplicationState& state) {
+    BadLink::PolicerConfig config;
+    config.mode = static_cast<BadLink::PolicerMode>(state.simulation.policer_mode);
+    config.committed_burst = static_cast<uint32_t>(state.simulation.policer_committed_burst);
+    config.excess_burst = static_cast<uint32_t>(state.simulation.policer_excess_burst);
+    config.peak_kbps = static_cast<uint32_t>(state.simulation.policer_peak_kbps);
+    config.drop_exceeding = state.simulation.policer_drop_exceeding;
+    return config;
+}
+
+// Pushes the simulation profile's values to the modules, one set per direction
+static void ApplyDirectionProfiles(ApplicationState& state) {
+    if (!state.capture) {
+        return;
+    }
+    for (const auto direction : { BadLink::Direction::Inbound, BadLink::Direction::Outbound }) {
+        const auto& values = state.config.simulation.For(direction);
+        state.capture->SetPacketLossRate(direction, values.loss_rate);
+        state.capture->SetLatency(direction, values.latency_ms);
+        state.capture->SetDuplicateRate(direction, values.duplicate_rate);
+        state.capture->SetDuplicateCount(direction, values.duplicate_count);
+        state.capture->SetDuplicateDelay(direction, values.duplicate_delay_min_ms, values.duplicate_delay_max_ms);
+        state.capture->SetCorruptionRate(direction, values.corruption_ber);
+        state.capture->SetRewriteHopDecrement(direction, values.rewrite_hop_decrement);
+        state.capture->SetRewriteDscp(direction, values.rewrite_dscp);
+        state.capture->SetRewriteMssClamp(direction, values.rewrite_mss_clamp);
+        state.capture->SetOutOfOrderRate(direction, values.reorder_rate);
+        state.capture->SetReorderGap(direction, values.reorder_gap);
+        state.capture->SetJitterRange(direction, values.jitter_min_ms, values.jitter_max_ms);
+        state.capture->SetBandwidthLimit(direction, values.bandwidth_kbps);
+    }
+}
+
+// "40 ms", or "in 600 ms, out 40 ms" while the simulation profile is asymmetric
+template <typename Format>
+static std::string DirectionValues(const BadLink::Config::SimulationProfile& profile, Format format) {
+    std::string outbound = format(profile.For(BadLink::Direction::Outbound));
+    if (!profile.asymmetric) {
+        return outbound;
+    }
+    return std::format("in {}, out {}", format(profile.For(BadLink::Direction::Inbound)), outbound);
+}
+
+static void ApplyCrossTraffic(ApplicationState& state) {
+    auto& config = state.simulation.cross_traffic;
+    config.model = static_cast<BadLink::CrossTrafficModel>(state.simulation.cross_model);
+    config.rate_kbps = static_cast<uint32_t>(state.simulation.cross_rate_kbps);
+    config.on_ms = static_cast<uint32_t>(state.simulation.cross_on_ms);
+    config.off_ms = static_cast<uint32_t>(state.simulation.cross_off_ms);
+    config.packet_bytes = static_cast<uint32_t>(state.simulation.cross_packet_bytes);
+    if (state.capture) {
+        state.capture->SetCrossTraffic(config);
+    }
+}
+
+static void ApplyOutage(ApplicationState& state) {
+    if (!state.capture) {
+        return;
+    }
+    BadLink::OutageConfig config;
+    config.schedule = static_cast<BadLink::OutageSchedule>(state.simulation.outage_schedule);
+    config.action = static_cast<BadLink::OutageAction>(state.simulation.outage_action);
+    config.up_ms = static_cast<uint32_t>(state.simulation.outage_up_ms);
+    config.down_ms = static_cast<uint32_t>(state.simulation.outage_down_ms);
+    config.hold_limit = static_cast<uint32_t>(state.simulation.outage_hold_limit);
+    state.capture->SetOutage(config);
+    state.capture->SetOutageInbound(state.simulation.outage_inbound);
+    state.capture->SetOutageOutbound(state.simulation.outage_outbound);
+    state.capture->SetOutageEnabled(state.simulation.outage_enabled);
+}
+
+static void ApplyReleaseSlots(ApplicationState& state) {
+    if (!state.capture) {
+        return;
+    }
+    BadLink::ReleaseSlotConfig config;
+    config.slot_us = state.simulation.slots_enabled ? static_cast<uint32_t>(state.simulation.slot_us) : 0;
+    config.max_packets = static_cast<uint32_t>(state.simulation.slot_max_packets);
+    config.max_bytes = static_cast<uint32_t>(state.simulation.slot_max_bytes);
+    state.capture->SetReleaseSlots(config);
+}
+
+// Install the configured traffic classes into the bandwidth module
+static void ApplyTrafficClasses(ApplicationState& state) {
+    if (!state.capture) {
+        return;
+    }
+
+    auto result = state.capture->SetTrafficClasses(state.config.traffic_classes);
+    state.classes_error = result.has_value() ? std::string{} : result.error();
+}
+
+// Install the configured named links, rules pick them up by name
+static void ApplyLinks(ApplicationState& state) {
+    if (!state.capture) {
+        return;
+    }
+
+    auto result = state.capture->SetLinks(state.config.links);
+    state.links_error = result.has_value() ? std::string{} : result.error();
+}
+
 static void ToggleCapture(ApplicationState& state) {
     bool is_capturing = state.capture && state.capture->IsCapturing();
 
@@ -237,46 +454,69 @@ static void ToggleCapture(ApplicationState& state) {
             state.capture = std::make_unique<BadLink::NetworkCapture>();
         }
 
-        auto result = state.capture->Start(state.filter_buffer, state.config.params);
+        state.capture->SetRandomSeed(state.config.simulation.seed);
+        auto backend = state.capture->SetBackend(state.config.generator_enabled ?
+            std::make_unique<BadLink::TrafficGenerator>(state.config.generator) : nullptr);
+        auto result = backend.has_value() ? state.capture->Start(state.filter_buffer, state.config.params) : backend;
         if (!result.has_value()) {
             auto error = state.capture->GetLastErrorMessage();
-            state.capture_error = error.value_or("Unknown error");
+            state.capture_error = error.value_or(result.error());
         }
         else {
             state.capture_error.clear();
 
             // Apply current simulation settings
+            ApplyDirectionProfiles(state);
             state.capture->SetPacketLossEnabled(state.simulation.packet_loss_enabled);
-            state.capture->SetPacketLossRate(state.simulation.packet_loss_rate);
             state.capture->SetPacketLossInbound(state.simulation.packet_loss_inbound);
             state.capture->SetPacketLossOutbound(state.simulation.packet_loss_outbound);
 
             state.capture->SetLatencyEnabled(state.simulation.latency_enabled);
-            state.capture->SetLatency(state.simulation.latency_ms);
             state.capture->SetLatencyInbound(state.simulation.latency_inbound);
             state.capture->SetLatencyOutbound(state.simulation.latency_outbound);
+            state.capture->SetLatencyMap(state.simulation.latency_map);
 
             state.capture->SetDuplicateEnabled(state.simulation.duplicate_enabled);
-            state.capture->SetDuplicateRate(state.simulation.duplicate_rate);
-            state.capture->SetDuplicateCount(state.simulation.duplicate_count);
             state.capture->SetDuplicateInbound(state.simulation.duplicate_inbound);
             state.capture->SetDuplicateOutbound(state.simulation.duplicate_outbound);
 
+            state.capture->SetCorruptionEnabled(state.simulation.corruption_enabled);
+            state.capture->SetCorruptionFixChecksums(state.simulation.corruption_fix_checksums);
+            state.capture->SetCorruptionInbound(state.simulation.corruption_inbound);
+            state.capture->SetCorruptionOutbound(state.simulation.corruption_outbound);
+
+            state.capture->SetRewriteEnabled(state.simulation.rewrite_enabled);
+            state.capture->SetRewriteInbound(state.simulation.rewrite_inbound);
+            state.capture->SetRewriteOutbound(state.simulation.rewrite_outbound);
+
+            state.capture->SetMtuEnabled(state.simulation.mtu_enabled);
+            state.capture->SetMtuAction(static_cast<BadLink::MtuAction>(state.simulation.mtu_action));
+            state.capture->SetMtuReassembly(state.simulation.mtu_reassembly);
+            state.capture->SetMtuInbound(state.simulation.mtu_inbound);
+            state.capture->SetMtuOutbound(state.simulation.mtu_outbound);
+
             state.capture->SetOutOfOrderEnabled(state.simulation.out_of_order_enabled);
-            state.capture->SetOutOfOrderRate(state.simulation.out_of_order_rate);
-            state.capture->SetReorderGap(state.simulation.reorder_gap);
             state.capture->SetOutOfOrderInbound(state.simulation.out_of_order_inbound);
             state.capture->SetOutOfOrderOutbound(state.simulation.out_of_order_outbound);
 
             state.capture->SetJitterEnabled(state.simulation.jitter_enabled);
-            state.capture->SetJitterRange(state.simulation.jitter_min_ms, state.simulation.jitter_max_ms);
             state.capture->SetJitterInbound(state.simulation.jitter_inbound);
             state.capture->SetJitterOutbound(state.simulation.jitter_outbound);
 
             state.capture->SetBandwidthEnabled(state.simulation.bandwidth_enabled);
-            state.capture->SetBandwidthLimit(state.simulation.bandwidth_kbps);
             state.capture->SetBandwidthInbound(state.simulation.bandwidth_inbound);
             state.capture->SetBandwidthOutbound(state.simulation.bandwidth_outbound);
+            state.capture->SetBandwidthFlowLimit(state.simulation.bandwidth_flow_kbps);
+            state.capture->SetSynRateLimit(state.simulation.syn_rate);
+            state.capture->SetBandwidthMode(static_cast<BadLink::BandwidthMode>(state.simulation.bandwidth_mode));
+            state.capture->SetPolicer(PolicerFromSettings(state));
+            ApplyCrossTraffic(state);
+            ApplyTrafficClasses(state);
+            ApplyLinks(state);
+            ApplyReleaseSlots(state);
+            ApplyOutage(state);
+
+            ApplyRules(state);
         }
     }
     else {
@@ -476,7 +716,7 @@ static void RenderControlPanel(ApplicationState& state, const WinDivertStatus& d
             state.config_dirty = true;
         }
         if (ImGui::IsItemHovered())
-            ImGui::SetTooltip("Requires restart");
+            ImGui::SetTooltip("Requires restart\nBadLinkBench.exe --capture shows how this machine scales");
 
         int packet_buffer_kb = state.config.params.packet_buffer_size / 1024;
         if (ImGui::SliderInt("Packet Buffer (KB)", &packet_buffer_kb, 1, 128)) {
@@ -502,12 +742,94 @@ static void RenderControlPanel(ApplicationState& state, const WinDivertStatus& d
 
     ImGui::Separator();
 
+    // Synthetic traffic in place of the capture, to load the engine without a driver or a network
+    if (ImGui::CollapsingHeader("Synthetic Traffic")) {
+        BadLink::TrafficProfile& generator = state.config.generator;
+        if (ImGui::Checkbox("Generate Instead of Capture", &state.config.generator_enabled)) {
+            state.config_dirty = true;
+        }
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Applies from the next capture start\nThe filter is ignored, processed packets are counted and dropped");
+
+        float mpps = static_cast<float>(generator.packets_per_second / 1e6);
+        if (ImGui::SliderFloat("Rate (Mpps)", &mpps, 0.0f, 20.0f, "%.2f", ImGuiSliderFlags_Logarithmic)) {
+            generator.packets_per_second = mpps * 1e6;
+            state.config_dirty = true;
+        }
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("0 generates as fast as the worker threads take packets");
+
+        int flows = static_cast<int>(generator.flows);
+        if (ImGui::SliderInt("Active Flows", &flows, 1, 100000, "%d", ImGuiSliderFlags_Logarithmic)) {
+            generator.flows = flows;
+            state.config_dirty = true;
+        }
+
+        float shape = static_cast<float>(generator.flow_size_shape);
+        if (ImGui::SliderFloat("Flow Size Shape", &shape, 0.5f, 3.0f, "%.2f")) {
+            generator.flow_size_shape = shape;
+            state.config_dirty = true;
+        }
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Pareto shape of packets per flow\nLower makes a few elephant flows carry most packets");
+
+        float ipv6 = static_cast<float>(generator.ipv6_share * 100.0);
+        float tcp = static_cast<float>(generator.tcp_share * 100.0);
+        float outbound = static_cast<float>(generator.outbound_share * 100.0);
+        if (ImGui::SliderFloat("IPv6 (%)", &ipv6, 0.0f, 100.0f, "%.0f")) {
+            generator.ipv6_share = ipv6 / 100.0;
+            state.config_dirty = true;
+        }
+        if (ImGui::SliderFloat("TCP (%)", &tcp, 0.0f, 100.0f, "%.0f")) {
+            generator.tcp_share = tcp / 100.0;
+            state.config_dirty = true;
+        }
+        if (ImGui::SliderFloat("Outbound (%)", &outbound, 0.0f, 100.0f, "%.0f")) {
+            generator.outbound_share = outbound / 100.0;
+            state.config_dirty = true;
+        }
+
+        ImGui::SetNextItemWidth(-60);
+        ImGui::InputTextWithHint("##PacketSizes", "64:7, 576:4, 1500:1  (bytes:weight)",
+            state.generator_sizes, sizeof(state.generator_sizes));
+        ImGui::SameLine();
+        if (ImGui::Button("Apply")) {
+            auto sizes = BadLink::ParsePacketSizes(state.generator_sizes);
+            if (sizes.has_value()) {
+                generator.packet_sizes = std::move(*sizes);
+                state.generator_sizes[0] = '\0';
+                state.generator_error.clear();
+                state.config_dirty = true;
+            }
+            else {
+                state.generator_error = sizes.error();
+            }
+        }
+        if (!state.generator_error.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", state.generator_error.c_str());
+        }
+        else {
+            ImGui::TextDisabled("Sizes: %s", BadLink::FormatPacketSizes(generator.packet_sizes).c_str());
+        }
+
+        // The generator only hands out batches whose every packet could be the largest
+        const auto largest = std::ranges::max(generator.packet_sizes, {}, &BadLink::PacketSizeWeight::bytes);
+        if (largest.bytes > state.config.params.packet_buffer_size) {
+            ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Packet buffer is smaller than %u byte packets", largest.bytes);
+        }
+    }
+
+    ImGui::Separator();
+
     // Network Parameters
     if (ImGui::CollapsingHeader("Network Parameters", ImGuiTreeNodeFlags_DefaultOpen)) {
         int mtu = static_cast<int>(state.config.params.mtu_size);
         if (ImGui::SliderInt("MTU Size", &mtu, 576, 9000)) {
             state.config.params.mtu_size = mtu;
             state.config_dirty = true;
+            if (state.capture) {
+                state.capture->SetMtuSize(mtu);
+            }
         }
 
         int max_packet = static_cast<int>(state.config.params.max_packet_size);
@@ -544,6 +866,11 @@ static void RenderControlPanel(ApplicationState& state, const WinDivertStatus& d
             state.config.params = BadLink::CaptureParameters{};
             state.config.filter_presets = BadLink::Config::GetDefaultPresets();
             state.config.capture_hotkey = BadLink::Config::HotkeyConfig{};
+            state.config.rules.clear();
+            state.config.unmatched_modules = BadLink::ModuleMask::ALL;
+            state.config.traffic_classes.clear();
+            state.config.generator_enabled = false;
+            state.config.generator = BadLink::TrafficProfile{};
             state.config_dirty = true;
         }
     }
@@ -561,6 +888,11 @@ static void RenderControlPanel(ApplicationState& state, const WinDivertStatus& d
             ImGui::Text("Bytes Captured: %llu", stats.bytes_captured);
             ImGui::Text("Batch Operations: %llu", stats.batch_count);
             ImGui::Text("Avg Batch Size: %.2f packets", stats.avg_batch_size);
+            ImGui::Text("Active Flows: %zu (%llu evicted)", stats.active_flows, stats.flow_evictions);
+            if (stats.slots_sent > 0) {
+                ImGui::Text("Release Slots: %llu sent, %.1f packets avg, %zu waiting",
+                    stats.slots_sent, stats.avg_slot_packets, stats.slot_backlog);
+            }
         }
         else {
             ImGui::TextDisabled("No capture session");
@@ -580,7 +912,7 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         return;
     }
 
-    if (!divert_status.driver_available) {
+    if (!divert_status.driver_available && !state.config.generator_enabled) {
         ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f),
             "Capture unavailable: check Control Panel for WinDivert status");
         ImGui::End();
@@ -689,6 +1021,51 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
     if (ImGui::CollapsingHeader("Network Simulation", ImGuiTreeNodeFlags_DefaultOpen)) {
         bool is_capturing = state.capture && state.capture->IsCapturing();
 
+        // Values per direction, while asymmetric the rows below edit the picked direction
+        auto& profile = state.config.simulation;
+        if (ImGui::Checkbox("Asymmetric", &profile.asymmetric)) {
+            if (profile.asymmetric) {
+                profile.directions[BadLink::DirectionIndex(BadLink::Direction::Inbound)] =
+                    profile.directions[BadLink::DirectionIndex(BadLink::Direction::Outbound)];
+            }
+            state.config_dirty = true;
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Separate values for inbound and outbound traffic, starting from the current ones");
+        }
+        ImGui::BeginDisabled(!profile.asymmetric);
+        ImGui::SameLine();
+        ImGui::RadioButton("Edit Inbound", &state.simulation.edit_direction, static_cast<int>(BadLink::Direction::Inbound));
+        ImGui::SameLine();
+        ImGui::RadioButton("Edit Outbound", &state.simulation.edit_direction, static_cast<int>(BadLink::Direction::Outbound));
+        ImGui::EndDisabled();
+
+        // Random seed, taken when the capture starts
+        ImGui::SetNextItemWidth(160);
+        if (ImGui::InputScalar("Seed", ImGuiDataType_U64, &profile.seed)) {
+            state.config_dirty = true;
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("The same seed replays the same drops, delays and bit flips for the same traffic\n"
+                "0 picks a new seed every capture, applies when the capture starts");
+        }
+        if (is_capturing && state.capture) {
+            const uint64_t seed = state.capture->GetRandomSeed();
+            ImGui::SameLine();
+            ImGui::TextDisabled("In use: %llu", static_cast<unsigned long long>(seed));
+            if (profile.seed != seed) {
+                ImGui::SameLine();
+                if (ImGui::SmallButton("Keep")) {
+                    profile.seed = seed;
+                    state.config_dirty = true;
+                }
+            }
+        }
+
+        auto& values = profile.directions[profile.asymmetric ?
+            state.simulation.edit_direction : BadLink::DirectionIndex(BadLink::Direction::Outbound)];
+        bool values_changed = false;
+
         // Packet Loss
         ImGui::Text("Packet Loss:");
         ImGui::PushID("PacketLoss");
@@ -700,10 +1077,7 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         ImGui::BeginDisabled(!state.simulation.packet_loss_enabled);
         ImGui::SameLine();
         ImGui::SetNextItemWidth(150);
-        ImGui::SliderFloat("##Rate", &state.simulation.packet_loss_rate, 0.0f, 100.0f, "%.1f%%");
-        if (is_capturing && state.capture) {
-            state.capture->SetPacketLossRate(state.simulation.packet_loss_rate);
-        }
+        values_changed |= ImGui::SliderFloat("##Rate", &values.loss_rate, 0.0f, 100.0f, "%.1f%%");
 
         ImGui::SameLine();
         ImGui::Checkbox("Inbound", &state.simulation.packet_loss_inbound);
@@ -730,10 +1104,7 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         ImGui::BeginDisabled(!state.simulation.latency_enabled);
         ImGui::SameLine();
         ImGui::SetNextItemWidth(150);
-        ImGui::SliderInt("##Delay", &state.simulation.latency_ms, 0, 5000, "%d ms");
-        if (is_capturing && state.capture) {
-            state.capture->SetLatency(state.simulation.latency_ms);
-        }
+        values_changed |= ImGui::SliderInt("##Delay", &values.latency_ms, 0, 5000, "%d ms");
 
         ImGui::SameLine();
         ImGui::Checkbox("Inbound", &state.simulation.latency_inbound);
@@ -746,6 +1117,42 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         if (is_capturing && state.capture) {
             state.capture->SetLatencyOutbound(state.simulation.latency_outbound);
         }
+
+        // Per-destination map, built here so the capture threads only see a finished table
+        ImGui::SetNextItemWidth(-120);
+        ImGui::InputTextWithHint("##LatencyMap", "10.1.0.0/16 = 80, default = 20  or  map file path",
+            state.simulation.latency_map_spec, sizeof(state.simulation.latency_map_spec));
+        ImGui::SameLine();
+        if (ImGui::Button("Load")) {
+            const std::string_view spec = state.simulation.latency_map_spec;
+            auto map = spec.find('=') != std::string_view::npos ?
+                BadLink::LatencyMap::Parse(spec) : BadLink::LatencyMap::LoadFile(std::string(spec));
+            if (map.has_value()) {
+                state.simulation.latency_map = std::make_shared<const BadLink::LatencyMap>(std::move(*map));
+                state.simulation.latency_map_error.clear();
+            }
+            else {
+                state.simulation.latency_map_error = map.error();
+            }
+            if (state.capture) {
+                state.capture->SetLatencyMap(state.simulation.latency_map);
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) {
+            state.simulation.latency_map.reset();
+            state.simulation.latency_map_error.clear();
+            if (state.capture) {
+                state.capture->SetLatencyMap(nullptr);
+            }
+        }
+        if (!state.simulation.latency_map_error.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", state.simulation.latency_map_error.c_str());
+        }
+        else if (state.simulation.latency_map) {
+            ImGui::TextDisabled("Map: %zu prefixes, %.1f MB", state.simulation.latency_map->GetPrefixCount(),
+                state.simulation.latency_map->GetMemoryBytes() / (1024.0 * 1024.0));
+        }
         ImGui::EndDisabled();
         ImGui::PopID();
 
@@ -760,21 +1167,26 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         ImGui::BeginDisabled(!state.simulation.duplicate_enabled);
         ImGui::SameLine();
         ImGui::SetNextItemWidth(150);
-        ImGui::SliderFloat("##DupRate", &state.simulation.duplicate_rate, 0.0f, 100.0f, "%.1f%%");
-        if (is_capturing && state.capture) {
-            state.capture->SetDuplicateRate(state.simulation.duplicate_rate);
-        }
+        values_changed |= ImGui::SliderFloat("##DupRate", &values.duplicate_rate, 0.0f, 100.0f, "%.1f%%");
 
         ImGui::SameLine();
         ImGui::SetNextItemWidth(80);
-        ImGui::SliderInt("##Count", &state.simulation.duplicate_count, 1, 5, "%d");
-        if (is_capturing && state.capture) {
-            state.capture->SetDuplicateCount(state.simulation.duplicate_count);
-        }
+        values_changed |= ImGui::SliderInt("##Count", &values.duplicate_count, 1, 5, "%d");
         if (ImGui::IsItemHovered()) {
             ImGui::SetTooltip("Number of duplicate copies");
         }
 
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        values_changed |= ImGui::DragInt("##MinDupDelay", &values.duplicate_delay_min_ms, 1.0f, 0, 1000, "%d ms min");
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        values_changed |= ImGui::DragInt("##MaxDupDelay", &values.duplicate_delay_max_ms, 1.0f, 0, 1000, "%d ms max");
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Delay duplicates after the original (0 sends them together)");
+        }
+
         ImGui::SameLine();
         ImGui::Checkbox("Inbound", &state.simulation.duplicate_inbound);
         if (is_capturing && state.capture) {
@@ -789,6 +1201,133 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         ImGui::EndDisabled();
         ImGui::PopID();
 
+        // Bit Corruption
+        ImGui::Text("Bit Corruption:");
+        ImGui::PushID("Corruption");
+        ImGui::Checkbox("Enable", &state.simulation.corruption_enabled);
+        if (is_capturing && state.capture) {
+            state.capture->SetCorruptionEnabled(state.simulation.corruption_enabled);
+        }
+
+        ImGui::BeginDisabled(!state.simulation.corruption_enabled);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(150);
+        values_changed |= ImGui::SliderFloat("##BER", &values.corruption_ber, 0.000000001f, 0.01f, "BER %.1e",
+            ImGuiSliderFlags_Logarithmic);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Probability of each payload bit being flipped");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Fix Checksums", &state.simulation.corruption_fix_checksums);
+        if (is_capturing && state.capture) {
+            state.capture->SetCorruptionFixChecksums(state.simulation.corruption_fix_checksums);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Recompute checksums so corrupted packets reach the application");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Inbound", &state.simulation.corruption_inbound);
+        if (is_capturing && state.capture) {
+            state.capture->SetCorruptionInbound(state.simulation.corruption_inbound);
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Outbound", &state.simulation.corruption_outbound);
+        if (is_capturing && state.capture) {
+            state.capture->SetCorruptionOutbound(state.simulation.corruption_outbound);
+        }
+        ImGui::EndDisabled();
+        ImGui::PopID();
+
+        // Header Rewrite
+        ImGui::Text("Header Rewrite:");
+        ImGui::PushID("Rewrite");
+        ImGui::Checkbox("Enable", &state.simulation.rewrite_enabled);
+        if (is_capturing && state.capture) {
+            state.capture->SetRewriteEnabled(state.simulation.rewrite_enabled);
+        }
+
+        ImGui::BeginDisabled(!state.simulation.rewrite_enabled);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        values_changed |= ImGui::SliderInt("##HopDecrement", &values.rewrite_hop_decrement, 0, 64, "TTL -%d");
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Hops to subtract from TTL / hop limit, expired packets are dropped");
+        }
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        values_changed |= ImGui::SliderInt("##Dscp", &values.rewrite_dscp, -1, 63,
+            values.rewrite_dscp < 0 ? "DSCP keep" : "DSCP %d");
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        values_changed |= ImGui::DragInt("##MssClamp", &values.rewrite_mss_clamp, 4.0f, 0, 9000,
+            values.rewrite_mss_clamp == 0 ? "MSS off" : "MSS %d");
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Clamp the MSS option of TCP SYN packets (0 disables)");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Inbound", &state.simulation.rewrite_inbound);
+        if (is_capturing && state.capture) {
+            state.capture->SetRewriteInbound(state.simulation.rewrite_inbound);
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Outbound", &state.simulation.rewrite_outbound);
+        if (is_capturing && state.capture) {
+            state.capture->SetRewriteOutbound(state.simulation.rewrite_outbound);
+        }
+        ImGui::EndDisabled();
+        ImGui::PopID();
+
+        // MTU Enforcement
+        ImGui::Text("MTU Enforcement:");
+        ImGui::PushID("Mtu");
+        ImGui::Checkbox("Enable", &state.simulation.mtu_enabled);
+        if (is_capturing && state.capture) {
+            state.capture->SetMtuEnabled(state.simulation.mtu_enabled);
+        }
+
+        ImGui::BeginDisabled(!state.simulation.mtu_enabled);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(150);
+        const char* mtu_actions[] = { "Drop (blackhole)", "Fragment", "ICMP too big" };
+        ImGui::Combo("##MtuAction", &state.simulation.mtu_action, mtu_actions, IM_ARRAYSIZE(mtu_actions));
+        if (is_capturing && state.capture) {
+            state.capture->SetMtuAction(static_cast<BadLink::MtuAction>(state.simulation.mtu_action));
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Packets above %u bytes (Network Parameters > MTU Size)",
+                state.config.params.mtu_size);
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Reassemble", &state.simulation.mtu_reassembly);
+        if (is_capturing && state.capture) {
+            state.capture->SetMtuReassembly(state.simulation.mtu_reassembly);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Reassemble inbound IPv4 fragments before enforcing the MTU");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Inbound", &state.simulation.mtu_inbound);
+        if (is_capturing && state.capture) {
+            state.capture->SetMtuInbound(state.simulation.mtu_inbound);
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Outbound", &state.simulation.mtu_outbound);
+        if (is_capturing && state.capture) {
+            state.capture->SetMtuOutbound(state.simulation.mtu_outbound);
+        }
+        ImGui::EndDisabled();
+        ImGui::PopID();
+
         // Out of Order
         ImGui::Text("Out of Order:");
         ImGui::PushID("OutOfOrder");
@@ -800,17 +1339,11 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         ImGui::BeginDisabled(!state.simulation.out_of_order_enabled);
         ImGui::SameLine();
         ImGui::SetNextItemWidth(150);
-        ImGui::SliderFloat("##ReorderRate", &state.simulation.out_of_order_rate, 0.0f, 100.0f, "%.1f%%");
-        if (is_capturing && state.capture) {
-            state.capture->SetOutOfOrderRate(state.simulation.out_of_order_rate);
-        }
+        values_changed |= ImGui::SliderFloat("##ReorderRate", &values.reorder_rate, 0.0f, 100.0f, "%.1f%%");
 
         ImGui::SameLine();
         ImGui::SetNextItemWidth(80);
-        ImGui::SliderInt("##Gap", &state.simulation.reorder_gap, 2, 10, "%d");
-        if (is_capturing && state.capture) {
-            state.capture->SetReorderGap(state.simulation.reorder_gap);
-        }
+        values_changed |= ImGui::SliderInt("##Gap", &values.reorder_gap, 2, 10, "%d");
         if (ImGui::IsItemHovered()) {
             ImGui::SetTooltip("Buffer size before reordering");
         }
@@ -840,15 +1373,11 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         ImGui::BeginDisabled(!state.simulation.jitter_enabled);
         ImGui::SameLine();
         ImGui::SetNextItemWidth(100);
-        ImGui::DragInt("##MinJitter", &state.simulation.jitter_min_ms, 1.0f, 0, 1000, "%d ms min");
+        values_changed |= ImGui::DragInt("##MinJitter", &values.jitter_min_ms, 1.0f, 0, 1000, "%d ms min");
 
         ImGui::SameLine();
         ImGui::SetNextItemWidth(100);
-        ImGui::DragInt("##MaxJitter", &state.simulation.jitter_max_ms, 1.0f, 0, 5000, "%d ms max");
-        if (is_capturing && state.capture) {
-            state.capture->SetJitterRange(state.simulation.jitter_min_ms,
-                state.simulation.jitter_max_ms);
-        }
+        values_changed |= ImGui::DragInt("##MaxJitter", &values.jitter_max_ms, 1.0f, 0, 5000, "%d ms max");
 
         ImGui::SameLine();
         ImGui::Checkbox("Inbound", &state.simulation.jitter_inbound);
@@ -875,12 +1404,10 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         ImGui::BeginDisabled(!state.simulation.bandwidth_enabled);
         ImGui::SameLine();
         ImGui::SetNextItemWidth(200);
-        ImGui::SliderInt("##Bandwidth", &state.simulation.bandwidth_kbps, 56, 100000, "%d kbps");
-        if (is_capturing && state.capture) {
-            state.capture->SetBandwidthLimit(state.simulation.bandwidth_kbps);
-        }
+        values_changed |= ImGui::SliderInt("##Bandwidth", &values.bandwidth_kbps, 0, 100000,
+            values.bandwidth_kbps == 0 ? "No total cap" : "%d kbps");
         if (ImGui::IsItemHovered()) {
-            float mbps = state.simulation.bandwidth_kbps / 1000.0f;
+            float mbps = values.bandwidth_kbps / 1000.0f;
             ImGui::SetTooltip("%.2f Mbps", mbps);
         }
 
@@ -895,9 +1422,199 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         if (is_capturing && state.capture) {
             state.capture->SetBandwidthOutbound(state.simulation.bandwidth_outbound);
         }
+
+        const char* bandwidth_modes[] = { "Shaper (queue)", "Policer (drop)" };
+        ImGui::SetNextItemWidth(200);
+        ImGui::Combo("Mode", &state.simulation.bandwidth_mode, bandwidth_modes, IM_ARRAYSIZE(bandwidth_modes));
+        if (is_capturing && state.capture) {
+            state.capture->SetBandwidthMode(static_cast<BadLink::BandwidthMode>(state.simulation.bandwidth_mode));
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("A policer drops out-of-profile packets on arrival instead of queueing them, "
+                "the total limit is its committed rate");
+        }
+
+        const bool policing = state.simulation.bandwidth_mode == static_cast<int>(BadLink::BandwidthMode::Policer);
+        if (policing) {
+            const bool two_rate = state.simulation.policer_mode == static_cast<int>(BadLink::PolicerMode::TwoRate);
+            const char* policer_modes[] = { "Single rate (srTCM)", "Two rate (trTCM)" };
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(150);
+            ImGui::Combo("##PolicerMode", &state.simulation.policer_mode, policer_modes, IM_ARRAYSIZE(policer_modes));
+
+            ImGui::SetNextItemWidth(120);
+            ImGui::DragInt("CBS", &state.simulation.policer_committed_burst, 100.0f, 0, 10000000, "%d B");
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(120);
+            ImGui::DragInt(two_rate ? "PBS" : "EBS", &state.simulation.policer_excess_burst, 100.0f, 0, 10000000, "%d B");
+            if (two_rate) {
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(150);
+                ImGui::SliderInt("PIR", &state.simulation.policer_peak_kbps, 0, 100000, "%d kbps");
+            }
+            ImGui::SameLine();
+            ImGui::Checkbox("Drop Exceeding", &state.simulation.policer_drop_exceeding);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Drop yellow packets too, otherwise only red ones are dropped");
+            }
+            if (is_capturing && state.capture) {
+                state.capture->SetPolicer(PolicerFromSettings(state));
+            }
+        }
+
+        ImGui::BeginDisabled(policing);
+        ImGui::SetNextItemWidth(200);
+        ImGui::SliderInt("Per Flow", &state.simulation.bandwidth_flow_kbps, 0, 100000,
+            state.simulation.bandwidth_flow_kbps == 0 ? "Off" : "%d kbps");
+        if (is_capturing && state.capture) {
+            state.capture->SetBandwidthFlowLimit(state.simulation.bandwidth_flow_kbps);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Caps every connection on its own, queue depth and drops show in the Packet Monitor");
+        }
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(150);
+        ImGui::SliderInt("New Connections", &state.simulation.syn_rate, 0, 1000,
+            state.simulation.syn_rate == 0 ? "Unlimited" : "%d /s");
+        if (is_capturing && state.capture) {
+            state.capture->SetSynRateLimit(state.simulation.syn_rate);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("SYN policing: connection attempts beyond this rate are dropped");
+        }
+
+        // Background load, only virtual bytes: nothing is generated or sent
+        const char* cross_models[] = { "No cross traffic", "Constant", "On/Off", "Poisson", "Trace" };
+        ImGui::SetNextItemWidth(200);
+        ImGui::Combo("Cross Traffic", &state.simulation.cross_model, cross_models, IM_ARRAYSIZE(cross_models));
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Virtual background load sharing the shaper queue with real packets");
+        }
+        const auto cross_model = static_cast<BadLink::CrossTrafficModel>(state.simulation.cross_model);
+        if (cross_model != BadLink::CrossTrafficModel::Off && cross_model != BadLink::CrossTrafficModel::Trace) {
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(150);
+            ImGui::SliderInt("##CrossRate", &state.simulation.cross_rate_kbps, 0, 100000, "%d kbps");
+        }
+        if (cross_model == BadLink::CrossTrafficModel::OnOff) {
+            ImGui::SetNextItemWidth(120);
+            ImGui::DragInt("##CrossOn", &state.simulation.cross_on_ms, 10.0f, 1, 60000, "%d ms on");
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(120);
+            ImGui::DragInt("##CrossOff", &state.simulation.cross_off_ms, 10.0f, 1, 60000, "%d ms off");
+        }
+        else if (cross_model == BadLink::CrossTrafficModel::Poisson) {
+            ImGui::SetNextItemWidth(120);
+            ImGui::DragInt("##CrossPacket", &state.simulation.cross_packet_bytes, 10.0f, 40, 65535, "%d B packets");
+        }
+        else if (cross_model == BadLink::CrossTrafficModel::Trace) {
+            ImGui::SetNextItemWidth(-120);
+            ImGui::InputTextWithHint("##CrossTrace", "500ms = 2000kbps, 1000 = 0  or  trace file path",
+                state.simulation.cross_trace_spec, sizeof(state.simulation.cross_trace_spec));
+            ImGui::SameLine();
+            if (ImGui::Button("Load##CrossTrace")) {
+                const std::string_view spec = state.simulation.cross_trace_spec;
+                auto trace = spec.find('=') != std::string_view::npos ?
+                    BadLink::CrossTraffic::ParseTrace(spec) : BadLink::CrossTraffic::LoadTrace(std::string(spec));
+                if (trace.has_value()) {
+                    state.simulation.cross_traffic.trace = std::move(*trace);
+                    state.simulation.cross_trace_error.clear();
+                }
+                else {
+                    state.simulation.cross_trace_error = trace.error();
+                }
+            }
+            if (!state.simulation.cross_trace_error.empty()) {
+                ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", state.simulation.cross_trace_error.c_str());
+            }
+            else if (!state.simulation.cross_traffic.trace.empty()) {
+                ImGui::TextDisabled("%zu trace steps loaded", state.simulation.cross_traffic.trace.size());
+            }
+        }
+        if (is_capturing && state.capture) {
+            ApplyCrossTraffic(state);
+        }
+        ImGui::EndDisabled();
+        ImGui::EndDisabled();
+        ImGui::PopID();
+
+        // Link Outage
+        ImGui::Text("Link Outage:");
+        ImGui::PushID("Outage");
+        ImGui::Checkbox("Enable", &state.simulation.outage_enabled);
+
+        ImGui::BeginDisabled(!state.simulation.outage_enabled);
+        ImGui::SameLine();
+        const char* outage_schedules[] = { "Periodic", "Random" };
+        ImGui::SetNextItemWidth(100);
+        ImGui::Combo("##Schedule", &state.simulation.outage_schedule, outage_schedules, IM_ARRAYSIZE(outage_schedules));
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Random draws up and down times from exponential distributions around the values");
+        }
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(110);
+        ImGui::DragInt("##Up", &state.simulation.outage_up_ms, 100.0f, 1, 3600000, "%d ms up");
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(110);
+        ImGui::DragInt("##Down", &state.simulation.outage_down_ms, 10.0f, 1, 600000, "%d ms down");
+
+        ImGui::SameLine();
+        const char* outage_actions[] = { "Drop", "Hold" };
+        ImGui::SetNextItemWidth(70);
+        ImGui::Combo("##Action", &state.simulation.outage_action, outage_actions, IM_ARRAYSIZE(outage_actions));
+        if (state.simulation.outage_action == static_cast<int>(BadLink::OutageAction::Hold)) {
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(120);
+            ImGui::DragInt("##HoldLimit", &state.simulation.outage_hold_limit, 10.0f, 0, 1000000, "%d packets held");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Inbound", &state.simulation.outage_inbound);
+        ImGui::SameLine();
+        ImGui::Checkbox("Outbound", &state.simulation.outage_outbound);
+        ImGui::EndDisabled();
+        if (is_capturing) {
+            ApplyOutage(state);
+        }
+        ImGui::PopID();
+
+        // Release Slots
+        ImGui::Text("Release Slots:");
+        ImGui::PushID("ReleaseSlots");
+        ImGui::Checkbox("Enable", &state.simulation.slots_enabled);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Release delayed packets in bursts on slot boundaries,\n"
+                "like Wi-Fi A-MPDU aggregation or cellular TTIs");
+        }
+
+        ImGui::BeginDisabled(!state.simulation.slots_enabled);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(110);
+        ImGui::DragInt("##SlotUs", &state.simulation.slot_us, 10.0f, 100, 100000, "%d us slot");
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(110);
+        ImGui::DragInt("##SlotPackets", &state.simulation.slot_max_packets, 1.0f, 0, 1024, "%d packets max");
+
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(110);
+        ImGui::DragInt("##SlotBytes", &state.simulation.slot_max_bytes, 100.0f, 0, 1048576, "%d B max");
         ImGui::EndDisabled();
+        if (is_capturing) {
+            ApplyReleaseSlots(state);
+        }
         ImGui::PopID();
 
+        if (values_changed) {
+            state.config_dirty = true;
+        }
+        if (is_capturing) {
+            ApplyDirectionProfiles(state);
+        }
+
         ImGui::Separator();
 
         // Simulation Status Summary
@@ -906,54 +1623,125 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
             int active_count = 0;
 
             if (state.simulation.packet_loss_enabled) {
-                ImGui::BulletText("Packet Loss: %.1f%% (%s%s%s)",
-                    state.simulation.packet_loss_rate,
+                ImGui::BulletText("Packet Loss: %s (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("{:.1f}%", settings.loss_rate); }).c_str(),
                     state.simulation.packet_loss_inbound ? "IN" : "",
                     (state.simulation.packet_loss_inbound && state.simulation.packet_loss_outbound) ? "/" : "",
                     state.simulation.packet_loss_outbound ? "OUT" : "");
                 active_count++;
             }
             if (state.simulation.latency_enabled) {
-                ImGui::BulletText("Latency: %d ms (%s%s%s)%s",
-                    state.simulation.latency_ms,
+                ImGui::BulletText("Latency: %s%s (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("{} ms", settings.latency_ms); }).c_str(),
+                    state.simulation.latency_map ? " + map" : "",
                     state.simulation.latency_inbound ? "IN" : "",
                     (state.simulation.latency_inbound&& state.simulation.latency_outbound) ? "/" : "",
                     state.simulation.latency_outbound ? "OUT" : "");
                 active_count++;
             }
             if (state.simulation.duplicate_enabled) {
-                ImGui::BulletText("Duplicate: %.1f%% x%d (%s%s%s)",
-                    state.simulation.duplicate_rate,
-                    state.simulation.duplicate_count,
+                ImGui::BulletText("Duplicate: %s (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("{:.1f}% x{} +{}-{} ms", settings.duplicate_rate, settings.duplicate_count,
+                            settings.duplicate_delay_min_ms, settings.duplicate_delay_max_ms); }).c_str(),
                     state.simulation.duplicate_inbound ? "IN" : "",
                     (state.simulation.duplicate_inbound && state.simulation.duplicate_outbound) ? "/" : "",
                     state.simulation.duplicate_outbound ? "OUT" : "");
                 active_count++;
             }
+            if (state.simulation.corruption_enabled) {
+                ImGui::BulletText("Corruption: %s%s, %llu packets (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("BER {:.1e}", settings.corruption_ber); }).c_str(),
+                    state.simulation.corruption_fix_checksums ? " fixed" : " broken",
+                    state.capture->GetCorruptedPackets(),
+                    state.simulation.corruption_inbound ? "IN" : "",
+                    (state.simulation.corruption_inbound && state.simulation.corruption_outbound) ? "/" : "",
+                    state.simulation.corruption_outbound ? "OUT" : "");
+                active_count++;
+            }
+            if (state.simulation.rewrite_enabled) {
+                ImGui::BulletText("Rewrite: %s, %llu packets, %llu expired (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("TTL -{}, DSCP {}, MSS {}", settings.rewrite_hop_decrement,
+                            settings.rewrite_dscp, settings.rewrite_mss_clamp); }).c_str(),
+                    state.capture->GetRewrittenPackets(),
+                    state.capture->GetExpiredPackets(),
+                    state.simulation.rewrite_inbound ? "IN" : "",
+                    (state.simulation.rewrite_inbound && state.simulation.rewrite_outbound) ? "/" : "",
+                    state.simulation.rewrite_outbound ? "OUT" : "");
+                active_count++;
+            }
+            if (state.simulation.mtu_enabled) {
+                ImGui::BulletText("MTU: %u bytes, %llu dropped, %llu fragments, %llu ICMP, %llu reassembled (%s%s%s)",
+                    state.config.params.mtu_size,
+                    state.capture->GetMtuDroppedPackets(),
+                    state.capture->GetFragmentsCreated(),
+                    state.capture->GetIcmpTooBigSent(),
+                    state.capture->GetReassembledPackets(),
+                    state.simulation.mtu_inbound ? "IN" : "",
+                    (state.simulation.mtu_inbound && state.simulation.mtu_outbound) ? "/" : "",
+                    state.simulation.mtu_outbound ? "OUT" : "");
+                active_count++;
+            }
             if (state.simulation.out_of_order_enabled) {
-                ImGui::BulletText("Out of Order: %.1f%% gap:%d (%s%s%s)",
-                    state.simulation.out_of_order_rate,
-                    state.simulation.reorder_gap,
+                ImGui::BulletText("Out of Order: %s (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("{:.1f}% gap:{}", settings.reorder_rate, settings.reorder_gap); }).c_str(),
                     state.simulation.out_of_order_inbound ? "IN" : "",
                     (state.simulation.out_of_order_inbound && state.simulation.out_of_order_outbound) ? "/" : "",
                     state.simulation.out_of_order_outbound ? "OUT" : "");
                 active_count++;
             }
             if (state.simulation.jitter_enabled) {
-                ImGui::BulletText("Jitter: %d-%d ms (%s%s%s)",
-                    state.simulation.jitter_min_ms,
-                    state.simulation.jitter_max_ms,
+                ImGui::BulletText("Jitter: %s (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("{}-{} ms", settings.jitter_min_ms, settings.jitter_max_ms); }).c_str(),
                     state.simulation.jitter_inbound ? "IN" : "",
                     (state.simulation.jitter_inbound && state.simulation.jitter_outbound) ? "/" : "",
                     state.simulation.jitter_outbound ? "OUT" : "");
                 active_count++;
             }
             if (state.simulation.bandwidth_enabled) {
-                ImGui::BulletText("Bandwidth: %d kbps (%s%s%s)",
-                    state.simulation.bandwidth_kbps,
+                ImGui::BulletText("Bandwidth: %s (%s%s%s)",
+                    DirectionValues(profile, [](const auto& settings) {
+                        return std::format("{} kbps", settings.bandwidth_kbps); }).c_str(),
                     state.simulation.bandwidth_inbound ? "IN" : "",
                     (state.simulation.bandwidth_inbound && state.simulation.bandwidth_outbound) ? "/" : "",
                     state.simulation.bandwidth_outbound ? "OUT" : "");
+                if (state.simulation.bandwidth_mode == static_cast<int>(BadLink::BandwidthMode::Policer)) {
+                    const auto counters = state.capture->GetPolicerCounters();
+                    ImGui::BulletText("Policer: %llu conform, %llu exceed, %llu violate",
+                        counters.packets[0], counters.packets[1], counters.packets[2]);
+                }
+                else if (state.simulation.bandwidth_flow_kbps > 0 || state.simulation.syn_rate > 0) {
+                    ImGui::BulletText("Per Flow: %d kbps, %d new conn/s (0 = off)",
+                        state.simulation.bandwidth_flow_kbps, state.simulation.syn_rate);
+                }
+                if (state.simulation.cross_model != static_cast<int>(BadLink::CrossTrafficModel::Off)) {
+                    const auto cross = state.capture->GetCrossTrafficStats();
+                    ImGui::BulletText("Cross Traffic: %llu KB sent, %llu KB dropped, %llu KB queued",
+                        cross.sent_bytes / 1024, cross.dropped_bytes / 1024, cross.backlog_bytes / 1024);
+                }
+                active_count++;
+            }
+            if (state.simulation.outage_enabled) {
+                ImGui::BulletText("Outage: %s, %d ms down / %d ms up%s, %llu dropped (%s%s%s)",
+                    state.capture->IsLinkDown() ? "DOWN" : "up",
+                    state.simulation.outage_down_ms,
+                    state.simulation.outage_up_ms,
+                    state.simulation.outage_schedule == static_cast<int>(BadLink::OutageSchedule::Random) ? " avg" : "",
+                    state.capture->GetOutageDrops(),
+                    state.simulation.outage_inbound ? "IN" : "",
+                    (state.simulation.outage_inbound && state.simulation.outage_outbound) ? "/" : "",
+                    state.simulation.outage_outbound ? "OUT" : "");
+                active_count++;
+            }
+            if (state.simulation.slots_enabled) {
+                ImGui::BulletText("Release Slots: %d us, max %d packets / %d bytes (0 = no limit)",
+                    state.simulation.slot_us, state.simulation.slot_max_packets, state.simulation.slot_max_bytes);
                 active_count++;
             }
 
@@ -966,6 +1754,382 @@ static void RenderCaptureWindow(ApplicationState& state, const WinDivertStatus&
         }
     }
 
+    if (ImGui::CollapsingHeader("Traffic Rules")) {
+        bool is_capturing = state.capture && state.capture->IsCapturing();
+        bool rules_changed = false;
+        const char* directions[] = { "Any", "Inbound", "Outbound" };
+
+        ImGui::TextWrapped("Rules select which enabled impairments apply to a flow. First match wins.");
+
+        // Existing rules
+        for (size_t i = 0; i < state.config.rules.size(); ++i) {
+            const auto& rule = state.config.rules[i];
+            ImGui::PushID(static_cast<int>(i));
+            if (ImGui::SmallButton("Delete")) {
+                state.config.rules.erase(state.config.rules.begin() + i);
+                rules_changed = true;
+                ImGui::PopID();
+                break;
+            }
+            ImGui::SameLine();
+            ImGui::Text("%zu. %s: %s %s:%s -> %s:%s %s%s%s%s%s%s%s%s%s%s%s => %s",
+                i + 1,
+                rule.name.empty() ? "(unnamed)" : rule.name.c_str(),
+                rule.protocol.empty() ? "any" : rule.protocol.c_str(),
+                rule.src.empty() ? "*" : rule.src.c_str(),
+                rule.src_ports.empty() ? "*" : rule.src_ports.c_str(),
+                rule.dst.empty() ? "*" : rule.dst.c_str(),
+                rule.dst_ports.empty() ? "*" : rule.dst_ports.c_str(),
+                directions[static_cast<int>(rule.direction)],
+                rule.filter.empty() ? "" : " where ",
+                rule.filter.c_str(),
+                rule.content.empty() ? "" : " containing ",
+                rule.content.c_str(),
+                rule.domains.empty() ? "" : " for ",
+                rule.domains.c_str(),
+                rule.traffic_class.empty() ? "" : " in class ",
+                rule.traffic_class.c_str(),
+                rule.link.empty() ? "" : " on link ",
+                rule.link.c_str(),
+                BadLink::ModuleMaskToString(rule.modules).c_str());
+            ImGui::PopID();
+        }
+        if (state.config.rules.empty()) {
+            ImGui::TextDisabled("No rules, every enabled impairment applies to all traffic");
+        }
+
+        // New rule
+        ImGui::SeparatorText("Add Rule");
+        ImGui::PushID("RuleForm");
+        auto& form = state.rule_form;
+        ImGui::InputText("Name", form.name, sizeof(form.name));
+        ImGui::InputTextWithHint("Source", "10.0.0.0/8 or 2001:db8::/32", form.src, sizeof(form.src));
+        ImGui::InputTextWithHint("Source Ports", "443 or 1000-2000", form.src_ports, sizeof(form.src_ports));
+        ImGui::InputTextWithHint("Destination", "any", form.dst, sizeof(form.dst));
+        ImGui::InputTextWithHint("Destination Ports", "any", form.dst_ports, sizeof(form.dst_ports));
+        ImGui::InputTextWithHint("Protocol", "tcp, udp, icmp, icmpv6 or number", form.protocol, sizeof(form.protocol));
+        ImGui::Combo("Direction", &form.direction, directions, IM_ARRAYSIZE(directions));
+        ImGui::InputTextWithHint("Packet Filter", "optional, e.g. tcp.Syn or udp.PayloadLength > 200", form.filter, sizeof(form.filter));
+        ImGui::InputTextWithHint("Payload Content", "optional, e.g. GET /api/ or |80 60|", form.content, sizeof(form.content));
+        ImGui::InputTextWithHint("Domains", "optional, e.g. api.example.com, *.cdn.example.net", form.domains, sizeof(form.domains));
+        ImGui::InputTextWithHint("Traffic Class", "optional, a class from Traffic Classes", form.traffic_class, sizeof(form.traffic_class));
+        ImGui::InputTextWithHint("Link", "optional, a link from Links", form.link, sizeof(form.link));
+
+        for (size_t i = 0; i < BadLink::MODULE_NAMES.size(); ++i) {
+            if (i % 5 != 0) {
+                ImGui::SameLine();
+            }
+            ImGui::CheckboxFlags(BadLink::MODULE_NAMES[i].name, &form.modules, BadLink::MODULE_NAMES[i].bit);
+        }
+
+        ImGui::BeginDisabled(state.config.rules.size() >= BadLink::RuleClassifier::MAX_RULES);
+        if (ImGui::Button("Add Rule", ImVec2(-1, 0))) {
+            BadLink::ClassifierRule rule;
+            rule.name = form.name;
+            rule.src = form.src;
+            rule.dst = form.dst;
+            rule.src_ports = form.src_ports;
+            rule.dst_ports = form.dst_ports;
+            rule.protocol = form.protocol;
+            rule.filter = form.filter;
+            rule.content = form.content;
+            rule.domains = form.domains;
+            rule.traffic_class = form.traffic_class;
+            rule.link = form.link;
+            rule.direction = static_cast<BadLink::RuleDirection>(form.direction);
+            rule.modules = form.modules;
+
+            // Validate before accepting so a typo never reaches the capture
+            std::vector<BadLink::ClassifierRule> candidate = state.config.rules;
+            candidate.push_back(rule);
+            auto compiled = BadLink::RuleClassifier::Compile(candidate);
+            if (compiled.has_value()) {
+                state.config.rules = std::move(candidate);
+                state.rule_form = {};
+                rules_changed = true;
+            }
+            else {
+                state.rules_error = compiled.error();
+            }
+        }
+        ImGui::EndDisabled();
+        ImGui::PopID();
+
+        // Traffic no rule matches
+        ImGui::SeparatorText("Unmatched Traffic");
+        ImGui::PushID("Unmatched");
+        for (size_t i = 0; i < BadLink::MODULE_NAMES.size(); ++i) {
+            if (i % 5 != 0) {
+                ImGui::SameLine();
+            }
+            if (ImGui::CheckboxFlags(BadLink::MODULE_NAMES[i].name,
+                &state.config.unmatched_modules, BadLink::MODULE_NAMES[i].bit)) {
+                rules_changed = true;
+            }
+        }
+        ImGui::PopID();
+
+        if (rules_changed) {
+            state.config_dirty = true;
+            state.rules_error.clear();
+            ApplyRules(state);
+        }
+
+        if (!state.rules_error.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", state.rules_error.c_str());
+        }
+        else if (is_capturing && state.capture) {
+            ImGui::TextDisabled("%zu rules active", state.capture->GetRuleCount());
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Traffic Classes")) {
+        bool classes_changed = false;
+
+        ImGui::TextWrapped("Classes share the bandwidth limit: each is guaranteed its rate and borrows spare "
+            "capacity up to its ceil, lower priority numbers first. Traffic no rule or DSCP value "
+            "claims goes to the last class.");
+
+        // Existing classes
+        for (size_t i = 0; i < state.config.traffic_classes.size(); ++i) {
+            const auto& traffic_class = state.config.traffic_classes[i];
+            ImGui::PushID(static_cast<int>(i));
+            if (ImGui::SmallButton("Delete")) {
+                state.config.traffic_classes.erase(state.config.traffic_classes.begin() + i);
+                classes_changed = true;
+                ImGui::PopID();
+                break;
+            }
+            ImGui::SameLine();
+            ImGui::Text("%zu. %s: prio %d, %u kbps, ceil %u kbps, weight %u%s%s",
+                i + 1,
+                traffic_class.name.c_str(),
+                traffic_class.priority,
+                traffic_class.rate_kbps,
+                traffic_class.ceil_kbps == 0 ? traffic_class.rate_kbps : traffic_class.ceil_kbps,
+                traffic_class.weight,
+                traffic_class.dscp.empty() ? "" : ", DSCP ",
+                traffic_class.dscp.c_str());
+            ImGui::PopID();
+        }
+        if (state.config.traffic_classes.empty()) {
+            ImGui::TextDisabled("No classes, shaped traffic shares one queue");
+        }
+
+        // New class
+        ImGui::SeparatorText("Add Class");
+        ImGui::PushID("ClassForm");
+        auto& form = state.class_form;
+        ImGui::InputText("Name", form.name, sizeof(form.name));
+        ImGui::SliderInt("Priority", &form.priority, 0, static_cast<int>(BadLink::HtbScheduler::PRIORITIES) - 1);
+        ImGui::InputInt("Rate (kbps)", &form.rate_kbps, 100, 1000);
+        ImGui::InputInt("Ceil (kbps)", &form.ceil_kbps, 100, 1000);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Most the class may reach by borrowing, 0 = its rate");
+        }
+        ImGui::SliderInt("Weight", &form.weight, 1, 100);
+        ImGui::InputTextWithHint("DSCP", "optional, e.g. 46 or 32-40, 10", form.dscp, sizeof(form.dscp));
+
+        ImGui::BeginDisabled(state.config.traffic_classes.size() >= BadLink::HtbScheduler::MAX_CLASSES);
+        if (ImGui::Button("Add Class", ImVec2(-1, 0))) {
+            BadLink::TrafficClassConfig traffic_class;
+            traffic_class.name = form.name;
+            traffic_class.priority = static_cast<uint8_t>(form.priority);
+            traffic_class.rate_kbps = static_cast<uint32_t>(form.rate_kbps > 0 ? form.rate_kbps : 0);
+            traffic_class.ceil_kbps = static_cast<uint32_t>(form.ceil_kbps > 0 ? form.ceil_kbps : 0);
+            traffic_class.weight = static_cast<uint32_t>(form.weight);
+            traffic_class.dscp = form.dscp;
+
+            // Validate on a scratch scheduler so a typo never reaches the capture
+            std::vector<BadLink::TrafficClassConfig> candidate = state.config.traffic_classes;
+            candidate.push_back(traffic_class);
+            BadLink::HtbScheduler scratch;
+            std::vector<BadLink::SimulatedPacket> unused;
+            auto result = scratch.Configure(candidate, unused);
+            if (result.has_value()) {
+                state.config.traffic_classes = std::move(candidate);
+                state.class_form = {};
+                classes_changed = true;
+            }
+            else {
+                state.classes_error = result.error();
+            }
+        }
+        ImGui::EndDisabled();
+        ImGui::PopID();
+
+        if (classes_changed) {
+            state.config_dirty = true;
+            state.classes_error.clear();
+            ApplyTrafficClasses(state);
+        }
+
+        if (!state.classes_error.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", state.classes_error.c_str());
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Links")) {
+        bool links_changed = false;
+
+        ImGui::TextWrapped("Each link runs its own impairments for the traffic rules send to it, e.g. one "
+            "link per client class. Links share the capture and release threads, MTU and outages "
+            "apply to all of them.");
+
+        // Existing links, with what they carried this capture
+        const auto live = state.capture ? state.capture->GetLinks() : std::vector<BadLink::LinkInfo>{};
+        for (size_t i = 0; i < state.config.links.size(); ++i) {
+            const auto& link = state.config.links[i];
+            const auto& inbound = link.directions[BadLink::DirectionIndex(BadLink::Direction::Inbound)];
+            const auto& outbound = link.directions[BadLink::DirectionIndex(BadLink::Direction::Outbound)];
+            ImGui::PushID(static_cast<int>(i));
+            if (ImGui::SmallButton("Delete")) {
+                state.config.links.erase(state.config.links.begin() + i);
+                links_changed = true;
+                ImGui::PopID();
+                break;
+            }
+            ImGui::SameLine();
+            ImGui::Text("%zu. %s: %d/%d ms, %d/%d kbps (in/out) => %s",
+                i + 1,
+                link.name.c_str(),
+                inbound.latency_ms,
+                outbound.latency_ms,
+                inbound.bandwidth_kbps,
+                outbound.bandwidth_kbps,
+                BadLink::ModuleMaskToString(link.modules).c_str());
+            const auto it = std::ranges::find(live, link.name, &BadLink::LinkInfo::name);
+            if (it != live.end()) {
+                ImGui::SameLine();
+                ImGui::TextDisabled("%llu packets, %llu KB", it->packets, it->bytes / 1024);
+            }
+            ImGui::PopID();
+        }
+        if (state.config.links.empty()) {
+            ImGui::TextDisabled("No links, all traffic uses the Network Simulation settings");
+        }
+
+        // New link
+        ImGui::SeparatorText("Add Link");
+        ImGui::PushID("LinkForm");
+        auto& form = state.link_form;
+        ImGui::InputText("Name", form.name, sizeof(form.name));
+        for (size_t i = 0, shown = 0; i < BadLink::MODULE_NAMES.size(); ++i) {
+            if (BadLink::MODULE_NAMES[i].bit == BadLink::ModuleMask::MTU) {
+                continue;   // Link-wide
+            }
+            if (shown++ % 4 != 0) {
+                ImGui::SameLine();
+            }
+            ImGui::CheckboxFlags(BadLink::MODULE_NAMES[i].name, &form.modules, BadLink::MODULE_NAMES[i].bit);
+        }
+        ImGui::TextDisabled("Values are copied from the Network Simulation settings, per direction");
+
+        ImGui::BeginDisabled(state.config.links.size() >= BadLink::NetworkCapture::MAX_LINKS);
+        if (ImGui::Button("Add Link", ImVec2(-1, 0))) {
+            BadLink::LinkConfig link;
+            link.name = form.name;
+            link.modules = form.modules & ~BadLink::ModuleMask::MTU;
+            for (const auto direction : { BadLink::Direction::Inbound, BadLink::Direction::Outbound }) {
+                link.directions[BadLink::DirectionIndex(direction)] = state.config.simulation.For(direction);
+            }
+
+            if (link.name.empty()) {
+                state.links_error = "Links need a name";
+            }
+            else if (std::ranges::find(state.config.links, link.name, &BadLink::LinkConfig::name) !=
+                state.config.links.end()) {
+                state.links_error = std::format("Duplicate link '{}'", link.name);
+            }
+            else {
+                state.config.links.push_back(std::move(link));
+                state.link_form = {};
+                links_changed = true;
+            }
+        }
+        ImGui::EndDisabled();
+        ImGui::PopID();
+
+        if (links_changed) {
+            state.config_dirty = true;
+            state.links_error.clear();
+            ApplyLinks(state);
+        }
+
+        if (!state.links_error.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", state.links_error.c_str());
+        }
+    }
+
+    // Self Test
+    if (ImGui::CollapsingHeader("Self Test")) {
+        // Scenarios swap the run-wide random seed while they run, so not during a capture
+        const bool is_capturing = state.capture && state.capture->IsCapturing();
+        ImGui::BeginDisabled(is_capturing);
+        if (ImGui::Button("Run Scenarios")) {
+            state.self_test = BadLink::RunBuiltInScenarios();
+        }
+        ImGui::EndDisabled();
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+            ImGui::SetTooltip("Scripted flows through loss, latency, jitter, shaping and reordering with\n"
+                "statistical checks, in virtual time; stop the capture first");
+        }
+
+        for (const auto& check : state.self_test) {
+            ImGui::TextColored(check.passed ? ImVec4(0.0f, 1.0f, 0.0f, 1.0f) : ImVec4(1.0f, 0.3f, 0.3f, 1.0f),
+                check.passed ? "PASS" : "FAIL");
+            ImGui::SameLine();
+            ImGui::Text("%s, %s: %s", check.scenario.c_str(), check.check.c_str(), check.detail.c_str());
+        }
+    }
+
+    // Outage Log
+    if (state.capture && ImGui::CollapsingHeader("Outage Log")) {
+        const auto events = state.capture->GetOutageEvents();
+        if (ImGui::Button("Clear")) {
+            state.capture->ClearOutageEvents();
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("%zu outages", events.size());
+
+        if (ImGui::BeginTable("OutageEvents", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+            ImGuiTableFlags_ScrollY, ImVec2(0, 160))) {
+            ImGui::TableSetupScrollFreeze(0, 1);
+            ImGui::TableSetupColumn("Down");
+            ImGui::TableSetupColumn("Up");
+            ImGui::TableSetupColumn("Duration");
+            ImGui::TableSetupColumn("Dropped");
+            ImGui::TableSetupColumn("Held");
+            ImGui::TableHeadersRow();
+
+            const auto* zone = std::chrono::current_zone();
+            for (auto it = events.rbegin(); it != events.rend(); ++it) {
+                const bool ongoing = it->ended == std::chrono::system_clock::time_point{};
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(std::format("{:%H:%M:%S}",
+                    zone->to_local(std::chrono::floor<std::chrono::milliseconds>(it->started))).c_str());
+                ImGui::TableNextColumn();
+                if (ongoing) {
+                    ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "down");
+                }
+                else {
+                    ImGui::TextUnformatted(std::format("{:%H:%M:%S}",
+                        zone->to_local(std::chrono::floor<std::chrono::milliseconds>(it->ended))).c_str());
+                }
+                ImGui::TableNextColumn();
+                if (!ongoing) {
+                    ImGui::Text("%.1f ms", std::chrono::duration<double, std::milli>(it->duration).count());
+                }
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", it->dropped);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", it->held);
+            }
+            ImGui::EndTable();
+        }
+    }
+
     ImGui::End();
 }
 
@@ -1001,6 +2165,80 @@ void RenderPacketTable(ApplicationState& state) {
         state.packets.size(), state.config.params.visual_packet_buffer,
         state.packets.size());
 
+    // Flows queued by the per-flow bandwidth cap
+    if (state.capture && (state.simulation.bandwidth_flow_kbps > 0 || state.simulation.syn_rate > 0) &&
+        ImGui::CollapsingHeader("Shaped Flows", ImGuiTreeNodeFlags_DefaultOpen)) {
+        const auto queues = state.capture->GetFlowQueues(20);
+        ImGui::Text("Queued flows: %zu | Flow cap drops: %llu | SYN drops: %llu",
+            queues.size(), state.capture->GetFlowShaperDrops(), state.capture->GetSynDrops());
+
+        if (!queues.empty() && ImGui::BeginTable("FlowQueueTable", 5,
+            ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("Dir", ImGuiTableColumnFlags_WidthFixed, 50.0f);
+            ImGui::TableSetupColumn("Flow", ImGuiTableColumnFlags_WidthFixed, 420.0f);
+            ImGui::TableSetupColumn("Queued", ImGuiTableColumnFlags_WidthFixed, 80.0f);
+            ImGui::TableSetupColumn("Bytes", ImGuiTableColumnFlags_WidthFixed, 100.0f);
+            ImGui::TableSetupColumn("Drops", ImGuiTableColumnFlags_WidthFixed, 80.0f);
+            ImGui::TableHeadersRow();
+
+            for (const auto& queue : queues) {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text(queue.outbound ? "OUT" : "IN");
+
+                ImGui::TableSetColumnIndex(1);
+                const std::string src = std::visit([](const auto& addr) { return addr.ToString(); }, queue.src_addr);
+                const std::string dst = std::visit([](const auto& addr) { return addr.ToString(); }, queue.dst_addr);
+                ImGui::Text("%s:%d -> %s:%d", src.c_str(), queue.src_port, dst.c_str(), queue.dst_port);
+
+                ImGui::TableSetColumnIndex(2);
+                ImGui::Text("%zu", queue.queued_packets);
+                ImGui::TableSetColumnIndex(3);
+                ImGui::Text("%zu", queue.queued_bytes);
+                ImGui::TableSetColumnIndex(4);
+                ImGui::Text("%llu", queue.drops);
+            }
+            ImGui::EndTable();
+        }
+    }
+
+    // Traffic class rates, borrowing and queues
+    if (state.capture && !state.config.traffic_classes.empty() &&
+        ImGui::CollapsingHeader("Traffic Classes", ImGuiTreeNodeFlags_DefaultOpen)) {
+        const auto classes = state.capture->GetTrafficClasses();
+
+        if (!classes.empty() && ImGui::BeginTable("TrafficClassTable", 7,
+            ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("Class", ImGuiTableColumnFlags_WidthFixed, 160.0f);
+            ImGui::TableSetupColumn("Prio", ImGuiTableColumnFlags_WidthFixed, 40.0f);
+            ImGui::TableSetupColumn("Rate / Ceil", ImGuiTableColumnFlags_WidthFixed, 140.0f);
+            ImGui::TableSetupColumn("Current", ImGuiTableColumnFlags_WidthFixed, 100.0f);
+            ImGui::TableSetupColumn("Borrowed", ImGuiTableColumnFlags_WidthFixed, 100.0f);
+            ImGui::TableSetupColumn("Queued", ImGuiTableColumnFlags_WidthFixed, 80.0f);
+            ImGui::TableSetupColumn("Drops", ImGuiTableColumnFlags_WidthFixed, 80.0f);
+            ImGui::TableHeadersRow();
+
+            for (const auto& traffic_class : classes) {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("%s", traffic_class.name.c_str());
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text("%d", traffic_class.priority);
+                ImGui::TableSetColumnIndex(2);
+                ImGui::Text("%u / %u kbps", traffic_class.rate_kbps, traffic_class.ceil_kbps);
+                ImGui::TableSetColumnIndex(3);
+                ImGui::Text("%.0f kbps", traffic_class.current_kbps);
+                ImGui::TableSetColumnIndex(4);
+                ImGui::Text("%llu KB", traffic_class.borrowed_bytes / 1024);
+                ImGui::TableSetColumnIndex(5);
+                ImGui::Text("%zu", traffic_class.backlog_packets);
+                ImGui::TableSetColumnIndex(6);
+                ImGui::Text("%llu", traffic_class.drops);
+            }
+            ImGui::EndTable();
+        }
+    }
+
     ImGui::Separator();
 
     // Packet table
@@ -1117,8 +2355,8 @@ static void CheckHotkey(ApplicationState& state, const WinDivertStatus& divert_s
     bool alt_match = state.config.capture_hotkey.alt == ImGui::GetIO().KeyAlt;
 
     if (key_pressed && ctrl_match && shift_match && alt_match) {
-        // Only toggle if WinDivert is available
-        if (divert_status.driver_available) {
+        // Only toggle if WinDivert is available or nothing needs it
+        if (divert_status.driver_available || state.config.generator_enabled) {
             ToggleCapture(state);
         }
     }
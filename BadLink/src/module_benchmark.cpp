@@ -0,0 +1,566 @@
+#define NOMINMAX
+#include <windows.h>
+#include "module_benchmark.h"
+#include "bandwidth_module.h"
+#include "capture_backend.h"
+#include "duplicate_module.h"
+#include "jitter_module.h"
+#include "latency_module.h"
+#include "network_capture.h"
+#include "out_of_order_module.h"
+#include "packet_filter.h"
+#include "packet_loss_module.h"
+#include "payload_matcher.h"
+#include "random_utils.h"
+#include "scenario.h"
+#include "simulation_clock.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <memory>
+#include <new>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+    // Allocations of the measuring thread, only counted while a run is timed
+    thread_local bool counting_allocations = false;
+    thread_local uint64_t allocation_count = 0;
+    thread_local uint64_t allocation_bytes = 0;
+}
+
+// Replaced so the benchmark sees the modules' allocations, this file is only built into
+// BadLinkBench.exe, never into the GUI
+void* operator new(std::size_t size) {
+    if (counting_allocations) {
+        ++allocation_count;
+        allocation_bytes += size;
+    }
+    if (void* memory = std::malloc(size != 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace BadLink {
+
+    namespace {
+        using namespace std::chrono_literals;
+
+        // Delay of the delaying modules, the time step sets how many packets it holds
+        constexpr SimulationClock::duration MODULE_DELAY = 50ms;
+
+        // A configured module and the virtual time between two batches
+        struct BenchmarkSetup {
+            std::unique_ptr<SimulationModule> module;
+            SimulationClock::duration step{};
+        };
+
+        struct BenchmarkCase {
+            const char* name;
+            uint32_t mask;
+            bool queues;        // Holds packets, so the queue depth sweep applies
+            BenchmarkSetup(*make)(size_t depth, size_t batch, uint32_t bytes);
+        };
+
+        // Steady state of `depth` packets held for MODULE_DELAY at one batch per step
+        SimulationClock::duration DelayStep(size_t depth, size_t batch) {
+            if (depth == 0) {
+                return MODULE_DELAY + 1ms;
+            }
+            return std::max<SimulationClock::duration>(MODULE_DELAY * batch / depth, 1us);
+        }
+
+        const BenchmarkCase CASES[] = {
+            { "PacketLoss", ModuleMask::PACKET_LOSS, false, [](size_t, size_t, uint32_t) {
+                auto module = std::make_unique<PacketLossModule>();
+                module->SetLossRate(Direction::Outbound, 10.0f);
+                module->SetEnabled(true);
+                return BenchmarkSetup{ std::move(module), 1ms };
+            } },
+            { "Duplicate", ModuleMask::DUPLICATE, true, [](size_t depth, size_t batch, uint32_t) {
+                // Every packet leaves one delayed copy, the copies are the queue
+                auto module = std::make_unique<DuplicateModule>();
+                module->SetDuplicationRate(Direction::Outbound, 100.0f);
+                module->SetDuplicateCount(Direction::Outbound, 1);
+                const auto delay = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(MODULE_DELAY).count());
+                module->SetDuplicateDelay(Direction::Outbound, delay, delay);
+                module->SetEnabled(true);
+                return BenchmarkSetup{ std::move(module), DelayStep(depth, batch) };
+            } },
+            { "OutOfOrder", ModuleMask::OUT_OF_ORDER, true, [](size_t depth, size_t, uint32_t) {
+                // The reorder buffer is the queue
+                auto module = std::make_unique<OutOfOrderModule>();
+                module->SetReorderRate(Direction::Outbound, 10.0f);
+                module->SetReorderGap(Direction::Outbound, static_cast<uint32_t>(std::max<size_t>(depth, 3)));
+                module->SetEnabled(true);
+                return BenchmarkSetup{ std::move(module), 1ms };
+            } },
+            { "Jitter", ModuleMask::JITTER, true, [](size_t depth, size_t batch, uint32_t) {
+                auto module = std::make_unique<JitterModule>();
+                const auto delay = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(MODULE_DELAY).count());
+                module->SetJitterRange(Direction::Outbound, 0, delay * 2);
+                module->SetEnabled(true);
+                return BenchmarkSetup{ std::move(module), DelayStep(depth, batch) };
+            } },
+            { "Bandwidth", ModuleMask::BANDWIDTH, true, [](size_t, size_t batch, uint32_t bytes) {
+                // Drains exactly what arrives, a prefilled backlog stays at its depth
+                auto module = std::make_unique<BandwidthModule>();
+                module->SetBandwidthLimit(static_cast<uint32_t>(batch * bytes * 8));
+                module->SetEnabled(true);
+                return BenchmarkSetup{ std::move(module), 1ms };
+            } },
+            { "Latency", ModuleMask::LATENCY, true, [](size_t depth, size_t batch, uint32_t) {
+                auto module = std::make_unique<LatencyModule>();
+                module->SetLatency(Direction::Outbound,
+                    static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(MODULE_DELAY).count()));
+                module->SetEnabled(true);
+                return BenchmarkSetup{ std::move(module), DelayStep(depth, batch) };
+            } },
+        };
+
+        // IPv4 header and UDP ports of a `bytes` long packet between 10.0.0.1 and 10.0.0.2
+        void WriteUdpPacket(uint8_t* data, uint32_t bytes, uint16_t local_port, bool outbound) {
+            data[0] = 0x45;
+            StoreBe16(data + 2, static_cast<uint16_t>(bytes));
+            data[8] = 64;
+            data[9] = IpProtocol::UDP;
+            StoreBe32(data + (outbound ? 12 : 16), 0x0A000001u);
+            StoreBe32(data + (outbound ? 16 : 12), 0x0A000002u);
+            StoreBe16(data + (outbound ? 20 : 22), local_port);
+            StoreBe16(data + (outbound ? 22 : 20), 5001);
+            StoreBe16(data + 24, static_cast<uint16_t>(bytes - 20));
+        }
+
+        // Outbound UDP/IPv4 packets, `ratio` of them selected for the module, spread evenly
+        class PacketSource {
+        public:
+            PacketSource(uint32_t bytes, uint32_t mask, double ratio) : bytes_(std::max(bytes, 28u)), mask_(mask), ratio_(ratio) {}
+
+            std::vector<SimulatedPacket> Batch(size_t count, SimulationClock::time_point now,
+                std::unordered_set<const void*>& buffers) {
+                std::vector<SimulatedPacket> packets(count);
+                for (auto& packet : packets) {
+                    packet.data = std::make_shared<std::vector<uint8_t>>(bytes_, 0);
+                    WriteUdpPacket(packet.data->data(), bytes_, static_cast<uint16_t>(10000 + sequence_ % 64), true);
+                    packet.headers = ParseHeaders(*packet.data);
+                    packet.addr.Outbound = 1;
+                    packet.random_stream = { 0, sequence_ };
+                    packet.timestamp = now;
+
+                    const bool selected = static_cast<uint64_t>((sequence_ + 1) * ratio_) > static_cast<uint64_t>(sequence_ * ratio_);
+                    packet.modules = selected ? ModuleMask::ALL : (ModuleMask::ALL & ~mask_);
+                    ++sequence_;
+                    buffers.insert(packet.data.get());
+                }
+                return packets;
+            }
+
+        private:
+            uint32_t bytes_;
+            uint32_t mask_;
+            double ratio_;
+            uint64_t sequence_ = 0;
+        };
+
+        BenchmarkResult RunCase(const BenchmarkCase& benchmark, size_t batch, uint32_t bytes, size_t depth,
+            double ratio, size_t packets_per_run) {
+            VirtualClock clock;
+            BenchmarkSetup setup = benchmark.make(depth, batch, bytes);
+            SimulationModule& module = *setup.module;
+            module.SetClock(clock);
+
+            PacketSource source(bytes, benchmark.mask, ratio);
+            std::unordered_set<const void*> buffers;
+
+            // Fill the queue before measuring, everything selected so all of it is held
+            if (benchmark.queues && depth != 0) {
+                PacketSource prefill(bytes, benchmark.mask, 1.0);
+                [[maybe_unused]] auto passed = module.ProcessBatch(prefill.Batch(depth, clock.Now(), buffers));
+            }
+
+            // Build every batch up front, only the module's own work is timed
+            const size_t iterations = std::max<size_t>(1, packets_per_run / batch);
+            std::vector<std::vector<SimulatedPacket>> batches;
+            batches.reserve(iterations);
+            for (size_t i = 0; i < iterations; ++i) {
+                batches.push_back(source.Batch(batch, clock.Now() + setup.step * i, buffers));
+            }
+            std::vector<std::vector<SimulatedPacket>> outputs;
+            outputs.reserve(iterations * 2);
+
+            allocation_count = 0;
+            allocation_bytes = 0;
+            counting_allocations = true;
+            const auto started = std::chrono::steady_clock::now();
+            for (auto& packets : batches) {
+                outputs.push_back(module.ProcessBatch(std::move(packets)));
+                clock.Advance(setup.step);
+                outputs.push_back(module.GetReleasablePackets());
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - started;
+            counting_allocations = false;
+
+            // A buffer the source did not build was copied by the module
+            uint64_t copied = 0;
+            for (const auto& packets : outputs) {
+                for (const auto& packet : packets) {
+                    if (packet.data && !buffers.contains(packet.data.get())) {
+                        copied += packet.Size();
+                    }
+                }
+            }
+
+            BenchmarkResult result;
+            result.module = benchmark.name;
+            result.batch_size = batch;
+            result.packet_bytes = bytes;
+            result.queue_depth = benchmark.queues ? depth : 0;
+            result.enable_ratio = ratio;
+            result.packets = iterations * batch;
+            const double packets = static_cast<double>(result.packets);
+            result.ns_per_packet = std::chrono::duration<double, std::nano>(elapsed).count() / packets;
+            result.allocations_per_packet = allocation_count / packets;
+            result.bytes_allocated_per_packet = allocation_bytes / packets;
+            result.bytes_copied_per_packet = copied / packets;
+            return result;
+        }
+
+        // Engine settings of one capture benchmark profile, applied before Start
+        struct CaptureProfile {
+            const char* name;
+            void(*configure)(NetworkCapture& capture);
+        };
+
+        constexpr uint32_t PROFILE_LATENCY_MS = 20;
+        constexpr uint32_t PROFILE_BANDWIDTH_KBPS = 10'000'000;
+
+        const CaptureProfile PROFILES[] = {
+            { "LatencyOnly", [](NetworkCapture& capture) {
+                capture.SetLatency(Direction::Outbound, PROFILE_LATENCY_MS);
+                capture.SetLatency(Direction::Inbound, PROFILE_LATENCY_MS);
+                capture.SetLatencyEnabled(true);
+            } },
+            { "ShaperOnly", [](NetworkCapture& capture) {
+                capture.SetBandwidthLimit(Direction::Outbound, PROFILE_BANDWIDTH_KBPS);
+                capture.SetBandwidthLimit(Direction::Inbound, PROFILE_BANDWIDTH_KBPS);
+                capture.SetBandwidthEnabled(true);
+            } },
+            { "Everything", [](NetworkCapture& capture) {
+                for (const Direction direction : { Direction::Outbound, Direction::Inbound }) {
+                    capture.SetLatency(direction, PROFILE_LATENCY_MS);
+                    capture.SetPacketLossRate(direction, 1.0f);
+                    capture.SetDuplicateRate(direction, 1.0f);
+                    capture.SetDuplicateCount(direction, 1);
+                    capture.SetDuplicateDelay(direction, 0, 5);
+                    capture.SetOutOfOrderRate(direction, 1.0f);
+                    capture.SetReorderGap(direction, 3);
+                    capture.SetJitterRange(direction, 0, 5);
+                    capture.SetBandwidthLimit(direction, PROFILE_BANDWIDTH_KBPS);
+                    capture.SetCorruptionRate(direction, 1e-7);
+                    capture.SetRewriteHopDecrement(direction, 1);
+                }
+                capture.SetLatencyEnabled(true);
+                capture.SetPacketLossEnabled(true);
+                capture.SetDuplicateEnabled(true);
+                capture.SetOutOfOrderEnabled(true);
+                capture.SetJitterEnabled(true);
+                capture.SetBandwidthEnabled(true);
+                capture.SetCorruptionEnabled(true);
+                capture.SetRewriteEnabled(true);
+                capture.SetMtuSize(ConfigConstants::DEFAULT_MTU_SIZE);
+                capture.SetMtuEnabled(true);
+            } },
+        };
+
+        // One packet per flow, even flows outbound and odd ones inbound
+        std::vector<MemoryBackend::Packet> CapturePackets(const CaptureBenchmarkSweep& sweep) {
+            const uint32_t bytes = std::max(sweep.packet_bytes, 28u);
+            std::vector<MemoryBackend::Packet> packets(std::max(sweep.flows, 1u));
+            for (size_t flow = 0; flow < packets.size(); ++flow) {
+                MemoryBackend::Packet& packet = packets[flow];
+                packet.outbound = flow % 2 == 0;
+                packet.data.assign(bytes, 0);
+                WriteUdpPacket(packet.data.data(), bytes, static_cast<uint16_t>(10000 + flow), packet.outbound);
+            }
+            return packets;
+        }
+
+        double PercentileUs(const std::vector<std::chrono::nanoseconds>& sorted, double percentile) {
+            if (sorted.empty()) {
+                return 0;
+            }
+            const auto index = std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * percentile / 100.0));
+            return std::chrono::duration<double, std::micro>(sorted[index]).count();
+        }
+
+        uint64_t ProcessCycles() {
+            ULONG64 cycles = 0;
+            QueryProcessCycleTime(GetCurrentProcess(), &cycles);
+            return cycles;
+        }
+
+        CaptureBenchmarkResult RunCapture(const CaptureProfile& profile, uint32_t workers,
+            const CaptureBenchmarkSweep& sweep) {
+            using namespace std::chrono_literals;
+
+            CaptureBenchmarkResult result;
+            result.profile = profile.name;
+            result.worker_threads = workers;
+            result.offered_pps = sweep.offered_pps;
+
+            auto owned = std::make_unique<MemoryBackend>(CapturePackets(sweep), sweep.packets_per_run, sweep.offered_pps);
+            MemoryBackend& backend = *owned;
+            NetworkCapture capture;
+            capture.SetRandomSeed(1);
+            profile.configure(capture);
+            if (!capture.SetBackend(std::move(owned))) {
+                return result;
+            }
+
+            CaptureParameters params;
+            params.worker_threads = std::max(workers, 1u);
+            params.batch_size = std::max(sweep.batch_size, 1u);
+            params.packet_buffer_size = std::max(params.packet_buffer_size, params.batch_size * std::max(sweep.packet_bytes, 28u));
+
+            LockStats::Reset();
+            const uint64_t cycles_before = ProcessCycles();
+            if (!capture.Start(sweep.filter, params)) {
+                return result;
+            }
+
+            // Wait for the source to run dry, then for the held packets to come out
+            const auto deadline = std::chrono::steady_clock::now() + 60s;
+            uint64_t sent = 0;
+            auto last_progress = std::chrono::steady_clock::now();
+            while (std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(20ms);
+                const auto now = std::chrono::steady_clock::now();
+                if (backend.GetSent() != sent) {
+                    sent = backend.GetSent();
+                    last_progress = now;
+                }
+                else if (backend.IsExhausted() && now - last_progress >= 200ms) {
+                    break;
+                }
+            }
+
+            const uint64_t cycles = ProcessCycles() - cycles_before;
+            for (auto& lock : LockStats::Snapshot()) {
+                if (lock.acquisitions != 0) {
+                    result.locks.push_back(std::move(lock));
+                }
+            }
+            capture.Stop();
+
+            auto latencies = backend.GetLatencies();
+            std::ranges::sort(latencies);
+            result.packets = backend.GetReceived();
+            result.delivered = latencies.size();
+            const double active = std::chrono::duration<double>(backend.GetActiveTime()).count();
+            result.packets_per_second = active > 0 ? result.delivered / active : 0;
+            result.latency_p50_us = PercentileUs(latencies, 50);
+            result.latency_p99_us = PercentileUs(latencies, 99);
+            result.latency_p999_us = PercentileUs(latencies, 99.9);
+            result.cycles_per_packet = result.packets != 0 ? static_cast<double>(cycles) / result.packets : 0;
+            return result;
+        }
+    }
+
+    std::string BenchmarkResult::ToJson() const {
+        return std::format("{{\"module\":\"{}\",\"batch_size\":{},\"packet_bytes\":{},\"queue_depth\":{},"
+            "\"enable_ratio\":{:.2f},\"packets\":{},\"ns_per_packet\":{:.1f},\"allocations_per_packet\":{:.3f},"
+            "\"bytes_allocated_per_packet\":{:.1f},\"bytes_copied_per_packet\":{:.1f}}}",
+            module, batch_size, packet_bytes, queue_depth, enable_ratio, packets, ns_per_packet,
+            allocations_per_packet, bytes_allocated_per_packet, bytes_copied_per_packet);
+    }
+
+    std::vector<BenchmarkResult> RunModuleBenchmarks(const BenchmarkSweep& sweep,
+        const std::function<void(const BenchmarkResult&)>& on_result) {
+        std::vector<BenchmarkResult> results;
+        for (const auto& benchmark : CASES) {
+            // Modules without a queue only run the first depth
+            const size_t depths = benchmark.queues ? sweep.queue_depths.size() : std::min<size_t>(sweep.queue_depths.size(), 1);
+            for (size_t depth = 0; depth < depths; ++depth) {
+                for (const size_t batch : sweep.batch_sizes) {
+                    for (const uint32_t bytes : sweep.packet_bytes) {
+                        for (const double ratio : sweep.enable_ratios) {
+                            results.push_back(RunCase(benchmark, std::max<size_t>(batch, 1), bytes,
+                                sweep.queue_depths[depth], ratio, sweep.packets_per_run));
+                            if (on_result) {
+                                on_result(results.back());
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return results;
+    }
+
+    std::string FilterBenchmarkResult::ToJson() const {
+        return std::format("{{\"filter\":\"{}\",\"instructions\":{},\"packets\":{},\"interpreter_ns_per_packet\":{:.2f},"
+            "\"compiled_ns_per_packet\":{:.2f},\"speedup\":{:.2f},\"mismatches\":{}}}",
+            filter, instructions, packets, interpreter_ns_per_packet, compiled_ns_per_packet,
+            compiled_ns_per_packet > 0 ? interpreter_ns_per_packet / compiled_ns_per_packet : 0.0, mismatches);
+    }
+
+    std::vector<FilterBenchmarkResult> RunFilterBenchmarks(size_t packet_count,
+        const std::function<void(const FilterBenchmarkResult&)>& on_result) {
+        constexpr std::string_view RULE_FILTER =
+            "(tcp.DstPort == 443 or udp.DstPort == 443 or tcp.DstPort == 80) and outbound and !loopback "
+            "and (ip.DstAddr < 10.0.0.0 or ip.DstAddr > 10.255.255.255 or ipv6) and length > 100";
+        std::vector<std::string_view> filters;
+        for (const auto& preset : PRESET_FILTERS) {
+            filters.push_back(preset.expression);
+        }
+        filters.push_back(RULE_FILTER);
+
+        constexpr int FILTER_ROUNDS = 5;
+        const auto packets = MakeMixedPackets(std::max<size_t>(packet_count, 1));
+        std::vector<FilterBenchmarkResult> results;
+        for (const auto filter : filters) {
+            auto root = ParseFilter(filter);
+            auto program = root.has_value() ? FilterProgram::Compile(**root) : std::unexpected(root.error());
+            if (!program.has_value()) {
+                continue;
+            }
+
+            // Best of a few rounds each, the results are compared so neither loop is optimized away
+            std::vector<uint8_t> interpreted(packets.size());
+            std::vector<uint8_t> compiled;
+            auto interpreter_elapsed = std::chrono::steady_clock::duration::max();
+            auto compiled_elapsed = std::chrono::steady_clock::duration::max();
+            for (int round = 0; round < FILTER_ROUNDS; ++round) {
+                auto started = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < packets.size(); ++i) {
+                    interpreted[i] = (*root)->Evaluate(packets[i]) ? 1 : 0;
+                }
+                interpreter_elapsed = std::min(interpreter_elapsed, std::chrono::steady_clock::now() - started);
+
+                started = std::chrono::steady_clock::now();
+                program->Evaluate(packets, compiled);
+                compiled_elapsed = std::min(compiled_elapsed, std::chrono::steady_clock::now() - started);
+            }
+
+            FilterBenchmarkResult result;
+            result.filter = filter;
+            result.instructions = program->GetInstructionCount();
+            result.packets = packets.size();
+            const double count = static_cast<double>(packets.size());
+            result.interpreter_ns_per_packet = std::chrono::duration<double, std::nano>(interpreter_elapsed).count() / count;
+            result.compiled_ns_per_packet = std::chrono::duration<double, std::nano>(compiled_elapsed).count() / count;
+            for (size_t i = 0; i < packets.size(); ++i) {
+                result.mismatches += (compiled[i] != 0) != (interpreted[i] != 0) ? 1 : 0;
+            }
+            results.push_back(result);
+            if (on_result) {
+                on_result(results.back());
+            }
+        }
+        return results;
+    }
+
+    std::string MatcherBenchmarkResult::ToJson() const {
+        return std::format("{{\"patterns\":{},\"payload_bytes\":{},\"payloads\":{},\"vectorized\":{},"
+            "\"scalar_ns_per_payload\":{:.1f},\"vector_ns_per_payload\":{:.1f},\"speedup\":{:.2f},\"mismatches\":{}}}",
+            patterns, payload_bytes, payloads, vectorized, scalar_ns_per_payload, vector_ns_per_payload,
+            vector_ns_per_payload > 0 ? scalar_ns_per_payload / vector_ns_per_payload : 0.0, mismatches);
+    }
+
+    std::vector<MatcherBenchmarkResult> RunMatcherBenchmarks(size_t payload_count,
+        const std::function<void(const MatcherBenchmarkResult&)>& on_result) {
+        constexpr int MATCHER_ROUNDS = 5;
+        std::vector<MatcherBenchmarkResult> results;
+        for (const size_t pattern_count : { 1, 8, 64 }) {
+            // Printable patterns of 4-12 bytes, like the content rules users write
+            RandomStream rng(RandomDomain::SelfTest, 3, pattern_count);
+            std::vector<std::vector<uint8_t>> patterns(pattern_count);
+            for (auto& pattern : patterns) {
+                pattern.resize(rng.Between(4, 12));
+                for (auto& byte : pattern) {
+                    byte = static_cast<uint8_t>(rng.Between(' ', '~'));
+                }
+            }
+            auto matcher = PayloadMatcher::Compile(patterns);
+            if (!matcher.has_value()) {
+                continue;
+            }
+
+            for (const size_t bytes : { 64, 512, 1500 }) {
+                const auto payloads = MakePayloads(std::max<size_t>(payload_count, 1), bytes, patterns);
+                std::vector<uint64_t> scalar(payloads.size());
+                std::vector<uint64_t> vector(payloads.size());
+                auto scalar_elapsed = std::chrono::steady_clock::duration::max();
+                auto vector_elapsed = std::chrono::steady_clock::duration::max();
+                for (int round = 0; round < MATCHER_ROUNDS; ++round) {
+                    auto started = std::chrono::steady_clock::now();
+                    for (size_t i = 0; i < payloads.size(); ++i) {
+                        scalar[i] = matcher->MatchScalar(payloads[i]);
+                    }
+                    scalar_elapsed = std::min(scalar_elapsed, std::chrono::steady_clock::now() - started);
+
+                    started = std::chrono::steady_clock::now();
+                    for (size_t i = 0; i < payloads.size(); ++i) {
+                        vector[i] = matcher->Match(payloads[i]);
+                    }
+                    vector_elapsed = std::min(vector_elapsed, std::chrono::steady_clock::now() - started);
+                }
+
+                MatcherBenchmarkResult result;
+                result.patterns = pattern_count;
+                result.payload_bytes = bytes;
+                result.payloads = payloads.size();
+                result.vectorized = PayloadMatcher::IsVectorized();
+                const double count = static_cast<double>(payloads.size());
+                result.scalar_ns_per_payload = std::chrono::duration<double, std::nano>(scalar_elapsed).count() / count;
+                result.vector_ns_per_payload = std::chrono::duration<double, std::nano>(vector_elapsed).count() / count;
+                for (size_t i = 0; i < payloads.size(); ++i) {
+                    result.mismatches += scalar[i] != vector[i] ? 1 : 0;
+                }
+                results.push_back(result);
+                if (on_result) {
+                    on_result(results.back());
+                }
+            }
+        }
+        return results;
+    }
+
+    std::string CaptureBenchmarkResult::ToJson() const {
+        std::string lock_json;
+        for (const auto& lock : locks) {
+            lock_json += std::format("{}\"{}\":{{\"acquisitions\":{},\"contended\":{},\"wait_us\":{:.1f}}}",
+                lock_json.empty() ? "" : ",", lock.name, lock.acquisitions, lock.contended, lock.wait_ns / 1000.0);
+        }
+        return std::format("{{\"profile\":\"{}\",\"worker_threads\":{},\"offered_pps\":{},\"packets\":{},\"delivered\":{},"
+            "\"packets_per_second\":{:.0f},\"latency_p50_us\":{:.1f},\"latency_p99_us\":{:.1f},"
+            "\"latency_p999_us\":{:.1f},\"cycles_per_packet\":{:.0f},\"locks\":{{{}}}}}",
+            profile, worker_threads, offered_pps, packets, delivered, packets_per_second, latency_p50_us, latency_p99_us,
+            latency_p999_us, cycles_per_packet, lock_json);
+    }
+
+    std::vector<CaptureBenchmarkResult> RunCaptureBenchmarks(const CaptureBenchmarkSweep& sweep,
+        const std::function<void(const CaptureBenchmarkResult&)>& on_result) {
+        std::vector<CaptureBenchmarkResult> results;
+        for (const auto& profile : PROFILES) {
+            for (const uint32_t workers : sweep.worker_threads) {
+                results.push_back(RunCapture(profile, workers, sweep));
+                if (on_result) {
+                    on_result(results.back());
+                }
+            }
+        }
+        return results;
+    }
+
+}
@@ -0,0 +1,126 @@
+#ifndef BADLINK_SRC_MODULE_BENCHMARK_H_
+#define BADLINK_SRC_MODULE_BENCHMARK_H_
+
+#include "lock_stats.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace BadLink {
+
+    // Parameter grid, every module runs every combination that applies to it
+    struct BenchmarkSweep {
+        std::vector<size_t> batch_sizes{ 1, 16, 64, 256 };
+        std::vector<uint32_t> packet_bytes{ 64, 512, 1500 };
+        std::vector<size_t> queue_depths{ 0, 1000, 10000 };    // Packets held when a batch arrives
+        std::vector<double> enable_ratios{ 0.0, 0.5, 1.0 };    // Share of packets a rule lets the module touch
+        size_t packets_per_run = 20000;
+    };
+
+    // One module at one point of the grid, figures are per packet offered
+    struct BenchmarkResult {
+        std::string module;
+        size_t batch_size = 0;
+        uint32_t packet_bytes = 0;
+        size_t queue_depth = 0;
+        double enable_ratio = 0;
+        uint64_t packets = 0;
+        double ns_per_packet = 0;
+        double allocations_per_packet = 0;
+        double bytes_allocated_per_packet = 0;
+        double bytes_copied_per_packet = 0;    // Packet buffers that came out as new copies
+
+        // One JSON object on one line
+        std::string ToJson() const;
+    };
+
+    // Times ProcessBatch plus GetReleasablePackets of the loss, duplicate, out-of-order, jitter,
+    // bandwidth and latency modules over synthetic UDP packets, single-threaded under a
+    // VirtualClock so queues hold the requested depth whatever the machine's speed
+    // Packets are built before the clock starts; allocations are counted by the replaced
+    // global operator new while a run is measured
+    // `on_result` sees each result as soon as it is measured, e.g. to stream JSON lines
+    std::vector<BenchmarkResult> RunModuleBenchmarks(const BenchmarkSweep& sweep = {},
+        const std::function<void(const BenchmarkResult&)>& on_result = {});
+
+    // One filter on the same mixed packets, through the AST walk and through the compiled VM
+    struct FilterBenchmarkResult {
+        std::string filter;
+        size_t instructions = 0;
+        uint64_t packets = 0;
+        double interpreter_ns_per_packet = 0;   // FilterNode::Evaluate, one packet at a time
+        double compiled_ns_per_packet = 0;      // FilterProgram::Evaluate, batches of BATCH_WIDTH
+        uint64_t mismatches = 0;                // Packets the two disagree on, 0 unless the VM is wrong
+
+        // One JSON object on one line
+        std::string ToJson() const;
+    };
+
+    // Times every preset filter and a long rule-style filter both ways over MakeMixedPackets
+    std::vector<FilterBenchmarkResult> RunFilterBenchmarks(size_t packets = 65536,
+        const std::function<void(const FilterBenchmarkResult&)>& on_result = {});
+
+    // One pattern set on payloads of one size, through the scalar and the vectorized search
+    struct MatcherBenchmarkResult {
+        size_t patterns = 0;
+        size_t payload_bytes = 0;               // Largest payload, sizes are spread below it
+        uint64_t payloads = 0;
+        bool vectorized = false;                // SSSE3 present, otherwise both columns are scalar
+        double scalar_ns_per_payload = 0;
+        double vector_ns_per_payload = 0;
+        uint64_t mismatches = 0;
+
+        // One JSON object on one line
+        std::string ToJson() const;
+    };
+
+    // Times PayloadMatcher::Match against MatchScalar over MakePayloads for 1, 8 and 64
+    // random patterns and 64 to 1500 byte payloads
+    std::vector<MatcherBenchmarkResult> RunMatcherBenchmarks(size_t payloads = 20000,
+        const std::function<void(const MatcherBenchmarkResult&)>& on_result = {});
+
+    // Worker counts and traffic for the capture engine benchmark, every profile runs every count
+    struct CaptureBenchmarkSweep {
+        std::vector<uint32_t> worker_threads{ 1, 2, 4, 8, 12, 16 };
+        uint32_t batch_size = 10;               // The engine's default batch
+        uint32_t packet_bytes = 512;
+        uint32_t flows = 256;                   // UDP flows, half of them inbound
+        uint32_t packets_per_run = 200000;
+        uint64_t offered_pps = 0;               // Source rate, 0 offers packets as fast as the workers take them
+        std::string filter = "true";            // Capture filter, applied by the source like the driver would
+    };
+
+    // One profile at one worker count
+    struct CaptureBenchmarkResult {
+        std::string profile;
+        uint32_t worker_threads = 0;
+        uint64_t offered_pps = 0;
+        uint64_t packets = 0;                   // Handed to the engine
+        uint64_t delivered = 0;                 // Came back at least once
+        double packets_per_second = 0;          // Delivered, first receive to last send
+        double latency_p50_us = 0;              // Receive to send, the profile's own delay included
+        double latency_p99_us = 0;
+        double latency_p999_us = 0;
+        double cycles_per_packet = 0;           // CPU cycles of the whole process per packet handed in
+        std::vector<LockWaitStats> locks;       // Mutexes taken during the run
+
+        // One JSON object on one line
+        std::string ToJson() const;
+    };
+
+    // Runs the whole NetworkCapture engine, workers, rules, flow table, link chain and release
+    // threads, against a MemoryBackend at 1 to 16 workers with three profiles: latency only
+    // (20 ms), shaper only (10 Gbps, so it meters without holding) and everything enabled
+    // Unpaced, the source feeds packets as fast as the workers take them, so throughput is what
+    // the engine sustains and latency includes the backlog; a paced source below that rate
+    // shows the latency the engine adds in normal operation
+    // Lock waits come from the engine's ContendedMutexes
+    // Hardware cache-miss counters need a kernel driver on Windows, process cycle time is
+    // reported in their place
+    std::vector<CaptureBenchmarkResult> RunCaptureBenchmarks(const CaptureBenchmarkSweep& sweep = {},
+        const std::function<void(const CaptureBenchmarkResult&)>& on_result = {});
+
+}
+#endif  // BADLINK_SRC_MODULE_BENCHMARK_H_
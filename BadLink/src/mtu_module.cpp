@@ -0,0 +1,539 @@
+#define NOMINMAX
+#include "mtu_module.h"
+#include "checksum.h"
+#include "gso.h"
+#include <algorithm>
+#include <cstring>
+
+namespace BadLink {
+
+    namespace {
+        constexpr uint32_t MIN_IPV4_MTU = 68;
+        constexpr size_t MIN_IPV6_MTU = 1280;
+        constexpr size_t IPV4_HEADER = 20;
+        constexpr size_t IPV6_HEADER = 40;
+        constexpr size_t ICMP_HEADER = 8;
+        constexpr uint16_t IPV4_FLAG_DF = 0x4000;
+        constexpr uint16_t IPV4_FLAG_MF = 0x2000;
+        constexpr uint16_t IPV4_OFFSET_MASK = 0x1FFF;
+
+        // Payload of an IPv4 fragment starts this far into a reassembly buffer,
+        // leaving room to put the header of the first fragment right in front of it
+        constexpr size_t REASSEMBLY_HEADROOM = 60;
+
+        size_t IPv4HeaderLength(std::span<const uint8_t> bytes) {
+            return static_cast<size_t>(bytes[0] & 0x0F) * 4;
+        }
+
+        // IPv6 links must carry 1280 bytes (RFC 8200), a lower setting only holds for IPv4
+        uint32_t PathMtu(const PacketHeaders& headers, uint32_t mtu) {
+            return headers.ip_version == 6 ? std::max(mtu, static_cast<uint32_t>(MIN_IPV6_MTU)) : mtu;
+        }
+
+        void WriteIPv4Checksum(uint8_t* header, size_t length) {
+            StoreBe16(header + 10, 0);
+            StoreBe16(header + 10, Checksum::Compute({ header, length }));
+        }
+
+        // Header for fragments after the first: only options with the copy flag are repeated (RFC 791)
+        size_t BuildLaterFragmentHeader(std::span<const uint8_t> header, uint8_t* out) {
+            std::memcpy(out, header.data(), IPV4_HEADER);
+            size_t length = IPV4_HEADER;
+
+            size_t i = IPV4_HEADER;
+            while (i < header.size()) {
+                const uint8_t type = header[i];
+                if (type == 0) {
+                    break;
+                }
+                if (type == 1) {
+                    ++i;
+                    continue;
+                }
+                if (i + 1 >= header.size() || header[i + 1] < 2 || i + header[i + 1] > header.size()) {
+                    break;
+                }
+
+                const size_t option_length = header[i + 1];
+                if (type & 0x80) {
+                    std::memcpy(out + length, header.data() + i, option_length);
+                    length += option_length;
+                }
+                i += option_length;
+            }
+
+            // Pad with end-of-options up to a 32-bit boundary
+            while (length % 4 != 0) {
+                out[length++] = 0;
+            }
+            out[0] = static_cast<uint8_t>(0x40 | (length / 4));
+            return length;
+        }
+
+        // ICMP errors are never sent in response to other ICMP errors
+        bool IsIcmpError(std::span<const uint8_t> bytes, const PacketHeaders& headers) {
+            if (headers.is_fragment || headers.l4_offset >= bytes.size()) {
+                return false;
+            }
+
+            const uint8_t type = bytes[headers.l4_offset];
+            if (headers.protocol == IpProtocol::ICMP) {
+                return type == 3 || type == 4 || type == 5 || type == 11 || type == 12;
+            }
+            if (headers.protocol == IpProtocol::ICMPV6) {
+                return type < 128;
+            }
+            return false;
+        }
+    }
+
+    MtuModule::MtuModule() = default;
+    MtuModule::~MtuModule() = default;
+
+    void MtuModule::SetMtu(uint32_t mtu) {
+        mtu_.store(std::clamp(mtu, MIN_IPV4_MTU, static_cast<uint32_t>(MAX_DATAGRAM)));
+    }
+
+    uint32_t MtuModule::GetMtu() const {
+        return mtu_.load();
+    }
+
+    void MtuModule::SetAction(MtuAction action) {
+        action_.store(action);
+    }
+
+    MtuAction MtuModule::GetAction() const {
+        return action_.load();
+    }
+
+    void MtuModule::SetReassembly(bool enabled) {
+        reassembly_.store(enabled);
+    }
+
+    bool MtuModule::GetReassembly() const {
+        return reassembly_.load();
+    }
+
+    uint64_t MtuModule::GetDroppedPackets() const {
+        return dropped_packets_.load();
+    }
+
+    uint64_t MtuModule::GetFragmentsCreated() const {
+        return fragments_created_.load();
+    }
+
+    uint64_t MtuModule::GetIcmpSent() const {
+        return icmp_sent_.load();
+    }
+
+    uint64_t MtuModule::GetReassembledPackets() const {
+        return reassembled_packets_.load();
+    }
+
+    void MtuModule::SetEnabled(bool enabled) {
+        enabled_.store(enabled);
+    }
+
+    bool MtuModule::IsEnabled() const {
+        return enabled_.load();
+    }
+
+    void MtuModule::SetInboundEnabled(bool enabled) {
+        inbound_enabled_.store(enabled);
+    }
+
+    void MtuModule::SetOutboundEnabled(bool enabled) {
+        outbound_enabled_.store(enabled);
+    }
+
+    std::vector<SimulatedPacket> MtuModule::ProcessBatch(
+        std::vector<SimulatedPacket>&& packets) {
+
+        if (!enabled_.load()) {
+            return std::move(packets);
+        }
+
+        const uint32_t mtu = mtu_.load();
+        const MtuAction action = action_.load();
+        const bool reassembly = reassembly_.load();
+
+        std::vector<SimulatedPacket> output;
+        output.reserve(packets.size());
+
+        for (auto& packet : packets) {
+            if (!ShouldProcess(packet) || !packet.headers.IsValid()) {
+                output.push_back(std::move(packet));
+                continue;
+            }
+
+            if (reassembly && !packet.addr.Outbound &&
+                packet.headers.ip_version == 4 && packet.headers.is_fragment) {
+                bool complete = false;
+                if (Reassemble(packet, complete) && !complete) {
+                    continue;  // Held until the rest of the datagram arrives
+                }
+            }
+
+            // A super-packet is judged by its wire segments, split only if those are too big
+            if (packet.gso_size != 0) {
+                if (packet.headers.payload_offset + static_cast<size_t>(packet.gso_size) <= PathMtu(packet.headers, mtu)) {
+                    output.push_back(std::move(packet));
+                    continue;
+                }
+
+                std::vector<SimulatedPacket> segments;
+                Gso::Segment(std::move(packet), segments);
+                for (auto& segment : segments) {
+                    Enforce(std::move(segment), mtu, action, output);
+                }
+                continue;
+            }
+
+            Enforce(std::move(packet), mtu, action, output);
+        }
+
+        return output;
+    }
+
+    std::vector<SimulatedPacket> MtuModule::GetReleasablePackets() {
+        // Fragments are released as soon as they are created, nothing is delayed
+        return {};
+    }
+
+    bool MtuModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::MTU) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
+        if (addr.Outbound && !outbound_enabled_.load()) {
+            return false;
+        }
+        if (!addr.Outbound && !inbound_enabled_.load()) {
+            return false;
+        }
+        return true;
+    }
+
+    void MtuModule::Enforce(SimulatedPacket&& packet, uint32_t mtu, MtuAction action,
+        std::vector<SimulatedPacket>& output) {
+
+        mtu = PathMtu(packet.headers, mtu);
+        if (packet.Size() <= mtu) {
+            output.push_back(std::move(packet));
+            return;
+        }
+
+        // Header fields are read in place, a packet with an inline prefix is flattened first
+        if (packet.is_slice && packet.prefix_length > 0) {
+            packet.MutableData();
+        }
+
+        if (action == MtuAction::Fragment && packet.headers.ip_version == 4) {
+            const bool dont_fragment = (LoadBe16(packet.Bytes().data() + 6) & IPV4_FLAG_DF) != 0;
+            if (!dont_fragment && FragmentIPv4(packet, mtu, output)) {
+                return;
+            }
+        }
+
+        // Oversized packet is dropped, the sender only learns about it through ICMP
+        dropped_packets_.fetch_add(1);
+        if (action == MtuAction::Drop) {
+            return;
+        }
+
+        SimulatedPacket icmp;
+        if (BuildTooBig(packet, mtu, icmp)) {
+            icmp.timestamp = Now();
+            icmp.release_time = icmp.timestamp;
+            output.push_back(std::move(icmp));
+            icmp_sent_.fetch_add(1);
+        }
+    }
+
+    bool MtuModule::FragmentIPv4(SimulatedPacket& packet, uint32_t mtu,
+        std::vector<SimulatedPacket>& output) {
+
+        // The NIC can't offload a checksum over fragments, finish it before slicing
+        const PacketHeaders& headers = packet.headers;
+        const bool checksum_pending = headers.IsTcp() ? !packet.addr.TCPChecksum :
+            headers.IsUdp() ? !packet.addr.UDPChecksum : false;
+        if (checksum_pending) {
+            Checksum::UpdateTransport(packet.MutableData(), headers);
+            packet.addr.TCPChecksum = headers.IsTcp() ? 1 : packet.addr.TCPChecksum;
+            packet.addr.UDPChecksum = headers.IsUdp() ? 1 : packet.addr.UDPChecksum;
+        }
+
+        const std::span<const uint8_t> bytes = packet.Bytes();
+        const size_t header_length = IPv4HeaderLength(bytes);
+        const size_t total_length = std::min<size_t>(LoadBe16(bytes.data() + 2), bytes.size());
+        if (total_length <= header_length) {
+            return false;
+        }
+
+        // Re-fragmenting a fragment keeps its offset and MF flag on the last piece
+        const uint16_t frag = LoadBe16(bytes.data() + 6);
+        const size_t base_offset = static_cast<size_t>(frag & IPV4_OFFSET_MASK) * 8;
+        const bool more_after = (frag & IPV4_FLAG_MF) != 0;
+
+        uint8_t later_header[SimulatedPacket::MAX_PREFIX_LENGTH];
+        const size_t later_length = BuildLaterFragmentHeader(bytes.first(header_length), later_header);
+
+        // Every fragment except the last carries a multiple of 8 payload bytes
+        const size_t first_chunk = (mtu - header_length) & ~static_cast<size_t>(7);
+        const size_t later_chunk = (mtu - later_length) & ~static_cast<size_t>(7);
+        if (mtu <= header_length || first_chunk == 0 || later_chunk == 0) {
+            return false;
+        }
+
+        const size_t payload_length = total_length - header_length;
+        const uint32_t ip_start = packet.is_slice ? packet.slice_offset : 0;
+
+        for (size_t offset = 0, index = 0; offset < payload_length; ++index) {
+            const bool first = offset == 0;
+            const size_t length = first ? header_length : later_length;
+            const size_t chunk = std::min(first ? first_chunk : later_chunk, payload_length - offset);
+            const bool more = offset + chunk < payload_length || more_after;
+
+            // Fragment = own IP header + a view of the original payload, no copy of the data
+            SimulatedPacket fragment;
+            fragment.data = packet.data;
+            fragment.addr = packet.addr;
+            fragment.addr.IPChecksum = 1;
+            fragment.flow = packet.flow;
+            fragment.modules = packet.modules;
+            fragment.traffic_class = packet.traffic_class;
+            fragment.link = packet.link;
+            fragment.random_stream = packet.random_stream.Child(index);
+            fragment.timestamp = packet.timestamp;
+            fragment.release_time = packet.release_time;
+            fragment.is_slice = true;
+            fragment.prefix_length = static_cast<uint16_t>(length);
+            fragment.slice_offset = static_cast<uint32_t>(ip_start + header_length + offset);
+            fragment.slice_length = static_cast<uint32_t>(chunk);
+
+            uint8_t* header = fragment.prefix.data();
+            std::memcpy(header, first ? bytes.data() : later_header, length);
+            StoreBe16(header + 2, static_cast<uint16_t>(length + chunk));
+            StoreBe16(header + 6, static_cast<uint16_t>((more ? IPV4_FLAG_MF : 0) |
+                ((base_offset + offset) / 8)));
+            WriteIPv4Checksum(header, length);
+
+            fragment.headers.ip_version = 4;
+            fragment.headers.protocol = headers.protocol;
+            fragment.headers.is_fragment = true;
+            fragment.headers.l4_offset = static_cast<uint16_t>(length);
+            fragment.headers.payload_offset = first ?
+                static_cast<uint16_t>(std::min<size_t>(headers.payload_offset, length + chunk)) :
+                static_cast<uint16_t>(length);
+
+            output.push_back(std::move(fragment));
+            fragments_created_.fetch_add(1);
+            offset += chunk;
+        }
+        return true;
+    }
+
+    bool MtuModule::BuildTooBig(const SimulatedPacket& packet, uint32_t mtu, SimulatedPacket& icmp) {
+        const std::span<const uint8_t> bytes = packet.Bytes();
+        const PacketHeaders& headers = packet.headers;
+        if (IsIcmpError(bytes, headers)) {
+            return false;
+        }
+
+        std::vector<uint8_t> reply;
+        if (headers.ip_version == 4) {
+            if (bytes.size() < IPV4_HEADER) {
+                return false;
+            }
+
+            // Fragmentation needed: original IP header plus the first 8 payload bytes
+            const size_t quoted = std::min(bytes.size(), IPv4HeaderLength(bytes) + 8);
+            reply.resize(IPV4_HEADER + ICMP_HEADER + quoted);
+            uint8_t* ip = reply.data();
+            ip[0] = 0x45;
+            StoreBe16(ip + 2, static_cast<uint16_t>(reply.size()));
+            ip[8] = 64;
+            ip[9] = IpProtocol::ICMP;
+            std::memcpy(ip + 12, bytes.data() + 16, 4);
+            std::memcpy(ip + 16, bytes.data() + 12, 4);
+            WriteIPv4Checksum(ip, IPV4_HEADER);
+
+            uint8_t* message = ip + IPV4_HEADER;
+            message[0] = 3;
+            message[1] = 4;
+            StoreBe16(message + 6, static_cast<uint16_t>(mtu));
+            std::memcpy(message + ICMP_HEADER, bytes.data(), quoted);
+            StoreBe16(message + 2, Checksum::Compute({ message, ICMP_HEADER + quoted }));
+
+            icmp.headers = { 4, IpProtocol::ICMP, IPV4_HEADER, IPV4_HEADER + ICMP_HEADER, false };
+        }
+        else {
+            if (bytes.size() < IPV6_HEADER) {
+                return false;
+            }
+
+            // Packet too big: as much of the original as fits in the minimum IPv6 MTU
+            const size_t quoted = std::min(bytes.size(), MIN_IPV6_MTU - IPV6_HEADER - ICMP_HEADER);
+            reply.resize(IPV6_HEADER + ICMP_HEADER + quoted);
+            uint8_t* ip = reply.data();
+            ip[0] = 0x60;
+            StoreBe16(ip + 4, static_cast<uint16_t>(ICMP_HEADER + quoted));
+            ip[6] = IpProtocol::ICMPV6;
+            ip[7] = 64;
+            std::memcpy(ip + 8, bytes.data() + 24, 16);
+            std::memcpy(ip + 24, bytes.data() + 8, 16);
+
+            uint8_t* message = ip + IPV6_HEADER;
+            message[0] = 2;
+            StoreBe32(message + 4, mtu);
+            std::memcpy(message + ICMP_HEADER, bytes.data(), quoted);
+
+            icmp.headers = { 6, IpProtocol::ICMPV6, IPV6_HEADER, IPV6_HEADER + ICMP_HEADER, false };
+            Checksum::UpdateTransport(reply, icmp.headers);
+        }
+
+        // The error travels back towards the sender of the oversized packet
+        icmp.data = std::make_shared<std::vector<uint8_t>>(std::move(reply));
+        icmp.addr = packet.addr;
+        icmp.addr.Outbound = packet.addr.Outbound ? 0 : 1;
+        icmp.addr.IPChecksum = 1;
+        return true;
+    }
+
+    bool MtuModule::Reassemble(SimulatedPacket& packet, bool& complete) {
+        const std::span<const uint8_t> bytes = packet.Bytes();
+        if (packet.is_slice && packet.prefix_length > 0) {
+            return false;
+        }
+
+        const size_t header_length = IPv4HeaderLength(bytes);
+        const size_t total_length = LoadBe16(bytes.data() + 2);
+        if (total_length <= header_length || total_length > bytes.size()) {
+            return false;
+        }
+
+        const uint16_t frag = LoadBe16(bytes.data() + 6);
+        const size_t offset = static_cast<size_t>(frag & IPV4_OFFSET_MASK) * 8;
+        const size_t length = total_length - header_length;
+        const bool more = (frag & IPV4_FLAG_MF) != 0;
+        if (offset + length > MAX_DATAGRAM - header_length || (more && length % 8 != 0)) {
+            return false;  // Malformed, let the receiver deal with it
+        }
+
+        const auto now = Now();
+        std::lock_guard<ContendedMutex> lock(reassembly_mutex_);
+
+        ReassemblySlot* slot = FindSlot(LoadBe32(bytes.data() + 12), LoadBe32(bytes.data() + 16),
+            LoadBe16(bytes.data() + 4), bytes[9], now);
+        if (slot == nullptr) {
+            return false;
+        }
+
+        uint8_t* buffer = slot->buffer->data();
+        std::memcpy(buffer + REASSEMBLY_HEADROOM + offset, bytes.data() + header_length, length);
+        if (offset == 0) {
+            slot->header_length = header_length;
+            slot->addr = packet.addr;
+            std::memcpy(buffer + REASSEMBLY_HEADROOM - header_length, bytes.data(), header_length);
+        }
+        if (!more) {
+            slot->total_length = offset + length;
+        }
+
+        // Count newly covered 8-byte blocks so overlaps and retransmitted fragments don't double count
+        const size_t first_block = offset / 8;
+        const size_t end_block = (offset + length + 7) / 8;
+        for (size_t block = first_block; block < end_block; ++block) {
+            uint64_t& word = slot->block_bitmap[block / 64];
+            const uint64_t bit = uint64_t{ 1 } << (block % 64);
+            if ((word & bit) == 0) {
+                word |= bit;
+                ++slot->received_blocks;
+            }
+        }
+
+        complete = slot->header_length != 0 && slot->total_length != 0 &&
+            slot->received_blocks == (slot->total_length + 7) / 8;
+        if (!complete) {
+            return true;
+        }
+
+        slot->in_use = false;
+        const size_t datagram_length = slot->header_length + slot->total_length;
+        if (datagram_length > MAX_DATAGRAM) {
+            dropped_packets_.fetch_add(1);
+            complete = false;
+            return true;
+        }
+
+        // Header of the first fragment sits right in front of the payload, fix it up in place
+        uint8_t* header = buffer + REASSEMBLY_HEADROOM - slot->header_length;
+        StoreBe16(header + 2, static_cast<uint16_t>(datagram_length));
+        StoreBe16(header + 6, 0);
+        WriteIPv4Checksum(header, slot->header_length);
+
+        SimulatedPacket datagram;
+        datagram.data = slot->buffer;
+        datagram.addr = slot->addr;
+        datagram.addr.IPChecksum = 1;
+        datagram.flow = packet.flow;
+        datagram.modules = packet.modules;
+        datagram.traffic_class = packet.traffic_class;
+        datagram.link = packet.link;
+        datagram.random_stream = packet.random_stream;
+        datagram.timestamp = packet.timestamp;
+        datagram.release_time = packet.release_time;
+        datagram.is_slice = true;
+        datagram.slice_offset = static_cast<uint32_t>(REASSEMBLY_HEADROOM - slot->header_length);
+        datagram.slice_length = static_cast<uint32_t>(datagram_length);
+        datagram.headers = ParseHeaders(datagram.Bytes());
+
+        packet = std::move(datagram);
+        reassembled_packets_.fetch_add(1);
+        return true;
+    }
+
+    MtuModule::ReassemblySlot* MtuModule::FindSlot(uint32_t src, uint32_t dst, uint16_t id,
+        uint8_t protocol, std::chrono::steady_clock::time_point now) {
+
+        ReassemblySlot* free_slot = nullptr;
+        for (auto& slot : slots_) {
+            if (slot.in_use && now - slot.first_seen > REASSEMBLY_TIMEOUT) {
+                // Incomplete datagram timed out, its fragments are lost
+                slot.in_use = false;
+                dropped_packets_.fetch_add(1);
+            }
+
+            if (!slot.in_use) {
+                free_slot = free_slot ? free_slot : &slot;
+                continue;
+            }
+            if (slot.src == src && slot.dst == dst && slot.id == id && slot.protocol == protocol) {
+                return &slot;
+            }
+        }
+
+        if (free_slot == nullptr) {
+            return nullptr;
+        }
+
+        free_slot->in_use = true;
+        free_slot->src = src;
+        free_slot->dst = dst;
+        free_slot->id = id;
+        free_slot->protocol = protocol;
+        free_slot->first_seen = now;
+        free_slot->header_length = 0;
+        free_slot->total_length = 0;
+        free_slot->received_blocks = 0;
+        free_slot->block_bitmap.fill(0);
+
+        // Buffers are reused unless a released datagram still references them
+        if (!free_slot->buffer || free_slot->buffer.use_count() > 1) {
+            free_slot->buffer = std::make_shared<std::vector<uint8_t>>(REASSEMBLY_HEADROOM + MAX_DATAGRAM);
+        }
+        return free_slot;
+    }
+
+}
@@ -0,0 +1,109 @@
+#ifndef BADLINK_SRC_MTU_MODULE_H_
+#define BADLINK_SRC_MTU_MODULE_H_
+
+#include "simulation_module.h"
+#include "lock_stats.h"
+#include <atomic>
+#include <mutex>
+#include <array>
+
+namespace BadLink {
+
+    // What happens to packets larger than the MTU
+    enum class MtuAction : uint8_t {
+        Drop,           // Silent PMTU blackhole
+        Fragment,       // Fragment IPv4 like a router, DF packets and IPv6 get ICMP too-big
+        IcmpTooBig,     // Always answer with ICMP fragmentation needed / packet too big
+    };
+
+    class MtuModule : public SimulationModule {
+    public:
+        MtuModule();
+        ~MtuModule() override;
+
+        // Set link MTU in bytes (68 - 65535), IPv6 packets never see less than 1280
+        void SetMtu(uint32_t mtu);
+        uint32_t GetMtu() const;
+
+        void SetAction(MtuAction action);
+        MtuAction GetAction() const;
+
+        // Reassemble inbound IPv4 fragments before the MTU is enforced
+        void SetReassembly(bool enabled);
+        bool GetReassembly() const;
+
+        // Statistics
+        uint64_t GetDroppedPackets() const;
+        uint64_t GetFragmentsCreated() const;
+        uint64_t GetIcmpSent() const;
+        uint64_t GetReassembledPackets() const;
+
+        // Enable/disable the module
+        void SetEnabled(bool enabled);
+        bool IsEnabled() const override;
+
+        // Direction control
+        void SetInboundEnabled(bool enabled) override;
+        void SetOutboundEnabled(bool enabled) override;
+
+        // Process packets
+        std::vector<SimulatedPacket> ProcessBatch(
+            std::vector<SimulatedPacket>&& packets) override;
+        std::vector<SimulatedPacket> GetReleasablePackets() override;
+
+    private:
+        static constexpr size_t MAX_DATAGRAM = 65535;
+        static constexpr size_t REASSEMBLY_SLOTS = 32;
+        static constexpr size_t BLOCKS_PER_DATAGRAM = (MAX_DATAGRAM + 7) / 8;
+        static constexpr std::chrono::seconds REASSEMBLY_TIMEOUT{ 5 };
+
+        // One datagram being reassembled, payload lands at its final position in a
+        // buffer sized for the largest datagram so fragments are copied exactly once
+        struct ReassemblySlot {
+            bool in_use = false;
+            uint32_t src = 0;
+            uint32_t dst = 0;
+            uint16_t id = 0;
+            uint8_t protocol = 0;
+            std::chrono::steady_clock::time_point first_seen;
+
+            size_t header_length = 0;       // 0 until the first fragment arrives
+            size_t total_length = 0;        // Payload length, 0 until the last fragment arrives
+            size_t received_blocks = 0;
+            std::array<uint64_t, (BLOCKS_PER_DATAGRAM + 63) / 64> block_bitmap{};
+            WINDIVERT_ADDRESS addr{};
+            std::shared_ptr<std::vector<uint8_t>> buffer;
+        };
+
+        std::atomic<bool> enabled_{ false };
+        std::atomic<bool> inbound_enabled_{ true };
+        std::atomic<bool> outbound_enabled_{ true };
+        std::atomic<uint32_t> mtu_{ 1500 };
+        std::atomic<MtuAction> action_{ MtuAction::Fragment };
+        std::atomic<bool> reassembly_{ false };
+
+        std::atomic<uint64_t> dropped_packets_{ 0 };
+        std::atomic<uint64_t> fragments_created_{ 0 };
+        std::atomic<uint64_t> icmp_sent_{ 0 };
+        std::atomic<uint64_t> reassembled_packets_{ 0 };
+
+        // Bounded reassembly table, fragments beyond it pass through untouched
+        ContendedMutex reassembly_mutex_{ "MTU reassembly" };
+        std::array<ReassemblySlot, REASSEMBLY_SLOTS> slots_;
+
+        bool ShouldProcess(const SimulatedPacket& packet) const;
+
+        // Returns false if the fragment should pass through as is, otherwise it was consumed
+        // and `complete` tells whether `packet` now holds the reassembled datagram
+        bool Reassemble(SimulatedPacket& packet, bool& complete);
+        ReassemblySlot* FindSlot(uint32_t src, uint32_t dst, uint16_t id, uint8_t protocol,
+            std::chrono::steady_clock::time_point now);
+
+        void Enforce(SimulatedPacket&& packet, uint32_t mtu, MtuAction action,
+            std::vector<SimulatedPacket>& output);
+        bool FragmentIPv4(SimulatedPacket& packet, uint32_t mtu, std::vector<SimulatedPacket>& output);
+        static bool BuildTooBig(const SimulatedPacket& packet, uint32_t mtu, SimulatedPacket& icmp);
+    };
+
+}
+#endif  // BADLINK_SRC_MTU_MODULE_H_
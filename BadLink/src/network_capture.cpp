@@ -2,12 +2,27 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include "network_capture.h"
+#include "capture_backend.h"
+#include "link_chain.h"
 #include "latency_module.h"
 #include "packet_loss_module.h"
 #include "duplicate_module.h"
 #include "out_of_order_module.h"
 #include "jitter_module.h"
 #include "bandwidth_module.h"
+#include "corruption_module.h"
+#include "header_rewrite_module.h"
+#include "mtu_module.h"
+#include "outage_module.h"
+#include "precise_timer.h"
+#include "random_utils.h"
+#include "gso.h"
+#include "flow_table.h"
+#include "rule_classifier.h"
+#include "domain_snoop.h"
+#include "release_slots.h"
+#include <algorithm>
+#include <bit>
 #include <chrono>
 #include <string>
 #include <format>
@@ -48,12 +63,16 @@ namespace BadLink {
     }
 
     NetworkCapture::NetworkCapture()
-        : latency_module_(std::make_unique<LatencyModule>())
-        , packet_loss_module_(std::make_unique<PacketLossModule>())
-        , duplicate_module_(std::make_unique<DuplicateModule>())
-        , out_of_order_module_(std::make_unique<OutOfOrderModule>())
-        , jitter_module_(std::make_unique<JitterModule>())
-        , bandwidth_module_(std::make_unique<BandwidthModule>()) {
+        : backend_(std::make_unique<WinDivertBackend>())
+        , main_link_(std::make_unique<LinkChain>())
+        , links_(std::make_shared<const LinkSet>())
+        , mtu_module_(std::make_unique<MtuModule>())
+        , outage_module_(std::make_unique<OutageModule>())
+        , flow_table_(std::make_unique<FlowTable>())
+        , interface_mtus_(std::make_unique<Gso::InterfaceMtus>())
+        , rule_set_(std::make_shared<const RuleSet>())
+        , rule_cache_(std::make_unique<PerFlow<RuleDecision>>(flow_table_->Capacity()))
+        , domain_cache_(std::make_unique<DomainCache>()) {
         WSADATA wsaData;
         WSAStartup(MAKEWORD(2, 2), &wsaData);
     }
@@ -74,30 +93,26 @@ namespace BadLink {
             current_params_ = params;
             max_packets_ = params.ring_packet_buffer;
         }
+        mtu_module_->SetMtu(params.mtu_size);
 
-        // Open WinDivert handle
-        divert_handle_ = WinDivertOpen(filter.c_str(), WINDIVERT_LAYER_NETWORK, 0, 0);
-        if (divert_handle_ == INVALID_HANDLE_VALUE) {
-            DWORD error = ::GetLastError();
-            return std::unexpected(std::format("Failed to open WinDivert: {}", error));
+        // Open the capture backend, WinDivert unless one was set
+        if (auto opened = backend_->Open(filter); !opened) {
+            return std::unexpected(opened.error());
         }
 
         // Configure WinDivert parameters
-        if (!WinDivertSetParam(divert_handle_, WINDIVERT_PARAM_QUEUE_LENGTH, params.queue_length)) {
-            WinDivertClose(divert_handle_);
-            divert_handle_ = INVALID_HANDLE_VALUE;
+        if (!backend_->SetParam(WINDIVERT_PARAM_QUEUE_LENGTH, params.queue_length)) {
+            backend_->Close();
             return std::unexpected("Failed to set queue length");
         }
 
-        if (!WinDivertSetParam(divert_handle_, WINDIVERT_PARAM_QUEUE_TIME, params.queue_time)) {
-            WinDivertClose(divert_handle_);
-            divert_handle_ = INVALID_HANDLE_VALUE;
+        if (!backend_->SetParam(WINDIVERT_PARAM_QUEUE_TIME, params.queue_time)) {
+            backend_->Close();
             return std::unexpected("Failed to set queue time");
         }
 
-        if (!WinDivertSetParam(divert_handle_, WINDIVERT_PARAM_QUEUE_SIZE, params.queue_size)) {
-            WinDivertClose(divert_handle_);
-            divert_handle_ = INVALID_HANDLE_VALUE;
+        if (!backend_->SetParam(WINDIVERT_PARAM_QUEUE_SIZE, params.queue_size)) {
+            backend_->Close();
             return std::unexpected("Failed to set queue size");
         }
 
@@ -110,6 +125,11 @@ namespace BadLink {
         batch_count_.store(0);
         total_batch_packets_.store(0);
 
+        // Forget the flows and repeats of the last run so a run with the same seed draws the same numbers
+        const uint64_t seed = random_seed_.load();
+        RandomUtils::SetSeed(seed != 0 ? seed : RandomUtils::NewSeed());
+        flow_table_->Clear();
+
         // Start capture threads
         is_capturing_.store(true);
         capture_threads_.reserve(params.worker_threads);
@@ -118,14 +138,15 @@ namespace BadLink {
         }
 
         // Start release threads for time-based modules if enabled
-        if (latency_module_->IsEnabled()) {
-            latency_thread_ = std::jthread(&NetworkCapture::LatencyReleaseThread, this);
+        StartReleaseThreads();
+        {
+            std::lock_guard<std::mutex> lock(slot_thread_mutex_);
+            if (slot_us_.load() != 0) {
+                StartSlotThread();
+            }
         }
-        if (jitter_module_->IsEnabled()) {
-            jitter_thread_ = std::jthread(&NetworkCapture::JitterReleaseThread, this);
-        }
-        if (bandwidth_module_->IsEnabled()) {
-            bandwidth_thread_ = std::jthread(&NetworkCapture::BandwidthReleaseThread, this);
+        if (outage_module_->IsEnabled()) {
+            outage_thread_ = std::jthread(&NetworkCapture::OutageThread, this);
         }
 
         return {};
@@ -139,17 +160,16 @@ namespace BadLink {
         // Signal threads to stop
         should_stop_.store(true);
 
-        // Gracefully shutdown WinDivert handle
-        if (divert_handle_ != INVALID_HANDLE_VALUE) {
-            // First shutdown receive to unblock WinDivertRecvEx calls
-            WinDivertShutdown(divert_handle_, WINDIVERT_SHUTDOWN_RECV);
+        // Gracefully shutdown the backend
+        if (backend_->IsOpen()) {
+            // First shutdown receive to unblock the workers' receive calls
+            backend_->Shutdown();
 
             // Give threads time to process remaining packets
             std::this_thread::sleep_for(std::chrono::milliseconds(250));
 
             // Then close the handle
-            WinDivertClose(divert_handle_);
-            divert_handle_ = INVALID_HANDLE_VALUE;
+            backend_->Close();
         }
 
         // jthread automatically joins on destruction
@@ -159,19 +179,35 @@ namespace BadLink {
         latency_thread_ = {};
         jitter_thread_ = {};
         bandwidth_thread_ = {};
+        duplicate_thread_ = {};
+        reorder_thread_ = {};
+        {
+            std::lock_guard<std::mutex> lock(slot_thread_mutex_);
+            slot_thread_ = {};
+        }
+        outage_thread_ = {};
 
         // Flush any remaining delayed packets
-        [[maybe_unused]] auto remaining_latency = latency_module_->GetReleasablePackets();
-        [[maybe_unused]] auto remaining_jitter = jitter_module_->GetReleasablePackets();
-        [[maybe_unused]] auto remaining_bandwidth = bandwidth_module_->GetReleasablePackets();
-        [[maybe_unused]] auto remaining_order = out_of_order_module_->GetReleasablePackets();
+        main_link_->Clear();
+        for (const auto& link : *GetLinkSet()) {
+            link->Clear();
+        }
+        outage_module_->Reset();
 
         is_capturing_.store(false);
     }
 
+    std::expected<void, std::string> NetworkCapture::SetBackend(std::unique_ptr<CaptureBackend> backend) {
+        if (is_capturing_.load()) {
+            return std::unexpected("Cannot change the capture backend while capturing");
+        }
+        backend_ = backend ? std::move(backend) : std::make_unique<WinDivertBackend>();
+        return {};
+    }
+
     // Latency control methods
     void NetworkCapture::SetLatencyEnabled(bool enabled) {
-        latency_module_->SetEnabled(enabled);
+        main_link_->latency->SetEnabled(enabled);
 
         // Start or stop the latency release thread as needed
         if (enabled && is_capturing_.load() && !latency_thread_.joinable()) {
@@ -180,119 +216,149 @@ namespace BadLink {
     }
 
     bool NetworkCapture::IsLatencyEnabled() const {
-        return latency_module_->IsEnabled();
+        return main_link_->latency->IsEnabled();
     }
 
-    void NetworkCapture::SetLatency(uint32_t latency_ms) {
-        latency_module_->SetLatency(latency_ms);
+    void NetworkCapture::SetLatency(Direction direction, uint32_t latency_ms) {
+        main_link_->latency->SetLatency(direction, latency_ms);
     }
 
-    uint32_t NetworkCapture::GetLatency() const {
-        return latency_module_->GetLatency();
+    uint32_t NetworkCapture::GetLatency(Direction direction) const {
+        return main_link_->latency->GetLatency(direction);
     }
 
     void NetworkCapture::SetLatencyInbound(bool enabled) {
-        latency_module_->SetInboundEnabled(enabled);
+        main_link_->latency->SetInboundEnabled(enabled);
     }
 
     void NetworkCapture::SetLatencyOutbound(bool enabled) {
-        latency_module_->SetOutboundEnabled(enabled);
+        main_link_->latency->SetOutboundEnabled(enabled);
+    }
+
+    void NetworkCapture::SetLatencyMap(std::shared_ptr<const LatencyMap> map) {
+        main_link_->latency->SetLatencyMap(std::move(map));
+    }
+
+    std::shared_ptr<const LatencyMap> NetworkCapture::GetLatencyMap() const {
+        return main_link_->latency->GetLatencyMap();
     }
 
     // Packet Loss control methods
     void NetworkCapture::SetPacketLossEnabled(bool enabled) {
-        packet_loss_module_->SetEnabled(enabled);
+        main_link_->packet_loss->SetEnabled(enabled);
     }
 
     bool NetworkCapture::IsPacketLossEnabled() const {
-        return packet_loss_module_->IsEnabled();
+        return main_link_->packet_loss->IsEnabled();
     }
 
-    void NetworkCapture::SetPacketLossRate(float loss_percentage) {
-        packet_loss_module_->SetLossRate(loss_percentage);
+    void NetworkCapture::SetPacketLossRate(Direction direction, float loss_percentage) {
+        main_link_->packet_loss->SetLossRate(direction, loss_percentage);
     }
 
-    float NetworkCapture::GetPacketLossRate() const {
-        return packet_loss_module_->GetLossRate();
+    float NetworkCapture::GetPacketLossRate(Direction direction) const {
+        return main_link_->packet_loss->GetLossRate(direction);
     }
 
     void NetworkCapture::SetPacketLossInbound(bool enabled) {
-        packet_loss_module_->SetInboundEnabled(enabled);
+        main_link_->packet_loss->SetInboundEnabled(enabled);
     }
 
     void NetworkCapture::SetPacketLossOutbound(bool enabled) {
-        packet_loss_module_->SetOutboundEnabled(enabled);
+        main_link_->packet_loss->SetOutboundEnabled(enabled);
     }
 
     // Duplicate control methods
     void NetworkCapture::SetDuplicateEnabled(bool enabled) {
-        duplicate_module_->SetEnabled(enabled);
+        main_link_->duplicate->SetEnabled(enabled);
+
+        // Start the duplicate release thread for delayed duplicates
+        if (enabled && is_capturing_.load() && !duplicate_thread_.joinable()) {
+            duplicate_thread_ = std::jthread(&NetworkCapture::DuplicateReleaseThread, this);
+        }
     }
 
     bool NetworkCapture::IsDuplicateEnabled() const {
-        return duplicate_module_->IsEnabled();
+        return main_link_->duplicate->IsEnabled();
+    }
+
+    void NetworkCapture::SetDuplicateRate(Direction direction, float duplicate_percentage) {
+        main_link_->duplicate->SetDuplicationRate(direction, duplicate_percentage);
+    }
+
+    float NetworkCapture::GetDuplicateRate(Direction direction) const {
+        return main_link_->duplicate->GetDuplicationRate(direction);
     }
 
-    void NetworkCapture::SetDuplicateRate(float duplicate_percentage) {
-        duplicate_module_->SetDuplicationRate(duplicate_percentage);
+    void NetworkCapture::SetDuplicateCount(Direction direction, uint32_t count) {
+        main_link_->duplicate->SetDuplicateCount(direction, count);
     }
 
-    float NetworkCapture::GetDuplicateRate() const {
-        return duplicate_module_->GetDuplicationRate();
+    uint32_t NetworkCapture::GetDuplicateCount(Direction direction) const {
+        return main_link_->duplicate->GetDuplicateCount(direction);
     }
 
-    void NetworkCapture::SetDuplicateCount(uint32_t count) {
-        duplicate_module_->SetDuplicateCount(count);
+    void NetworkCapture::SetDuplicateDelay(Direction direction, uint32_t min_ms, uint32_t max_ms) {
+        main_link_->duplicate->SetDuplicateDelay(direction, min_ms, max_ms);
     }
 
-    uint32_t NetworkCapture::GetDuplicateCount() const {
-        return duplicate_module_->GetDuplicateCount();
+    uint32_t NetworkCapture::GetDuplicateDelayMin(Direction direction) const {
+        return main_link_->duplicate->GetMinDelay(direction);
+    }
+
+    uint32_t NetworkCapture::GetDuplicateDelayMax(Direction direction) const {
+        return main_link_->duplicate->GetMaxDelay(direction);
     }
 
     void NetworkCapture::SetDuplicateInbound(bool enabled) {
-        duplicate_module_->SetInboundEnabled(enabled);
+        main_link_->duplicate->SetInboundEnabled(enabled);
     }
 
     void NetworkCapture::SetDuplicateOutbound(bool enabled) {
-        duplicate_module_->SetOutboundEnabled(enabled);
+        main_link_->duplicate->SetOutboundEnabled(enabled);
     }
 
     // Out of Order control methods
     void NetworkCapture::SetOutOfOrderEnabled(bool enabled) {
-        out_of_order_module_->SetEnabled(enabled);
+        main_link_->out_of_order->SetEnabled(enabled);
+
+        // Start the reorder release thread for flows that go quiet with packets held
+        if (enabled && is_capturing_.load() && !reorder_thread_.joinable()) {
+            reorder_thread_ = std::jthread(&NetworkCapture::ReorderReleaseThread, this);
+        }
     }
 
     bool NetworkCapture::IsOutOfOrderEnabled() const {
-        return out_of_order_module_->IsEnabled();
+        return main_link_->out_of_order->IsEnabled();
     }
 
-    void NetworkCapture::SetOutOfOrderRate(float reorder_percentage) {
-        out_of_order_module_->SetReorderRate(reorder_percentage);
+    void NetworkCapture::SetOutOfOrderRate(Direction direction, float reorder_percentage) {
+        main_link_->out_of_order->SetReorderRate(direction, reorder_percentage);
     }
 
-    float NetworkCapture::GetOutOfOrderRate() const {
-        return out_of_order_module_->GetReorderRate();
+    float NetworkCapture::GetOutOfOrderRate(Direction direction) const {
+        return main_link_->out_of_order->GetReorderRate(direction);
     }
 
-    void NetworkCapture::SetReorderGap(uint32_t gap) {
-        out_of_order_module_->SetReorderGap(gap);
+    void NetworkCapture::SetReorderGap(Direction direction, uint32_t gap) {
+        main_link_->out_of_order->SetReorderGap(direction, gap);
     }
 
-    uint32_t NetworkCapture::GetReorderGap() const {
-        return out_of_order_module_->GetReorderGap();
+    uint32_t NetworkCapture::GetReorderGap(Direction direction) const {
+        return main_link_->out_of_order->GetReorderGap(direction);
     }
 
     void NetworkCapture::SetOutOfOrderInbound(bool enabled) {
-        out_of_order_module_->SetInboundEnabled(enabled);
+        main_link_->out_of_order->SetInboundEnabled(enabled);
     }
 
     void NetworkCapture::SetOutOfOrderOutbound(bool enabled) {
-        out_of_order_module_->SetOutboundEnabled(enabled);
+        main_link_->out_of_order->SetOutboundEnabled(enabled);
     }
 
     // Jitter control methods
     void NetworkCapture::SetJitterEnabled(bool enabled) {
-        jitter_module_->SetEnabled(enabled);
+        main_link_->jitter->SetEnabled(enabled);
 
         // Start or stop the jitter release thread as needed
         if (enabled && is_capturing_.load() && !jitter_thread_.joinable()) {
@@ -301,32 +367,34 @@ namespace BadLink {
     }
 
     bool NetworkCapture::IsJitterEnabled() const {
-        return jitter_module_->IsEnabled();
+        return main_link_->jitter->IsEnabled();
     }
 
-    void NetworkCapture::SetJitterRange(uint32_t min_ms, uint32_t max_ms) {
-        jitter_module_->SetJitterRange(min_ms, max_ms);
+    void NetworkCapture::SetJitterRange(Direction direction, uint32_t min_ms, uint32_t max_ms) {
+        main_link_->jitter->SetJitterRange(direction, min_ms, max_ms);
     }
 
-    uint32_t NetworkCapture::GetJitterMin() const {
-        return jitter_module_->GetMinJitter();
+    uint32_t NetworkCapture::GetJitterMin(Direction direction) const {
+        return main_link_->jitter->GetMinJitter(direction);
     }
 
-    uint32_t NetworkCapture::GetJitterMax() const {
-        return jitter_module_->GetMaxJitter();
+    uint32_t NetworkCapture::GetJitterMax(Direction direction) const {
+        return main_link_->jitter->GetMaxJitter(direction);
     }
 
     void NetworkCapture::SetJitterInbound(bool enabled) {
-        jitter_module_->SetInboundEnabled(enabled);
+        main_link_->jitter->SetInboundEnabled(enabled);
     }
 
     void NetworkCapture::SetJitterOutbound(bool enabled) {
-        jitter_module_->SetOutboundEnabled(enabled);
+        main_link_->jitter->SetOutboundEnabled(enabled);
     }
 
     // Bandwidth control methods
     void NetworkCapture::SetBandwidthEnabled(bool enabled) {
-        bandwidth_module_->SetEnabled(enabled);
+        for (auto& module : main_link_->bandwidth) {
+            module->SetEnabled(enabled);
+        }
 
         // Start or stop the bandwidth release thread as needed
         if (enabled && is_capturing_.load() && !bandwidth_thread_.joinable()) {
@@ -335,32 +403,706 @@ namespace BadLink {
     }
 
     bool NetworkCapture::IsBandwidthEnabled() const {
-        return bandwidth_module_->IsEnabled();
+        return main_link_->IsBandwidthEnabled();
     }
 
-    void NetworkCapture::SetBandwidthLimit(uint32_t kbps) {
-        bandwidth_module_->SetBandwidthLimit(kbps);
+    void NetworkCapture::SetBandwidthLimit(Direction direction, uint32_t kbps) {
+        main_link_->bandwidth[DirectionIndex(direction)]->SetBandwidthLimit(kbps);
     }
 
-    uint32_t NetworkCapture::GetBandwidthLimit() const {
-        return bandwidth_module_->GetBandwidthLimit();
+    uint32_t NetworkCapture::GetBandwidthLimit(Direction direction) const {
+        return main_link_->bandwidth[DirectionIndex(direction)]->GetBandwidthLimit();
     }
 
     void NetworkCapture::SetBandwidthInbound(bool enabled) {
-        bandwidth_module_->SetInboundEnabled(enabled);
+        main_link_->bandwidth[DirectionIndex(Direction::Inbound)]->SetInboundEnabled(enabled);
     }
 
     void NetworkCapture::SetBandwidthOutbound(bool enabled) {
-        bandwidth_module_->SetOutboundEnabled(enabled);
+        main_link_->bandwidth[DirectionIndex(Direction::Outbound)]->SetOutboundEnabled(enabled);
+    }
+
+    void NetworkCapture::SetBandwidthFlowLimit(uint32_t kbps) {
+        for (auto& module : main_link_->bandwidth) {
+            module->SetFlowLimit(kbps);
+        }
+    }
+
+    uint32_t NetworkCapture::GetBandwidthFlowLimit() const {
+        return main_link_->bandwidth[0]->GetFlowLimit();
+    }
+
+    void NetworkCapture::SetSynRateLimit(uint32_t per_second) {
+        for (auto& module : main_link_->bandwidth) {
+            module->SetSynRateLimit(per_second);
+        }
+    }
+
+    uint32_t NetworkCapture::GetSynRateLimit() const {
+        return main_link_->bandwidth[0]->GetSynRateLimit();
+    }
+
+    std::vector<FlowQueueInfo> NetworkCapture::GetFlowQueues(size_t max_flows) const {
+        // Deepest of both directions
+        auto backlog = main_link_->bandwidth[0]->GetFlowBacklog(max_flows);
+        auto outbound_backlog = main_link_->bandwidth[1]->GetFlowBacklog(max_flows);
+        backlog.insert(backlog.end(), outbound_backlog.begin(), outbound_backlog.end());
+        std::ranges::sort(backlog, std::ranges::greater{}, &FlowShaper::FlowStats::queued_bytes);
+        if (backlog.size() > max_flows) {
+            backlog.resize(max_flows);
+        }
+
+        std::vector<FlowQueueInfo> queues;
+        for (const auto& flow : backlog) {
+            FlowQueueInfo info{};
+            if (flow.key.ip_version == 4) {
+                info.src_addr = IPv4Address{ LoadBe32(flow.key.src_addr.data()) };
+                info.dst_addr = IPv4Address{ LoadBe32(flow.key.dst_addr.data()) };
+            }
+            else {
+                IPv6Address src{}, dst{};
+                std::memcpy(src.addr.data(), flow.key.src_addr.data(), sizeof(src.addr));
+                std::memcpy(dst.addr.data(), flow.key.dst_addr.data(), sizeof(dst.addr));
+                info.src_addr = src;
+                info.dst_addr = dst;
+            }
+            info.src_port = flow.key.src_port;
+            info.dst_port = flow.key.dst_port;
+            info.protocol = flow.key.protocol;
+            info.outbound = flow.key.outbound != 0;
+            info.queued_packets = flow.queued_packets;
+            info.queued_bytes = flow.queued_bytes;
+            info.drops = flow.drops;
+            queues.push_back(info);
+        }
+        return queues;
+    }
+
+    uint64_t NetworkCapture::GetFlowShaperDrops() const {
+        return main_link_->bandwidth[0]->GetFlowDrops() + main_link_->bandwidth[1]->GetFlowDrops();
+    }
+
+    uint64_t NetworkCapture::GetSynDrops() const {
+        return main_link_->bandwidth[0]->GetSynDrops() + main_link_->bandwidth[1]->GetSynDrops();
+    }
+
+    void NetworkCapture::SetBandwidthMode(BandwidthMode mode) {
+        for (auto& module : main_link_->bandwidth) {
+            module->SetMode(mode);
+        }
+    }
+
+    BandwidthMode NetworkCapture::GetBandwidthMode() const {
+        return main_link_->bandwidth[0]->GetMode();
+    }
+
+    void NetworkCapture::SetPolicer(const PolicerConfig& config) {
+        for (auto& module : main_link_->bandwidth) {
+            module->SetPolicer(config);
+        }
+    }
+
+    PolicerCounters NetworkCapture::GetPolicerCounters() const {
+        PolicerCounters counters = main_link_->bandwidth[0]->GetPolicerCounters();
+        const PolicerCounters outbound = main_link_->bandwidth[1]->GetPolicerCounters();
+        for (size_t color = 0; color < counters.packets.size(); ++color) {
+            counters.packets[color] += outbound.packets[color];
+            counters.bytes[color] += outbound.bytes[color];
+        }
+        return counters;
+    }
+
+    void NetworkCapture::SetCrossTraffic(const CrossTrafficConfig& config) {
+        main_link_->SetCrossTraffic(config);
+    }
+
+    CrossTrafficStats NetworkCapture::GetCrossTrafficStats() const {
+        CrossTrafficStats stats = main_link_->bandwidth[0]->GetCrossTrafficStats();
+        const CrossTrafficStats outbound = main_link_->bandwidth[1]->GetCrossTrafficStats();
+        stats.offered_bytes += outbound.offered_bytes;
+        stats.sent_bytes += outbound.sent_bytes;
+        stats.dropped_bytes += outbound.dropped_bytes;
+        stats.backlog_bytes += outbound.backlog_bytes;
+        return stats;
+    }
+
+    std::expected<void, std::string> NetworkCapture::SetTrafficClasses(const std::vector<TrafficClassConfig>& classes) {
+        // Both directions get the same classes, so validation fails on the first or not at all
+        for (auto& module : main_link_->bandwidth) {
+            auto result = module->SetTrafficClasses(classes);
+            if (!result) {
+                return result;
+            }
+        }
+
+        std::lock_guard<ContendedMutex> lock(rules_mutex_);
+        traffic_class_names_.clear();
+        for (const auto& traffic_class : classes) {
+            traffic_class_names_.push_back(traffic_class.name);
+        }
+        PublishRules();
+        return {};
+    }
+
+    std::vector<TrafficClassInfo> NetworkCapture::GetTrafficClasses() const {
+        // Rates and ceilings apply per direction, the counters add up both
+        std::vector<TrafficClassInfo> classes;
+        for (const auto& stats : main_link_->bandwidth[0]->GetClassStats()) {
+            classes.push_back({ stats.name, stats.priority, stats.rate_kbps, stats.ceil_kbps, stats.current_kbps,
+                stats.sent_packets, stats.borrowed_bytes, stats.drops, stats.backlog_packets, stats.backlog_bytes });
+        }
+        const auto outbound = main_link_->bandwidth[1]->GetClassStats();
+        for (size_t i = 0; i < classes.size() && i < outbound.size(); ++i) {
+            classes[i].current_kbps += outbound[i].current_kbps;
+            classes[i].sent_packets += outbound[i].sent_packets;
+            classes[i].borrowed_bytes += outbound[i].borrowed_bytes;
+            classes[i].drops += outbound[i].drops;
+            classes[i].backlog_packets += outbound[i].backlog_packets;
+            classes[i].backlog_bytes += outbound[i].backlog_bytes;
+        }
+        return classes;
+    }
+
+    // Corruption control methods
+    void NetworkCapture::SetCorruptionEnabled(bool enabled) {
+        main_link_->corruption->SetEnabled(enabled);
+    }
+
+    bool NetworkCapture::IsCorruptionEnabled() const {
+        return main_link_->corruption->IsEnabled();
+    }
+
+    void NetworkCapture::SetCorruptionRate(Direction direction, double bit_error_rate) {
+        main_link_->corruption->SetBitErrorRate(direction, bit_error_rate);
+    }
+
+    double NetworkCapture::GetCorruptionRate(Direction direction) const {
+        return main_link_->corruption->GetBitErrorRate(direction);
+    }
+
+    void NetworkCapture::SetCorruptionFixChecksums(bool fix) {
+        main_link_->corruption->SetFixChecksums(fix);
+    }
+
+    bool NetworkCapture::GetCorruptionFixChecksums() const {
+        return main_link_->corruption->GetFixChecksums();
+    }
+
+    uint64_t NetworkCapture::GetCorruptedPackets() const {
+        return main_link_->corruption->GetCorruptedPackets();
+    }
+
+    void NetworkCapture::SetCorruptionInbound(bool enabled) {
+        main_link_->corruption->SetInboundEnabled(enabled);
+    }
+
+    void NetworkCapture::SetCorruptionOutbound(bool enabled) {
+        main_link_->corruption->SetOutboundEnabled(enabled);
+    }
+
+    // Header rewrite control methods
+    void NetworkCapture::SetRewriteEnabled(bool enabled) {
+        main_link_->header_rewrite->SetEnabled(enabled);
+    }
+
+    bool NetworkCapture::IsRewriteEnabled() const {
+        return main_link_->header_rewrite->IsEnabled();
+    }
+
+    void NetworkCapture::SetRewriteHopDecrement(Direction direction, uint32_t hops) {
+        main_link_->header_rewrite->SetHopDecrement(direction, hops);
+    }
+
+    uint32_t NetworkCapture::GetRewriteHopDecrement(Direction direction) const {
+        return main_link_->header_rewrite->GetHopDecrement(direction);
+    }
+
+    void NetworkCapture::SetRewriteDscp(Direction direction, int dscp) {
+        main_link_->header_rewrite->SetDscp(direction, dscp);
+    }
+
+    int NetworkCapture::GetRewriteDscp(Direction direction) const {
+        return main_link_->header_rewrite->GetDscp(direction);
+    }
+
+    void NetworkCapture::SetRewriteMssClamp(Direction direction, uint32_t mss) {
+        main_link_->header_rewrite->SetMssClamp(direction, mss);
+    }
+
+    uint32_t NetworkCapture::GetRewriteMssClamp(Direction direction) const {
+        return main_link_->header_rewrite->GetMssClamp(direction);
+    }
+
+    uint64_t NetworkCapture::GetRewrittenPackets() const {
+        return main_link_->header_rewrite->GetRewrittenPackets();
+    }
+
+    uint64_t NetworkCapture::GetExpiredPackets() const {
+        return main_link_->header_rewrite->GetExpiredPackets();
+    }
+
+    void NetworkCapture::SetRewriteInbound(bool enabled) {
+        main_link_->header_rewrite->SetInboundEnabled(enabled);
+    }
+
+    void NetworkCapture::SetRewriteOutbound(bool enabled) {
+        main_link_->header_rewrite->SetOutboundEnabled(enabled);
+    }
+
+    // MTU control methods
+    void NetworkCapture::SetMtuEnabled(bool enabled) {
+        mtu_module_->SetEnabled(enabled);
+    }
+
+    bool NetworkCapture::IsMtuEnabled() const {
+        return mtu_module_->IsEnabled();
+    }
+
+    void NetworkCapture::SetMtuSize(uint32_t mtu) {
+        mtu_module_->SetMtu(mtu);
+    }
+
+    uint32_t NetworkCapture::GetMtuSize() const {
+        return mtu_module_->GetMtu();
+    }
+
+    void NetworkCapture::SetMtuAction(MtuAction action) {
+        mtu_module_->SetAction(action);
+    }
+
+    MtuAction NetworkCapture::GetMtuAction() const {
+        return mtu_module_->GetAction();
+    }
+
+    void NetworkCapture::SetMtuReassembly(bool enabled) {
+        mtu_module_->SetReassembly(enabled);
+    }
+
+    bool NetworkCapture::GetMtuReassembly() const {
+        return mtu_module_->GetReassembly();
+    }
+
+    uint64_t NetworkCapture::GetMtuDroppedPackets() const {
+        return mtu_module_->GetDroppedPackets();
+    }
+
+    uint64_t NetworkCapture::GetFragmentsCreated() const {
+        return mtu_module_->GetFragmentsCreated();
+    }
+
+    uint64_t NetworkCapture::GetIcmpTooBigSent() const {
+        return mtu_module_->GetIcmpSent();
+    }
+
+    uint64_t NetworkCapture::GetReassembledPackets() const {
+        return mtu_module_->GetReassembledPackets();
+    }
+
+    void NetworkCapture::SetMtuInbound(bool enabled) {
+        mtu_module_->SetInboundEnabled(enabled);
+    }
+
+    void NetworkCapture::SetMtuOutbound(bool enabled) {
+        mtu_module_->SetOutboundEnabled(enabled);
+    }
+
+    // Outage control methods
+    void NetworkCapture::SetOutageEnabled(bool enabled) {
+        outage_module_->SetEnabled(enabled);
+
+        // The outage thread runs the schedule, it keeps running once started
+        if (enabled && is_capturing_.load() && !outage_thread_.joinable()) {
+            outage_thread_ = std::jthread(&NetworkCapture::OutageThread, this);
+        }
+    }
+
+    bool NetworkCapture::IsOutageEnabled() const {
+        return outage_module_->IsEnabled();
+    }
+
+    void NetworkCapture::SetOutage(const OutageConfig& config) {
+        outage_module_->Configure(config);
+    }
+
+    void NetworkCapture::SetOutageInbound(bool enabled) {
+        outage_module_->SetInboundEnabled(enabled);
+    }
+
+    void NetworkCapture::SetOutageOutbound(bool enabled) {
+        outage_module_->SetOutboundEnabled(enabled);
+    }
+
+    bool NetworkCapture::IsLinkDown() const {
+        return outage_module_->IsDown();
+    }
+
+    uint64_t NetworkCapture::GetOutageDrops() const {
+        return outage_module_->GetDroppedPackets();
+    }
+
+    std::vector<OutageEvent> NetworkCapture::GetOutageEvents() const {
+        return outage_module_->GetEvents();
+    }
+
+    void NetworkCapture::ClearOutageEvents() {
+        outage_module_->ClearEvents();
+    }
+
+    // Release slot methods
+    void NetworkCapture::SetReleaseSlots(const ReleaseSlotConfig& config) {
+        slot_max_packets_.store(config.max_packets);
+        slot_max_bytes_.store(config.max_bytes);
+
+        const std::chrono::microseconds slot(config.slot_us);
+        main_link_->latency->SetReleaseSlot(slot);
+        main_link_->jitter->SetReleaseSlot(slot);
+        main_link_->duplicate->SetReleaseSlot(slot);
+
+        // The slot thread only leaves once slot_us_ reads zero, and turning slots off joins it right here,
+        // so a joinable thread is always a live one and turning them back on never finds a dying thread
+        std::lock_guard<std::mutex> lock(slot_thread_mutex_);
+        slot_us_.store(config.slot_us);
+        if (config.slot_us == 0) {
+            slot_thread_ = {};  // Flushes what it still held back
+        }
+        else if (is_capturing_.load()) {
+            StartSlotThread();
+        }
+    }
+
+    // Random seed methods
+    void NetworkCapture::SetRandomSeed(uint64_t seed) {
+        random_seed_.store(seed);
+    }
+
+    uint64_t NetworkCapture::GetRandomSeed() const {
+        return RandomUtils::GetSeed();
+    }
+
+    void NetworkCapture::StartReleaseThreads() {
+        // One thread per kind of delaying stage serves every link
+        const auto links = GetLinkSet();
+        const auto any_link = [&](const auto& enabled) {
+            return enabled(*main_link_) || std::ranges::any_of(*links, [&](const auto& link) { return enabled(*link); });
+        };
+
+        if (!latency_thread_.joinable() && any_link([](const LinkChain& link) { return link.latency->IsEnabled(); })) {
+            latency_thread_ = std::jthread(&NetworkCapture::LatencyReleaseThread, this);
+        }
+        if (!jitter_thread_.joinable() && any_link([](const LinkChain& link) { return link.jitter->IsEnabled(); })) {
+            jitter_thread_ = std::jthread(&NetworkCapture::JitterReleaseThread, this);
+        }
+        if (!bandwidth_thread_.joinable() && any_link([](const LinkChain& link) { return link.IsBandwidthEnabled(); })) {
+            bandwidth_thread_ = std::jthread(&NetworkCapture::BandwidthReleaseThread, this);
+        }
+        if (!duplicate_thread_.joinable() && any_link([](const LinkChain& link) { return link.duplicate->IsEnabled(); })) {
+            duplicate_thread_ = std::jthread(&NetworkCapture::DuplicateReleaseThread, this);
+        }
+        if (!reorder_thread_.joinable() && any_link([](const LinkChain& link) { return link.out_of_order->IsEnabled(); })) {
+            reorder_thread_ = std::jthread(&NetworkCapture::ReorderReleaseThread, this);
+        }
+    }
+
+    void NetworkCapture::StartSlotThread() {
+        // Caller holds slot_thread_mutex_
+        if (!slot_thread_.joinable()) {
+            slot_thread_ = std::jthread(&NetworkCapture::SlotReleaseThread, this);
+        }
+    }
+
+    // Traffic rule methods
+    std::expected<void, std::string> NetworkCapture::SetRules(const std::vector<ClassifierRule>& rules,
+        uint32_t unmatched_modules) {
+        auto compiled = RuleClassifier::Compile(rules, unmatched_modules);
+        if (!compiled) {
+            return std::unexpected(compiled.error());
+        }
+
+        auto classifier = std::make_shared<const RuleClassifier>(std::move(*compiled));
+        std::lock_guard<ContendedMutex> lock(rules_mutex_);
+        rule_classifier_ = std::move(classifier);
+        ++rules_generation_;    // Invalidates every cached decision
+        rule_class_names_.clear();
+        rule_link_names_.clear();
+        for (const auto& rule : rules) {
+            rule_class_names_.push_back(rule.traffic_class);
+            rule_link_names_.push_back(rule.link);
+        }
+        PublishRules();
+        return {};
+    }
+
+    void NetworkCapture::PublishRules() {
+        auto rules = std::make_shared<RuleSet>();
+        rules->classifier = rule_classifier_;
+        rules->generation = rules_generation_;
+
+        // Rules naming a class that does not exist (yet) leave their traffic to DSCP
+        rules->traffic_classes.assign(rule_class_names_.size(), 0);
+        for (size_t i = 0; i < rule_class_names_.size(); ++i) {
+            const auto it = std::ranges::find(traffic_class_names_, rule_class_names_[i]);
+            if (!rule_class_names_[i].empty() && it != traffic_class_names_.end()) {
+                rules->traffic_classes[i] = static_cast<uint8_t>(it - traffic_class_names_.begin() + 1);
+            }
+        }
+
+        // Rules naming a link that does not exist (yet) keep their traffic on the main link
+        rules->links.assign(rule_link_names_.size(), 0);
+        for (size_t i = 0; i < rule_link_names_.size(); ++i) {
+            const auto it = std::ranges::find(link_names_, rule_link_names_[i]);
+            if (!rule_link_names_[i].empty() && it != link_names_.end()) {
+                rules->links[i] = static_cast<uint8_t>(it - link_names_.begin() + 1);
+            }
+        }
+        rule_set_ = std::move(rules);
+    }
+
+    std::shared_ptr<const NetworkCapture::RuleSet> NetworkCapture::GetRuleSet() const {
+        std::lock_guard<ContendedMutex> lock(rules_mutex_);
+        return rule_set_;
+    }
+
+    std::expected<void, std::string> NetworkCapture::SetLinks(const std::vector<LinkConfig>& configs) {
+        if (configs.size() > MAX_LINKS) {
+            return std::unexpected(std::format("At most {} links", MAX_LINKS));
+        }
+        std::vector<std::string> names;
+        for (const auto& config : configs) {
+            if (config.name.empty()) {
+                return std::unexpected(std::string("Links need a name"));
+            }
+            if (std::ranges::find(names, config.name) != names.end()) {
+                return std::unexpected(std::format("Duplicate link '{}'", config.name));
+            }
+            names.push_back(config.name);
+        }
+
+        // A link that keeps its name keeps its queues and flow state
+        const auto current = GetLinkSet();
+        auto links = std::make_shared<LinkSet>();
+        for (const auto& config : configs) {
+            const auto it = std::ranges::find(*current, config.name, &LinkChain::name);
+            auto link = it != current->end() ? *it : std::make_shared<LinkChain>();
+            link->Configure(config);
+            links->push_back(std::move(link));
+        }
+
+        {
+            std::lock_guard<ContendedMutex> lock(links_mutex_);
+            links_ = std::move(links);
+        }
+        {
+            std::lock_guard<ContendedMutex> lock(rules_mutex_);
+            link_names_ = std::move(names);
+            PublishRules();
+        }
+
+        // Removed links hand over what they held back instead of dropping it
+        if (is_capturing_.load()) {
+            std::vector<SimulatedPacket> drained;
+            for (const auto& link : *current) {
+                if (std::ranges::find(configs, link->name, &LinkConfig::name) == configs.end()) {
+                    link->Drain(drained);
+                }
+            }
+            drained = outage_module_->ProcessBatch(std::move(drained));
+            if (!drained.empty() && backend_->IsOpen()) {
+                SendPackets(drained);
+                packets_injected_.fetch_add(drained.size());
+            }
+
+            StartReleaseThreads();
+        }
+        return {};
+    }
+
+    std::vector<LinkInfo> NetworkCapture::GetLinks() const {
+        std::vector<LinkInfo> links;
+        for (const auto& link : *GetLinkSet()) {
+            links.push_back({ link->name, link->packets_processed.load(), link->bytes_processed.load() });
+        }
+        return links;
+    }
+
+    std::shared_ptr<const NetworkCapture::LinkSet> NetworkCapture::GetLinkSet() const {
+        std::lock_guard<ContendedMutex> lock(links_mutex_);
+        return links_;
+    }
+
+    std::vector<SimulatedPacket> NetworkCapture::RunLinks(std::vector<SimulatedPacket>&& packets) {
+        const auto links = GetLinkSet();
+        const auto named = [&](const SimulatedPacket& packet) {
+            return packet.link != 0 && packet.link <= links->size();
+        };
+        if (links->empty() || std::ranges::none_of(packets, named)) {
+            return main_link_->Process(std::move(packets), *mtu_module_);
+        }
+
+        // Split by link, packets of a link that went away stay on the main link
+        std::vector<std::vector<SimulatedPacket>> routed(links->size() + 1);
+        for (auto& packet : packets) {
+            routed[named(packet) ? packet.link : 0].push_back(std::move(packet));
+        }
+
+        auto output = main_link_->Process(std::move(routed[0]), *mtu_module_);
+        for (size_t i = 1; i < routed.size(); ++i) {
+            if (routed[i].empty()) {
+                continue;
+            }
+            auto sent = (*links)[i - 1]->Process(std::move(routed[i]), *mtu_module_);
+            output.insert(output.end(), std::make_move_iterator(sent.begin()), std::make_move_iterator(sent.end()));
+        }
+        return output;
+    }
+
+    std::vector<SimulatedPacket> NetworkCapture::CollectReleasable(
+        void (LinkChain::*release)(std::vector<SimulatedPacket>&)) {
+        std::vector<SimulatedPacket> packets;
+        (main_link_.get()->*release)(packets);
+        for (const auto& link : *GetLinkSet()) {
+            (link.get()->*release)(packets);
+        }
+        return packets;
+    }
+
+    std::vector<SimulatedPacket> NetworkCapture::CollectDuplicates() {
+        std::vector<SimulatedPacket> packets;
+        main_link_->ReleaseDuplicates(packets, *mtu_module_);
+        for (const auto& link : *GetLinkSet()) {
+            link->ReleaseDuplicates(packets, *mtu_module_);
+        }
+        return packets;
+    }
+
+    std::chrono::steady_clock::time_point NetworkCapture::NextDuplicateRelease() const {
+        auto next = main_link_->NextDuplicateRelease();
+        for (const auto& link : *GetLinkSet()) {
+            next = std::min(next, link->NextDuplicateRelease());
+        }
+        return next;
+    }
+
+    size_t NetworkCapture::GetRuleCount() const {
+        const auto rules = GetRuleSet();
+        return rules->classifier ? rules->classifier->GetRuleCount() : 0;
+    }
+
+    void NetworkCapture::ApplyRules(std::vector<SimulatedPacket>& packets, std::vector<uint64_t>& candidates) {
+        // DNS answers are learned even without rules, so a domain rule added mid-capture
+        // already knows the addresses resolved before it
+        for (const auto& packet : packets) {
+            if (auto answer = SnoopDnsResponse(packet)) {
+                std::lock_guard<ContendedMutex> lock(domain_mutex_);
+                domain_cache_->Learn(*answer);
+            }
+        }
+
+        const auto rules = GetRuleSet();
+        if (!rules->classifier) {
+            return;     // No rules, packets keep ModuleMask::ALL
+        }
+
+        const RuleClassifier& classifier = *rules->classifier;
+        const uint64_t content_rules = classifier.GetContentRules();
+        const uint64_t domain_rules = classifier.GetDomainRules();
+        candidates.resize(packets.size());
+        for (size_t i = 0; i < packets.size(); ++i) {
+            const SimulatedPacket& packet = packets[i];
+            if (!packet.flow.IsValid()) {
+                const FlowKey key = FlowKey::FromPacket(packet.Bytes(), packet.headers, packet.addr.Outbound);
+                uint64_t matched = classifier.Candidates(key);
+                if (matched & content_rules) {
+                    matched &= ~content_rules | classifier.MatchContent(packet).value_or(0);
+                }
+                if (matched & domain_rules) {
+                    matched &= ~domain_rules | LookupDomainRules(classifier, key) |
+                        classifier.MatchServerName(packet).value_or(0);
+                }
+                candidates[i] = matched;
+                continue;
+            }
+
+            // First packet of a flow (or of a new rule set) pays for the lookups
+            RuleDecision decision;
+            {
+                std::lock_guard<ContendedMutex> lock(rule_cache_mutex_);
+                RuleDecision& cached = (*rule_cache_)[packet.flow];
+                if (cached.generation != rules->generation) {
+                    const FlowKey key = FlowKey::FromPacket(packet.Bytes(), packet.headers, packet.addr.Outbound);
+                    cached.candidates = classifier.Candidates(key);
+                    cached.content_scans = 0;
+                    cached.content = 0;
+                    cached.domain_scans = 0;
+                    cached.domains = cached.candidates & domain_rules ? LookupDomainRules(classifier, key) : 0;
+                    cached.generation = rules->generation;
+                }
+                decision = cached;
+            }
+
+            // Flows the DNS cache could not name get a look at their TLS ClientHello
+            std::optional<uint64_t> domains;
+            const uint64_t unnamed = decision.candidates & domain_rules & ~decision.domains;
+            if (unnamed && decision.domain_scans < RuleClassifier::CONTENT_SCAN_PACKETS) {
+                domains = classifier.MatchServerName(packet);
+            }
+
+            // Payload scans stop once every content candidate matched or the flow's first
+            // payload packets were seen, later packets reuse the flow's result
+            std::optional<uint64_t> content;
+            const uint64_t pending = decision.candidates & content_rules & ~decision.content;
+            if (pending && decision.content_scans < RuleClassifier::CONTENT_SCAN_PACKETS) {
+                content = classifier.MatchContent(packet);
+            }
+
+            // Scans ran unlocked, fold them into the flow's decision unless the rules moved on
+            if (domains || content) {
+                std::lock_guard<ContendedMutex> lock(rule_cache_mutex_);
+                RuleDecision& cached = (*rule_cache_)[packet.flow];
+                if (cached.generation == rules->generation) {
+                    cached.domains |= domains.value_or(0);
+                    cached.domain_scans += domains ? 1 : 0;
+                    cached.content |= content.value_or(0);
+                    cached.content_scans += content ? 1 : 0;
+                    decision = cached;
+                }
+                else {
+                    decision.domains |= domains.value_or(0);
+                    decision.content |= content.value_or(0);
+                }
+            }
+            candidates[i] = decision.candidates & (~content_rules | decision.content) &
+                (~domain_rules | decision.domains);
+        }
+
+        // Packet filters run batch-wide on the filter VM, only for rules some packet still has
+        if (classifier.HasFilters()) {
+            classifier.ApplyFilters(packets, candidates);
+        }
+
+        for (size_t i = 0; i < packets.size(); ++i) {
+            packets[i].modules = classifier.Resolve(candidates[i]);
+            if (candidates[i]) {
+                const int winner = std::countr_zero(candidates[i]);
+                packets[i].traffic_class = rules->traffic_classes[winner];
+                packets[i].link = rules->links[winner];
+            }
+        }
+    }
+
+    uint64_t NetworkCapture::LookupDomainRules(const RuleClassifier& classifier, const FlowKey& key) const {
+        const auto& remote = key.outbound ? key.dst_addr : key.src_addr;
+        std::lock_guard<ContendedMutex> lock(domain_mutex_);
+        const std::string* name = domain_cache_->Find(key.ip_version, remote);
+        return name ? classifier.MatchDomain(*name) : 0;
     }
 
     // Runtime parameter methods
     bool NetworkCapture::SetQueueLength(uint64_t length) {
-        if (divert_handle_ == INVALID_HANDLE_VALUE) {
+        if (!backend_->IsOpen()) {
             return false;
         }
 
-        bool result = WinDivertSetParam(divert_handle_, WINDIVERT_PARAM_QUEUE_LENGTH, length);
+        bool result = backend_->SetParam(WINDIVERT_PARAM_QUEUE_LENGTH, length);
         if (result) {
             std::lock_guard<std::mutex> lock(params_mutex_);
             current_params_.queue_length = length;
@@ -369,11 +1111,11 @@ namespace BadLink {
     }
 
     bool NetworkCapture::SetQueueTime(uint64_t time_ms) {
-        if (divert_handle_ == INVALID_HANDLE_VALUE) {
+        if (!backend_->IsOpen()) {
             return false;
         }
 
-        bool result = WinDivertSetParam(divert_handle_, WINDIVERT_PARAM_QUEUE_TIME, time_ms);
+        bool result = backend_->SetParam(WINDIVERT_PARAM_QUEUE_TIME, time_ms);
         if (result) {
             std::lock_guard<std::mutex> lock(params_mutex_);
             current_params_.queue_time = time_ms;
@@ -382,11 +1124,11 @@ namespace BadLink {
     }
 
     bool NetworkCapture::SetQueueSize(uint64_t size) {
-        if (divert_handle_ == INVALID_HANDLE_VALUE) {
+        if (!backend_->IsOpen()) {
             return false;
         }
 
-        bool result = WinDivertSetParam(divert_handle_, WINDIVERT_PARAM_QUEUE_SIZE, size);
+        bool result = backend_->SetParam(WINDIVERT_PARAM_QUEUE_SIZE, size);
         if (result) {
             std::lock_guard<std::mutex> lock(params_mutex_);
             current_params_.queue_size = size;
@@ -402,16 +1144,16 @@ namespace BadLink {
     NetworkCapture::VersionInfo NetworkCapture::GetDriverVersion() const {
         VersionInfo info = { 0, 0 };
 
-        if (divert_handle_ != INVALID_HANDLE_VALUE) {
-            WinDivertGetParam(divert_handle_, WINDIVERT_PARAM_VERSION_MAJOR, &info.major);
-            WinDivertGetParam(divert_handle_, WINDIVERT_PARAM_VERSION_MINOR, &info.minor);
+        if (backend_->IsOpen()) {
+            backend_->GetParam(WINDIVERT_PARAM_VERSION_MAJOR, &info.major);
+            backend_->GetParam(WINDIVERT_PARAM_VERSION_MINOR, &info.minor);
         }
 
         return info;
     }
 
     std::vector<PacketInfo> NetworkCapture::GetPackets() {
-        std::lock_guard<std::mutex> lock(packets_mutex_);
+        std::lock_guard<ContendedMutex> lock(packets_mutex_);
         std::vector<PacketInfo> result(packets_.begin(), packets_.end());
         packets_.clear();
         return result;
@@ -429,6 +1171,12 @@ namespace BadLink {
         uint64_t batches = batch_count_.load();
         stats.avg_batch_size = (batches > 0) ?
             static_cast<double>(total_packets) / batches : 0.0;
+        stats.active_flows = flow_table_->GetActiveFlows();
+        stats.flow_evictions = flow_table_->GetEvictions();
+        stats.slots_sent = slots_sent_.load();
+        stats.avg_slot_packets = stats.slots_sent > 0 ?
+            static_cast<double>(slot_packets_.load()) / stats.slots_sent : 0.0;
+        stats.slot_backlog = slot_backlog_.load();
 
         return stats;
     }
@@ -444,20 +1192,18 @@ namespace BadLink {
         const uint32_t batch_size = params.batch_size;
         std::vector<uint8_t> packet_buffer(params.packet_buffer_size);
         std::vector<WINDIVERT_ADDRESS> addr_buffer(batch_size);
+        std::vector<uint64_t> rule_candidates;     // Per packet of the current batch
 
         while (!should_stop_.load()) {
             UINT recv_len = 0;
             UINT addr_len = static_cast<UINT>(sizeof(WINDIVERT_ADDRESS) * batch_size);
 
-            // Receive batch of packets using WinDivertRecvEx
-            if (!WinDivertRecvEx(divert_handle_,
-                packet_buffer.data(),
+            // Receive batch of packets from the backend
+            if (!backend_->Receive(packet_buffer.data(),
                 static_cast<UINT>(packet_buffer.size()),
                 &recv_len,
-                0,  // flags
                 addr_buffer.data(),
-                &addr_len,
-                nullptr)) {  // No overlapped I/O for now
+                &addr_len)) {
 
                 DWORD error = ::GetLastError();
 
@@ -468,7 +1214,7 @@ namespace BadLink {
 
                 // Handle other errors
                 if (error != ERROR_NO_DATA) {
-                    SetError(std::format("WinDivertRecvEx failed: {}", error));
+                    SetError(std::format("Receive failed: {}", error));
                 }
                 continue;
             }
@@ -481,10 +1227,21 @@ namespace BadLink {
             batch_count_.fetch_add(1);
             total_batch_packets_.fetch_add(num_packets);
 
+            // Link down and dropping: the batch goes before any parsing or copying
+            if (outage_module_->DropsWholeBatches()) {
+                outage_module_->CountDropped(num_packets);
+                packets_captured_.fetch_add(num_packets);
+                bytes_captured_.fetch_add(recv_len);
+                continue;
+            }
+
             // Convert received packets to SimulatedPackets
             std::vector<SimulatedPacket> sim_packets;
             sim_packets.reserve(num_packets);
 
+            // TCP larger than both the link MTU and its adapter's MTU was coalesced by LSO/RSC
+            const uint32_t link_mtu = mtu_module_->GetMtu();
+
             const uint8_t* packet_ptr = packet_buffer.data();
             UINT bytes_processed = 0;
             const auto current_time = std::chrono::steady_clock::now();
@@ -515,7 +1272,7 @@ namespace BadLink {
                         addr_buffer[i]
                     );
                     {
-                        std::lock_guard<std::mutex> lock(packets_mutex_);
+                        std::lock_guard<ContendedMutex> lock(packets_mutex_);
                         packets_.push_back(info);
                         if (packets_.size() > max_packets_) {
                             packets_.pop_front();
@@ -525,8 +1282,10 @@ namespace BadLink {
 
                     // Create SimulatedPacket for processing
                     SimulatedPacket sim_packet;
-                    sim_packet.data.assign(packet_ptr, packet_ptr + packet_len);
+                    sim_packet.data = std::make_shared<std::vector<uint8_t>>(packet_ptr, packet_ptr + packet_len);
                     sim_packet.addr = addr_buffer[i];
+                    sim_packet.headers = ParseHeaders(*sim_packet.data);
+                    Gso::Classify(sim_packet, link_mtu, *interface_mtus_);
                     sim_packet.timestamp = current_time;
                     sim_packets.push_back(std::move(sim_packet));
 
@@ -540,176 +1299,215 @@ namespace BadLink {
                 }
             }
 
-            // Apply simulation effects in order
-            // 1. Packet loss (drops packets)
-            if (packet_loss_module_->IsEnabled()) {
-                sim_packets = packet_loss_module_->ProcessBatch(std::move(sim_packets));
-            }
+            // Give every packet its flow handle before any module looks at it
+            flow_table_->Classify(sim_packets, std::chrono::steady_clock::now());
+            ApplyRules(sim_packets, rule_candidates);
 
-            // 2. Duplicate (creates duplicates)
-            if (duplicate_module_->IsEnabled()) {
-                sim_packets = duplicate_module_->ProcessBatch(std::move(sim_packets));
-            }
+            // Apply simulation effects in order, each packet through the chain of its link
+            sim_packets = RunLinks(std::move(sim_packets));
 
-            // 3. Out of order (reorders packets)
-            if (out_of_order_module_->IsEnabled()) {
-                sim_packets = out_of_order_module_->ProcessBatch(std::move(sim_packets));
+            // Then the outage (drops or holds whatever reaches the wire while the link is down)
+            if (outage_module_->IsEnabled()) {
+                sim_packets = outage_module_->ProcessBatch(std::move(sim_packets));
             }
 
-            // 4. Jitter (adds variable delay)
-            if (jitter_module_->IsEnabled()) {
-                sim_packets = jitter_module_->ProcessBatch(std::move(sim_packets));
+            // Send packets that aren't delayed
+            if (!sim_packets.empty() && SendPackets(sim_packets)) {
+                packets_injected_.fetch_add(sim_packets.size());
             }
+        }
+    }
 
-            // 5. Bandwidth limiting (rate limits)
-            if (bandwidth_module_->IsEnabled()) {
-                sim_packets = bandwidth_module_->ProcessBatch(std::move(sim_packets));
+    void NetworkCapture::LatencyReleaseThread() {
+        using namespace std::chrono_literals;
+
+        while (!should_stop_.load()) {
+            // Check every 10ms for packets ready to be released
+            std::this_thread::sleep_for(10ms);
+            if (slot_us_.load() != 0) {
+                continue;   // The slot thread releases for every module
             }
 
-            // 6. Latency (adds fixed delay)
-            if (latency_module_->IsEnabled()) {
-                sim_packets = latency_module_->ProcessBatch(std::move(sim_packets));
+            auto releasable = CollectReleasable(&LinkChain::ReleaseLatency);
+            releasable = outage_module_->ProcessBatch(std::move(releasable));
+            if (!releasable.empty() && backend_->IsOpen()) {
+                SendPackets(releasable);
+                packets_injected_.fetch_add(releasable.size());
             }
+        }
+    }
 
-            // Send packets that aren't delayed
-            if (!sim_packets.empty()) {
-                // Calculate total size needed
-                size_t total_bytes = 0;
-                for (const auto& sim_packet : sim_packets) {
-                    total_bytes += sim_packet.data.size();
-                }
+    void NetworkCapture::JitterReleaseThread() {
+        using namespace std::chrono_literals;
 
-                // Rebuild packet buffer for sending with proper reservation
-                std::vector<uint8_t> send_buffer;
-                std::vector<WINDIVERT_ADDRESS> send_addrs;
-                send_buffer.reserve(total_bytes);
-                send_addrs.reserve(sim_packets.size());
-
-                for (const auto& sim_packet : sim_packets) {
-                    send_buffer.insert(send_buffer.end(),
-                        sim_packet.data.begin(),
-                        sim_packet.data.end());
-                    send_addrs.push_back(sim_packet.addr);
-                }
+        while (!should_stop_.load()) {
+            // Check every 10ms for packets ready to be released
+            std::this_thread::sleep_for(10ms);
+            if (slot_us_.load() != 0) {
+                continue;   // The slot thread releases for every module
+            }
 
-                UINT send_len = 0;
-                if (WinDivertSendEx(divert_handle_,
-                    send_buffer.data(),
-                    static_cast<UINT>(send_buffer.size()),
-                    &send_len,
-                    0,  // flags
-                    send_addrs.data(),
-                    static_cast<UINT>(send_addrs.size() * sizeof(WINDIVERT_ADDRESS)),
-                    nullptr)) {
-                    packets_injected_.fetch_add(sim_packets.size());
-                }
+            auto releasable = CollectReleasable(&LinkChain::ReleaseJitter);
+            releasable = outage_module_->ProcessBatch(std::move(releasable));
+            if (!releasable.empty() && backend_->IsOpen()) {
+                SendPackets(releasable);
+                packets_injected_.fetch_add(releasable.size());
             }
         }
     }
 
-    void NetworkCapture::LatencyReleaseThread() {
+    void NetworkCapture::BandwidthReleaseThread() {
         using namespace std::chrono_literals;
 
         while (!should_stop_.load()) {
             // Check every 10ms for packets ready to be released
             std::this_thread::sleep_for(10ms);
+            if (slot_us_.load() != 0) {
+                continue;   // The slot thread releases for every module
+            }
 
-            auto releasable = latency_module_->GetReleasablePackets();
-            if (!releasable.empty() && divert_handle_ != INVALID_HANDLE_VALUE) {
-                // Send released packets
-                std::vector<uint8_t> send_buffer;
-                std::vector<WINDIVERT_ADDRESS> send_addrs;
-
-                for (const auto& packet : releasable) {
-                    send_buffer.insert(send_buffer.end(),
-                        packet.data.begin(),
-                        packet.data.end());
-                    send_addrs.push_back(packet.addr);
-                }
+            auto releasable = CollectReleasable(&LinkChain::ReleaseBandwidth);
+            releasable = outage_module_->ProcessBatch(std::move(releasable));
+            if (!releasable.empty() && backend_->IsOpen()) {
+                SendPackets(releasable);
+                packets_injected_.fetch_add(releasable.size());
+            }
+        }
+    }
+
+    void NetworkCapture::DuplicateReleaseThread() {
+        using namespace std::chrono_literals;
+        PreciseTimer timer;
 
-                UINT send_len = 0;
-                WinDivertSendEx(divert_handle_,
-                    send_buffer.data(),
-                    static_cast<UINT>(send_buffer.size()),
-                    &send_len,
-                    0,
-                    send_addrs.data(),
-                    static_cast<UINT>(send_addrs.size() * sizeof(WINDIVERT_ADDRESS)),
-                    nullptr);
+        while (!should_stop_.load()) {
+            // Wake when the next copy falls due, duplicate delays are a few milliseconds
+            // Every 10ms at the latest to pick up new settings and stop requests
+            const auto now = std::chrono::steady_clock::now();
+            timer.SleepUntil(std::clamp(NextDuplicateRelease(), now + 1ms, now + 10ms));
+            if (slot_us_.load() != 0) {
+                continue;   // The slot thread releases for every module
+            }
 
+            // Copies still delayed by later stages come back through those stages' threads
+            auto releasable = CollectDuplicates();
+            releasable = outage_module_->ProcessBatch(std::move(releasable));
+            if (!releasable.empty() && backend_->IsOpen()) {
+                SendPackets(releasable);
                 packets_injected_.fetch_add(releasable.size());
             }
         }
     }
 
-    void NetworkCapture::JitterReleaseThread() {
+    void NetworkCapture::ReorderReleaseThread() {
         using namespace std::chrono_literals;
 
         while (!should_stop_.load()) {
-            // Check every 10ms for packets ready to be released
+            // Check every 10ms for flows that went quiet with packets held back
             std::this_thread::sleep_for(10ms);
+            if (slot_us_.load() != 0) {
+                continue;   // The slot thread releases for every module
+            }
 
-            auto releasable = jitter_module_->GetReleasablePackets();
-            if (!releasable.empty() && divert_handle_ != INVALID_HANDLE_VALUE) {
-                // Send released packets
-                std::vector<uint8_t> send_buffer;
-                std::vector<WINDIVERT_ADDRESS> send_addrs;
-
-                for (const auto& packet : releasable) {
-                    send_buffer.insert(send_buffer.end(),
-                        packet.data.begin(),
-                        packet.data.end());
-                    send_addrs.push_back(packet.addr);
-                }
+            auto releasable = CollectReleasable(&LinkChain::ReleaseReorder);
+            releasable = outage_module_->ProcessBatch(std::move(releasable));
+            if (!releasable.empty() && backend_->IsOpen()) {
+                SendPackets(releasable);
+                packets_injected_.fetch_add(releasable.size());
+            }
+        }
+    }
 
-                UINT send_len = 0;
-                WinDivertSendEx(divert_handle_,
-                    send_buffer.data(),
-                    static_cast<UINT>(send_buffer.size()),
-                    &send_len,
-                    0,
-                    send_addrs.data(),
-                    static_cast<UINT>(send_addrs.size() * sizeof(WINDIVERT_ADDRESS)),
-                    nullptr);
+    void NetworkCapture::SlotReleaseThread() {
+        PreciseTimer timer;
+        SlotAggregator aggregator;
+        std::vector<SimulatedPacket> aggregate;
 
-                packets_injected_.fetch_add(releasable.size());
+        while (!should_stop_.load()) {
+            const std::chrono::microseconds slot(slot_us_.load());
+            if (slot.count() == 0) {
+                break;
             }
+
+            // Wake on the next boundary, the modules aligned their release times to it
+            timer.SleepUntil(AlignToSlot(std::chrono::steady_clock::now() + std::chrono::nanoseconds(1), slot));
+
+            aggregator.Add(CollectReleasable(&LinkChain::ReleaseLatency));
+            aggregator.Add(CollectReleasable(&LinkChain::ReleaseJitter));
+            aggregator.Add(CollectReleasable(&LinkChain::ReleaseBandwidth));
+            aggregator.Add(CollectDuplicates());
+            aggregator.Add(CollectReleasable(&LinkChain::ReleaseReorder));
+
+            ReleaseSlotConfig config;
+            config.slot_us = static_cast<uint32_t>(slot.count());
+            config.max_packets = slot_max_packets_.load();
+            config.max_bytes = slot_max_bytes_.load();
+
+            aggregate.clear();
+            aggregator.Cut(config, aggregate);
+            slot_backlog_.store(aggregator.GetBacklog());
+            aggregate = outage_module_->ProcessBatch(std::move(aggregate));
+            if (!aggregate.empty() && backend_->IsOpen()) {
+                SendPackets(aggregate);
+                packets_injected_.fetch_add(aggregate.size());
+                slots_sent_.fetch_add(1);
+                slot_packets_.fetch_add(aggregate.size());
+            }
+        }
+
+        // Slots switched off or capture stopping: nothing stays behind, but a link that is down
+        // still drops or holds the backlog like any other slot
+        aggregate.clear();
+        aggregator.Flush(aggregate);
+        aggregate = outage_module_->ProcessBatch(std::move(aggregate));
+        if (!aggregate.empty() && backend_->IsOpen()) {
+            SendPackets(aggregate);
+            packets_injected_.fetch_add(aggregate.size());
         }
+        slot_backlog_.store(0);
     }
 
-    void NetworkCapture::BandwidthReleaseThread() {
+    void NetworkCapture::OutageThread() {
         using namespace std::chrono_literals;
+        PreciseTimer timer;
 
         while (!should_stop_.load()) {
-            // Check every 10ms for packets ready to be released
-            std::this_thread::sleep_for(10ms);
+            const auto now = std::chrono::steady_clock::now();
+            const auto next_transition = outage_module_->Advance(now);
+
+            // Packets held through an outage that just ended
+            auto released = outage_module_->GetReleasablePackets();
+            if (!released.empty() && backend_->IsOpen()) {
+                SendPackets(released);
+                packets_injected_.fetch_add(released.size());
+            }
 
-            auto releasable = bandwidth_module_->GetReleasablePackets();
-            if (!releasable.empty() && divert_handle_ != INVALID_HANDLE_VALUE) {
-                // Send released packets
-                std::vector<uint8_t> send_buffer;
-                std::vector<WINDIVERT_ADDRESS> send_addrs;
-
-                for (const auto& packet : releasable) {
-                    send_buffer.insert(send_buffer.end(),
-                        packet.data.begin(),
-                        packet.data.end());
-                    send_addrs.push_back(packet.addr);
-                }
+            // Wake on the transition, or sooner to pick up new settings and stop requests
+            timer.SleepUntil(next_transition < now + 100ms ? next_transition : now + 100ms);
+        }
+    }
 
-                UINT send_len = 0;
-                WinDivertSendEx(divert_handle_,
-                    send_buffer.data(),
-                    static_cast<UINT>(send_buffer.size()),
-                    &send_len,
-                    0,
-                    send_addrs.data(),
-                    static_cast<UINT>(send_addrs.size() * sizeof(WINDIVERT_ADDRESS)),
-                    nullptr);
+    bool NetworkCapture::SendPackets(const std::vector<SimulatedPacket>& packets) {
+        // Calculate total size needed
+        size_t total_bytes = 0;
+        for (const auto& packet : packets) {
+            total_bytes += packet.Size();
+        }
 
-                packets_injected_.fetch_add(releasable.size());
-            }
+        // Rebuild packet buffer for sending with proper reservation
+        std::vector<uint8_t> send_buffer;
+        std::vector<WINDIVERT_ADDRESS> send_addrs;
+        send_buffer.reserve(total_bytes);
+        send_addrs.reserve(packets.size());
+
+        for (const auto& packet : packets) {
+            packet.AppendTo(send_buffer);
+            send_addrs.push_back(packet.addr);
         }
+
+        return backend_->Send(send_buffer.data(),
+            static_cast<UINT>(send_buffer.size()),
+            send_addrs.data(),
+            static_cast<UINT>(send_addrs.size() * sizeof(WINDIVERT_ADDRESS)));
     }
 
     PacketInfo NetworkCapture::ParsePacket(std::span<const uint8_t> packet_data,
@@ -1,6 +1,7 @@
 #ifndef BADLINK_SRC_NETWORK_CAPTURE_H_
 #define BADLINK_SRC_NETWORK_CAPTURE_H_
 
+#include "lock_stats.h"
 #include <windivert.h>
 #include <string>
 #include <vector>
@@ -20,13 +21,31 @@
 namespace BadLink {
 
     // Forward declarations
-    class LatencyModule;
-    class PacketLossModule;
-    class DuplicateModule;
-    class OutOfOrderModule;
-    class JitterModule;
-    class BandwidthModule;
+    class CaptureBackend;
+    class LatencyMap;
+    class MtuModule;
+    class OutageModule;
+    class FlowTable;
+    class RuleClassifier;
+    class DomainCache;
+    namespace Gso { class InterfaceMtus; }
+    struct FlowKey;
+    template <typename T> class PerFlow;
+    enum class MtuAction : uint8_t;
+    enum class Direction : uint8_t;
+    enum class BandwidthMode : uint8_t;
+    struct PolicerConfig;
+    struct PolicerCounters;
+    struct CrossTrafficConfig;
+    struct CrossTrafficStats;
+    struct ReleaseSlotConfig;
+    struct OutageConfig;
+    struct OutageEvent;
     struct SimulatedPacket;
+    struct ClassifierRule;
+    struct TrafficClassConfig;
+    struct LinkChain;
+    struct LinkConfig;
 
     // Configuration constants with defaults
     struct ConfigConstants {
@@ -75,6 +94,40 @@ namespace BadLink {
         uint8_t     ip_version;     // 4 or 6
     };
 
+    // Flow held back by the per-flow bandwidth cap
+    struct FlowQueueInfo {
+        IPAddress   src_addr;
+        IPAddress   dst_addr;
+        uint16_t    src_port;
+        uint16_t    dst_port;
+        uint8_t     protocol;
+        bool        outbound;
+        size_t      queued_packets;
+        size_t      queued_bytes;
+        uint64_t    drops;          // Tail drops of this flow since it was first queued
+    };
+
+    // Live state of a bandwidth traffic class
+    struct TrafficClassInfo {
+        std::string name;
+        uint8_t     priority;
+        uint32_t    rate_kbps;
+        uint32_t    ceil_kbps;
+        double      current_kbps;
+        uint64_t    sent_packets;
+        uint64_t    borrowed_bytes;     // Sent above the guaranteed rate
+        uint64_t    drops;
+        size_t      backlog_packets;
+        size_t      backlog_bytes;
+    };
+
+    // Traffic a named link has carried
+    struct LinkInfo {
+        std::string name;
+        uint64_t    packets;
+        uint64_t    bytes;
+    };
+
     // WinDivert runtime parameters
     struct CaptureParameters {
         // WinDivert queue parameters
@@ -108,58 +161,156 @@ namespace BadLink {
         // Stop capturing
         void Stop();
 
+        // Packet source and sink of the next Start, only while stopped; nullptr goes back to WinDivert
+        std::expected<void, std::string> SetBackend(std::unique_ptr<CaptureBackend> backend);
+
         // Simulation control methods - Latency
         void SetLatencyEnabled(bool enabled);
         bool IsLatencyEnabled() const;
-        void SetLatency(uint32_t latency_ms);
-        uint32_t GetLatency() const;
+        void SetLatency(Direction direction, uint32_t latency_ms);
+        uint32_t GetLatency(Direction direction) const;
         void SetLatencyInbound(bool enabled);
         void SetLatencyOutbound(bool enabled);
+        void SetLatencyMap(std::shared_ptr<const LatencyMap> map);     // nullptr clears it
+        std::shared_ptr<const LatencyMap> GetLatencyMap() const;
 
         // Simulation control methods - Packet Loss
         void SetPacketLossEnabled(bool enabled);
         bool IsPacketLossEnabled() const;
-        void SetPacketLossRate(float loss_percentage);
-        float GetPacketLossRate() const;
+        void SetPacketLossRate(Direction direction, float loss_percentage);
+        float GetPacketLossRate(Direction direction) const;
         void SetPacketLossInbound(bool enabled);
         void SetPacketLossOutbound(bool enabled);
 
         // Simulation control methods - Duplicate
         void SetDuplicateEnabled(bool enabled);
         bool IsDuplicateEnabled() const;
-        void SetDuplicateRate(float duplicate_percentage);
-        float GetDuplicateRate() const;
-        void SetDuplicateCount(uint32_t count);
-        uint32_t GetDuplicateCount() const;
+        void SetDuplicateRate(Direction direction, float duplicate_percentage);
+        float GetDuplicateRate(Direction direction) const;
+        void SetDuplicateCount(Direction direction, uint32_t count);
+        uint32_t GetDuplicateCount(Direction direction) const;
+        void SetDuplicateDelay(Direction direction, uint32_t min_ms, uint32_t max_ms);
+        uint32_t GetDuplicateDelayMin(Direction direction) const;
+        uint32_t GetDuplicateDelayMax(Direction direction) const;
         void SetDuplicateInbound(bool enabled);
         void SetDuplicateOutbound(bool enabled);
 
         // Simulation control methods - Out of Order
         void SetOutOfOrderEnabled(bool enabled);
         bool IsOutOfOrderEnabled() const;
-        void SetOutOfOrderRate(float reorder_percentage);
-        float GetOutOfOrderRate() const;
-        void SetReorderGap(uint32_t gap);
-        uint32_t GetReorderGap() const;
+        void SetOutOfOrderRate(Direction direction, float reorder_percentage);
+        float GetOutOfOrderRate(Direction direction) const;
+        void SetReorderGap(Direction direction, uint32_t gap);
+        uint32_t GetReorderGap(Direction direction) const;
         void SetOutOfOrderInbound(bool enabled);
         void SetOutOfOrderOutbound(bool enabled);
 
         // Simulation control methods - Jitter
         void SetJitterEnabled(bool enabled);
         bool IsJitterEnabled() const;
-        void SetJitterRange(uint32_t min_ms, uint32_t max_ms);
-        uint32_t GetJitterMin() const;
-        uint32_t GetJitterMax() const;
+        void SetJitterRange(Direction direction, uint32_t min_ms, uint32_t max_ms);
+        uint32_t GetJitterMin(Direction direction) const;
+        uint32_t GetJitterMax(Direction direction) const;
         void SetJitterInbound(bool enabled);
         void SetJitterOutbound(bool enabled);
 
         // Simulation control methods - Bandwidth
         void SetBandwidthEnabled(bool enabled);
         bool IsBandwidthEnabled() const;
-        void SetBandwidthLimit(uint32_t kbps);
-        uint32_t GetBandwidthLimit() const;
+        void SetBandwidthLimit(Direction direction, uint32_t kbps);
+        uint32_t GetBandwidthLimit(Direction direction) const;
         void SetBandwidthInbound(bool enabled);
         void SetBandwidthOutbound(bool enabled);
+        void SetBandwidthFlowLimit(uint32_t kbps);         // 0 disables the per-flow cap
+        uint32_t GetBandwidthFlowLimit() const;
+        void SetSynRateLimit(uint32_t per_second);          // 0 disables SYN policing
+        uint32_t GetSynRateLimit() const;
+        std::vector<FlowQueueInfo> GetFlowQueues(size_t max_flows) const;   // Deepest first
+        uint64_t GetFlowShaperDrops() const;
+        uint64_t GetSynDrops() const;
+        void SetBandwidthMode(BandwidthMode mode);          // Shaper queues, policer drops
+        BandwidthMode GetBandwidthMode() const;
+        void SetPolicer(const PolicerConfig& config);       // Committed rate is the bandwidth limit
+        PolicerCounters GetPolicerCounters() const;
+        void SetCrossTraffic(const CrossTrafficConfig& config);    // Virtual background load in the shaper
+        CrossTrafficStats GetCrossTrafficStats() const;
+        // Classes sharing the bandwidth limit, traffic no rule or DSCP value claims goes to the last one
+        std::expected<void, std::string> SetTrafficClasses(const std::vector<TrafficClassConfig>& classes);
+        std::vector<TrafficClassInfo> GetTrafficClasses() const;
+
+        // Simulation control methods - Corruption
+        void SetCorruptionEnabled(bool enabled);
+        bool IsCorruptionEnabled() const;
+        void SetCorruptionRate(Direction direction, double bit_error_rate);
+        double GetCorruptionRate(Direction direction) const;
+        void SetCorruptionFixChecksums(bool fix);
+        bool GetCorruptionFixChecksums() const;
+        uint64_t GetCorruptedPackets() const;
+        void SetCorruptionInbound(bool enabled);
+        void SetCorruptionOutbound(bool enabled);
+
+        // Simulation control methods - Header rewrite
+        void SetRewriteEnabled(bool enabled);
+        bool IsRewriteEnabled() const;
+        void SetRewriteHopDecrement(Direction direction, uint32_t hops);
+        uint32_t GetRewriteHopDecrement(Direction direction) const;
+        void SetRewriteDscp(Direction direction, int dscp);
+        int GetRewriteDscp(Direction direction) const;
+        void SetRewriteMssClamp(Direction direction, uint32_t mss);
+        uint32_t GetRewriteMssClamp(Direction direction) const;
+        uint64_t GetRewrittenPackets() const;
+        uint64_t GetExpiredPackets() const;
+        void SetRewriteInbound(bool enabled);
+        void SetRewriteOutbound(bool enabled);
+
+        // Simulation control methods - MTU
+        void SetMtuEnabled(bool enabled);
+        bool IsMtuEnabled() const;
+        void SetMtuSize(uint32_t mtu);
+        uint32_t GetMtuSize() const;
+        void SetMtuAction(MtuAction action);
+        MtuAction GetMtuAction() const;
+        void SetMtuReassembly(bool enabled);
+        bool GetMtuReassembly() const;
+        uint64_t GetMtuDroppedPackets() const;
+        uint64_t GetFragmentsCreated() const;
+        uint64_t GetIcmpTooBigSent() const;
+        uint64_t GetReassembledPackets() const;
+        void SetMtuInbound(bool enabled);
+        void SetMtuOutbound(bool enabled);
+
+        // Link outages - the whole link goes down on a schedule, packets are dropped or held
+        void SetOutageEnabled(bool enabled);
+        bool IsOutageEnabled() const;
+        void SetOutage(const OutageConfig& config);
+        void SetOutageInbound(bool enabled);
+        void SetOutageOutbound(bool enabled);
+        bool IsLinkDown() const;
+        uint64_t GetOutageDrops() const;
+        std::vector<OutageEvent> GetOutageEvents() const;     // Oldest first
+        void ClearOutageEvents();
+
+        // Slotted release: delayed packets leave on slot boundaries, one WinDivertSendEx per slot
+        void SetReleaseSlots(const ReleaseSlotConfig& config);
+
+        // Seed of every random impairment decision, taken at Start; 0 picks a new one per capture
+        // The same seed and the same traffic give the same drops, delays and flips whatever the
+        // number of worker threads, each draw is keyed by the flow and the packet's contents
+        void SetRandomSeed(uint64_t seed);
+        uint64_t GetRandomSeed() const;     // Seed in use since the last Start
+
+        // Traffic rules - select which impairments apply to which flows
+        std::expected<void, std::string> SetRules(const std::vector<ClassifierRule>& rules,
+            uint32_t unmatched_modules);
+        size_t GetRuleCount() const;
+
+        // Named links - rules send traffic to a link, each link runs its own impairment chain
+        // while sharing the receive path and release threads with the main link
+        // Links keep their queues across calls by name, a removed link's held packets are sent
+        // at once, through the outage module like any other release
+        static constexpr size_t MAX_LINKS = 32;
+        std::expected<void, std::string> SetLinks(const std::vector<LinkConfig>& links);
+        std::vector<LinkInfo> GetLinks() const;
 
         // Runtime parameter adjustment
         bool SetQueueLength(uint64_t length);
@@ -171,7 +322,7 @@ namespace BadLink {
 
         // Set max packets for ring buffer
         void SetMaxPackets(size_t max) {
-            std::lock_guard<std::mutex> lock(packets_mutex_);
+            std::lock_guard<ContendedMutex> lock(packets_mutex_);
             max_packets_ = max;
         }
 
@@ -202,6 +353,11 @@ namespace BadLink {
             uint64_t bytes_captured;
             uint64_t batch_count;       // Number of batch operations
             double   avg_batch_size;    // Average packets per batch
+            size_t   active_flows;      // Flows currently in the flow table
+            uint64_t flow_evictions;    // Flows replaced because their probe window was full
+            uint64_t slots_sent;        // Slots that carried packets, with slotted release
+            double   avg_slot_packets;  // Average aggregate per slot
+            size_t   slot_backlog;      // Packets due but waiting for a slot with room
         };
         Stats GetStats() const;
 
@@ -213,6 +369,31 @@ namespace BadLink {
         void LatencyReleaseThread();
         void JitterReleaseThread();
         void BandwidthReleaseThread();
+        void DuplicateReleaseThread();
+        void ReorderReleaseThread();
+        void SlotReleaseThread();     // Replaces the five above while release slots are on
+        void StartSlotThread();
+        void StartReleaseThreads();   // Threads some link's modules need that are not running yet
+        void OutageThread();          // Flips the link at each scheduled transition
+
+        // Stamp each packet with the module set of its flow, cached per flow handle
+        // `candidates` is the calling thread's scratch, one entry per packet
+        void ApplyRules(std::vector<SimulatedPacket>& packets, std::vector<uint64_t>& candidates);
+
+        // Run each packet through the chain of its link, main link packets first
+        using LinkSet = std::vector<std::shared_ptr<LinkChain>>;
+        std::shared_ptr<const LinkSet> GetLinkSet() const;
+        std::vector<SimulatedPacket> RunLinks(std::vector<SimulatedPacket>&& packets);
+
+        // Packets due from one kind of delaying stage, across every link
+        std::vector<SimulatedPacket> CollectReleasable(void (LinkChain::*release)(std::vector<SimulatedPacket>&));
+
+        // Due duplicates of every link, after the stages that follow duplication
+        std::vector<SimulatedPacket> CollectDuplicates();
+        std::chrono::steady_clock::time_point NextDuplicateRelease() const;
+
+        // Serialize packets into one buffer and inject them with a single backend send
+        bool SendPackets(const std::vector<SimulatedPacket>& packets);
 
         // Parse single packet from batch
         PacketInfo ParsePacket(std::span<const uint8_t> packet_data,
@@ -225,16 +406,29 @@ namespace BadLink {
         std::jthread latency_thread_;
         std::jthread jitter_thread_;
         std::jthread bandwidth_thread_;
-
-        // WinDivert handle
-        HANDLE divert_handle_ = INVALID_HANDLE_VALUE;
+        std::jthread duplicate_thread_;
+        std::jthread reorder_thread_;
+        std::jthread slot_thread_;
+        std::jthread outage_thread_;
+        std::mutex slot_thread_mutex_;  // Starting and joining the slot thread, with every change of slot_us_
+
+        // Release slot settings, read by the slot thread at every slot
+        std::atomic<uint32_t> slot_us_{ 0 };
+        std::atomic<uint32_t> slot_max_packets_{ 64 };
+        std::atomic<uint32_t> slot_max_bytes_{ 65535 };
+        std::atomic<uint64_t> slots_sent_{ 0 };
+        std::atomic<uint64_t> slot_packets_{ 0 };
+        std::atomic<size_t> slot_backlog_{ 0 };
+
+        // WinDivert unless SetBackend gave another one
+        std::unique_ptr<CaptureBackend> backend_;
 
         // Current parameters
         CaptureParameters current_params_;
         mutable std::mutex params_mutex_;
 
         // Packet buffer (thread-safe)
-        std::mutex packets_mutex_;
+        ContendedMutex packets_mutex_{ "Packet list" };
         std::deque<PacketInfo> packets_;
         size_t max_packets_ = ConfigConstants::DEFAULT_RING_PACKET_BUFFER;
 
@@ -245,18 +439,66 @@ namespace BadLink {
         std::atomic<uint64_t> bytes_captured_{ 0 };
         std::atomic<uint64_t> batch_count_{ 0 };
         std::atomic<uint64_t> total_batch_packets_{ 0 };
+        std::atomic<uint64_t> random_seed_{ 0 };
 
         // Error handling
         mutable std::mutex error_mutex_;
         std::string last_error_;
 
         // Simulation modules
-        std::unique_ptr<LatencyModule> latency_module_;
-        std::unique_ptr<PacketLossModule> packet_loss_module_;
-        std::unique_ptr<DuplicateModule> duplicate_module_;
-        std::unique_ptr<OutOfOrderModule> out_of_order_module_;
-        std::unique_ptr<JitterModule> jitter_module_;
-        std::unique_ptr<BandwidthModule> bandwidth_module_;
+        // The main link's chain is driven by the setters above, named links come from SetLinks
+        // MTU and outage are link-wide: MTU also drives GSO classification at capture, and an
+        // outage takes the whole wire down
+        std::unique_ptr<LinkChain> main_link_;
+        mutable ContendedMutex links_mutex_{ "Links" };
+        std::shared_ptr<const LinkSet> links_;      // Swapped whole, threads keep the snapshot they took
+        std::unique_ptr<MtuModule> mtu_module_;
+        std::unique_ptr<OutageModule> outage_module_;
+
+        // Engine-wide flow table, every packet gets a handle before the module chain
+        std::unique_ptr<FlowTable> flow_table_;
+
+        // Adapter MTUs, to tell offloaded super-packets from jumbo packets
+        std::unique_ptr<Gso::InterfaceMtus> interface_mtus_;
+
+        // Compiled traffic rules with their class and link mapping, published whole on every
+        // change so the capture threads classify from a snapshot without holding rules_mutex_
+        // A cached decision is only trusted while its generation matches the snapshot's
+        struct RuleSet {
+            std::shared_ptr<const RuleClassifier> classifier;
+            uint32_t generation = 0;
+            std::vector<uint8_t> traffic_classes;   // 1-based class index per rule, 0 = by DSCP
+            std::vector<uint8_t> links;             // 1-based link index per rule, 0 = main link
+        };
+
+        // Flows cache their candidate rules, packet filters narrow them per packet
+        // Content and domain rules remember what the first payload packets of the flow matched
+        struct RuleDecision {
+            uint32_t generation = 0;
+            uint16_t content_scans = 0;
+            uint16_t domain_scans = 0;
+            uint64_t candidates = 0;
+            uint64_t content = 0;
+            uint64_t domains = 0;
+        };
+        mutable ContendedMutex rules_mutex_{ "Rules" };
+        std::shared_ptr<const RuleSet> rule_set_;
+        std::shared_ptr<const RuleClassifier> rule_classifier_;
+        uint32_t rules_generation_ = 1;
+        std::vector<std::string> rule_class_names_;     // Traffic class named by each rule
+        std::vector<std::string> traffic_class_names_;
+        std::vector<std::string> rule_link_names_;      // Link named by each rule
+        std::vector<std::string> link_names_;
+
+        // Guard only the lookups and updates, scans and filters run outside both
+        ContendedMutex rule_cache_mutex_{ "Rule decisions" };
+        std::unique_ptr<PerFlow<RuleDecision>> rule_cache_;
+        mutable ContendedMutex domain_mutex_{ "Domain cache" };
+        std::unique_ptr<DomainCache> domain_cache_;     // Names learned from DNS responses
+
+        std::shared_ptr<const RuleSet> GetRuleSet() const;
+        uint64_t LookupDomainRules(const RuleClassifier& classifier, const FlowKey& key) const;
+        void PublishRules();    // Caller holds rules_mutex_
 
         void SetError(const std::string& error);
     };
@@ -7,20 +7,20 @@ namespace BadLink {
     OutOfOrderModule::OutOfOrderModule() = default;
     OutOfOrderModule::~OutOfOrderModule() = default;
 
-    void OutOfOrderModule::SetReorderRate(float reorder_percentage) {
-        reorder_rate_.store(std::clamp(reorder_percentage, 0.0f, 100.0f));
+    void OutOfOrderModule::SetReorderRate(Direction direction, float reorder_percentage) {
+        reorder_rate_[DirectionIndex(direction)].store(std::clamp(reorder_percentage, 0.0f, 100.0f));
     }
 
-    float OutOfOrderModule::GetReorderRate() const {
-        return reorder_rate_.load();
+    float OutOfOrderModule::GetReorderRate(Direction direction) const {
+        return reorder_rate_[DirectionIndex(direction)].load();
     }
 
-    void OutOfOrderModule::SetReorderGap(uint32_t gap) {
-        reorder_gap_.store(std::clamp(gap, 2u, 10u));
+    void OutOfOrderModule::SetReorderGap(Direction direction, uint32_t gap) {
+        reorder_gap_[DirectionIndex(direction)].store(std::clamp(gap, 2u, 10u));
     }
 
-    uint32_t OutOfOrderModule::GetReorderGap() const {
-        return reorder_gap_.load();
+    uint32_t OutOfOrderModule::GetReorderGap(Direction direction) const {
+        return reorder_gap_[DirectionIndex(direction)].load();
     }
 
     void OutOfOrderModule::SetEnabled(bool enabled) {
@@ -46,56 +46,88 @@ namespace BadLink {
             return std::move(packets);
         }
 
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        const auto current_time = Now();
+        std::lock_guard<ContendedMutex> lock(buffer_mutex_);
+        std::vector<SimulatedPacket> output_packets;
 
-        // Add new packets to buffer
+        // Add new packets to their flow's buffer one at a time, skipped packets are not held back
+        // Cutting after every packet puts the cuts where the flow's own count says, not where
+        // the batches that carried it happen to end
         for (auto&& packet : packets) {
-            if (ShouldProcess(packet.addr)) {
-                packet_buffer_.push_back(std::move(packet));
+            if (!ShouldProcess(packet)) {
+                output_packets.push_back(std::move(packet));
+                continue;
+            }
+            const auto it = packet_buffers_.try_emplace(BufferKey(packet)).first;
+            if (it->second.packets.empty()) {
+                it->second.oldest = current_time;
             }
-            else {
-                packet_buffer_.push_back(std::move(packet));
+            it->second.packets.push_back(std::move(packet));
+            ReleaseBuffer(it->second, current_time, output_packets);
+            if (it->second.packets.empty()) {
+                packet_buffers_.erase(it);
             }
         }
 
-        std::vector<SimulatedPacket> output_packets;
-        const uint32_t gap = reorder_gap_.load();
+        return output_packets;
+    }
+
+    void OutOfOrderModule::ReleaseBuffer(FlowBuffer& buffer, SimulationClock::time_point now,
+        std::vector<SimulatedPacket>& output_packets) {
+        const size_t direction = DirectionIndex(buffer.packets.front());
+        const uint32_t gap = reorder_gap_[direction].load();
 
         // If buffer has enough packets, process them
-        if (packet_buffer_.size() >= gap) {
+        if (buffer.packets.size() >= gap) {
             // Determine how many packets to release
-            size_t release_count = packet_buffer_.size() - (gap / 2);
+            size_t release_count = buffer.packets.size() - (gap / 2);
 
             // If we should reorder, shuffle the packets
-            if (ShouldReorder()) {
-                ShuffleBuffer();
+            // Keyed by the flow's newest packet, which only depends on the flow's own arrival order
+            const RandomKey stream = buffer.packets.back().random_stream;
+            if (ShouldReorder(reorder_rate_[direction].load(), stream)) {
+                ShuffleBuffer(buffer.packets, stream);
             }
 
             // Move packets to output
-            for (size_t i = 0; i < release_count && !packet_buffer_.empty(); ++i) {
-                output_packets.push_back(std::move(packet_buffer_.front()));
-                packet_buffer_.pop_front();
+            for (size_t i = 0; i < release_count && !buffer.packets.empty(); ++i) {
+                output_packets.push_back(std::move(buffer.packets.front()));
+                buffer.packets.pop_front();
             }
+            buffer.oldest = now;    // The held tail counts from the cut
         }
-
-        return output_packets;
     }
 
     std::vector<SimulatedPacket> OutOfOrderModule::GetReleasablePackets() {
-        if (!enabled_.load()) {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            std::vector<SimulatedPacket> remaining;
-            remaining.reserve(packet_buffer_.size());
-            while (!packet_buffer_.empty()) {
-                remaining.push_back(std::move(packet_buffer_.front()));
-                packet_buffer_.pop_front();
+        std::vector<SimulatedPacket> released;
+        const bool enabled = enabled_.load();
+        const auto current_time = Now();
+
+        std::lock_guard<ContendedMutex> lock(buffer_mutex_);
+        for (auto it = packet_buffers_.begin(); it != packet_buffers_.end();) {
+            if (enabled && current_time - it->second.oldest < MAX_HOLD) {
+                ++it;
+                continue;
+            }
+            for (auto& packet : it->second.packets) {
+                released.push_back(std::move(packet));
             }
-            return remaining;
+            it = packet_buffers_.erase(it);
         }
-        return {};
+        return released;
+    }
+
+    uint64_t OutOfOrderModule::BufferKey(const SimulatedPacket& packet) {
+        // Flow streams already differ by direction, the bit keeps the two flowless buffers apart
+        return packet.random_stream.stream ^ DirectionIndex(packet);
     }
 
-    bool OutOfOrderModule::ShouldProcess(const WINDIVERT_ADDRESS& addr) const {
+    bool OutOfOrderModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::OUT_OF_ORDER) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
         if (addr.Outbound && !outbound_enabled_.load()) {
             return false;
         }
@@ -105,28 +137,31 @@ namespace BadLink {
         return true;
     }
 
-    bool OutOfOrderModule::ShouldReorder() const {
-        const float rate = reorder_rate_.load();
+    bool OutOfOrderModule::ShouldReorder(float rate, RandomKey stream) const {
         if (rate <= 0.0f) return false;
         if (rate >= 100.0f) return true;
-        return RandomUtils::GetPercentage() < rate;
+        return RandomStream(RandomDomain::Reorder, stream).Percentage() < rate;
     }
 
-    void OutOfOrderModule::ShuffleBuffer() {
-        if (packet_buffer_.size() <= 1) {
+    void OutOfOrderModule::ShuffleBuffer(std::deque<SimulatedPacket>& buffer, RandomKey stream) {
+        if (buffer.size() <= 1) {
             return;
         }
 
         // Vector has better cache locality for shuffling large buffers
         std::vector<SimulatedPacket> temp(
-            std::make_move_iterator(packet_buffer_.begin()),
-            std::make_move_iterator(packet_buffer_.end())
+            std::make_move_iterator(buffer.begin()),
+            std::make_move_iterator(buffer.end())
         );
-        packet_buffer_.clear();
+        buffer.clear();
 
-        std::shuffle(temp.begin(), temp.end(), RandomUtils::GetGenerator());
+        // Fisher-Yates on our own draws, std::shuffle differs between standard libraries
+        RandomStream random(RandomDomain::Shuffle, stream);
+        for (size_t i = temp.size() - 1; i > 0; --i) {
+            std::swap(temp[i], temp[random.Between(0, static_cast<uint32_t>(i))]);
+        }
 
-        packet_buffer_.assign(
+        buffer.assign(
             std::make_move_iterator(temp.begin()),
             std::make_move_iterator(temp.end())
         );
@@ -3,25 +3,33 @@
 
 #include "simulation_module.h"
 #include "random_utils.h"
+#include "lock_stats.h"
 #include <atomic>
 #include <mutex>
 #include <deque>
 #include <chrono>
+#include <unordered_map>
 
 namespace BadLink {
 
+    // Holds each flow's packets until its reorder gap is reached, then shuffles them
+    // Packets only trade places within their own flow, so the outcome does not depend on how
+    // flows interleave or which worker thread carried them
     class OutOfOrderModule : public SimulationModule {
     public:
+        // A flow that goes quiet gets its held packets back in arrival order after this long
+        static constexpr std::chrono::milliseconds MAX_HOLD{ 100 };
+
         OutOfOrderModule();
         ~OutOfOrderModule() override;
 
         // Set reorder percentage (0.0 - 100.0)
-        void SetReorderRate(float reorder_percentage);
-        float GetReorderRate() const;
+        void SetReorderRate(Direction direction, float reorder_percentage);
+        float GetReorderRate(Direction direction) const;
 
         // Set reorder gap (how many packets to buffer before reordering)
-        void SetReorderGap(uint32_t gap);
-        uint32_t GetReorderGap() const;
+        void SetReorderGap(Direction direction, uint32_t gap);
+        uint32_t GetReorderGap(Direction direction) const;
 
         // Enable/disable the module
         void SetEnabled(bool enabled);
@@ -34,21 +42,32 @@ namespace BadLink {
         // Process packets
         std::vector<SimulatedPacket> ProcessBatch(
             std::vector<SimulatedPacket>&& packets) override;
+
+        // Packets held longer than MAX_HOLD, or everything once disabled
         std::vector<SimulatedPacket> GetReleasablePackets() override;
 
     private:
         std::atomic<bool> enabled_{ false };
         std::atomic<bool> inbound_enabled_{ true };
         std::atomic<bool> outbound_enabled_{ true };
-        std::atomic<float> reorder_rate_{ 0.0f };
-        std::atomic<uint32_t> reorder_gap_{ 3 };
+        PerDirection<std::atomic<float>> reorder_rate_{ 0.0f, 0.0f };
+        PerDirection<std::atomic<uint32_t>> reorder_gap_{ 3, 3 };
 
-        mutable std::mutex buffer_mutex_;
-        std::deque<SimulatedPacket> packet_buffer_;
+        // One reorder buffer per flow, keyed by the flow's random stream and direction
+        // Packets without a flow share one buffer per direction; empty buffers are dropped
+        struct FlowBuffer {
+            std::deque<SimulatedPacket> packets;
+            SimulationClock::time_point oldest;     // When the front packet was buffered
+        };
+        mutable ContendedMutex buffer_mutex_{ "Reorder buffer" };
+        std::unordered_map<uint64_t, FlowBuffer> packet_buffers_;
 
-        bool ShouldProcess(const WINDIVERT_ADDRESS& addr) const;
-        bool ShouldReorder() const;
-        void ShuffleBuffer();
+        static uint64_t BufferKey(const SimulatedPacket& packet);
+        bool ShouldProcess(const SimulatedPacket& packet) const;
+        bool ShouldReorder(float rate, RandomKey stream) const;
+        void ReleaseBuffer(FlowBuffer& buffer, SimulationClock::time_point now,
+            std::vector<SimulatedPacket>& output_packets);
+        static void ShuffleBuffer(std::deque<SimulatedPacket>& buffer, RandomKey stream);
     };
 
 }
@@ -0,0 +1,220 @@
+#define NOMINMAX
+#include "outage_module.h"
+#include <algorithm>
+#include <cmath>
+
+namespace BadLink {
+
+    OutageModule::OutageModule() = default;
+    OutageModule::~OutageModule() = default;
+
+    void OutageModule::Configure(const OutageConfig& config) {
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        if (config == config_) {
+            return;
+        }
+        config_ = config;
+        hold_.store(config.action == OutageAction::Hold);
+        if (down_.load()) {
+            GoUp(Now());
+        }
+        next_transition_.reset();
+    }
+
+    OutageConfig OutageModule::GetConfig() const {
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        return config_;
+    }
+
+    void OutageModule::SetEnabled(bool enabled) {
+        enabled_.store(enabled);
+        if (!enabled) {
+            std::lock_guard<ContendedMutex> lock(mutex_);
+            if (down_.load()) {
+                GoUp(Now());
+            }
+            next_transition_.reset();
+        }
+    }
+
+    bool OutageModule::IsEnabled() const {
+        return enabled_.load();
+    }
+
+    void OutageModule::SetInboundEnabled(bool enabled) {
+        inbound_enabled_.store(enabled);
+    }
+
+    void OutageModule::SetOutboundEnabled(bool enabled) {
+        outbound_enabled_.store(enabled);
+    }
+
+    bool OutageModule::DropsWholeBatches() const {
+        return enabled_.load() && down_.load() && !hold_.load() &&
+            inbound_enabled_.load() && outbound_enabled_.load();
+    }
+
+    void OutageModule::CountDropped(size_t packets) {
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        Discard(packets);
+    }
+
+    OutageModule::Clock::time_point OutageModule::Advance(Clock::time_point now) {
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        if (!enabled_.load()) {
+            return now + std::chrono::milliseconds(100);
+        }
+
+        if (!next_transition_) {
+            // Same seed, same schedule of outages from every restart
+            rng_ = RandomStream(RandomDomain::Outage, 0);
+            next_transition_ = now + PhaseLength(down_.load());
+        }
+
+        // Transitions are chained from their scheduled times, a late wakeup does not shift the schedule
+        Clock::time_point& next = *next_transition_;
+        while (next <= now) {
+            if (down_.load()) {
+                GoUp(next);
+            }
+            else {
+                GoDown(next);
+            }
+            next += PhaseLength(down_.load());
+        }
+        return next;
+    }
+
+    void OutageModule::Reset() {
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        if (down_.load()) {
+            GoUp(Now());
+        }
+        next_transition_.reset();
+        held_.clear();
+        held_packets_ = 0;
+    }
+
+    std::vector<SimulatedPacket> OutageModule::ProcessBatch(std::vector<SimulatedPacket>&& packets) {
+        if (!enabled_.load() || !down_.load() || packets.empty()) {
+            return std::move(packets);
+        }
+
+        std::vector<SimulatedPacket> passing;
+        std::vector<SimulatedPacket> affected;
+        if (inbound_enabled_.load() && outbound_enabled_.load()) {
+            affected = std::move(packets);
+        }
+        else {
+            for (auto&& packet : packets) {
+                (Affects(packet) ? affected : passing).push_back(std::move(packet));
+            }
+            if (affected.empty()) {
+                return passing;
+            }
+        }
+
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        if (!down_.load()) {
+            // Came back up while the batch was on its way
+            passing.insert(passing.end(), std::make_move_iterator(affected.begin()), std::make_move_iterator(affected.end()));
+            return passing;
+        }
+
+        if (config_.action == OutageAction::Hold && held_packets_ + affected.size() <= config_.hold_limit) {
+            held_packets_ += affected.size();
+            if (!events_.empty()) {
+                events_.back().held += affected.size();
+            }
+            held_.push_back(std::move(affected));
+        }
+        else {
+            Discard(affected.size());
+        }
+        return passing;
+    }
+
+    std::vector<SimulatedPacket> OutageModule::GetReleasablePackets() {
+        if (down_.load()) {
+            return {};
+        }
+
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        std::vector<SimulatedPacket> released;
+        if (down_.load() || held_.empty()) {
+            return released;
+        }
+
+        released.reserve(held_packets_);
+        for (auto& batch : held_) {
+            released.insert(released.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+        }
+        held_.clear();
+        held_packets_ = 0;
+        return released;
+    }
+
+    std::vector<OutageEvent> OutageModule::GetEvents() const {
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        return { events_.begin(), events_.end() };
+    }
+
+    void OutageModule::ClearEvents() {
+        std::lock_guard<ContendedMutex> lock(mutex_);
+        if (down_.load() && !events_.empty()) {
+            events_.erase(events_.begin(), events_.end() - 1);     // Keep the running outage
+        }
+        else {
+            events_.clear();
+        }
+    }
+
+    OutageModule::Clock::duration OutageModule::PhaseLength(bool down) {
+        const uint32_t mean_ms = down ? config_.down_ms : config_.up_ms;
+        std::chrono::duration<double, std::milli> length(mean_ms);
+        if (config_.schedule == OutageSchedule::Random && mean_ms != 0) {
+            // Inverse transform, the same lengths on every standard library
+            length = std::chrono::duration<double, std::milli>(-static_cast<double>(mean_ms) * std::log(rng_.Uniform()));
+        }
+        // At least a millisecond so a zero length cannot spin Advance
+        return std::max<Clock::duration>(std::chrono::duration_cast<Clock::duration>(length), std::chrono::milliseconds(1));
+    }
+
+    void OutageModule::GoDown(Clock::time_point at) {
+        // Wall clock time of `at`, for the log
+        const auto wall = std::chrono::system_clock::now() -
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(Now() - at);
+
+        OutageEvent event;
+        event.started = wall;
+        events_.push_back(event);
+        if (events_.size() > MAX_EVENTS) {
+            events_.pop_front();
+        }
+
+        down_since_ = at;
+        outages_.fetch_add(1);
+        down_.store(true);
+    }
+
+    void OutageModule::GoUp(Clock::time_point at) {
+        down_.store(false);
+        if (!events_.empty()) {
+            auto& event = events_.back();
+            event.duration = at - down_since_;
+            event.ended = event.started + std::chrono::duration_cast<std::chrono::system_clock::duration>(event.duration);
+        }
+    }
+
+    void OutageModule::Discard(size_t packets) {
+        dropped_.fetch_add(packets);
+        if (down_.load() && !events_.empty()) {
+            events_.back().dropped += packets;
+        }
+    }
+
+    bool OutageModule::Affects(const SimulatedPacket& packet) const {
+        return packet.addr.Outbound ? outbound_enabled_.load() : inbound_enabled_.load();
+    }
+
+}
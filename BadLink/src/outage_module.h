@@ -0,0 +1,119 @@
+#ifndef BADLINK_SRC_OUTAGE_MODULE_H_
+#define BADLINK_SRC_OUTAGE_MODULE_H_
+
+#include "simulation_module.h"
+#include "random_utils.h"
+#include "lock_stats.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace BadLink {
+
+    enum class OutageSchedule : uint8_t {
+        Periodic,       // Up for up_ms, then down for down_ms, repeated
+        Random,         // Up and down durations exponential around up_ms and down_ms
+    };
+
+    enum class OutageAction : uint8_t {
+        Drop,           // Packets sent while the link is down are lost
+        Hold,           // Packets wait for the link to come back, up to hold_limit packets
+    };
+
+    struct OutageConfig {
+        OutageSchedule schedule = OutageSchedule::Periodic;
+        OutageAction action = OutageAction::Drop;
+        uint32_t up_ms = 28000;         // "Down 2 s every 30 s" is 28000 up, 2000 down
+        uint32_t down_ms = 2000;
+        uint32_t hold_limit = 10000;    // Held packets, whole batches beyond it are dropped
+
+        bool operator==(const OutageConfig&) const = default;
+    };
+
+    // One outage, `ended` stays empty while the link is still down
+    struct OutageEvent {
+        std::chrono::system_clock::time_point started;
+        std::chrono::system_clock::time_point ended;
+        std::chrono::steady_clock::duration duration{};
+        uint64_t dropped = 0;
+        uint64_t held = 0;
+    };
+
+    // Link outages and flaps
+    // The schedule only flips a flag, a thread calls Advance at each transition time; packets
+    // are dropped or held a whole batch at a time while the flag is set
+    // Sits at the wire: captured packets pass it after the other modules, delayed packets
+    // pass it on release, rules do not select it since the whole link goes down
+    class OutageModule : public SimulationModule {
+    public:
+        using Clock = std::chrono::steady_clock;
+        static constexpr size_t MAX_EVENTS = 100;
+
+        OutageModule();
+        ~OutageModule() override;
+
+        // Restarts the schedule with a full up period when the config changes
+        void Configure(const OutageConfig& config);
+        OutageConfig GetConfig() const;
+
+        // Disabling ends a running outage
+        void SetEnabled(bool enabled);
+        bool IsEnabled() const override;
+
+        void SetInboundEnabled(bool enabled) override;
+        void SetOutboundEnabled(bool enabled) override;
+
+        bool IsDown() const { return down_.load(); }
+
+        // Whether the capture thread may drop a whole received batch before parsing it
+        bool DropsWholeBatches() const;
+        void CountDropped(size_t packets);
+
+        // Applies every transition due by `now`, returns when the next one is due
+        Clock::time_point Advance(Clock::time_point now);
+
+        // Ends a running outage and discards held packets, the schedule restarts on the next Advance
+        void Reset();
+
+        std::vector<SimulatedPacket> ProcessBatch(std::vector<SimulatedPacket>&& packets) override;
+
+        // Held packets once the link is up again
+        std::vector<SimulatedPacket> GetReleasablePackets() override;
+
+        // Most recent outages last, at most MAX_EVENTS
+        std::vector<OutageEvent> GetEvents() const;
+        void ClearEvents();
+        uint64_t GetOutageCount() const { return outages_.load(); }
+        uint64_t GetDroppedPackets() const { return dropped_.load(); }
+
+    private:
+        std::atomic<bool> enabled_{ false };
+        std::atomic<bool> inbound_enabled_{ true };
+        std::atomic<bool> outbound_enabled_{ true };
+        std::atomic<bool> down_{ false };
+        std::atomic<bool> hold_{ false };             // Mirrors config_.action for the lock-free checks
+        std::atomic<uint64_t> outages_{ 0 };
+        std::atomic<uint64_t> dropped_{ 0 };
+
+        mutable ContendedMutex mutex_{ "Outage" };
+        OutageConfig config_;
+        std::optional<Clock::time_point> next_transition_;  // Empty until the first Advance after a (re)start
+        Clock::time_point down_since_{};
+        std::vector<std::vector<SimulatedPacket>> held_;   // Whole batches, in arrival order
+        size_t held_packets_ = 0;
+        std::deque<OutageEvent> events_;
+        RandomStream rng_{ RandomDomain::Outage, 0 };     // Reseeded whenever the schedule restarts
+
+        Clock::duration PhaseLength(bool down);
+        void GoDown(Clock::time_point at);
+        void GoUp(Clock::time_point at);
+        void Discard(size_t packets);
+        bool Affects(const SimulatedPacket& packet) const;
+    };
+
+}
+#endif  // BADLINK_SRC_OUTAGE_MODULE_H_
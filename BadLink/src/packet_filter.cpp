@@ -0,0 +1,953 @@
+#define NOMINMAX
+#include "packet_filter.h"
+#include "cidr.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cctype>
+#include <format>
+#include <map>
+#include <tuple>
+#include <utility>
+
+namespace BadLink {
+
+    namespace {
+        constexpr size_t FIELD_COUNT = static_cast<size_t>(FilterField::Count);
+        constexpr FilterField NO_LAYER = FilterField::Count;
+
+        struct FieldInfo {
+            const char* name;       // Lower case, nullptr for internal fields
+            FilterField layer;      // Presence guard, NO_LAYER if always present
+            uint8_t bits;           // Value width, used to fold impossible comparisons
+        };
+
+        constexpr std::array<FieldInfo, FIELD_COUNT> FIELDS = { {
+            { "outbound", NO_LAYER, 1 },
+            { "inbound", NO_LAYER, 1 },
+            { "loopback", NO_LAYER, 1 },
+            { "impostor", NO_LAYER, 1 },
+            { "fragment", NO_LAYER, 1 },
+            { "length", NO_LAYER, 32 },
+            { "ifidx", NO_LAYER, 32 },
+            { "subifidx", NO_LAYER, 32 },
+            { "ip", NO_LAYER, 1 },
+            { "ipv6", NO_LAYER, 1 },
+            { "tcp", NO_LAYER, 1 },
+            { "udp", NO_LAYER, 1 },
+            { "icmp", NO_LAYER, 1 },
+            { "icmpv6", NO_LAYER, 1 },
+            { "localport", FilterField::Transport, 16 },
+            { "remoteport", FilterField::Transport, 16 },
+            { "ip.hdrlength", FilterField::Ip, 4 },
+            { "ip.tos", FilterField::Ip, 8 },
+            { "ip.length", FilterField::Ip, 16 },
+            { "ip.id", FilterField::Ip, 16 },
+            { "ip.df", FilterField::Ip, 1 },
+            { "ip.mf", FilterField::Ip, 1 },
+            { "ip.fragoff", FilterField::Ip, 13 },
+            { "ip.ttl", FilterField::Ip, 8 },
+            { "ip.protocol", FilterField::Ip, 8 },
+            { "ip.checksum", FilterField::Ip, 16 },
+            { "ip.srcaddr", FilterField::Ip, 32 },
+            { "ip.dstaddr", FilterField::Ip, 32 },
+            { "ipv6.trafficclass", FilterField::Ipv6, 8 },
+            { "ipv6.flowlabel", FilterField::Ipv6, 20 },
+            { "ipv6.payloadlength", FilterField::Ipv6, 16 },
+            { "ipv6.nexthdr", FilterField::Ipv6, 8 },
+            { "ipv6.hoplimit", FilterField::Ipv6, 8 },
+            { "ipv6.srcaddr", FilterField::Ipv6, 128 },
+            { "ipv6.dstaddr", FilterField::Ipv6, 128 },
+            { "tcp.srcport", FilterField::Tcp, 16 },
+            { "tcp.dstport", FilterField::Tcp, 16 },
+            { "tcp.seqnum", FilterField::Tcp, 32 },
+            { "tcp.acknum", FilterField::Tcp, 32 },
+            { "tcp.hdrlength", FilterField::Tcp, 4 },
+            { "tcp.urg", FilterField::Tcp, 1 },
+            { "tcp.ack", FilterField::Tcp, 1 },
+            { "tcp.psh", FilterField::Tcp, 1 },
+            { "tcp.rst", FilterField::Tcp, 1 },
+            { "tcp.syn", FilterField::Tcp, 1 },
+            { "tcp.fin", FilterField::Tcp, 1 },
+            { "tcp.window", FilterField::Tcp, 16 },
+            { "tcp.checksum", FilterField::Tcp, 16 },
+            { "tcp.urgptr", FilterField::Tcp, 16 },
+            { "tcp.payloadlength", FilterField::Tcp, 32 },
+            { "udp.srcport", FilterField::Udp, 16 },
+            { "udp.dstport", FilterField::Udp, 16 },
+            { "udp.length", FilterField::Udp, 16 },
+            { "udp.checksum", FilterField::Udp, 16 },
+            { "udp.payloadlength", FilterField::Udp, 32 },
+            { "icmp.type", FilterField::Icmp, 8 },
+            { "icmp.code", FilterField::Icmp, 8 },
+            { "icmp.checksum", FilterField::Icmp, 16 },
+            { "icmp.body", FilterField::Icmp, 32 },
+            { "icmpv6.type", FilterField::Icmpv6, 8 },
+            { "icmpv6.code", FilterField::Icmpv6, 8 },
+            { "icmpv6.checksum", FilterField::Icmpv6, 16 },
+            { "icmpv6.body", FilterField::Icmpv6, 32 },
+            { nullptr, FilterField::Ipv6, 64 },
+            { nullptr, FilterField::Ipv6, 64 },
+            { nullptr, FilterField::Ipv6, 64 },
+            { nullptr, FilterField::Ipv6, 64 },
+            { nullptr, NO_LAYER, 1 },
+        } };
+
+        constexpr const FieldInfo& Info(FilterField field) {
+            return FIELDS[static_cast<size_t>(field)];
+        }
+
+        bool IsAddress128(FilterField field) {
+            return field == FilterField::Ipv6SrcAddr || field == FilterField::Ipv6DstAddr;
+        }
+
+        // Header bytes of a packet, fragments keep them in the slice prefix
+        // Built inline by every extractor, so each field only pays for the parts it reads
+        struct PacketView {
+            const uint8_t* ip = nullptr;
+            size_t header_size = 0;
+            const SimulatedPacket& packet;
+            const PacketHeaders& headers;
+
+            explicit PacketView(const SimulatedPacket& source)
+                : packet(source), headers(source.headers) {
+                if (packet.is_slice && packet.prefix_length > 0) {
+                    ip = packet.prefix.data();
+                    header_size = packet.prefix_length;
+                }
+                else {
+                    const auto bytes = packet.Bytes();
+                    ip = bytes.data();
+                    header_size = bytes.size();
+                }
+            }
+
+            bool HasL4(size_t length) const { return headers.l4_offset + length <= header_size; }
+            bool IsIp() const { return headers.ip_version == 4; }
+            bool IsIpv6() const { return headers.ip_version == 6; }
+            bool IsTcp() const { return headers.IsTcp() && HasL4(20); }
+            bool IsUdp() const { return headers.IsUdp() && HasL4(8); }
+            bool IsIcmp() const {
+                return IsIp() && headers.protocol == IpProtocol::ICMP && !headers.is_fragment && HasL4(8);
+            }
+            bool IsIcmpv6() const {
+                return IsIpv6() && headers.protocol == IpProtocol::ICMPV6 && !headers.is_fragment && HasL4(8);
+            }
+            const uint8_t* L4() const { return ip + headers.l4_offset; }
+            uint64_t PayloadLength() const {
+                const size_t size = packet.Size();
+                return size > headers.payload_offset ? size - headers.payload_offset : 0;
+            }
+        };
+
+        uint64_t LoadBe64(const uint8_t* p) {
+            return (static_cast<uint64_t>(LoadBe32(p)) << 32) | LoadBe32(p + 4);
+        }
+
+        // One extractor per field, F is a compile-time constant so the switch folds away
+        template <FilterField F>
+        inline bool Extract(const PacketView& v, uint64_t& out) {
+            using enum FilterField;
+            switch (F) {
+            case Outbound: out = v.packet.addr.Outbound; return true;
+            case Inbound: out = !v.packet.addr.Outbound; return true;
+            case Loopback: out = v.packet.addr.Loopback; return true;
+            case Impostor: out = v.packet.addr.Impostor; return true;
+            case Fragment: out = v.headers.is_fragment ? 1 : 0; return true;
+            case Length: out = v.packet.Size(); return true;
+            case IfIdx: out = v.packet.addr.Network.IfIdx; return true;
+            case SubIfIdx: out = v.packet.addr.Network.SubIfIdx; return true;
+            case Ip: out = v.IsIp(); return true;
+            case Ipv6: out = v.IsIpv6(); return true;
+            case Tcp: out = v.IsTcp(); return true;
+            case Udp: out = v.IsUdp(); return true;
+            case Icmp: out = v.IsIcmp(); return true;
+            case Icmpv6: out = v.IsIcmpv6(); return true;
+            case Transport: out = v.IsTcp() || v.IsUdp(); return true;
+            case LocalPort:
+            case RemotePort: {
+                if (!v.IsTcp() && !v.IsUdp()) {
+                    return false;
+                }
+                const bool source = (F == LocalPort) == static_cast<bool>(v.packet.addr.Outbound);
+                out = LoadBe16(v.L4() + (source ? 0 : 2));
+                return true;
+            }
+            default:
+                break;
+            }
+
+            if constexpr (F >= IpHdrLength && F <= IpDstAddr) {
+                if (!v.IsIp()) {
+                    return false;
+                }
+                const uint8_t* p = v.ip;
+                switch (F) {
+                case IpHdrLength: out = p[0] & 0x0F; break;
+                case IpTos: out = p[1]; break;
+                case IpLength: out = LoadBe16(p + 2); break;
+                case IpId: out = LoadBe16(p + 4); break;
+                case IpDf: out = (p[6] >> 6) & 1; break;
+                case IpMf: out = (p[6] >> 5) & 1; break;
+                case IpFragOff: out = LoadBe16(p + 6) & 0x1FFF; break;
+                case IpTtl: out = p[8]; break;
+                case IpProtocol: out = p[9]; break;
+                case IpChecksum: out = LoadBe16(p + 10); break;
+                case IpSrcAddr: out = LoadBe32(p + 12); break;
+                case IpDstAddr: out = LoadBe32(p + 16); break;
+                default: break;
+                }
+                return true;
+            }
+            else if constexpr ((F >= Ipv6TrafficClass && F <= Ipv6HopLimit) || (F >= Ipv6SrcHi && F <= Ipv6DstLo)) {
+                if (!v.IsIpv6()) {
+                    return false;
+                }
+                const uint8_t* p = v.ip;
+                switch (F) {
+                case Ipv6TrafficClass: out = ((p[0] & 0x0F) << 4) | (p[1] >> 4); break;
+                case Ipv6FlowLabel: out = (static_cast<uint64_t>(p[1] & 0x0F) << 16) | LoadBe16(p + 2); break;
+                case Ipv6PayloadLength: out = LoadBe16(p + 4); break;
+                case Ipv6NextHdr: out = p[6]; break;
+                case Ipv6HopLimit: out = p[7]; break;
+                case Ipv6SrcHi: out = LoadBe64(p + 8); break;
+                case Ipv6SrcLo: out = LoadBe64(p + 16); break;
+                case Ipv6DstHi: out = LoadBe64(p + 24); break;
+                case Ipv6DstLo: out = LoadBe64(p + 32); break;
+                default: break;
+                }
+                return true;
+            }
+            else if constexpr (F >= TcpSrcPort && F <= TcpPayloadLength) {
+                if (!v.IsTcp()) {
+                    return false;
+                }
+                const uint8_t* p = v.L4();
+                switch (F) {
+                case TcpSrcPort: out = LoadBe16(p); break;
+                case TcpDstPort: out = LoadBe16(p + 2); break;
+                case TcpSeqNum: out = LoadBe32(p + 4); break;
+                case TcpAckNum: out = LoadBe32(p + 8); break;
+                case TcpHdrLength: out = p[12] >> 4; break;
+                case TcpUrg: out = (p[13] >> 5) & 1; break;
+                case TcpAck: out = (p[13] >> 4) & 1; break;
+                case TcpPsh: out = (p[13] >> 3) & 1; break;
+                case TcpRst: out = (p[13] >> 2) & 1; break;
+                case TcpSyn: out = (p[13] >> 1) & 1; break;
+                case TcpFin: out = p[13] & 1; break;
+                case TcpWindow: out = LoadBe16(p + 14); break;
+                case TcpChecksum: out = LoadBe16(p + 16); break;
+                case TcpUrgPtr: out = LoadBe16(p + 18); break;
+                case TcpPayloadLength: out = v.PayloadLength(); break;
+                default: break;
+                }
+                return true;
+            }
+            else if constexpr (F >= UdpSrcPort && F <= UdpPayloadLength) {
+                if (!v.IsUdp()) {
+                    return false;
+                }
+                const uint8_t* p = v.L4();
+                switch (F) {
+                case UdpSrcPort: out = LoadBe16(p); break;
+                case UdpDstPort: out = LoadBe16(p + 2); break;
+                case UdpLength: out = LoadBe16(p + 4); break;
+                case UdpChecksum: out = LoadBe16(p + 6); break;
+                case UdpPayloadLength: out = v.PayloadLength(); break;
+                default: break;
+                }
+                return true;
+            }
+            else if constexpr (F >= IcmpType && F <= Icmpv6Body) {
+                const bool v6 = F >= Icmpv6Type;
+                if (v6 ? !v.IsIcmpv6() : !v.IsIcmp()) {
+                    return false;
+                }
+                const uint8_t* p = v.L4();
+                switch (F) {
+                case IcmpType: case Icmpv6Type: out = p[0]; break;
+                case IcmpCode: case Icmpv6Code: out = p[1]; break;
+                case IcmpChecksum: case Icmpv6Checksum: out = LoadBe16(p + 2); break;
+                case IcmpBody: case Icmpv6Body: out = LoadBe32(p + 4); break;
+                default: break;
+                }
+                return true;
+            }
+            else {
+                return false;   // 128-bit address fields are lowered before they reach an extractor
+            }
+        }
+
+        // Single packet and whole column entry points for every field
+        using SingleLoader = bool (*)(const SimulatedPacket&, uint64_t&);
+        using ColumnLoader = void (*)(const SimulatedPacket*, size_t, uint64_t*);
+
+        template <FilterField F>
+        bool LoadSingle(const SimulatedPacket& packet, uint64_t& out) {
+            return Extract<F>(PacketView(packet), out);
+        }
+
+        template <FilterField F>
+        void LoadColumn(const SimulatedPacket* packets, size_t count, uint64_t* out) {
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t value = 0;
+                Extract<F>(PacketView(packets[i]), value);
+                out[i] = value;
+            }
+        }
+
+        template <size_t... I>
+        constexpr auto MakeSingleLoaders(std::index_sequence<I...>) {
+            return std::array<SingleLoader, sizeof...(I)>{ &LoadSingle<static_cast<FilterField>(I)>... };
+        }
+
+        template <size_t... I>
+        constexpr auto MakeColumnLoaders(std::index_sequence<I...>) {
+            return std::array<ColumnLoader, sizeof...(I)>{ &LoadColumn<static_cast<FilterField>(I)>... };
+        }
+
+        constexpr auto SINGLE_LOADERS = MakeSingleLoaders(std::make_index_sequence<FIELD_COUNT>{});
+        constexpr auto COLUMN_LOADERS = MakeColumnLoaders(std::make_index_sequence<FIELD_COUNT>{});
+
+        // 128-bit address fields as their two 64-bit halves
+        std::pair<FilterField, FilterField> AddressHalves(FilterField field) {
+            return field == FilterField::Ipv6SrcAddr ?
+                std::pair{ FilterField::Ipv6SrcHi, FilterField::Ipv6SrcLo } :
+                std::pair{ FilterField::Ipv6DstHi, FilterField::Ipv6DstLo };
+        }
+
+        template <typename T>
+        bool Compare(FilterOp op, T a, T b) {
+            switch (op) {
+            case FilterOp::Eq: return a == b;
+            case FilterOp::Ne: return a != b;
+            case FilterOp::Lt: return a < b;
+            case FilterOp::Le: return a <= b;
+            case FilterOp::Gt: return a > b;
+            case FilterOp::Ge: return a >= b;
+            }
+            return false;
+        }
+
+        std::unique_ptr<FilterNode> MakeConstant(bool value) {
+            auto node = std::make_unique<FilterNode>();
+            node->kind = FilterNode::Kind::Constant;
+            node->constant = value;
+            return node;
+        }
+
+        std::unique_ptr<FilterNode> MakeUnary(FilterNode::Kind kind, std::unique_ptr<FilterNode> child) {
+            auto node = std::make_unique<FilterNode>();
+            node->kind = kind;
+            node->left = std::move(child);
+            return node;
+        }
+
+        std::unique_ptr<FilterNode> MakeBinary(FilterNode::Kind kind,
+            std::unique_ptr<FilterNode> left, std::unique_ptr<FilterNode> right) {
+            auto node = MakeUnary(kind, std::move(left));
+            node->right = std::move(right);
+            return node;
+        }
+
+        std::unique_ptr<FilterNode> MakeTest(FilterField field, FilterOp op, uint64_t value) {
+            auto node = std::make_unique<FilterNode>();
+            node->kind = FilterNode::Kind::Test;
+            node->field = field;
+            node->op = op;
+            node->value = value;
+            return node;
+        }
+
+        std::unique_ptr<FilterNode> Clone(const FilterNode& node) {
+            auto copy = std::make_unique<FilterNode>();
+            copy->kind = node.kind;
+            copy->constant = node.constant;
+            copy->field = node.field;
+            copy->op = node.op;
+            copy->value_hi = node.value_hi;
+            copy->value = node.value;
+            if (node.left) {
+                copy->left = Clone(*node.left);
+            }
+            if (node.right) {
+                copy->right = Clone(*node.right);
+            }
+            return copy;
+        }
+
+        // Recursive descent over the WinDivert grammar
+        class Parser {
+        public:
+            explicit Parser(std::string_view text) : text_(text) {}
+
+            std::expected<std::unique_ptr<FilterNode>, std::string> Run() {
+                auto node = ParseExpression();
+                if (node && (SkipSpace(), pos_ != text_.size())) {
+                    return Error("unexpected input");
+                }
+                return node;
+            }
+
+        private:
+            using Result = std::expected<std::unique_ptr<FilterNode>, std::string>;
+
+            std::string_view text_;
+            size_t pos_ = 0;
+
+            std::unexpected<std::string> Error(std::string_view what) const {
+                return std::unexpected(std::format("{} at position {}", what, pos_ + 1));
+            }
+
+            void SkipSpace() {
+                while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+                    ++pos_;
+                }
+            }
+
+            bool MatchSymbol(std::string_view symbol) {
+                SkipSpace();
+                if (text_.substr(pos_, symbol.size()) == symbol) {
+                    pos_ += symbol.size();
+                    return true;
+                }
+                return false;
+            }
+
+            // Whole-word, case-insensitive keyword
+            bool MatchKeyword(std::string_view keyword) {
+                SkipSpace();
+                if (text_.size() - pos_ < keyword.size()) {
+                    return false;
+                }
+                for (size_t i = 0; i < keyword.size(); ++i) {
+                    if (std::tolower(static_cast<unsigned char>(text_[pos_ + i])) != keyword[i]) {
+                        return false;
+                    }
+                }
+                const size_t end = pos_ + keyword.size();
+                if (end < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[end])) ||
+                    text_[end] == '_' || text_[end] == '.')) {
+                    return false;
+                }
+                pos_ = end;
+                return true;
+            }
+
+            Result ParseExpression() {
+                auto condition = ParseOr();
+                if (!condition || !MatchSymbol("?")) {
+                    return condition;
+                }
+
+                // c ? a : b  ==  (c and a) or (not c and b)
+                auto then_branch = ParseExpression();
+                if (!then_branch) {
+                    return then_branch;
+                }
+                if (!MatchSymbol(":")) {
+                    return Error("expected ':'");
+                }
+                auto else_branch = ParseExpression();
+                if (!else_branch) {
+                    return else_branch;
+                }
+                auto negated = MakeUnary(FilterNode::Kind::Not, Clone(**condition));
+                return MakeBinary(FilterNode::Kind::Or,
+                    MakeBinary(FilterNode::Kind::And, std::move(*condition), std::move(*then_branch)),
+                    MakeBinary(FilterNode::Kind::And, std::move(negated), std::move(*else_branch)));
+            }
+
+            Result ParseOr() {
+                auto left = ParseAnd();
+                while (left && (MatchKeyword("or") || MatchSymbol("||"))) {
+                    auto right = ParseAnd();
+                    if (!right) {
+                        return right;
+                    }
+                    left = MakeBinary(FilterNode::Kind::Or, std::move(*left), std::move(*right));
+                }
+                return left;
+            }
+
+            Result ParseAnd() {
+                auto left = ParseUnary();
+                while (left && (MatchKeyword("and") || MatchSymbol("&&"))) {
+                    auto right = ParseUnary();
+                    if (!right) {
+                        return right;
+                    }
+                    left = MakeBinary(FilterNode::Kind::And, std::move(*left), std::move(*right));
+                }
+                return left;
+            }
+
+            Result ParseUnary() {
+                if (MatchKeyword("not") || (SkipSpace(), text_.substr(pos_, 2) != "!=" && MatchSymbol("!"))) {
+                    auto child = ParseUnary();
+                    if (!child) {
+                        return child;
+                    }
+                    return MakeUnary(FilterNode::Kind::Not, std::move(*child));
+                }
+                if (MatchSymbol("(")) {
+                    auto inner = ParseExpression();
+                    if (inner && !MatchSymbol(")")) {
+                        return Error("expected ')'");
+                    }
+                    return inner;
+                }
+                if (MatchKeyword("true")) {
+                    return MakeConstant(true);
+                }
+                if (MatchKeyword("false")) {
+                    return MakeConstant(false);
+                }
+                return ParseTest();
+            }
+
+            Result ParseTest() {
+                SkipSpace();
+                const size_t start = pos_;
+                while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) ||
+                    text_[pos_] == '.' || text_[pos_] == '_')) {
+                    ++pos_;
+                }
+                if (pos_ == start) {
+                    return Error("expected a field");
+                }
+
+                std::string name(text_.substr(start, pos_ - start));
+                std::transform(name.begin(), name.end(), name.begin(),
+                    [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                const auto it = std::find_if(FIELDS.begin(), FIELDS.end(),
+                    [&](const FieldInfo& info) { return info.name != nullptr && name == info.name; });
+                if (it == FIELDS.end()) {
+                    pos_ = start;
+                    return Error(std::format("unknown field '{}'", name));
+                }
+                const auto field = static_cast<FilterField>(it - FIELDS.begin());
+
+                // Bare field means field != 0
+                static constexpr std::array<std::pair<std::string_view, FilterOp>, 6> OPS = { {
+                    { "==", FilterOp::Eq }, { "!=", FilterOp::Ne }, { "<=", FilterOp::Le },
+                    { ">=", FilterOp::Ge }, { "<", FilterOp::Lt }, { ">", FilterOp::Gt },
+                } };
+                FilterOp op = FilterOp::Ne;
+                bool has_op = false;
+                for (const auto& [symbol, candidate] : OPS) {
+                    if (MatchSymbol(symbol)) {
+                        op = candidate;
+                        has_op = true;
+                        break;
+                    }
+                }
+                if (!has_op && MatchSymbol("=")) {
+                    op = FilterOp::Eq;      // The driver accepts a single '=' as well
+                    has_op = true;
+                }
+
+                auto node = MakeTest(field, op, 0);
+                if (has_op && !ParseValue(*node)) {
+                    return Error("invalid value");
+                }
+                return node;
+            }
+
+            // Values are scanned greedily, so IPv6 colons never reach the ternary parser
+            bool ParseValue(FilterNode& node) {
+                SkipSpace();
+                const size_t start = pos_;
+                while (pos_ < text_.size() && (std::isxdigit(static_cast<unsigned char>(text_[pos_])) ||
+                    text_[pos_] == '.' || text_[pos_] == ':' || text_[pos_] == 'x' || text_[pos_] == 'X')) {
+                    ++pos_;
+                }
+                std::string_view token = text_.substr(start, pos_ - start);
+                if (token.empty()) {
+                    return false;
+                }
+
+                // A trailing ':' belongs to a ternary, not to an address
+                if (token.back() == ':' && !token.ends_with("::")) {
+                    token.remove_suffix(1);
+                    --pos_;
+                }
+
+                if (token.find(':') != std::string_view::npos || token.find('.') != std::string_view::npos) {
+                    const auto address = ParseCidr(token);
+                    if (!address || token.find('/') != std::string_view::npos) {
+                        return false;
+                    }
+                    if (address->version == 4) {
+                        node.value = LoadBe32(address->address.data());
+                    }
+                    else {
+                        node.value_hi = LoadBe64(address->address.data());
+                        node.value = LoadBe64(address->address.data() + 8);
+                    }
+                    return IsAddress128(node.field) == (address->version == 6);
+                }
+
+                int base = 10;
+                if (token.size() > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X')) {
+                    token.remove_prefix(2);
+                    base = 16;
+                }
+                const auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), node.value, base);
+                return error == std::errc() && end == token.data() + token.size() && !IsAddress128(node.field);
+            }
+        };
+
+        // Test that is true whenever the field exists
+        std::unique_ptr<FilterNode> Presence(FilterField field) {
+            const FilterField layer = Info(field).layer;
+            if (layer == NO_LAYER) {
+                return MakeConstant(true);
+            }
+            return MakeTest(layer, FilterOp::Ne, 0);
+        }
+
+        // Constant folding: absorb true/false, drop double negation, fold comparisons the
+        // field width makes impossible or trivially true
+        std::unique_ptr<FilterNode> Fold(std::unique_ptr<FilterNode> node) {
+            using Kind = FilterNode::Kind;
+            switch (node->kind) {
+            case Kind::Constant:
+                return node;
+
+            case Kind::Not: {
+                auto child = Fold(std::move(node->left));
+                if (child->kind == Kind::Constant) {
+                    return MakeConstant(!child->constant);
+                }
+                if (child->kind == Kind::Not) {
+                    return std::move(child->left);
+                }
+                node->left = std::move(child);
+                return node;
+            }
+
+            case Kind::And:
+            case Kind::Or: {
+                const bool absorbing = node->kind == Kind::Or;    // true absorbs or, false absorbs and
+                auto left = Fold(std::move(node->left));
+                auto right = Fold(std::move(node->right));
+                for (auto* side : { &left, &right }) {
+                    if ((*side)->kind == Kind::Constant && (*side)->constant == absorbing) {
+                        return MakeConstant(absorbing);
+                    }
+                }
+                if (left->kind == Kind::Constant) {
+                    return right;
+                }
+                if (right->kind == Kind::Constant) {
+                    return left;
+                }
+                node->left = std::move(left);
+                node->right = std::move(right);
+                return node;
+            }
+
+            case Kind::Test: {
+                const uint8_t bits = Info(node->field).bits;
+                if (bits >= 64) {
+                    return node;
+                }
+                const uint64_t max = (uint64_t{ 1 } << bits) - 1;
+                const uint64_t value = node->value;
+                bool always = false;
+                bool never = false;
+                switch (node->op) {
+                case FilterOp::Eq: never = value > max; break;
+                case FilterOp::Ne: always = value > max; break;
+                case FilterOp::Lt: never = value == 0; always = value > max; break;
+                case FilterOp::Le: always = value >= max; break;
+                case FilterOp::Gt: never = value >= max; break;
+                case FilterOp::Ge: always = value == 0; never = value > max; break;
+                }
+                if (never) {
+                    return MakeConstant(false);
+                }
+                if (always) {
+                    return Fold(Presence(node->field));
+                }
+                return node;
+            }
+            }
+            return node;
+        }
+
+        // Code generation with value numbering: identical loads and subexpressions share a register
+        // Registers are SSA, one per instruction; running out sets `overflow`
+        class Codegen {
+        public:
+            using Instruction = FilterProgram::Instruction;
+            using OpCode = FilterProgram::OpCode;
+
+            std::vector<Instruction> code;
+            bool overflow = false;
+
+            uint8_t Emit(const FilterNode& node) {
+                using Kind = FilterNode::Kind;
+                switch (node.kind) {
+                case Kind::Constant:
+                    return Add(OpCode::Const, 0, 0, {}, node.constant ? 1 : 0);
+                case Kind::Not:
+                    return Add(OpCode::Not, Emit(*node.left), 0, {}, 0);
+                case Kind::And:
+                case Kind::Or: {
+                    const uint8_t left = Emit(*node.left);
+                    const uint8_t right = Emit(*node.right);
+                    return Logic(node.kind == Kind::And ? OpCode::And : OpCode::Or, left, right);
+                }
+                case Kind::Test:
+                    break;
+                }
+                return EmitTest(node);
+            }
+
+        private:
+            std::map<std::tuple<OpCode, uint8_t, uint8_t, FilterField, uint64_t>, uint8_t> numbering_;
+
+            uint8_t Add(OpCode op, uint8_t a, uint8_t b, FilterField field, uint64_t imm) {
+                const auto key = std::tuple{ op, a, b, field, imm };
+                if (const auto it = numbering_.find(key); it != numbering_.end()) {
+                    return it->second;
+                }
+                if (code.size() >= FilterProgram::MAX_REGISTERS) {
+                    overflow = true;
+                    return 0;
+                }
+                const auto dst = static_cast<uint8_t>(code.size());
+                code.push_back({ op, dst, a, b, field, imm });
+                numbering_.emplace(key, dst);
+                return dst;
+            }
+
+            uint8_t Logic(OpCode op, uint8_t a, uint8_t b) {
+                if (a == b) {
+                    return a;   // x and x, x or x
+                }
+                return Add(op, std::min(a, b), std::max(a, b), {}, 0);
+            }
+
+            uint8_t Load(FilterField field) {
+                return Add(OpCode::Load, 0, 0, field, 0);
+            }
+
+            uint8_t Cmp(FilterOp op, uint8_t reg, uint64_t imm) {
+                const auto opcode = static_cast<OpCode>(static_cast<uint8_t>(OpCode::Eq) + static_cast<uint8_t>(op));
+                return Add(opcode, reg, 0, {}, imm);
+            }
+
+            uint8_t EmitTest(const FilterNode& node) {
+                const FieldInfo& info = Info(node.field);
+                uint8_t result = 0;
+
+                if (IsAddress128(node.field)) {
+                    // Lexicographic compare of the (hi, lo) halves
+                    const auto [hi_field, lo_field] = AddressHalves(node.field);
+                    const uint8_t hi = Load(hi_field);
+                    const uint8_t lo = Load(lo_field);
+                    if (node.op == FilterOp::Eq || node.op == FilterOp::Ne) {
+                        result = Logic(node.op == FilterOp::Eq ? OpCode::And : OpCode::Or,
+                            Cmp(node.op, hi, node.value_hi), Cmp(node.op, lo, node.value));
+                    }
+                    else {
+                        const FilterOp strict = node.op == FilterOp::Lt || node.op == FilterOp::Le ? FilterOp::Lt : FilterOp::Gt;
+                        const uint8_t tail = Logic(OpCode::And, Cmp(FilterOp::Eq, hi, node.value_hi), Cmp(node.op, lo, node.value));
+                        result = Logic(OpCode::Or, Cmp(strict, hi, node.value_hi), tail);
+                    }
+                }
+                else {
+                    const uint8_t value = Load(node.field);
+                    if (info.bits == 1 && node.value == 0 && node.op == FilterOp::Ne) {
+                        result = value;     // Flags are already 0/1
+                    }
+                    else if (info.bits == 1 && node.value == 0 && node.op == FilterOp::Eq) {
+                        result = Add(OpCode::Not, value, 0, {}, 0);
+                    }
+                    else {
+                        result = Cmp(node.op, value, node.value);
+                    }
+                }
+
+                if (info.layer == NO_LAYER) {
+                    return result;
+                }
+
+                // A missing field makes the test false, whatever the operator
+                return Logic(OpCode::And, Load(info.layer), result);
+            }
+        };
+    }
+
+    bool LoadFilterField(FilterField field, const SimulatedPacket& packet, uint64_t& value) {
+        if (field >= FilterField::Count) {
+            return false;
+        }
+        return SINGLE_LOADERS[static_cast<size_t>(field)](packet, value);
+    }
+
+    bool FilterNode::Evaluate(const SimulatedPacket& packet) const {
+        switch (kind) {
+        case Kind::Constant:
+            return constant;
+        case Kind::Not:
+            return !left->Evaluate(packet);
+        case Kind::And:
+            return left->Evaluate(packet) && right->Evaluate(packet);
+        case Kind::Or:
+            return left->Evaluate(packet) || right->Evaluate(packet);
+        case Kind::Test:
+            break;
+        }
+
+        if (IsAddress128(field)) {
+            const auto [hi_field, lo_field] = AddressHalves(field);
+            uint64_t hi = 0, lo = 0;
+            if (!LoadFilterField(hi_field, packet, hi) || !LoadFilterField(lo_field, packet, lo)) {
+                return false;
+            }
+            return Compare(op, std::pair{ hi, lo }, std::pair{ value_hi, value });
+        }
+
+        uint64_t loaded = 0;
+        if (!LoadFilterField(field, packet, loaded)) {
+            return false;
+        }
+        return Compare(op, loaded, value);
+    }
+
+    std::expected<std::unique_ptr<FilterNode>, std::string> ParseFilter(std::string_view expression) {
+        return Parser(expression).Run();
+    }
+
+    std::expected<FilterProgram, std::string> FilterProgram::Compile(std::string_view expression) {
+        auto root = ParseFilter(expression);
+        if (!root) {
+            return std::unexpected(root.error());
+        }
+        return Compile(**root);
+    }
+
+    std::expected<FilterProgram, std::string> FilterProgram::Compile(const FilterNode& root) {
+        Codegen codegen;
+        const uint8_t result = codegen.Emit(*Fold(Clone(root)));
+        if (codegen.overflow) {
+            return std::unexpected(std::format("Filter needs more than {} registers", MAX_REGISTERS));
+        }
+
+        FilterProgram program;
+        program.code_ = std::move(codegen.code);
+        program.register_count_ = program.code_.size();
+        program.result_ = result;
+        return program;
+    }
+
+    void FilterProgram::Evaluate(std::span<const SimulatedPacket> packets, std::vector<uint8_t>& results) const {
+        results.resize(packets.size());
+
+        // One column per register, reused across calls on the same thread
+        thread_local std::vector<uint64_t> registers;
+        registers.resize(register_count_ * BATCH_WIDTH);
+
+        for (size_t base = 0; base < packets.size(); base += BATCH_WIDTH) {
+            const size_t count = std::min(BATCH_WIDTH, packets.size() - base);
+            const SimulatedPacket* chunk = packets.data() + base;
+
+            for (const Instruction& ins : code_) {
+                uint64_t* dst = registers.data() + ins.dst * BATCH_WIDTH;
+                const uint64_t* a = registers.data() + ins.a * BATCH_WIDTH;
+                const uint64_t* b = registers.data() + ins.b * BATCH_WIDTH;
+                const uint64_t imm = ins.imm;
+
+                switch (ins.op) {
+                case OpCode::Load:
+                    COLUMN_LOADERS[static_cast<size_t>(ins.field)](chunk, count, dst);
+                    break;
+                case OpCode::Eq: for (size_t i = 0; i < count; ++i) dst[i] = a[i] == imm; break;
+                case OpCode::Ne: for (size_t i = 0; i < count; ++i) dst[i] = a[i] != imm; break;
+                case OpCode::Lt: for (size_t i = 0; i < count; ++i) dst[i] = a[i] < imm; break;
+                case OpCode::Le: for (size_t i = 0; i < count; ++i) dst[i] = a[i] <= imm; break;
+                case OpCode::Gt: for (size_t i = 0; i < count; ++i) dst[i] = a[i] > imm; break;
+                case OpCode::Ge: for (size_t i = 0; i < count; ++i) dst[i] = a[i] >= imm; break;
+                case OpCode::And: for (size_t i = 0; i < count; ++i) dst[i] = a[i] & b[i]; break;
+                case OpCode::Or: for (size_t i = 0; i < count; ++i) dst[i] = a[i] | b[i]; break;
+                case OpCode::Not: for (size_t i = 0; i < count; ++i) dst[i] = a[i] ^ 1; break;
+                case OpCode::Const: for (size_t i = 0; i < count; ++i) dst[i] = imm; break;
+                }
+            }
+
+            const uint64_t* result = registers.data() + result_ * BATCH_WIDTH;
+            for (size_t i = 0; i < count; ++i) {
+                results[base + i] = static_cast<uint8_t>(result[i]);
+            }
+        }
+    }
+
+    std::expected<size_t, std::string> CountFilterMismatches(std::string_view expression,
+        std::span<const SimulatedPacket> packets) {
+        auto root = ParseFilter(expression);
+        if (!root.has_value()) {
+            return std::unexpected(root.error());
+        }
+        auto program = FilterProgram::Compile(**root);
+        if (!program.has_value()) {
+            return std::unexpected(program.error());
+        }
+
+        std::vector<uint8_t> results;
+        program->Evaluate(packets, results);
+        size_t mismatches = 0;
+        for (size_t i = 0; i < packets.size(); ++i) {
+            if ((results[i] != 0) != (*root)->Evaluate(packets[i])) {
+                ++mismatches;
+            }
+        }
+        return mismatches;
+    }
+
+    bool FilterProgram::Matches(const SimulatedPacket& packet) const {
+        std::vector<uint8_t> result;
+        Evaluate(std::span<const SimulatedPacket>(&packet, 1), result);
+        return result[0] != 0;
+    }
+
+    bool FilterProgram::MatchesAll() const {
+        return code_.size() == 1 && code_[0].op == OpCode::Const && code_[0].imm != 0;
+    }
+
+    std::string FilterProgram::Disassemble() const {
+        static constexpr std::array<const char*, 11> NAMES = {
+            "load", "eq", "ne", "lt", "le", "gt", "ge", "and", "or", "not", "const" };
+
+        std::string text;
+        for (const Instruction& ins : code_) {
+            const char* name = NAMES[static_cast<size_t>(ins.op)];
+            switch (ins.op) {
+            case OpCode::Load: {
+                const char* field = Info(ins.field).name;
+                text += std::format("r{} = load {}\n", ins.dst, field ? field : "ipv6.addr.half");
+                break;
+            }
+            case OpCode::And:
+            case OpCode::Or:
+                text += std::format("r{} = {} r{}, r{}\n", ins.dst, name, ins.a, ins.b);
+                break;
+            case OpCode::Not:
+                text += std::format("r{} = not r{}\n", ins.dst, ins.a);
+                break;
+            case OpCode::Const:
+                text += std::format("r{} = const {}\n", ins.dst, ins.imm);
+                break;
+            default:
+                text += std::format("r{} = {} r{}, {}\n", ins.dst, name, ins.a, ins.imm);
+                break;
+            }
+        }
+        text += std::format("return r{}\n", result_);
+        return text;
+    }
+
+}
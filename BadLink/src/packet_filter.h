@@ -0,0 +1,138 @@
+#ifndef BADLINK_SRC_PACKET_FILTER_H_
+#define BADLINK_SRC_PACKET_FILTER_H_
+
+#include "simulation_module.h"
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    // Fields of the WinDivert filter language understood outside the driver
+    // The split *Hi/*Lo halves and Transport are internal: the compiler lowers 128-bit IPv6
+    // addresses to the halves, Transport guards the direction-relative ports
+    enum class FilterField : uint8_t {
+        // Flags and metadata, present on every packet
+        Outbound, Inbound, Loopback, Impostor, Fragment, Length, IfIdx, SubIfIdx,
+        // Layer flags, also the presence guard of the fields below
+        Ip, Ipv6, Tcp, Udp, Icmp, Icmpv6,
+        // Direction-relative ports (TCP or UDP)
+        LocalPort, RemotePort,
+        IpHdrLength, IpTos, IpLength, IpId, IpDf, IpMf, IpFragOff, IpTtl, IpProtocol, IpChecksum, IpSrcAddr, IpDstAddr,
+        Ipv6TrafficClass, Ipv6FlowLabel, Ipv6PayloadLength, Ipv6NextHdr, Ipv6HopLimit, Ipv6SrcAddr, Ipv6DstAddr,
+        TcpSrcPort, TcpDstPort, TcpSeqNum, TcpAckNum, TcpHdrLength, TcpUrg, TcpAck, TcpPsh, TcpRst, TcpSyn, TcpFin,
+        TcpWindow, TcpChecksum, TcpUrgPtr, TcpPayloadLength,
+        UdpSrcPort, UdpDstPort, UdpLength, UdpChecksum, UdpPayloadLength,
+        IcmpType, IcmpCode, IcmpChecksum, IcmpBody,
+        Icmpv6Type, Icmpv6Code, Icmpv6Checksum, Icmpv6Body,
+        Ipv6SrcHi, Ipv6SrcLo, Ipv6DstHi, Ipv6DstLo, Transport,
+        Count
+    };
+
+    enum class FilterOp : uint8_t { Eq, Ne, Lt, Le, Gt, Ge };
+
+    // Parsed filter expression, also the reference (naive) evaluator
+    struct FilterNode {
+        enum class Kind : uint8_t { Constant, Test, Not, And, Or };
+
+        Kind kind = Kind::Constant;
+        bool constant = false;              // Kind::Constant
+        FilterField field{};                // Kind::Test: field op value
+        FilterOp op = FilterOp::Ne;
+        uint64_t value_hi = 0;              // Upper half of 128-bit IPv6 address constants
+        uint64_t value = 0;
+        std::unique_ptr<FilterNode> left;   // Not, And, Or
+        std::unique_ptr<FilterNode> right;  // And, Or
+
+        // Recursive short-circuit walk, one packet at a time
+        bool Evaluate(const SimulatedPacket& packet) const;
+    };
+
+    // Parse "tcp.DstPort == 443 and outbound" with WinDivert syntax: and/&&, or/||, not/!,
+    // parentheses, c ? a : b, == != < <= > >=, decimal/hex/IPv4/IPv6 constants
+    // Case-insensitive like the driver, a bare field means field != 0
+    [[nodiscard]] std::expected<std::unique_ptr<FilterNode>, std::string> ParseFilter(std::string_view expression);
+
+    // Filter compiled to register bytecode and run column-wise over a batch:
+    // every instruction loops over up to BATCH_WIDTH packets, so dispatch is paid per batch
+    // and each loop is a tight, branch-free kernel
+    class FilterProgram {
+    public:
+        static constexpr size_t BATCH_WIDTH = 64;
+        static constexpr size_t MAX_REGISTERS = 255;
+
+        enum class OpCode : uint8_t {
+            Load,       // dst = field
+            Eq, Ne, Lt, Le, Gt, Ge,     // dst = a op imm
+            And, Or,    // dst = a op b
+            Not,        // dst = !a
+            Const,      // dst = imm
+        };
+
+        struct Instruction {
+            OpCode op;
+            uint8_t dst;
+            uint8_t a;
+            uint8_t b;
+            FilterField field;
+            uint64_t imm;
+        };
+
+        // Parse, fold constants, then generate code with one load per distinct field
+        static std::expected<FilterProgram, std::string> Compile(std::string_view expression);
+        static std::expected<FilterProgram, std::string> Compile(const FilterNode& root);
+
+        // results[i] = 1 if packets[i] matches, resized to the batch
+        void Evaluate(std::span<const SimulatedPacket> packets, std::vector<uint8_t>& results) const;
+        bool Matches(const SimulatedPacket& packet) const;
+
+        // Folded to the constant true, every packet matches without running the program
+        bool MatchesAll() const;
+
+        size_t GetInstructionCount() const { return code_.size(); }
+        size_t GetRegisterCount() const { return register_count_; }
+        std::string Disassemble() const;
+
+    private:
+        std::vector<Instruction> code_;
+        size_t register_count_ = 0;
+        uint8_t result_ = 0;
+    };
+
+    // Field value for one packet, false if the packet lacks the field's layer
+    // Uses the same extractors as the VM column loads, so both evaluators agree
+    bool LoadFilterField(FilterField field, const SimulatedPacket& packet, uint64_t& value);
+
+    // Packets of `packets` on which the compiled program and FilterNode::Evaluate disagree,
+    // the reference check that keeps the VM honest
+    [[nodiscard]] std::expected<size_t, std::string> CountFilterMismatches(std::string_view expression,
+        std::span<const SimulatedPacket> packets);
+
+    // Filters offered as presets, also what the filter self test and benchmark run
+    struct NamedFilter {
+        std::string_view name;
+        std::string_view expression;
+    };
+
+    inline constexpr NamedFilter PRESET_FILTERS[] = {
+        { "All traffic", "true" },
+        { "TCP only", "tcp" },
+        { "UDP only", "udp" },
+        { "HTTP (port 80)", "tcp.DstPort == 80 or tcp.SrcPort == 80" },
+        { "HTTPS (port 443)", "tcp.DstPort == 443 or tcp.SrcPort == 443" },
+        { "DNS (port 53)", "udp.DstPort == 53 or udp.SrcPort == 53" },
+        { "Local network", "ip.DstAddr >= 192.168.0.0 and ip.DstAddr <= 192.168.255.255" },
+        { "IPv6 only", "ipv6" },
+        { "IPv4 only", "ip" },
+        { "Outbound only", "outbound" },
+        { "Inbound only", "inbound" },
+        { "Non-loopback", "!loopback" },
+        { "No traffic (test)", "false" },
+    };
+
+}
+#endif  // BADLINK_SRC_PACKET_FILTER_H_
@@ -1,4 +1,5 @@
 #include "packet_loss_module.h"
+#include "gso.h"
 #include <algorithm>
 
 namespace BadLink {
@@ -6,12 +7,12 @@ namespace BadLink {
     PacketLossModule::PacketLossModule() = default;
     PacketLossModule::~PacketLossModule() = default;
 
-    void PacketLossModule::SetLossRate(float loss_percentage) {
-        loss_rate_.store(std::clamp(loss_percentage, 0.0f, 100.0f));
+    void PacketLossModule::SetLossRate(Direction direction, float loss_percentage) {
+        loss_rate_[DirectionIndex(direction)].store(std::clamp(loss_percentage, 0.0f, 100.0f));
     }
 
-    float PacketLossModule::GetLossRate() const {
-        return loss_rate_.load();
+    float PacketLossModule::GetLossRate(Direction direction) const {
+        return loss_rate_[DirectionIndex(direction)].load();
     }
 
     void PacketLossModule::SetEnabled(bool enabled) {
@@ -39,9 +40,17 @@ namespace BadLink {
 
         std::vector<SimulatedPacket> surviving_packets;
         surviving_packets.reserve(packets.size());
+        const PerDirection<float> loss_rates{ loss_rate_[0].load(), loss_rate_[1].load() };
 
         for (auto&& packet : packets) {
-            if (ShouldProcess(packet.addr) && ShouldDrop()) {
+            const float loss_rate = loss_rates[DirectionIndex(packet)];
+            if (!ShouldProcess(packet)) {
+                surviving_packets.push_back(std::move(packet));
+            }
+            else if (packet.gso_size != 0) {
+                ProcessSuperPacket(std::move(packet), loss_rate, surviving_packets);
+            }
+            else if (RandomStream random(RandomDomain::Loss, packet.random_stream); ShouldDrop(loss_rate, random)) {
                 // Packet is dropped simply don't add it to surviving packets
                 // Memory will be freed when packet goes out of scope
             }
@@ -58,7 +67,38 @@ namespace BadLink {
         return {};
     }
 
-    bool PacketLossModule::ShouldProcess(const WINDIVERT_ADDRESS& addr) const {
+    void PacketLossModule::ProcessSuperPacket(SimulatedPacket&& packet, float loss_rate,
+        std::vector<SimulatedPacket>& surviving_packets) {
+
+        // One loss decision per wire segment, the super-packet is only split once one is lost
+        // Segments take successive draws of the packet's stream
+        RandomStream random(RandomDomain::Loss, packet.random_stream);
+        const size_t segment_count = Gso::SegmentCount(packet);
+        size_t first_lost = 0;
+        while (first_lost < segment_count && !ShouldDrop(loss_rate, random)) {
+            ++first_lost;
+        }
+        if (first_lost == segment_count) {
+            surviving_packets.push_back(std::move(packet));
+            return;
+        }
+
+        std::vector<SimulatedPacket> segments;
+        segments.reserve(segment_count);
+        Gso::Segment(std::move(packet), segments);
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (i < first_lost || (i > first_lost && !ShouldDrop(loss_rate, random))) {
+                surviving_packets.push_back(std::move(segments[i]));
+            }
+        }
+    }
+
+    bool PacketLossModule::ShouldProcess(const SimulatedPacket& packet) const {
+        if ((packet.modules & ModuleMask::PACKET_LOSS) == 0) {
+            return false;
+        }
+
+        const WINDIVERT_ADDRESS& addr = packet.addr;
         if (addr.Outbound && !outbound_enabled_.load()) {
             return false;
         }
@@ -68,15 +108,14 @@ namespace BadLink {
         return true;
     }
 
-    bool PacketLossModule::ShouldDrop() const {
-        const float loss_rate = loss_rate_.load();
+    bool PacketLossModule::ShouldDrop(float loss_rate, RandomStream& random) const {
         if (loss_rate <= 0.0f) {
             return false;
         }
         if (loss_rate >= 100.0f) {
             return true;
         }
-        return RandomUtils::GetPercentage() < loss_rate;
+        return random.Percentage() < loss_rate;
     }
 
 }
\ No newline at end of file
@@ -12,9 +12,9 @@ namespace BadLink {
         PacketLossModule();
         ~PacketLossModule() override;
 
-        // Set packet loss percentage (0.0 - 100.0)
-        void SetLossRate(float loss_percentage);
-        float GetLossRate() const;
+        // Set packet loss percentage (0.0 - 100.0) for one direction
+        void SetLossRate(Direction direction, float loss_percentage);
+        float GetLossRate(Direction direction) const;
 
         // Enable/disable the module
         void SetEnabled(bool enabled);
@@ -33,13 +33,17 @@ namespace BadLink {
         std::atomic<bool> enabled_{ false };
         std::atomic<bool> inbound_enabled_{ true };
         std::atomic<bool> outbound_enabled_{ true };
-        std::atomic<float> loss_rate_{ 0.0f };
+        PerDirection<std::atomic<float>> loss_rate_{};
 
-        // Check if packet should be processed based on direction
-        bool ShouldProcess(const WINDIVERT_ADDRESS& addr) const;
+        // Check if packet should be processed based on direction and rule selection
+        bool ShouldProcess(const SimulatedPacket& packet) const;
 
-        // Determine if packet should be dropped
-        bool ShouldDrop() const;
+        // Determine if packet should be dropped at this loss rate
+        bool ShouldDrop(float loss_rate, RandomStream& random) const;
+
+        // Per-segment loss for coalesced super-packets
+        void ProcessSuperPacket(SimulatedPacket&& packet, float loss_rate,
+            std::vector<SimulatedPacket>& surviving_packets);
     };
 
 }
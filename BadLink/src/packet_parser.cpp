@@ -0,0 +1,112 @@
+#include "packet_parser.h"
+
+namespace BadLink {
+
+    namespace {
+        constexpr size_t IPV4_MIN_HEADER = 20;
+        constexpr size_t IPV6_HEADER = 40;
+        constexpr size_t TCP_MIN_HEADER = 20;
+        constexpr size_t UDP_HEADER = 8;
+
+        // IPv6 extension headers that use the generic (next header, length) layout
+        bool IsIPv6ExtensionHeader(uint8_t next_header) {
+            switch (next_header) {
+            case 0:     // Hop-by-hop options
+            case 43:    // Routing
+            case 51:    // Authentication header
+            case 60:    // Destination options
+                return true;
+            default:
+                return false;
+            }
+        }
+    }
+
+    PacketHeaders ParseHeaders(std::span<const uint8_t> packet) {
+        PacketHeaders headers;
+        if (packet.empty()) {
+            return headers;
+        }
+
+        const uint8_t* data = packet.data();
+        const size_t size = packet.size();
+        const uint8_t version = data[0] >> 4;
+        size_t offset = 0;
+        uint8_t protocol = 0;
+        bool first_fragment = true;
+
+        if (version == 4) {
+            const size_t header_len = static_cast<size_t>(data[0] & 0x0F) * 4;
+            if (header_len < IPV4_MIN_HEADER || size < header_len) {
+                return headers;
+            }
+
+            // MF flag or a non-zero offset marks a fragment, only the first one has a transport header
+            const uint16_t frag = LoadBe16(data + 6);
+            headers.is_fragment = (frag & 0x1FFF) != 0 || (frag & 0x2000) != 0;
+            first_fragment = (frag & 0x1FFF) == 0;
+            protocol = data[9];
+            offset = header_len;
+        }
+        else if (version == 6) {
+            if (size < IPV6_HEADER) {
+                return headers;
+            }
+
+            protocol = data[6];
+            offset = IPV6_HEADER;
+
+            // Walk extension headers until we hit the transport protocol
+            while (IsIPv6ExtensionHeader(protocol) || protocol == IpProtocol::IPV6_FRAGMENT) {
+                if (offset + 8 > size) {
+                    return headers;
+                }
+
+                const uint8_t next = data[offset];
+                if (protocol == IpProtocol::IPV6_FRAGMENT) {
+                    const uint16_t frag = LoadBe16(data + offset + 2);
+                    headers.is_fragment = (frag & 0xFFF8) != 0 || (frag & 0x0001) != 0;
+                    first_fragment = (frag & 0xFFF8) == 0;
+                    offset += 8;
+                }
+                else if (protocol == 51) {
+                    offset += (static_cast<size_t>(data[offset + 1]) + 2) * 4;
+                }
+                else {
+                    offset += (static_cast<size_t>(data[offset + 1]) + 1) * 8;
+                }
+                protocol = next;
+            }
+
+            if (offset > size) {
+                return headers;
+            }
+        }
+        else {
+            return headers;
+        }
+
+        headers.ip_version = version;
+        headers.protocol = protocol;
+        headers.l4_offset = static_cast<uint16_t>(offset);
+        headers.payload_offset = static_cast<uint16_t>(offset);
+
+        // Non-first fragments carry only payload
+        if (!first_fragment) {
+            return headers;
+        }
+
+        if (protocol == IpProtocol::TCP && offset + TCP_MIN_HEADER <= size) {
+            const size_t tcp_len = static_cast<size_t>(data[offset + 12] >> 4) * 4;
+            if (tcp_len >= TCP_MIN_HEADER && offset + tcp_len <= size) {
+                headers.payload_offset = static_cast<uint16_t>(offset + tcp_len);
+            }
+        }
+        else if (protocol == IpProtocol::UDP && offset + UDP_HEADER <= size) {
+            headers.payload_offset = static_cast<uint16_t>(offset + UDP_HEADER);
+        }
+
+        return headers;
+    }
+
+}
@@ -0,0 +1,57 @@
+#ifndef BADLINK_SRC_PACKET_PARSER_H_
+#define BADLINK_SRC_PACKET_PARSER_H_
+
+#include <cstdint>
+#include <span>
+
+namespace BadLink {
+
+    // Protocol numbers used by the parser and the header-editing modules
+    namespace IpProtocol {
+        constexpr uint8_t ICMP = 1;
+        constexpr uint8_t TCP = 6;
+        constexpr uint8_t UDP = 17;
+        constexpr uint8_t IPV6_FRAGMENT = 44;
+        constexpr uint8_t ICMPV6 = 58;
+    }
+
+    // Offsets of the L3/L4 headers inside a raw IP packet
+    struct PacketHeaders {
+        uint8_t  ip_version = 0;        // 4 or 6, 0 if the packet could not be parsed
+        uint8_t  protocol = 0;          // Transport protocol (after IPv6 extension headers)
+        uint16_t l4_offset = 0;         // Start of the transport header
+        uint16_t payload_offset = 0;    // Start of the transport payload
+        bool     is_fragment = false;   // Non-first fragments carry no transport header
+
+        bool IsValid() const { return ip_version != 0; }
+        bool IsTcp() const { return protocol == IpProtocol::TCP && !is_fragment; }
+        bool IsUdp() const { return protocol == IpProtocol::UDP && !is_fragment; }
+    };
+
+    // Single pass over the IP and transport headers, never reads past packet.size()
+    [[nodiscard]] PacketHeaders ParseHeaders(std::span<const uint8_t> packet);
+
+    // Network byte order helpers for unaligned header fields
+    [[nodiscard]] inline uint16_t LoadBe16(const uint8_t* p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    [[nodiscard]] inline uint32_t LoadBe32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+            (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    inline void StoreBe16(uint8_t* p, uint16_t value) {
+        p[0] = static_cast<uint8_t>(value >> 8);
+        p[1] = static_cast<uint8_t>(value);
+    }
+
+    inline void StoreBe32(uint8_t* p, uint32_t value) {
+        p[0] = static_cast<uint8_t>(value >> 24);
+        p[1] = static_cast<uint8_t>(value >> 16);
+        p[2] = static_cast<uint8_t>(value >> 8);
+        p[3] = static_cast<uint8_t>(value);
+    }
+
+}
+#endif  // BADLINK_SRC_PACKET_PARSER_H_
@@ -0,0 +1,270 @@
+#define NOMINMAX
+#include "payload_matcher.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <numeric>
+
+namespace BadLink {
+
+    namespace {
+        int HexDigit(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+#ifdef BADLINK_X64
+        // Bucket bits of 16 consecutive candidate start positions
+        template <size_t MaskLength>
+        BADLINK_TARGET("ssse3") inline __m128i Classify(const uint8_t* bytes, const __m128i* low, const __m128i* high) {
+            const __m128i nibble = _mm_set1_epi8(0x0F);
+            __m128i result = _mm_set1_epi8(-1);
+            for (size_t j = 0; j < MaskLength; ++j) {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + j));
+                const __m128i lo = _mm_shuffle_epi8(low[j], _mm_and_si128(v, nibble));
+                const __m128i hi = _mm_shuffle_epi8(high[j], _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+                result = _mm_and_si128(result, _mm_and_si128(lo, hi));
+            }
+            return result;
+        }
+#endif
+    }
+
+    std::expected<std::vector<uint8_t>, std::string> ParsePattern(std::string_view text) {
+        std::vector<uint8_t> pattern;
+        bool hex = false;
+        int high_nibble = -1;
+
+        for (size_t i = 0; i < text.size(); ++i) {
+            const char c = text[i];
+            if (c == '|') {
+                if (high_nibble >= 0) {
+                    return std::unexpected(std::format("Odd number of hex digits before position {}", i));
+                }
+                hex = !hex;
+            }
+            else if (hex) {
+                if (c == ' ') {
+                    continue;
+                }
+                const int digit = HexDigit(c);
+                if (digit < 0) {
+                    return std::unexpected(std::format("Invalid hex digit '{}' at position {}", c, i));
+                }
+                if (high_nibble < 0) {
+                    high_nibble = digit;
+                }
+                else {
+                    pattern.push_back(static_cast<uint8_t>((high_nibble << 4) | digit));
+                    high_nibble = -1;
+                }
+            }
+            else if (c == '\\' && i + 1 < text.size()) {
+                pattern.push_back(static_cast<uint8_t>(text[++i]));
+            }
+            else {
+                pattern.push_back(static_cast<uint8_t>(c));
+            }
+        }
+
+        if (hex) {
+            return std::unexpected("Unterminated hex run, missing '|'");
+        }
+        if (pattern.empty()) {
+            return std::unexpected("Empty pattern");
+        }
+        return pattern;
+    }
+
+    std::expected<PayloadMatcher, std::string> PayloadMatcher::Compile(const std::vector<std::vector<uint8_t>>& patterns) {
+        if (patterns.size() > MAX_PATTERNS) {
+            return std::unexpected(std::format("Too many patterns ({}, max {})", patterns.size(), MAX_PATTERNS));
+        }
+
+        PayloadMatcher matcher;
+        if (patterns.empty()) {
+            return matcher;
+        }
+
+        size_t shortest = SIZE_MAX;
+        for (const auto& pattern : patterns) {
+            if (pattern.empty()) {
+                return std::unexpected("Empty pattern");
+            }
+            shortest = std::min(shortest, pattern.size());
+        }
+        for (const auto& pattern : patterns) {
+            Pattern& compiled = matcher.patterns_.emplace_back();
+            compiled.bytes = pattern;
+            std::memcpy(&compiled.head, pattern.data(), std::min(pattern.size(), sizeof(compiled.head)));
+        }
+        matcher.mask_length_ = std::min(shortest, MAX_MASK_LENGTH);
+        matcher.all_patterns_ = patterns.size() == 64 ? UINT64_MAX : (uint64_t{ 1 } << patterns.size()) - 1;
+
+        // Patterns with similar leading bytes share a bucket, which keeps the nibble
+        // tables of the other buckets tight and false candidates rare
+        // Equal leading bytes never straddle buckets, they would be candidates together anyway
+        const size_t mask_length = matcher.mask_length_;
+        auto prefix_less = [&](size_t a, size_t b) {
+            return std::lexicographical_compare(patterns[a].begin(), patterns[a].begin() + mask_length,
+                patterns[b].begin(), patterns[b].begin() + mask_length);
+        };
+        std::vector<size_t> order(patterns.size());
+        std::iota(order.begin(), order.end(), size_t{ 0 });
+        std::stable_sort(order.begin(), order.end(), prefix_less);
+
+        std::vector<size_t> group(order.size(), 0);
+        for (size_t rank = 1; rank < order.size(); ++rank) {
+            group[rank] = group[rank - 1] + (prefix_less(order[rank - 1], order[rank]) ? 1 : 0);
+        }
+        const size_t groups = group.back() + 1;
+
+        for (size_t rank = 0; rank < order.size(); ++rank) {
+            const size_t index = order[rank];
+            const size_t bucket = group[rank] * BUCKETS / groups;
+            const uint8_t bucket_bit = static_cast<uint8_t>(1u << bucket);
+
+            matcher.bucket_patterns_[bucket] |= uint64_t{ 1 } << index;
+            for (size_t j = 0; j < mask_length; ++j) {
+                const uint8_t byte = patterns[index][j];
+                matcher.low_[j][byte & 0x0F] |= bucket_bit;
+                matcher.high_[j][byte >> 4] |= bucket_bit;
+            }
+        }
+
+        return matcher;
+    }
+
+    uint64_t PayloadMatcher::Verify(std::span<const uint8_t> data, size_t position, uint8_t buckets, uint64_t found) const {
+        while (buckets) {
+            const int bucket = std::countr_zero(buckets);
+            buckets &= buckets - 1;
+
+            uint64_t candidates = bucket_patterns_[bucket] & ~found;
+            while (candidates) {
+                const int index = std::countr_zero(candidates);
+                candidates &= candidates - 1;
+
+                const Pattern& pattern = patterns_[index];
+                const size_t length = pattern.bytes.size();
+                if (position + length > data.size()) {
+                    continue;
+                }
+
+                const uint8_t* start = data.data() + position;
+                bool equal;
+                if (length >= sizeof(uint64_t)) {
+                    uint64_t head;
+                    std::memcpy(&head, start, sizeof(head));
+                    equal = head == pattern.head && std::memcmp(start + sizeof(head),
+                        pattern.bytes.data() + sizeof(head), length - sizeof(head)) == 0;
+                }
+                else {
+                    equal = std::memcmp(start, pattern.bytes.data(), length) == 0;
+                }
+                if (equal) {
+                    found |= uint64_t{ 1 } << index;
+                }
+            }
+        }
+        return found;
+    }
+
+    uint64_t PayloadMatcher::MatchScalar(std::span<const uint8_t> data) const {
+        uint64_t found = 0;
+        if (patterns_.empty() || data.size() < mask_length_) {
+            return found;
+        }
+
+        for (size_t position = 0; position + mask_length_ <= data.size(); ++position) {
+            uint8_t buckets = 0xFF;
+            for (size_t j = 0; j < mask_length_; ++j) {
+                const uint8_t byte = data[position + j];
+                buckets &= low_[j][byte & 0x0F] & high_[j][byte >> 4];
+            }
+            if (buckets) {
+                found = Verify(data, position, buckets, found);
+                if (found == all_patterns_) {
+                    break;
+                }
+            }
+        }
+        return found;
+    }
+
+#ifdef BADLINK_X64
+    template <size_t MaskLength>
+    BADLINK_TARGET("ssse3") uint64_t PayloadMatcher::MatchVector(std::span<const uint8_t> data) const {
+        __m128i low[MaskLength];
+        __m128i high[MaskLength];
+        for (size_t j = 0; j < MaskLength; ++j) {
+            low[j] = _mm_load_si128(reinterpret_cast<const __m128i*>(low_[j].data()));
+            high[j] = _mm_load_si128(reinterpret_cast<const __m128i*>(high_[j].data()));
+        }
+
+        uint64_t found = 0;
+        alignas(16) uint8_t buckets[16];
+        auto verify_block = [&](__m128i result, size_t position, uint32_t valid) {
+            uint32_t candidates = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(result, _mm_setzero_si128()))) & valid;
+            if (candidates == 0) {
+                return;
+            }
+            _mm_store_si128(reinterpret_cast<__m128i*>(buckets), result);
+            while (candidates) {
+                const int offset = std::countr_zero(candidates);
+                candidates &= candidates - 1;
+                found = Verify(data, position + offset, buckets[offset], found);
+            }
+        };
+
+        // Full blocks read MaskLength - 1 bytes past their 16 positions
+        size_t position = 0;
+        for (; position + 16 + MaskLength - 1 <= data.size(); position += 16) {
+            verify_block(Classify<MaskLength>(data.data() + position, low, high), position, 0xFFFF);
+            if (found == all_patterns_) {
+                return found;
+            }
+        }
+
+        // The tail goes through a zero-padded copy, Verify rejects matches running past the end
+        for (; position < data.size(); position += 16) {
+            uint8_t tail[16 + MAX_MASK_LENGTH] = {};
+            const size_t remaining = data.size() - position;
+            std::memcpy(tail, data.data() + position, std::min(remaining, sizeof(tail)));
+            const uint32_t valid = remaining >= 16 ? 0xFFFF : (1u << remaining) - 1;
+            verify_block(Classify<MaskLength>(tail, low, high), position, valid);
+        }
+        return found;
+    }
+#endif
+
+    uint64_t PayloadMatcher::Match(std::span<const uint8_t> data) const {
+        if (patterns_.empty() || data.size() < mask_length_) {
+            return 0;
+        }
+
+#ifdef BADLINK_X64
+        if (IsVectorized()) {
+            switch (mask_length_) {
+            case 1: return MatchVector<1>(data);
+            case 2: return MatchVector<2>(data);
+            default: return MatchVector<3>(data);
+            }
+        }
+#endif
+        return MatchScalar(data);
+    }
+
+    bool PayloadMatcher::IsVectorized() {
+#ifdef BADLINK_X64
+        return CpuFeatures::HasSsse3();
+#else
+        return false;
+#endif
+    }
+
+}
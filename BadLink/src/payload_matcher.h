@@ -0,0 +1,64 @@
+#ifndef BADLINK_SRC_PAYLOAD_MATCHER_H_
+#define BADLINK_SRC_PAYLOAD_MATCHER_H_
+
+#include <array>
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    // Byte pattern from user text: literal characters plus Snort-style hex runs,
+    // "GET /api/" or "|80 60|" or "Host: |0d 0a|", "\|" and "\\" escape the specials
+    [[nodiscard]] std::expected<std::vector<uint8_t>, std::string> ParsePattern(std::string_view text);
+
+    // Multi-pattern substring search in the style of Teddy: the first 1-3 bytes of every
+    // pattern are folded into nibble lookup tables, one shuffle per table classifies 16
+    // positions at once and only positions whose bucket bits survive are verified
+    // Patterns share 8 buckets, so the cost barely depends on how many there are
+    class PayloadMatcher {
+    public:
+        static constexpr size_t MAX_PATTERNS = 64;
+        static constexpr size_t MAX_MASK_LENGTH = 3;
+        static constexpr size_t BUCKETS = 8;
+
+        static std::expected<PayloadMatcher, std::string> Compile(const std::vector<std::vector<uint8_t>>& patterns);
+
+        // Bit i set if pattern i occurs anywhere in data
+        uint64_t Match(std::span<const uint8_t> data) const;
+
+        // Same result one position at a time, used without SSSE3 and as the reference
+        uint64_t MatchScalar(std::span<const uint8_t> data) const;
+
+        size_t GetPatternCount() const { return patterns_.size(); }
+        static bool IsVectorized();
+
+    private:
+        using NibbleTable = std::array<uint8_t, 16>;
+
+        // First 8 bytes as one word, so most false candidates fail a single compare
+        struct Pattern {
+            std::vector<uint8_t> bytes;
+            uint64_t head = 0;
+        };
+
+        std::vector<Pattern> patterns_;
+        std::array<uint64_t, BUCKETS> bucket_patterns_{};   // Pattern bitmap per bucket
+        size_t mask_length_ = 0;
+        uint64_t all_patterns_ = 0;
+
+        // Bucket bits allowed for byte j of a candidate, split by low and high nibble
+        alignas(16) std::array<NibbleTable, MAX_MASK_LENGTH> low_{};
+        alignas(16) std::array<NibbleTable, MAX_MASK_LENGTH> high_{};
+
+        uint64_t Verify(std::span<const uint8_t> data, size_t position, uint8_t buckets, uint64_t found) const;
+
+        template <size_t MaskLength>
+        uint64_t MatchVector(std::span<const uint8_t> data) const;
+    };
+
+}
+#endif  // BADLINK_SRC_PAYLOAD_MATCHER_H_
@@ -0,0 +1,36 @@
+#define NOMINMAX
+#include "precise_timer.h"
+#include <thread>
+
+namespace BadLink {
+
+    PreciseTimer::PreciseTimer() {
+        timer_ = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    }
+
+    PreciseTimer::~PreciseTimer() {
+        if (timer_ != nullptr) {
+            CloseHandle(timer_);
+        }
+    }
+
+    void PreciseTimer::SleepUntil(std::chrono::steady_clock::time_point deadline) {
+        const auto remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero()) {
+            return;
+        }
+
+        if (timer_ != nullptr) {
+            // Relative due time, negative and in 100 ns units
+            const auto ticks = std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(remaining);
+            LARGE_INTEGER due{};
+            due.QuadPart = -(ticks.count() > 0 ? ticks.count() : 1);
+            if (SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, FALSE)) {
+                WaitForSingleObject(timer_, INFINITE);
+                return;
+            }
+        }
+        std::this_thread::sleep_until(deadline);
+    }
+
+}
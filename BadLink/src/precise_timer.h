@@ -0,0 +1,28 @@
+#ifndef BADLINK_SRC_PRECISE_TIMER_H_
+#define BADLINK_SRC_PRECISE_TIMER_H_
+
+#include <windows.h>
+#include <chrono>
+
+namespace BadLink {
+
+    // Sleeps to a deadline on a high-resolution waitable timer, sub-millisecond where the
+    // system supports it instead of the default 15.6 ms tick that sleep_until rounds to
+    // Falls back to sleep_until on systems without high-resolution timers
+    // One timer per thread, not thread-safe
+    class PreciseTimer {
+    public:
+        PreciseTimer();
+        ~PreciseTimer();
+
+        PreciseTimer(const PreciseTimer&) = delete;
+        PreciseTimer& operator=(const PreciseTimer&) = delete;
+
+        void SleepUntil(std::chrono::steady_clock::time_point deadline);
+
+    private:
+        HANDLE timer_ = nullptr;
+    };
+
+}
+#endif  // BADLINK_SRC_PRECISE_TIMER_H_
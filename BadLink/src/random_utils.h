@@ -1,24 +1,151 @@
 #ifndef BADLINK_SRC_RANDOM_UTILS_H_
 #define BADLINK_SRC_RANDOM_UTILS_H_
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <random>
 
 namespace BadLink {
 
+    // Independent sequence per impairment decision, so one module drawing more or less
+    // never shifts what another one sees
+    enum class RandomDomain : uint32_t {
+        Loss = 1,
+        Duplicate,
+        DuplicateDelay,
+        Reorder,
+        Shuffle,
+        Jitter,
+        Corruption,
+        Outage,
+        CrossTraffic,
+        Traffic,
+        SelfTest,
+    };
+
     class RandomUtils {
     public:
-     
-        [[nodiscard]] static float GetPercentage() {
-            thread_local std::mt19937 rng{ std::random_device{}() };
-            thread_local std::uniform_real_distribution<float> dist{ 0.0f, 100.0f };
-            return dist(rng);
+        // Run-wide seed, every RandomStream is keyed by it
+        static void SetSeed(uint64_t seed) { seed_.store(seed); }
+        [[nodiscard]] static uint64_t GetSeed() { return seed_.load(); }
+
+        // Fresh non-zero seed for runs that do not ask for one
+        [[nodiscard]] static uint64_t NewSeed() {
+            std::random_device device;
+            uint64_t seed = 0;
+            while (seed == 0) {
+                seed = (static_cast<uint64_t>(device()) << 32) | device();
+            }
+            return seed;
+        }
+
+    private:
+        static inline std::atomic<uint64_t> seed_{ NewSeed() };
+    };
+
+    // SplitMix64 finalizer, a bijection that spreads every input bit over the whole word
+    [[nodiscard]] constexpr uint64_t MixBits(uint64_t value) {
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        return value ^ (value >> 31);
+    }
+
+    constexpr uint64_t GOLDEN_GAMMA = 0x9E3779B97F4A7C15ull;
+
+    // Where a packet's draws come from: its flow's 64-bit stream and a sequence hashed from the
+    // packet's own contents (see FlowTable::Classify)
+    struct RandomKey {
+        uint64_t stream = 0;        // 0 for packets without a flow and for plain numbered streams
+        uint64_t sequence = 0;      // Top bit clear for captured packets
+
+        // Key of the `index`th packet split off or copied from this one (segment, fragment or
+        // duplicate): same stream, sequence hashed from the parent's so siblings draw independently
+        // The top bit is set, so a piece cannot replay a captured packet
+        [[nodiscard]] RandomKey Child(uint64_t index) const {
+            return { stream, MixBits(sequence + (index + 1) * GOLDEN_GAMMA) | (1ull << 63) };
+        }
+    };
+
+    // Counter-based generator (Philox4x32-10): the output is a pure function of
+    // (seed, stream, domain, sequence, draw index), so there is no shared state to contend on and
+    // the same packet gets the same decisions whichever thread handles it
+    // The stream is mixed into the Philox key with the seed, the sequence fills the counter, so
+    // every packet of every flow has its own 2^32 blocks of draws per domain
+    class RandomStream {
+    public:
+        using result_type = uint32_t;
+
+        // `key` is normally SimulatedPacket::random_stream
+        RandomStream(RandomDomain domain, RandomKey key, uint64_t seed = RandomUtils::GetSeed())
+            : counter_{ static_cast<uint32_t>(key.sequence), static_cast<uint32_t>(key.sequence >> 32),
+                static_cast<uint32_t>(domain), 0 }
+            , key_{ static_cast<uint32_t>(seed ^ key.stream), static_cast<uint32_t>((seed ^ key.stream) >> 32) } {
+        }
+
+        // Numbered stream outside any flow, e.g. one per direction or shard
+        RandomStream(RandomDomain domain, uint64_t stream, uint64_t seed = RandomUtils::GetSeed())
+            : RandomStream(domain, RandomKey{ 0, stream }, seed) {
+        }
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return UINT32_MAX; }
+
+        result_type operator()() {
+            if (used_ == block_.size()) {
+                block_ = Philox(counter_, key_);
+                ++counter_[3];
+                used_ = 0;
+            }
+            return block_[used_++];
+        }
+
+        // Uniform in [0, 100), compared against the modules' percentage rates
+        [[nodiscard]] float Percentage() {
+            return static_cast<float>((*this)() >> 8) * (100.0f / 16777216.0f);
+        }
+
+        // Uniform in (0, 1] with 53 bits, safe to take the log of
+        [[nodiscard]] double Uniform() {
+            const uint64_t bits = (static_cast<uint64_t>((*this)()) << 21) ^ ((*this)() >> 11);
+            return static_cast<double>((bits & ((1ull << 53) - 1)) + 1) * (1.0 / 9007199254740992.0);
         }
 
-        [[nodiscard]] static std::mt19937& GetGenerator() {
-            thread_local std::mt19937 rng{ std::random_device{}() };
-            return rng;
+        // Uniform in [low, high] by multiply-shift, the same on every standard library
+        [[nodiscard]] uint32_t Between(uint32_t low, uint32_t high) {
+            if (low >= high) {
+                return low;
+            }
+            const uint64_t range = static_cast<uint64_t>(high - low) + 1;
+            return low + static_cast<uint32_t>((range * (*this)()) >> 32);
+        }
+
+    private:
+        using Block = std::array<uint32_t, 4>;
+
+        Block counter_;
+        std::array<uint32_t, 2> key_;
+        Block block_{};
+        size_t used_ = 4;
+
+        static Block Philox(Block counter, std::array<uint32_t, 2> key) {
+            constexpr uint64_t M0 = 0xD2511F53u;
+            constexpr uint64_t M1 = 0xCD9E8D57u;
+            for (int round = 0; round < 10; ++round) {
+                const uint64_t product0 = M0 * counter[0];
+                const uint64_t product1 = M1 * counter[2];
+                counter = {
+                    static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+                    static_cast<uint32_t>(product1),
+                    static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+                    static_cast<uint32_t>(product0),
+                };
+                key[0] += 0x9E3779B9u;
+                key[1] += 0xBB67AE85u;
+            }
+            return counter;
         }
     };
 
 }
-#endif  // BADLINK_SRC_RANDOM_UTILS_H_
\ No newline at end of file
+#endif  // BADLINK_SRC_RANDOM_UTILS_H_
@@ -0,0 +1,37 @@
+#include "release_slots.h"
+
+namespace BadLink {
+
+    void SlotAggregator::Add(std::vector<SimulatedPacket>&& packets) {
+        for (auto& packet : packets) {
+            carry_.push_back(std::move(packet));
+        }
+    }
+
+    void SlotAggregator::Cut(const ReleaseSlotConfig& config, std::vector<SimulatedPacket>& out) {
+        size_t packets = 0;
+        size_t bytes = 0;
+        while (!carry_.empty()) {
+            const size_t size = carry_.front().Size();
+            if (config.max_packets != 0 && packets >= config.max_packets) {
+                break;
+            }
+            if (config.max_bytes != 0 && packets != 0 && bytes + size > config.max_bytes) {
+                break;
+            }
+
+            out.push_back(std::move(carry_.front()));
+            carry_.pop_front();
+            ++packets;
+            bytes += size;
+        }
+    }
+
+    void SlotAggregator::Flush(std::vector<SimulatedPacket>& out) {
+        while (!carry_.empty()) {
+            out.push_back(std::move(carry_.front()));
+            carry_.pop_front();
+        }
+    }
+
+}
@@ -0,0 +1,51 @@
+#ifndef BADLINK_SRC_RELEASE_SLOTS_H_
+#define BADLINK_SRC_RELEASE_SLOTS_H_
+
+#include "simulation_module.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace BadLink {
+
+    // Slotted release, like Wi-Fi A-MPDU windows or cellular TTIs: delayed packets leave on
+    // slot boundaries, one aggregate per slot, whatever does not fit waits for the next slot
+    struct ReleaseSlotConfig {
+        uint32_t slot_us = 0;           // Slot length, 0 releases continuously
+        uint32_t max_packets = 64;      // Aggregate limits per slot, 0 = unlimited
+        uint32_t max_bytes = 65535;
+
+        bool operator==(const ReleaseSlotConfig&) const = default;
+    };
+
+    // First slot boundary at or after `time`, slots are counted from the clock's epoch so every
+    // module agrees on them
+    inline std::chrono::steady_clock::time_point AlignToSlot(std::chrono::steady_clock::time_point time,
+        std::chrono::microseconds slot) {
+        if (slot.count() <= 0) {
+            return time;
+        }
+        const auto slot_length = std::chrono::duration_cast<std::chrono::steady_clock::duration>(slot);
+        const auto remainder = time.time_since_epoch() % slot_length;
+        return remainder.count() == 0 ? time : time + (slot_length - remainder);
+    }
+
+    // Packets due in a slot, cut into aggregates in arrival order
+    // Used by the slot release thread only
+    class SlotAggregator {
+    public:
+        void Add(std::vector<SimulatedPacket>&& packets);
+
+        // Next aggregate within the limits, a packet larger than max_bytes goes out on its own
+        void Cut(const ReleaseSlotConfig& config, std::vector<SimulatedPacket>& out);
+
+        void Flush(std::vector<SimulatedPacket>& out);
+        size_t GetBacklog() const { return carry_.size(); }
+
+    private:
+        std::deque<SimulatedPacket> carry_;
+    };
+
+}
+#endif  // BADLINK_SRC_RELEASE_SLOTS_H_
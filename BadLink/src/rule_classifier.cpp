@@ -0,0 +1,387 @@
+#define NOMINMAX
+#include "rule_classifier.h"
+#include "cidr.h"
+#include "domain_snoop.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <format>
+#include <map>
+#include <optional>
+
+namespace BadLink {
+
+    namespace {
+        using Address = std::array<uint8_t, 16>;
+
+        // Transport payload of an unfragmented packet, empty if there is none
+        std::span<const uint8_t> PayloadOf(const SimulatedPacket& packet) {
+            const PacketHeaders& headers = packet.headers;
+            if (!headers.IsValid() || headers.is_fragment || packet.prefix_length > 0) {
+                return {};
+            }
+            const auto bytes = packet.Bytes();
+            return headers.payload_offset < bytes.size() ? bytes.subspan(headers.payload_offset) : std::span<const uint8_t>{};
+        }
+
+        struct AddressRange {
+            uint8_t version = 0;
+            Address first{};
+            Address last{};
+        };
+
+        struct PortRange {
+            uint32_t first = 0;
+            uint32_t last = 65535;
+        };
+
+        template <typename T>
+        std::optional<T> ParseNumber(std::string_view text) {
+            T value{};
+            const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (error != std::errc() || end != text.data() + text.size() || text.empty()) {
+                return std::nullopt;
+            }
+            return value;
+        }
+
+        std::optional<AddressRange> ParseRange(std::string_view text) {
+            const auto cidr = ParseCidr(text);
+            if (!cidr) {
+                return std::nullopt;
+            }
+            return AddressRange{ cidr->version, cidr->address, cidr->Last() };
+        }
+
+        std::optional<PortRange> ParsePorts(std::string_view text) {
+            const size_t dash = text.find('-');
+            const auto first = ParseNumber<uint32_t>(TrimSpaces(text.substr(0, dash)));
+            const auto last = dash == std::string_view::npos ? first : ParseNumber<uint32_t>(TrimSpaces(text.substr(dash + 1)));
+            if (!first || !last || *first > *last || *last > 65535) {
+                return std::nullopt;
+            }
+            return PortRange{ *first, *last };
+        }
+
+        std::optional<int> ParseProtocol(std::string_view text) {
+            if (text.empty() || text == "any") {
+                return -1;
+            }
+            if (text == "tcp") {
+                return IpProtocol::TCP;
+            }
+            if (text == "udp") {
+                return IpProtocol::UDP;
+            }
+            if (text == "icmp") {
+                return IpProtocol::ICMP;
+            }
+            if (text == "icmpv6") {
+                return IpProtocol::ICMPV6;
+            }
+            const auto value = ParseNumber<uint32_t>(text);
+            if (!value || *value > 255) {
+                return std::nullopt;
+            }
+            return static_cast<int>(*value);
+        }
+
+        // Next address within the first `width` bytes, false on wrap-around
+        bool Increment(Address& address, size_t width) {
+            for (size_t i = width; i-- > 0;) {
+                if (++address[i] != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    std::expected<RuleClassifier, std::string> RuleClassifier::Compile(
+        const std::vector<ClassifierRule>& rules, uint32_t unmatched_modules) {
+
+        if (rules.size() > MAX_RULES) {
+            return std::unexpected(std::format("Too many rules ({}), the limit is {}", rules.size(), MAX_RULES));
+        }
+
+        RuleClassifier classifier;
+        classifier.unmatched_modules_ = unmatched_modules;
+
+        // Parsed fields, nullopt means "any"
+        std::vector<std::optional<AddressRange>> src(rules.size()), dst(rules.size());
+        std::vector<PortRange> src_ports(rules.size()), dst_ports(rules.size());
+        std::vector<std::vector<uint8_t>> content_patterns;
+        std::vector<DomainTrie::Entry> domain_entries;
+
+        for (size_t i = 0; i < rules.size(); ++i) {
+            const ClassifierRule& rule = rules[i];
+            const std::string label = rule.name.empty() ? std::format("#{}", i + 1) : rule.name;
+            const uint64_t bit = uint64_t{ 1 } << i;
+
+            if (!TrimSpaces(rule.src).empty() && !(src[i] = ParseRange(rule.src))) {
+                return std::unexpected(std::format("Rule '{}': invalid source '{}'", label, rule.src));
+            }
+            if (!TrimSpaces(rule.dst).empty() && !(dst[i] = ParseRange(rule.dst))) {
+                return std::unexpected(std::format("Rule '{}': invalid destination '{}'", label, rule.dst));
+            }
+            if (src[i] && dst[i] && src[i]->version != dst[i]->version) {
+                return std::unexpected(std::format("Rule '{}': source and destination mix IPv4 and IPv6", label));
+            }
+
+            if (!TrimSpaces(rule.src_ports).empty()) {
+                const auto ports = ParsePorts(rule.src_ports);
+                if (!ports) {
+                    return std::unexpected(std::format("Rule '{}': invalid source ports '{}'", label, rule.src_ports));
+                }
+                src_ports[i] = *ports;
+            }
+            if (!TrimSpaces(rule.dst_ports).empty()) {
+                const auto ports = ParsePorts(rule.dst_ports);
+                if (!ports) {
+                    return std::unexpected(std::format("Rule '{}': invalid destination ports '{}'", label, rule.dst_ports));
+                }
+                dst_ports[i] = *ports;
+            }
+
+            const auto protocol = ParseProtocol(TrimSpaces(rule.protocol));
+            if (!protocol) {
+                return std::unexpected(std::format("Rule '{}': invalid protocol '{}'", label, rule.protocol));
+            }
+            for (int p = 0; p < 256; ++p) {
+                if (*protocol < 0 || *protocol == p) {
+                    classifier.protocol_[p] |= bit;
+                }
+            }
+
+            if (rule.direction != RuleDirection::Outbound) {
+                classifier.direction_[0] |= bit;
+            }
+            if (rule.direction != RuleDirection::Inbound) {
+                classifier.direction_[1] |= bit;
+            }
+
+            if (!TrimSpaces(rule.filter).empty()) {
+                auto program = FilterProgram::Compile(rule.filter);
+                if (!program) {
+                    return std::unexpected(std::format("Rule '{}': filter: {}", label, program.error()));
+                }
+                classifier.filters_.push_back(std::move(*program));
+                classifier.filter_rules_ |= bit;
+            }
+            else {
+                classifier.filters_.emplace_back();
+            }
+
+            if (!rule.content.empty()) {
+                auto pattern = ParsePattern(rule.content);
+                if (!pattern) {
+                    return std::unexpected(std::format("Rule '{}': content: {}", label, pattern.error()));
+                }
+                content_patterns.push_back(std::move(*pattern));
+                classifier.content_rule_index_.push_back(static_cast<uint8_t>(i));
+                classifier.content_rules_ |= bit;
+            }
+
+            std::string_view domains = rule.domains;
+            while (!domains.empty()) {
+                const size_t comma = domains.find(',');
+                const std::string_view domain = TrimSpaces(domains.substr(0, comma));
+                domains.remove_prefix(comma == std::string_view::npos ? domains.size() : comma + 1);
+                if (!domain.empty()) {
+                    domain_entries.push_back({ std::string(domain), bit });
+                    classifier.domain_rules_ |= bit;
+                }
+            }
+
+            classifier.rule_modules_.push_back(rule.modules);
+        }
+
+        auto domains = DomainTrie::Build(domain_entries);
+        if (!domains) {
+            return std::unexpected(domains.error());
+        }
+        classifier.domains_ = std::move(*domains);
+
+        // All content patterns share one matcher, a payload is scanned once for every rule
+        auto matcher = PayloadMatcher::Compile(content_patterns);
+        if (!matcher) {
+            return std::unexpected(matcher.error());
+        }
+        classifier.content_matcher_ = std::move(*matcher);
+
+        // Cut the address space of one field and version at every range boundary
+        auto build_addresses = [&](const std::vector<std::optional<AddressRange>>& ranges, uint8_t version) {
+            const size_t width = version == 4 ? 4 : 16;
+            AddressTable table;
+            std::vector<Address> starts{ Address{} };
+            for (const auto& range : ranges) {
+                if (range && range->version == version) {
+                    starts.push_back(range->first);
+                    Address next = range->last;
+                    if (Increment(next, width)) {
+                        starts.push_back(next);
+                    }
+                }
+            }
+            std::sort(starts.begin(), starts.end());
+            starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+            for (const Address& start : starts) {
+                uint64_t bitmap = 0;
+                for (size_t i = 0; i < ranges.size(); ++i) {
+                    const auto& range = ranges[i];
+                    if (!range || (range->version == version && range->first <= start && start <= range->last)) {
+                        bitmap |= uint64_t{ 1 } << i;
+                    }
+                }
+                table.starts.push_back(start);
+                table.bitmaps.push_back(bitmap);
+            }
+            return table;
+        };
+
+        auto build_ports = [&](const std::vector<PortRange>& ranges) {
+            std::vector<uint32_t> starts{ 0 };
+            for (const auto& range : ranges) {
+                starts.push_back(range.first);
+                if (range.last < 65535) {
+                    starts.push_back(range.last + 1);
+                }
+            }
+            std::sort(starts.begin(), starts.end());
+            starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+            // Intervals with the same rule set share one class
+            PortTable table;
+            table.classes.resize(65536);
+            std::map<uint64_t, uint8_t> class_of;
+            for (size_t s = 0; s < starts.size(); ++s) {
+                uint64_t bitmap = 0;
+                for (size_t i = 0; i < ranges.size(); ++i) {
+                    if (ranges[i].first <= starts[s] && starts[s] <= ranges[i].last) {
+                        bitmap |= uint64_t{ 1 } << i;
+                    }
+                }
+
+                auto [it, inserted] = class_of.try_emplace(bitmap, static_cast<uint8_t>(table.bitmaps.size()));
+                if (inserted) {
+                    table.bitmaps.push_back(bitmap);
+                }
+                const uint32_t end = s + 1 < starts.size() ? starts[s + 1] : 65536;
+                std::fill(table.classes.begin() + starts[s], table.classes.begin() + end, it->second);
+            }
+            return table;
+        };
+
+        classifier.src_v4_ = build_addresses(src, 4);
+        classifier.dst_v4_ = build_addresses(dst, 4);
+        classifier.src_v6_ = build_addresses(src, 6);
+        classifier.dst_v6_ = build_addresses(dst, 6);
+        classifier.src_ports_ = build_ports(src_ports);
+        classifier.dst_ports_ = build_ports(dst_ports);
+        return classifier;
+    }
+
+    uint32_t RuleClassifier::Classify(const FlowKey& key) const {
+        return Resolve(Candidates(key));
+    }
+
+    uint64_t RuleClassifier::Candidates(const FlowKey& key) const {
+        if (rule_modules_.empty()) {
+            return 0;
+        }
+
+        const bool v6 = key.ip_version == 6;
+        return protocol_[key.protocol] &
+            direction_[key.outbound ? 1 : 0] &
+            src_ports_.Lookup(key.src_port) &
+            dst_ports_.Lookup(key.dst_port) &
+            (v6 ? src_v6_ : src_v4_).Lookup(key.src_addr) &
+            (v6 ? dst_v6_ : dst_v4_).Lookup(key.dst_addr);
+    }
+
+    void RuleClassifier::ApplyFilters(std::span<const SimulatedPacket> packets, std::span<uint64_t> candidates) const {
+        uint64_t pending = 0;
+        for (const uint64_t bits : candidates) {
+            pending |= bits & filter_rules_;
+        }
+
+        // One batch evaluation per filter some packet still depends on
+        std::vector<uint8_t> results;
+        while (pending) {
+            const int rule = std::countr_zero(pending);
+            pending &= pending - 1;
+
+            filters_[rule].Evaluate(packets, results);
+            const uint64_t bit = uint64_t{ 1 } << rule;
+            for (size_t i = 0; i < packets.size(); ++i) {
+                if (!results[i]) {
+                    candidates[i] &= ~bit;
+                }
+            }
+        }
+    }
+
+    std::optional<uint64_t> RuleClassifier::MatchContent(const SimulatedPacket& packet) const {
+        const auto payload = PayloadOf(packet);
+        if (payload.empty()) {
+            return std::nullopt;
+        }
+
+        uint64_t patterns = content_matcher_.Match(payload.first(std::min(payload.size(), CONTENT_SCAN_BYTES)));
+        uint64_t matched = 0;
+        while (patterns) {
+            matched |= uint64_t{ 1 } << content_rule_index_[std::countr_zero(patterns)];
+            patterns &= patterns - 1;
+        }
+        return matched;
+    }
+
+    std::optional<uint64_t> RuleClassifier::MatchServerName(const SimulatedPacket& packet) const {
+        const auto payload = PayloadOf(packet);
+        if (!packet.headers.IsTcp() || payload.empty()) {
+            return std::nullopt;
+        }
+
+        const auto name = ParseTlsSni(payload);
+        return name ? domains_.Match(*name) : 0;
+    }
+
+    uint32_t RuleClassifier::Resolve(uint64_t candidates) const {
+        return candidates ? rule_modules_[std::countr_zero(candidates)] : unmatched_modules_;
+    }
+
+    uint64_t RuleClassifier::AddressTable::Lookup(const Address& address) const {
+        // starts[0] is the all-zero address, so there is always an interval
+        const auto it = std::upper_bound(starts.begin(), starts.end(), address);
+        return bitmaps[static_cast<size_t>(it - starts.begin()) - 1];
+    }
+
+    std::string ModuleMaskToString(uint32_t modules) {
+        if ((modules & ModuleMask::ALL) == ModuleMask::ALL) {
+            return "all";
+        }
+
+        std::string text;
+        for (const auto& module : MODULE_NAMES) {
+            if (modules & module.bit) {
+                text += text.empty() ? "" : ", ";
+                text += module.name;
+            }
+        }
+        return text.empty() ? "none" : text;
+    }
+
+    uint32_t ModuleMaskFromName(std::string_view name) {
+        if (name == "all") {
+            return ModuleMask::ALL;
+        }
+        for (const auto& module : MODULE_NAMES) {
+            if (name == module.name) {
+                return module.bit;
+            }
+        }
+        return 0;
+    }
+
+}
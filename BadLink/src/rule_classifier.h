@@ -0,0 +1,139 @@
+#ifndef BADLINK_SRC_RULE_CLASSIFIER_H_
+#define BADLINK_SRC_RULE_CLASSIFIER_H_
+
+#include "domain_trie.h"
+#include "flow_table.h"
+#include "packet_filter.h"
+#include "payload_matcher.h"
+#include "simulation_module.h"
+#include <array>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    enum class RuleDirection : uint8_t {
+        Any,
+        Inbound,
+        Outbound,
+    };
+
+    // Traffic rule as written by the user (TOML or UI), compiled by RuleClassifier
+    struct ClassifierRule {
+        std::string name;
+        std::string src;            // CIDR such as "10.0.0.0/8" or "2001:db8::/32", empty matches any
+        std::string dst;
+        std::string src_ports;      // "443" or "1000-2000", empty matches any
+        std::string dst_ports;
+        std::string protocol;       // "tcp", "udp", "icmp", "icmpv6", a number, empty matches any
+        std::string filter;         // Per-packet WinDivert-syntax expression such as "tcp.Syn", empty matches any
+        std::string content;        // Payload pattern such as "GET /api/" or "|de ad be ef|", empty matches any
+        std::string domains;        // "api.example.com, *.cdn.example.net" via DNS answers and TLS SNI, empty matches any
+        std::string traffic_class;  // Bandwidth traffic class for matching traffic, empty classifies by DSCP
+        std::string link;           // Named link for matching traffic, empty keeps it on the main link
+        RuleDirection direction = RuleDirection::Any;
+        uint32_t modules = ModuleMask::ALL;     // Impairments applied to matching traffic
+    };
+
+    // Module names used in config files and the UI
+    struct ModuleName {
+        const char* name;
+        uint32_t bit;
+    };
+
+    inline constexpr std::array<ModuleName, 9> MODULE_NAMES = { {
+        { "loss", ModuleMask::PACKET_LOSS },
+        { "rewrite", ModuleMask::HEADER_REWRITE },
+        { "duplicate", ModuleMask::DUPLICATE },
+        { "corruption", ModuleMask::CORRUPTION },
+        { "mtu", ModuleMask::MTU },
+        { "reorder", ModuleMask::OUT_OF_ORDER },
+        { "jitter", ModuleMask::JITTER },
+        { "bandwidth", ModuleMask::BANDWIDTH },
+        { "latency", ModuleMask::LATENCY },
+    } };
+
+    // Rules compiled into per-field lookup tables: each field maps the packet's value to
+    // the bitmap of rules it satisfies, the first bit of the intersection is the winner
+    // Cost per lookup is a handful of table reads no matter how many rules there are
+    class RuleClassifier {
+    public:
+        static constexpr size_t MAX_RULES = 64;
+
+        // Content rules look at the first CONTENT_SCAN_BYTES of a payload, and a flow keeps
+        // its result once its first CONTENT_SCAN_PACKETS payload packets were scanned
+        static constexpr size_t CONTENT_SCAN_BYTES = 256;
+        static constexpr size_t CONTENT_SCAN_PACKETS = 4;
+
+        // Parse and compile, first matching rule wins, unmatched traffic gets `unmatched_modules`
+        static std::expected<RuleClassifier, std::string> Compile(
+            const std::vector<ClassifierRule>& rules, uint32_t unmatched_modules = ModuleMask::ALL);
+
+        // Modules that apply to a flow, rule filters are not consulted
+        uint32_t Classify(const FlowKey& key) const;
+
+        // Two-step form for rules with packet filters: the flow's candidate rules are cached
+        // per flow, filters then drop candidates packet by packet, Resolve picks the winner
+        uint64_t Candidates(const FlowKey& key) const;
+        void ApplyFilters(std::span<const SimulatedPacket> packets, std::span<uint64_t> candidates) const;
+        uint32_t Resolve(uint64_t candidates) const;
+        bool HasFilters() const { return filter_rules_ != 0; }
+
+        // Content rules whose pattern occurs in the packet's payload, nullopt without a payload
+        std::optional<uint64_t> MatchContent(const SimulatedPacket& packet) const;
+        uint64_t GetContentRules() const { return content_rules_; }
+
+        // Domain rules matching a normalized host name
+        uint64_t MatchDomain(std::string_view name) const { return domains_.Match(name); }
+        // Domain rules matching the SNI of a TLS ClientHello, nullopt without a TCP payload
+        std::optional<uint64_t> MatchServerName(const SimulatedPacket& packet) const;
+        uint64_t GetDomainRules() const { return domain_rules_; }
+
+        size_t GetRuleCount() const { return rule_modules_.size(); }
+
+    private:
+        using Address = std::array<uint8_t, 16>;
+
+        // Address space split into intervals at every CIDR boundary, binary search over
+        // at most 2 * MAX_RULES + 1 starts
+        struct AddressTable {
+            std::vector<Address> starts;
+            std::vector<uint64_t> bitmaps;
+
+            uint64_t Lookup(const Address& address) const;
+        };
+
+        // Direct 64K-entry table of equivalence classes, at most 2 * MAX_RULES + 1 distinct bitmaps
+        struct PortTable {
+            std::vector<uint8_t> classes;
+            std::vector<uint64_t> bitmaps;
+
+            uint64_t Lookup(uint16_t port) const { return bitmaps[classes[port]]; }
+        };
+
+        std::vector<uint32_t> rule_modules_;
+        std::vector<FilterProgram> filters_;    // Indexed by rule, empty programs for rules without one
+        uint64_t filter_rules_ = 0;
+        PayloadMatcher content_matcher_;
+        std::vector<uint8_t> content_rule_index_;   // Rule of each matcher pattern
+        uint64_t content_rules_ = 0;
+        DomainTrie domains_;
+        uint64_t domain_rules_ = 0;
+        uint32_t unmatched_modules_ = ModuleMask::ALL;
+
+        std::array<uint64_t, 256> protocol_{};
+        std::array<uint64_t, 2> direction_{};   // Indexed by the outbound flag
+        AddressTable src_v4_, dst_v4_, src_v6_, dst_v6_;
+        PortTable src_ports_, dst_ports_;
+    };
+
+    // Helpers shared by config loading and the UI
+    std::string ModuleMaskToString(uint32_t modules);
+    uint32_t ModuleMaskFromName(std::string_view name);
+
+}
+#endif  // BADLINK_SRC_RULE_CLASSIFIER_H_
@@ -0,0 +1,701 @@
+#define NOMINMAX
+#include "scenario.h"
+#include "checksum.h"
+#include "mtu_module.h"
+#include "packet_filter.h"
+#include "payload_matcher.h"
+#include "random_utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <format>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+namespace BadLink {
+
+    namespace {
+        constexpr uint32_t MIN_PACKET_BYTES = 28;      // IPv4 + UDP headers
+
+        // Emission schedule of one flow
+        struct Emitter {
+            SimulationClock::time_point next;
+            SimulationClock::time_point end;
+            SimulationClock::duration interval;
+            uint32_t sequence = 0;
+        };
+
+        SimulatedPacket MakePacket(const ScenarioFlow& flow, uint32_t index, uint32_t sequence,
+            SimulationClock::time_point now) {
+            const uint32_t size = std::max(flow.packet_bytes, MIN_PACKET_BYTES);
+            auto data = std::make_shared<std::vector<uint8_t>>(size, 0);
+            uint8_t* bytes = data->data();
+
+            // 10.0.0.1:(10000 + flow) -> 10.0.0.2:5001, reversed for inbound flows
+            const bool outbound = flow.direction == Direction::Outbound;
+            const uint32_t local = 0x0A000001u;
+            const uint32_t remote = 0x0A000002u;
+            const uint16_t local_port = static_cast<uint16_t>(10000 + index);
+            bytes[0] = 0x45;
+            StoreBe16(bytes + 2, static_cast<uint16_t>(size));
+            StoreBe16(bytes + 4, static_cast<uint16_t>(sequence));
+            bytes[8] = 64;
+            bytes[9] = IpProtocol::UDP;
+            StoreBe32(bytes + 12, outbound ? local : remote);
+            StoreBe32(bytes + 16, outbound ? remote : local);
+            StoreBe16(bytes + 20, outbound ? local_port : 5001);
+            StoreBe16(bytes + 22, outbound ? 5001 : local_port);
+            StoreBe16(bytes + 24, static_cast<uint16_t>(size - 20));
+            StoreBe32(bytes + MIN_PACKET_BYTES, sequence);
+
+            SimulatedPacket packet;
+            packet.data = std::move(data);
+            packet.headers = ParseHeaders(*packet.data);
+            Checksum::UpdateIPv4Header(*packet.data, packet.headers);
+            Checksum::UpdateTransport(*packet.data, packet.headers);
+            packet.addr.Outbound = outbound ? 1 : 0;
+            packet.addr.IPChecksum = 1;
+            packet.addr.UDPChecksum = 1;
+            packet.addr.Network.IfIdx = index;
+            packet.addr.Network.SubIfIdx = sequence;
+            packet.timestamp = now;
+            packet.release_time = now;
+            return packet;
+        }
+
+        void Collect(std::vector<SimulatedPacket>&& packets, SimulationClock::time_point now,
+            std::vector<ScenarioPacket>& delivered) {
+            for (const auto& packet : packets) {
+                ScenarioPacket out;
+                out.flow = packet.addr.Network.IfIdx;
+                out.sequence = packet.addr.Network.SubIfIdx;
+                out.bytes = static_cast<uint32_t>(packet.Size());
+                out.direction = packet.addr.Outbound ? Direction::Outbound : Direction::Inbound;
+                out.sent = packet.timestamp;
+                out.delivered = now;
+                delivered.push_back(out);
+            }
+        }
+
+        // What the chain decided for one packet: which packet, how long it was held, what it carried
+        struct Decision {
+            uint32_t flow = 0;
+            uint32_t sequence = 0;
+            int64_t delay_us = 0;
+            size_t bytes_hash = 0;
+
+            auto operator<=>(const Decision&) const = default;
+        };
+
+        // Feeds `packets` through one flow table and chain from `workers` threads, each taking the
+        // next batch of 16 as it goes the way capture threads do, then drains the delaying stages
+        // Sorted, so runs compare by what happened to each packet rather than by thread timing
+        std::vector<Decision> RunWorkers(const LinkConfig& link, const std::vector<SimulatedPacket>& packets,
+            uint32_t workers) {
+            constexpr size_t BATCH = 16;
+            VirtualClock clock;
+            LinkChain chain;
+            MtuModule mtu;
+            chain.SetClock(clock);
+            mtu.SetClock(clock);
+            chain.Configure(link);
+            FlowTable flow_table(1024);
+
+            std::mutex output_mutex;
+            std::vector<SimulatedPacket> output;
+            std::atomic<size_t> next{ 0 };
+            {
+                std::vector<std::jthread> threads;
+                for (uint32_t i = 0; i < workers; ++i) {
+                    threads.emplace_back([&] {
+                        for (size_t first = next.fetch_add(BATCH); first < packets.size(); first = next.fetch_add(BATCH)) {
+                            std::vector<SimulatedPacket> batch(packets.begin() + first,
+                                packets.begin() + std::min(first + BATCH, packets.size()));
+                            flow_table.Classify(batch, clock.Now());
+                            auto processed = chain.Process(std::move(batch), mtu);
+                            std::lock_guard<std::mutex> lock(output_mutex);
+                            output.insert(output.end(), std::make_move_iterator(processed.begin()),
+                                std::make_move_iterator(processed.end()));
+                        }
+                    });
+                }
+            }
+
+            // Delayed duplicates pass the jitter stage when they come out, so drain in rounds
+            for (int round = 0; round < 3; ++round) {
+                clock.Advance(std::chrono::seconds(1));
+                chain.ReleaseDuplicates(output, mtu);
+                chain.ReleaseJitter(output);
+                chain.ReleaseLatency(output);
+                chain.ReleaseBandwidth(output);
+                chain.ReleaseReorder(output);
+            }
+
+            std::vector<Decision> decisions;
+            for (const auto& packet : output) {
+                const auto bytes = packet.Bytes();
+                decisions.push_back({ packet.addr.Network.IfIdx, packet.addr.Network.SubIfIdx,
+                    std::chrono::duration_cast<std::chrono::microseconds>(packet.release_time - packet.timestamp).count(),
+                    std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size())) });
+            }
+            std::ranges::sort(decisions);
+            return decisions;
+        }
+
+        std::vector<const ScenarioPacket*> FlowPackets(const ScenarioResult& result, uint32_t flow) {
+            std::vector<const ScenarioPacket*> packets;
+            for (const auto& packet : result.delivered) {
+                if (packet.flow == flow) {
+                    packets.push_back(&packet);
+                }
+            }
+            return packets;
+        }
+    }
+
+    ScenarioResult RunScenario(const Scenario& scenario) {
+        const auto wall_start = std::chrono::steady_clock::now();
+
+        // The modules draw from the run-wide seed, put back once the scenario is done
+        const uint64_t previous_seed = RandomUtils::GetSeed();
+        RandomUtils::SetSeed(scenario.seed);
+
+        VirtualClock clock;
+        LinkChain chain;
+        MtuModule mtu;
+        chain.SetClock(clock);
+        mtu.SetClock(clock);
+        chain.Configure(scenario.link);
+        if (scenario.mtu != 0) {
+            mtu.SetMtu(scenario.mtu);
+            mtu.SetEnabled(true);
+        }
+        FlowTable flow_table(1024);
+
+        ScenarioResult result;
+        result.sent.assign(scenario.flows.size(), 0);
+
+        const auto start = clock.Now();
+        auto traffic_end = start;
+        std::vector<Emitter> emitters;
+        for (const auto& flow : scenario.flows) {
+            Emitter emitter;
+            emitter.next = start + flow.start;
+            emitter.end = emitter.next + flow.duration;
+            const uint64_t bits = static_cast<uint64_t>(std::max(flow.packet_bytes, MIN_PACKET_BYTES)) * 8;
+            emitter.interval = std::chrono::nanoseconds(bits * 1000000 / std::max(flow.rate_kbps, 1u));
+            traffic_end = std::max(traffic_end, emitter.end);
+            emitters.push_back(emitter);
+        }
+
+        const auto tick = std::max<SimulationClock::duration>(scenario.tick, std::chrono::microseconds(1));
+        const auto end = traffic_end + scenario.drain;
+        std::vector<SimulatedPacket> released;
+        for (auto now = start; now <= end; clock.Advance(tick), now = clock.Now()) {
+            std::vector<SimulatedPacket> batch;
+            for (uint32_t i = 0; i < emitters.size(); ++i) {
+                auto& emitter = emitters[i];
+                for (; emitter.next <= now && emitter.next < emitter.end; emitter.next += emitter.interval) {
+                    batch.push_back(MakePacket(scenario.flows[i], i, emitter.sequence++, now));
+                }
+                result.sent[i] = emitter.sequence;
+            }
+            if (!batch.empty()) {
+                flow_table.Classify(batch, now);
+                Collect(chain.Process(std::move(batch), mtu), now, result.delivered);
+            }
+
+            released.clear();
+            chain.ReleaseLatency(released);
+            chain.ReleaseJitter(released);
+            chain.ReleaseBandwidth(released);
+            chain.ReleaseDuplicates(released, mtu);
+            chain.ReleaseReorder(released);
+            Collect(std::move(released), now, result.delivered);
+        }
+
+        RandomUtils::SetSeed(previous_seed);
+        result.simulated = clock.Now() - start;
+        result.wall = std::chrono::steady_clock::now() - wall_start;
+        return result;
+    }
+
+    namespace ScenarioStats {
+
+        double LossRate(const ScenarioResult& result, uint32_t flow) {
+            // z = 0 collapses the interval onto the measured rate
+            return LossInterval(result, flow, 0.0).low;
+        }
+
+        Interval LossInterval(const ScenarioResult& result, uint32_t flow, double z) {
+            const uint64_t sent = flow < result.sent.size() ? result.sent[flow] : 0;
+            if (sent == 0) {
+                return {};
+            }
+
+            // Duplicates and fragments repeat their sequence, a sequence counts once
+            std::vector<bool> seen(sent, false);
+            uint64_t distinct = 0;
+            for (const auto* packet : FlowPackets(result, flow)) {
+                if (packet->sequence < sent && !seen[packet->sequence]) {
+                    seen[packet->sequence] = true;
+                    ++distinct;
+                }
+            }
+
+            const double n = static_cast<double>(sent);
+            const double p = static_cast<double>(sent - distinct) / n;
+            const double z2 = z * z;
+            const double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+            const double half = z * std::sqrt(p * (1 - p) / n + z2 / (4 * n * n)) / (1 + z2 / n);
+            return { std::max(0.0, center - half) * 100.0, std::min(1.0, center + half) * 100.0 };
+        }
+
+        double DelayPercentile(const ScenarioResult& result, uint32_t flow, double percentile) {
+            std::vector<double> delays;
+            for (const auto* packet : FlowPackets(result, flow)) {
+                delays.push_back(packet->DelayMs());
+            }
+            if (delays.empty()) {
+                return 0;
+            }
+
+            // Nearest rank
+            std::ranges::sort(delays);
+            const double rank = std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * delays.size());
+            const size_t index = rank < 1 ? 0 : static_cast<size_t>(rank) - 1;
+            return delays[std::min(index, delays.size() - 1)];
+        }
+
+        double ThroughputKbps(const ScenarioResult& result, uint32_t flow) {
+            const auto packets = FlowPackets(result, flow);
+            if (packets.size() < 2) {
+                return 0;
+            }
+
+            // The first delivery opens the window, its bytes do not count
+            const double seconds = std::chrono::duration<double>(packets.back()->delivered - packets.front()->delivered).count();
+            if (seconds <= 0) {
+                return 0;
+            }
+            uint64_t bytes = 0;
+            for (size_t i = 1; i < packets.size(); ++i) {
+                bytes += packets[i]->bytes;
+            }
+            return bytes * 8.0 / seconds / 1000.0;
+        }
+
+        Reordering ReorderDistance(const ScenarioResult& result, uint32_t flow) {
+            Reordering reordering;
+            uint64_t total_distance = 0;
+            bool any = false;
+            uint32_t highest = 0;
+            for (const auto* packet : FlowPackets(result, flow)) {
+                if (any && packet->sequence < highest) {
+                    const uint32_t distance = highest - packet->sequence;
+                    ++reordering.reordered;
+                    reordering.max_distance = std::max(reordering.max_distance, distance);
+                    total_distance += distance;
+                }
+                else {
+                    highest = packet->sequence;
+                    any = true;
+                }
+            }
+            if (reordering.reordered != 0) {
+                reordering.mean_distance = static_cast<double>(total_distance) / reordering.reordered;
+            }
+            return reordering;
+        }
+
+    }
+
+    std::vector<SimulatedPacket> MakeMixedPackets(size_t count, uint64_t seed) {
+        RandomStream rng(RandomDomain::SelfTest, 0, seed);
+        const auto address = [&](uint8_t* out) {
+            // Private, loopback and arbitrary addresses so range tests land on both sides
+            switch (rng.Between(0, 3)) {
+            case 0: StoreBe32(out, 0xC0A80000u | rng.Between(0, 0xFFFF)); break;
+            case 1: StoreBe32(out, 0x0A000000u | rng.Between(0, 0xFFFFFF)); break;
+            case 2: StoreBe32(out, 0x7F000001u); break;
+            default: StoreBe32(out, rng()); break;
+            }
+        };
+        const auto port = [&]() -> uint16_t {
+            constexpr uint16_t COMMON[] = { 53, 80, 443, 8080 };
+            return rng.Between(0, 1) ? COMMON[rng.Between(0, 3)] : static_cast<uint16_t>(rng());
+        };
+
+        std::vector<SimulatedPacket> packets;
+        packets.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            const bool ipv6 = rng.Between(0, 2) == 0;
+            constexpr uint8_t PROTOCOLS[] = { IpProtocol::TCP, IpProtocol::UDP, IpProtocol::ICMP };
+            uint8_t protocol = PROTOCOLS[rng.Between(0, 2)];
+            if (ipv6 && protocol == IpProtocol::ICMP) {
+                protocol = IpProtocol::ICMPV6;
+            }
+            const size_t ip_length = ipv6 ? 40 : 20;
+            const size_t l4_length = protocol == IpProtocol::TCP ? 20 : 8;
+            const size_t size = ip_length + l4_length + rng.Between(0, 256);
+
+            auto data = std::make_shared<std::vector<uint8_t>>(size, 0);
+            uint8_t* bytes = data->data();
+            for (size_t j = ip_length + l4_length; j < size; ++j) {
+                bytes[j] = static_cast<uint8_t>(rng());
+            }
+            if (ipv6) {
+                StoreBe32(bytes, 0x60000000u | (rng() & 0x0FFFFFFFu));
+                StoreBe16(bytes + 4, static_cast<uint16_t>(size - 40));
+                bytes[6] = protocol;
+                bytes[7] = static_cast<uint8_t>(rng());
+                for (size_t j = 8; j < 40; j += 4) {
+                    StoreBe32(bytes + j, rng());
+                }
+                if (rng.Between(0, 3) == 0) {
+                    StoreBe32(bytes + 8, 0);    // ::1
+                    StoreBe32(bytes + 12, 0);
+                    StoreBe32(bytes + 16, 0);
+                    StoreBe32(bytes + 20, 1);
+                }
+            }
+            else {
+                bytes[0] = 0x45;
+                bytes[1] = static_cast<uint8_t>(rng());
+                StoreBe16(bytes + 2, static_cast<uint16_t>(size));
+                StoreBe16(bytes + 4, static_cast<uint16_t>(rng()));
+                // One in eight a fragment, MF or an offset
+                StoreBe16(bytes + 6, rng.Between(0, 7) == 0 ? static_cast<uint16_t>(rng() & 0x3FFF) : 0x4000);
+                bytes[8] = static_cast<uint8_t>(rng());
+                bytes[9] = protocol;
+                address(bytes + 12);
+                address(bytes + 16);
+            }
+
+            uint8_t* l4 = bytes + ip_length;
+            if (protocol == IpProtocol::TCP || protocol == IpProtocol::UDP) {
+                StoreBe16(l4, port());
+                StoreBe16(l4 + 2, port());
+            }
+            if (protocol == IpProtocol::TCP) {
+                StoreBe32(l4 + 4, rng());
+                StoreBe32(l4 + 8, rng());
+                l4[12] = 0x50;
+                l4[13] = static_cast<uint8_t>(rng() & 0x3F);
+                StoreBe16(l4 + 14, static_cast<uint16_t>(rng()));
+            }
+            else if (protocol == IpProtocol::UDP) {
+                StoreBe16(l4 + 4, static_cast<uint16_t>(size - ip_length));
+            }
+            else {
+                StoreBe32(l4, rng());
+                StoreBe32(l4 + 4, rng());
+            }
+
+            SimulatedPacket packet;
+            packet.data = std::move(data);
+            packet.headers = ParseHeaders(*packet.data);
+            Checksum::UpdateIPv4Header(*packet.data, packet.headers);
+            Checksum::UpdateTransport(*packet.data, packet.headers);
+            packet.addr.Outbound = rng.Between(0, 1);
+            packet.addr.Loopback = rng.Between(0, 7) == 0 ? 1 : 0;
+            packet.addr.Impostor = rng.Between(0, 15) == 0 ? 1 : 0;
+            packet.addr.IPv6 = ipv6 ? 1 : 0;
+            packet.addr.Network.IfIdx = rng.Between(1, 4);
+            packet.addr.Network.SubIfIdx = rng.Between(0, 1);
+            packets.push_back(std::move(packet));
+        }
+        return packets;
+    }
+
+    std::vector<std::vector<uint8_t>> MakePayloads(size_t count, size_t max_bytes,
+        const std::vector<std::vector<uint8_t>>& patterns, uint64_t seed) {
+        RandomStream rng(RandomDomain::SelfTest, 1, seed);
+        std::vector<uint8_t> alphabet;
+        for (const auto& pattern : patterns) {
+            alphabet.insert(alphabet.end(), pattern.begin(), pattern.end());
+        }
+
+        std::vector<std::vector<uint8_t>> payloads(count);
+        for (auto& payload : payloads) {
+            payload.resize(rng.Between(0, static_cast<uint32_t>(max_bytes)));
+            const bool near = !alphabet.empty() && rng.Between(0, 1) == 0;
+            for (auto& byte : payload) {
+                byte = near ? alphabet[rng.Between(0, static_cast<uint32_t>(alphabet.size() - 1))] : static_cast<uint8_t>(rng());
+            }
+            if (!patterns.empty() && rng.Between(0, 3) == 0) {
+                const auto& pattern = patterns[rng.Between(0, static_cast<uint32_t>(patterns.size() - 1))];
+                if (pattern.size() <= payload.size()) {
+                    const size_t at = rng.Between(0, static_cast<uint32_t>(payload.size() - pattern.size()));
+                    std::ranges::copy(pattern, payload.begin() + at);
+                }
+            }
+        }
+        return payloads;
+    }
+
+    std::vector<ScenarioCheck> RunBuiltInScenarios() {
+        std::vector<ScenarioCheck> checks;
+        const auto check = [&](const Scenario& scenario, std::string name, bool passed, std::string detail) {
+            checks.push_back({ scenario.name, std::move(name), passed, std::move(detail) });
+        };
+        const auto outbound = [](Scenario& scenario) -> DirectionProfile& {
+            return scenario.link.directions[DirectionIndex(Direction::Outbound)];
+        };
+        const ScenarioFlow cbr{ Direction::Outbound, 1000, 8000, std::chrono::milliseconds(0), std::chrono::milliseconds(10000) };
+
+        // Loss: 10 % of 10000 packets, within the 99.9 % interval, and the seed replays it
+        {
+            Scenario scenario;
+            scenario.name = "Loss";
+            scenario.link.modules = ModuleMask::PACKET_LOSS;
+            outbound(scenario).loss_rate = 10.0f;
+            scenario.flows = { cbr };
+            const auto result = RunScenario(scenario);
+            const auto interval = ScenarioStats::LossInterval(result, 0);
+            check(scenario, "loss rate", interval.Contains(10.0),
+                std::format("{:.2f} % [{:.2f}, {:.2f}], expected 10 %", ScenarioStats::LossRate(result, 0),
+                    interval.low, interval.high));
+
+            const auto replay = RunScenario(scenario);
+            const bool same = replay.delivered.size() == result.delivered.size() &&
+                std::ranges::equal(replay.delivered, result.delivered, {}, &ScenarioPacket::sequence, &ScenarioPacket::sequence);
+            check(scenario, "seed replay", same, std::format("{} and {} delivered", result.delivered.size(),
+                replay.delivered.size()));
+        }
+
+        // Latency: every packet exactly 300 ms late, within one tick
+        {
+            Scenario scenario;
+            scenario.name = "Latency";
+            scenario.link.modules = ModuleMask::LATENCY;
+            outbound(scenario).latency_ms = 300;
+            scenario.flows = { { Direction::Outbound, 1000, 800, std::chrono::milliseconds(0), std::chrono::milliseconds(2000) } };
+            const auto result = RunScenario(scenario);
+            const double low = ScenarioStats::DelayPercentile(result, 0, 0);
+            const double high = ScenarioStats::DelayPercentile(result, 0, 100);
+            check(scenario, "fixed delay", ScenarioStats::LossRate(result, 0) == 0 && low >= 300 && high <= 301,
+                std::format("{:.1f}-{:.1f} ms, expected 300 ms", low, high));
+        }
+
+        // Delayed duplicates: copies held 5 ms still pass the 100 ms latency, so each lands 5 ms
+        // after its original instead of ahead of it
+        {
+            Scenario scenario;
+            scenario.name = "Delayed duplicates";
+            scenario.link.modules = ModuleMask::DUPLICATE | ModuleMask::LATENCY;
+            outbound(scenario).latency_ms = 100;
+            outbound(scenario).duplicate_rate = 100.0f;
+            outbound(scenario).duplicate_delay_min_ms = 5;
+            outbound(scenario).duplicate_delay_max_ms = 5;
+            scenario.flows = { { Direction::Outbound, 1000, 800, std::chrono::milliseconds(0), std::chrono::milliseconds(2000) } };
+            const auto result = RunScenario(scenario);
+            const double low = ScenarioStats::DelayPercentile(result, 0, 0);
+            const double high = ScenarioStats::DelayPercentile(result, 0, 100);
+            check(scenario, "copy after original", result.delivered.size() == 2 * result.sent[0] &&
+                low >= 100 && low <= 101 && high >= 105 && high <= 106,
+                std::format("{} of {} delivered, {:.1f}-{:.1f} ms, expected twice each at 100 and 105 ms",
+                    result.delivered.size(), result.sent[0], low, high));
+        }
+
+        // Jitter: uniform 10-50 ms, so the median sits near 30 and the tails near the bounds
+        {
+            Scenario scenario;
+            scenario.name = "Jitter";
+            scenario.link.modules = ModuleMask::JITTER;
+            outbound(scenario).jitter_min_ms = 10;
+            outbound(scenario).jitter_max_ms = 50;
+            scenario.flows = { cbr };
+            const auto result = RunScenario(scenario);
+            const double p1 = ScenarioStats::DelayPercentile(result, 0, 1);
+            const double p50 = ScenarioStats::DelayPercentile(result, 0, 50);
+            const double p99 = ScenarioStats::DelayPercentile(result, 0, 99);
+            check(scenario, "percentiles", p1 >= 10 && p1 <= 12 && std::abs(p50 - 30) <= 2 && p99 >= 48 && p99 <= 51,
+                std::format("p1 {:.1f}, p50 {:.1f}, p99 {:.1f} ms, expected about 10.4, 30, 49.6", p1, p50, p99));
+        }
+
+        // Fragments then jitter: 3000-byte packets over a 1000-byte MTU, four fragments each
+        // Every fragment has its own draw, so the pieces of one packet rarely share a delay
+        {
+            Scenario scenario;
+            scenario.name = "Fragment jitter";
+            scenario.link.modules = ModuleMask::JITTER;
+            scenario.mtu = 1000;
+            outbound(scenario).jitter_min_ms = 10;
+            outbound(scenario).jitter_max_ms = 50;
+            scenario.flows = { { Direction::Outbound, 3000, 4800, std::chrono::milliseconds(0), std::chrono::milliseconds(5000) } };
+            const auto result = RunScenario(scenario);
+
+            std::vector<std::vector<double>> delays(result.sent[0]);
+            for (const auto& packet : result.delivered) {
+                if (packet.sequence < delays.size()) {
+                    delays[packet.sequence].push_back(packet.DelayMs());
+                }
+            }
+            size_t fragmented = 0;
+            size_t uniform = 0;
+            for (const auto& pieces : delays) {
+                if (pieces.size() > 1) {
+                    ++fragmented;
+                    uniform += std::ranges::all_of(pieces, [&](double delay) { return delay == pieces.front(); }) ? 1 : 0;
+                }
+            }
+            const double p50 = ScenarioStats::DelayPercentile(result, 0, 50);
+            check(scenario, "independent pieces", fragmented != 0 && uniform * 100 <= fragmented && std::abs(p50 - 30) <= 2,
+                std::format("{} of {} fragmented packets with one delay for every piece, p50 {:.1f} ms, expected under 1 % and about 30",
+                    uniform, fragmented, p50));
+        }
+
+        // Shaping: 4000 kbps offered into a 2000 kbps limit
+        {
+            Scenario scenario;
+            scenario.name = "Shaping";
+            scenario.link.modules = ModuleMask::BANDWIDTH;
+            outbound(scenario).bandwidth_kbps = 2000;
+            scenario.flows = { { Direction::Outbound, 1000, 4000, std::chrono::milliseconds(0), std::chrono::milliseconds(20000) } };
+            const auto result = RunScenario(scenario);
+            const double kbps = ScenarioStats::ThroughputKbps(result, 0);
+            check(scenario, "throughput", std::abs(kbps - 2000) <= 100,
+                std::format("{:.0f} kbps, expected 2000 kbps", kbps));
+        }
+
+        // Reordering: packets trade places inside the reorder buffer, so they mostly land a few
+        // places late; the held tail can be kept for several rounds, the maximum has no hard bound
+        {
+            Scenario scenario;
+            scenario.name = "Reorder";
+            scenario.link.modules = ModuleMask::OUT_OF_ORDER;
+            outbound(scenario).reorder_rate = 20.0f;
+            outbound(scenario).reorder_gap = 5;
+            scenario.flows = { cbr };
+            const auto result = RunScenario(scenario);
+            const auto reordering = ScenarioStats::ReorderDistance(result, 0);
+            check(scenario, "distance", reordering.reordered != 0 && reordering.mean_distance <= 5,
+                std::format("{} reordered, mean {:.2f}, max {}, expected a mean within the gap of 5", reordering.reordered,
+                    reordering.mean_distance, reordering.max_distance));
+        }
+
+        // Worker threads: the same traffic through one and through four workers gets the same drops,
+        // copies, flips and delays; one packet in 25 is sent twice to exercise the repeat count
+        {
+            LinkConfig link;
+            link.modules = ModuleMask::PACKET_LOSS | ModuleMask::DUPLICATE | ModuleMask::CORRUPTION | ModuleMask::JITTER;
+            for (auto& direction : link.directions) {
+                direction.loss_rate = 10.0f;
+                direction.duplicate_rate = 10.0f;
+                direction.duplicate_delay_min_ms = 1;
+                direction.duplicate_delay_max_ms = 5;
+                direction.corruption_ber = 0.0001f;
+                direction.jitter_min_ms = 10;
+                direction.jitter_max_ms = 50;
+            }
+
+            std::vector<SimulatedPacket> packets;
+            for (uint32_t sequence = 0; sequence < 500; ++sequence) {
+                for (uint32_t flow = 0; flow < 8; ++flow) {
+                    const ScenarioFlow traffic{ flow % 2 == 0 ? Direction::Outbound : Direction::Inbound, 200 + 100 * flow };
+                    packets.push_back(MakePacket(traffic, flow, sequence, {}));
+                    if ((sequence + flow) % 25 == 0) {
+                        packets.push_back(packets.back());
+                    }
+                }
+            }
+
+            const uint64_t previous_seed = RandomUtils::GetSeed();
+            RandomUtils::SetSeed(1);
+            const auto single = RunWorkers(link, packets, 1);
+            const auto threaded = RunWorkers(link, packets, 4);
+            RandomUtils::SetSeed(previous_seed);
+
+            checks.push_back({ "Worker threads", "1 and 4 workers", single == threaded,
+                std::format("{} and {} packets out of {}, expected the same decisions for every packet",
+                    single.size(), threaded.size(), packets.size()) });
+        }
+
+        // Filter compiler: the bytecode VM must agree with the AST walk it replaces on every
+        // preset and on the rule syntax the presets leave out
+        {
+            constexpr std::string_view EXTRA_FILTERS[] = {
+                "tcp.Syn and !tcp.Ack and tcp.DstPort < 1024",
+                "ipv6.DstAddr == ::1 or ip.SrcAddr == 10.0.0.1",
+                "(udp ? udp.DstPort == 443 : tcp.DstPort == 443)",
+                "fragment or ip.MF or ip.FragOff != 0",
+                "localport == 53 and remoteport > 1023",
+                "icmp.Type == 8 or icmpv6.Type >= 128",
+                "tcp.PayloadLength > 100 and outbound and not impostor",
+                "ip.TTL <= 64 && (ifIdx == 2 || subIfIdx == 1) && length >= 100",
+            };
+            std::vector<std::string_view> filters;
+            for (const auto& preset : PRESET_FILTERS) {
+                filters.push_back(preset.expression);
+            }
+            filters.insert(filters.end(), std::begin(EXTRA_FILTERS), std::end(EXTRA_FILTERS));
+
+            const auto packets = MakeMixedPackets(4096);
+            for (const auto filter : filters) {
+                const auto mismatches = CountFilterMismatches(filter, packets);
+                checks.push_back({ "Filter compiler", std::string(filter), mismatches.has_value() && *mismatches == 0,
+                    mismatches.has_value() ? std::format("{} of {} packets differ, expected 0", *mismatches, packets.size())
+                        : mismatches.error() });
+            }
+        }
+
+        // Payload matcher: the SSSE3 search against the scalar one, and the scalar one against a
+        // plain substring search, for each mask length and a full set of 64 patterns
+        {
+            const auto parse = [](std::initializer_list<std::string_view> texts) {
+                std::vector<std::vector<uint8_t>> patterns;
+                for (const auto text : texts) {
+                    patterns.push_back(*ParsePattern(text));
+                }
+                return patterns;
+            };
+            std::vector<std::pair<std::string, std::vector<std::vector<uint8_t>>>> sets = {
+                { "one byte", parse({ "a", "|00|", "|ff|" }) },
+                { "two bytes", parse({ "GE", "|16 03|", "ab" }) },
+                { "HTTP and TLS", parse({ "GET /", "Host: ", "|16 03 01|", "HTTP/1.1", "|0d 0a 0d 0a|" }) },
+            };
+            RandomStream rng(RandomDomain::SelfTest, 2, 1);
+            std::vector<std::vector<uint8_t>> many(PayloadMatcher::MAX_PATTERNS);
+            for (auto& pattern : many) {
+                pattern.resize(rng.Between(3, 12));
+                for (auto& byte : pattern) {
+                    byte = static_cast<uint8_t>(rng.Between('a', 'h'));
+                }
+            }
+            sets.emplace_back("64 patterns", std::move(many));
+
+            for (const auto& [name, patterns] : sets) {
+                auto matcher = PayloadMatcher::Compile(patterns);
+                if (!matcher.has_value()) {
+                    checks.push_back({ "Payload matcher", name, false, matcher.error() });
+                    continue;
+                }
+                size_t vector_mismatches = 0;
+                size_t scalar_mismatches = 0;
+                size_t matched = 0;
+                const auto payloads = MakePayloads(2000, 1500, patterns);
+                for (const auto& payload : payloads) {
+                    uint64_t expected = 0;
+                    for (size_t i = 0; i < patterns.size(); ++i) {
+                        if (!std::ranges::search(payload, patterns[i]).empty()) {
+                            expected |= uint64_t{ 1 } << i;
+                        }
+                    }
+                    const uint64_t scalar = matcher->MatchScalar(payload);
+                    scalar_mismatches += scalar != expected ? 1 : 0;
+                    vector_mismatches += matcher->Match(payload) != scalar ? 1 : 0;
+                    matched += expected != 0 ? 1 : 0;
+                }
+                checks.push_back({ "Payload matcher", name, vector_mismatches == 0 && scalar_mismatches == 0,
+                    std::format("{} vectorized and {} scalar of {} payloads ({} matching) differ, expected 0{}",
+                        vector_mismatches, scalar_mismatches, payloads.size(), matched,
+                        PayloadMatcher::IsVectorized() ? "" : ", no SSSE3 so both ran scalar") });
+            }
+        }
+
+        return checks;
+    }
+
+}
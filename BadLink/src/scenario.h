@@ -0,0 +1,115 @@
+#ifndef BADLINK_SRC_SCENARIO_H_
+#define BADLINK_SRC_SCENARIO_H_
+
+#include "link_chain.h"
+#include "simulation_clock.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace BadLink {
+
+    // Constant bit rate stream of equal-sized UDP/IPv4 packets
+    struct ScenarioFlow {
+        Direction direction = Direction::Outbound;
+        uint32_t packet_bytes = 1000;               // IP packet size, at least the 28 header bytes
+        uint32_t rate_kbps = 1000;
+        std::chrono::milliseconds start{ 0 };
+        std::chrono::milliseconds duration{ 10000 };
+    };
+
+    // Scripted traffic through one link chain
+    struct Scenario {
+        std::string name;
+        LinkConfig link;                            // Modules and per-direction values under test
+        uint32_t mtu = 0;                           // Link MTU, 0 leaves the MTU stage off
+        std::vector<ScenarioFlow> flows;
+        std::chrono::microseconds tick{ 1000 };     // Virtual time between release passes
+        std::chrono::milliseconds drain{ 2000 };    // Virtual time after the last flow for delayed packets
+        uint64_t seed = 1;
+    };
+
+    // A packet that came out of the chain
+    struct ScenarioPacket {
+        uint32_t flow = 0;          // Index into Scenario::flows
+        uint32_t sequence = 0;      // Position in its flow, duplicates and fragments repeat it
+        uint32_t bytes = 0;
+        Direction direction = Direction::Outbound;
+        SimulationClock::time_point sent;
+        SimulationClock::time_point delivered;
+
+        double DelayMs() const { return std::chrono::duration<double, std::milli>(delivered - sent).count(); }
+    };
+
+    struct ScenarioResult {
+        std::vector<uint64_t> sent;                 // Packets per flow
+        std::vector<ScenarioPacket> delivered;      // In delivery order
+        SimulationClock::duration simulated{};
+        std::chrono::steady_clock::duration wall{};
+    };
+
+    // Runs a scenario single-threaded under a VirtualClock through the in-process API:
+    // packets enter the chain when their flow emits them, every tick collects what the
+    // delaying stages release, the way the capture engine's release threads do
+    // Flow and sequence ride in the address's interface fields, which no stage touches
+    [[nodiscard]] ScenarioResult RunScenario(const Scenario& scenario);
+
+    // Statistics over one flow of a result
+    namespace ScenarioStats {
+
+        struct Interval {
+            double low = 0;
+            double high = 0;
+
+            bool Contains(double value) const { return value >= low && value <= high; }
+        };
+
+        struct Reordering {
+            uint64_t reordered = 0;     // Packets delivered after a later sequence of their flow
+            uint32_t max_distance = 0;  // Largest sequence gap they arrived behind
+            double mean_distance = 0;
+        };
+
+        // Percentage of the flow's sequences that never came out
+        [[nodiscard]] double LossRate(const ScenarioResult& result, uint32_t flow);
+
+        // Wilson score interval of the loss percentage, `z` 3.29 is 99.9 %
+        [[nodiscard]] Interval LossInterval(const ScenarioResult& result, uint32_t flow, double z = 3.29);
+
+        // Delay in milliseconds below which `percentile` (0-100) of the delivered packets fall
+        [[nodiscard]] double DelayPercentile(const ScenarioResult& result, uint32_t flow, double percentile);
+
+        // Delivered rate between the first and the last delivery
+        [[nodiscard]] double ThroughputKbps(const ScenarioResult& result, uint32_t flow);
+
+        [[nodiscard]] Reordering ReorderDistance(const ScenarioResult& result, uint32_t flow);
+
+    }
+
+    // Mixed IPv4/IPv6 TCP/UDP/ICMP packets with random addresses, ports, flags, fragments and
+    // direction, the same for the same seed; what the fast paths are checked and timed against
+    [[nodiscard]] std::vector<SimulatedPacket> MakeMixedPackets(size_t count, uint64_t seed = 1);
+
+    // Payloads of 0 to `max_bytes` bytes, half of them drawn from the patterns' own bytes so
+    // near misses are common, with one whole pattern planted in about a quarter of them
+    [[nodiscard]] std::vector<std::vector<uint8_t>> MakePayloads(size_t count, size_t max_bytes,
+        const std::vector<std::vector<uint8_t>>& patterns, uint64_t seed = 1);
+
+    // Outcome of one check of a built-in scenario
+    struct ScenarioCheck {
+        std::string scenario;
+        std::string check;
+        bool passed = false;
+        std::string detail;         // Measured against expected
+    };
+
+    // Regression net for the module chain: loss, latency, jitter, shaping and reordering
+    // scenarios with statistical checks, each runs in well under a second
+    // Also checks that one and four worker threads decide the same for the same traffic, the
+    // compiled filters against the filter AST walk on mixed packets, and the vectorized payload
+    // matcher against its scalar search
+    [[nodiscard]] std::vector<ScenarioCheck> RunBuiltInScenarios();
+
+}
+#endif  // BADLINK_SRC_SCENARIO_H_
@@ -0,0 +1,57 @@
+#ifndef BADLINK_SRC_SIMULATION_CLOCK_H_
+#define BADLINK_SRC_SIMULATION_CLOCK_H_
+
+#include <atomic>
+#include <chrono>
+
+namespace BadLink {
+
+    // Time source of the modules' delays, rates and schedules
+    // Time points stay steady_clock ones, so packet timestamps and release times mean the same
+    // under either clock
+    class SimulationClock {
+    public:
+        using time_point = std::chrono::steady_clock::time_point;
+        using duration = std::chrono::steady_clock::duration;
+
+        virtual ~SimulationClock() = default;
+        virtual time_point Now() const = 0;
+    };
+
+    // The steady clock, what every module uses unless given another one
+    class RealTimeClock final : public SimulationClock {
+    public:
+        time_point Now() const override { return std::chrono::steady_clock::now(); }
+
+        static const RealTimeClock& Instance() {
+            static const RealTimeClock clock;
+            return clock;
+        }
+    };
+
+    // Manually advanced clock: a single thread runs a scenario by alternating ProcessBatch,
+    // Advance and GetReleasablePackets, so an hour of shaped traffic takes as long as the
+    // packets take to process and every run sees the same times
+    // Starts at `start`, the zero time point by default, and never moves on its own
+    class VirtualClock final : public SimulationClock {
+    public:
+        explicit VirtualClock(time_point start = time_point{}) : now_(start.time_since_epoch().count()) {}
+
+        time_point Now() const override { return time_point(duration(now_.load())); }
+
+        void Advance(duration step) { now_.fetch_add(step.count()); }
+
+        // Moves to `at`, time never goes back so an earlier point is ignored
+        void AdvanceTo(time_point at) {
+            auto current = now_.load();
+            const auto target = at.time_since_epoch().count();
+            while (target > current && !now_.compare_exchange_weak(current, target)) {
+            }
+        }
+
+    private:
+        std::atomic<duration::rep> now_;
+    };
+
+}
+#endif  // BADLINK_SRC_SIMULATION_CLOCK_H_
@@ -5,17 +5,124 @@
 #include <vector>
 #include <chrono>
 #include <span>
+#include <memory>
+#include <array>
 #include <windivert.h>
+#include "packet_parser.h"
+#include "flow_table.h"
+#include "random_utils.h"
+#include "simulation_clock.h"
 
 namespace BadLink {
 
+    // One bit per impairment module, rules select which ones a flow goes through
+    namespace ModuleMask {
+        constexpr uint32_t PACKET_LOSS = 1u << 0;
+        constexpr uint32_t HEADER_REWRITE = 1u << 1;
+        constexpr uint32_t DUPLICATE = 1u << 2;
+        constexpr uint32_t CORRUPTION = 1u << 3;
+        constexpr uint32_t MTU = 1u << 4;
+        constexpr uint32_t OUT_OF_ORDER = 1u << 5;
+        constexpr uint32_t JITTER = 1u << 6;
+        constexpr uint32_t BANDWIDTH = 1u << 7;
+        constexpr uint32_t LATENCY = 1u << 8;
+        constexpr uint32_t ALL = (1u << 9) - 1;
+    }
+
     struct SimulatedPacket {
-        std::vector<uint8_t> data;
+        // Longest header carried inline by a slice (IP + TCP, both with options)
+        static constexpr size_t MAX_PREFIX_LENGTH = 128;
+
+        // Packet bytes, shared between a packet and its duplicates
+        // Use MutableData() before writing so copies are left untouched
+        std::shared_ptr<std::vector<uint8_t>> data;
         WINDIVERT_ADDRESS addr{};
+        PacketHeaders headers;      // Parsed once at capture, shared by all stages
+        FlowHandle flow;            // Assigned at capture, index for PerFlow<T> module state
+        uint32_t modules = ModuleMask::ALL;     // Modules allowed to touch this packet
+        uint8_t traffic_class = 0;              // 1-based HTB class picked by a rule, 0 = by DSCP
+        uint8_t link = 0;                       // 1-based named link picked by a rule, 0 = main link
+        RandomKey random_stream;                // Flow's stream and sequence within the flow, keys RandomStream
         std::chrono::steady_clock::time_point timestamp;
         std::chrono::steady_clock::time_point release_time;
+
+        // Coalesced LSO/GRO super-packet: payload bytes per wire segment, 0 for normal packets
+        // Carried as one unit until a stage needs per-segment decisions (see Gso::Segment)
+        uint16_t gso_size = 0;
+
+        // Scatter/gather view, used by fragments to reference the original buffer
+        // On the wire the packet is prefix[0, prefix_length) + data[slice_offset, slice_offset + slice_length)
+        bool is_slice = false;
+        uint16_t prefix_length = 0;
+        uint32_t slice_offset = 0;
+        uint32_t slice_length = 0;
+        std::array<uint8_t, MAX_PREFIX_LENGTH> prefix{};
+
+        size_t Size() const {
+            if (is_slice) {
+                return prefix_length + static_cast<size_t>(slice_length);
+            }
+            return data ? data->size() : 0;
+        }
+
+        // Contiguous bytes, only valid for packets without a prefix
+        std::span<const uint8_t> Bytes() const {
+            if (!data) {
+                return {};
+            }
+            std::span<const uint8_t> bytes(*data);
+            return is_slice ? bytes.subspan(slice_offset, slice_length) : bytes;
+        }
+
+        // Append the wire bytes to a send buffer
+        void AppendTo(std::vector<uint8_t>& out) const {
+            if (is_slice) {
+                out.insert(out.end(), prefix.begin(), prefix.begin() + prefix_length);
+            }
+            const auto bytes = Bytes();
+            out.insert(out.end(), bytes.begin(), bytes.end());
+        }
+
+        // Copy-on-write access to the packet bytes, slices are flattened first
+        std::vector<uint8_t>& MutableData() {
+            if (is_slice) {
+                auto flat = std::make_shared<std::vector<uint8_t>>();
+                flat->reserve(Size());
+                AppendTo(*flat);
+                data = std::move(flat);
+                is_slice = false;
+                prefix_length = 0;
+                slice_offset = 0;
+                slice_length = 0;
+            }
+            else if (!data) {
+                data = std::make_shared<std::vector<uint8_t>>();
+            }
+            else if (data.use_count() > 1) {
+                data = std::make_shared<std::vector<uint8_t>>(*data);
+            }
+            return *data;
+        }
     };
 
+    // Packet direction, the value is the WINDIVERT_ADDRESS Outbound bit
+    enum class Direction : uint8_t {
+        Inbound = 0,
+        Outbound = 1,
+    };
+
+    // One parameter set per direction, picked by the packet's Outbound bit without branching
+    template <typename T>
+    using PerDirection = std::array<T, 2>;
+
+    inline size_t DirectionIndex(Direction direction) {
+        return static_cast<size_t>(direction);
+    }
+
+    inline size_t DirectionIndex(const SimulatedPacket& packet) {
+        return packet.addr.Outbound;
+    }
+
     class SimulationModule {
     public:
         virtual ~SimulationModule() = default;
@@ -34,6 +141,16 @@ namespace BadLink {
         // Set direction filters
         virtual void SetInboundEnabled(bool enabled) = 0;
         virtual void SetOutboundEnabled(bool enabled) = 0;
+
+        // Time source, real time unless a test or scenario hands in a VirtualClock
+        // Set it before packets flow, the clock must outlive the module
+        virtual void SetClock(const SimulationClock& clock) { clock_ = &clock; }
+
+    protected:
+        SimulationClock::time_point Now() const { return clock_->Now(); }
+
+    private:
+        const SimulationClock* clock_ = &RealTimeClock::Instance();
     };
 }
 #endif  // BADLINK_SRC_SIMULATION_MODULE_H_
\ No newline at end of file
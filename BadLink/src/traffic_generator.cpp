@@ -0,0 +1,363 @@
+#define NOMINMAX
+#include "traffic_generator.h"
+#include "checksum.h"
+#include "cidr.h"
+#include "packet_parser.h"
+#include "precise_timer.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <format>
+#include <optional>
+#include <span>
+
+namespace BadLink {
+
+    namespace {
+        constexpr size_t MAX_SHARDS = 16;
+        constexpr uint32_t MAX_PACKET_BYTES = 65535;
+
+        // Well-known remote ports, local ones are ephemeral
+        constexpr uint16_t TCP_PORTS[] = { 443, 80, 8080, 22 };
+        constexpr uint16_t UDP_PORTS[] = { 443, 3478, 4500, 5001 };
+
+        uint32_t HeaderBytes(bool ipv6, bool tcp) {
+            return (ipv6 ? 40 : 20) + (tcp ? 20 : 8);
+        }
+
+        // True for a `share` of the draws: 1 - Uniform() is in [0, 1), so 0 never and 1 always holds
+        bool Draw(RandomStream& rng, double share) {
+            return 1.0 - rng.Uniform() < share;
+        }
+
+        std::optional<uint32_t> ParseNumber(std::string_view text) {
+            uint32_t value = 0;
+            const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (error != std::errc() || end != text.data() + text.size() || text.empty()) {
+                return std::nullopt;
+            }
+            return value;
+        }
+    }
+
+    std::expected<std::vector<PacketSizeWeight>, std::string> ParsePacketSizes(std::string_view text) {
+        std::vector<PacketSizeWeight> sizes;
+        while (!text.empty()) {
+            const size_t comma = text.find(',');
+            const std::string_view item = TrimSpaces(text.substr(0, comma));
+            text.remove_prefix(comma == std::string_view::npos ? text.size() : comma + 1);
+            if (item.empty()) {
+                continue;
+            }
+
+            const size_t colon = item.find(':');
+            const auto bytes = ParseNumber(TrimSpaces(item.substr(0, colon)));
+            const auto weight = colon == std::string_view::npos ? std::optional<uint32_t>(1) : ParseNumber(TrimSpaces(item.substr(colon + 1)));
+            if (!bytes || *bytes == 0 || *bytes > MAX_PACKET_BYTES || !weight || *weight == 0) {
+                return std::unexpected(std::format("Invalid packet size '{}'", item));
+            }
+            sizes.push_back({ *bytes, *weight });
+        }
+
+        if (sizes.empty()) {
+            return std::unexpected(std::string("No packet sizes"));
+        }
+        return sizes;
+    }
+
+    std::string FormatPacketSizes(const std::vector<PacketSizeWeight>& sizes) {
+        std::string text;
+        for (const auto& size : sizes) {
+            text += std::format("{}{}:{}", text.empty() ? "" : ", ", size.bytes, size.weight);
+        }
+        return text;
+    }
+
+    // A slice of the active flows with its own lock and random stream
+    struct TrafficGenerator::Shard {
+        ContendedMutex mutex{ "Traffic generator" };
+        RandomStream rng;
+        std::vector<Flow> flows;
+
+        Shard(uint64_t index, uint64_t seed) : rng(RandomDomain::Traffic, index, seed) {}
+    };
+
+    TrafficGenerator::TrafficGenerator(const TrafficProfile& profile) : profile_(profile) {
+        profile_.flows = std::max(profile_.flows, 1u);
+        profile_.flow_size_min = std::max(profile_.flow_size_min, 1u);
+        profile_.flow_size_shape = std::max(profile_.flow_size_shape, 0.1);
+        std::erase_if(profile_.packet_sizes, [](const PacketSizeWeight& size) { return size.weight == 0; });
+        if (profile_.packet_sizes.empty()) {
+            profile_.packet_sizes = TrafficProfile{}.packet_sizes;
+        }
+
+        uint64_t total_weight = 0;
+        for (const auto& size : profile_.packet_sizes) {
+            total_weight += size.weight;
+            size_weights_.push_back(total_weight);
+        }
+
+        // One template per version, protocol and size; sizes below the headers grow to fit them
+        for (const bool ipv6 : { false, true }) {
+            for (const bool tcp : { false, true }) {
+                for (const auto& size : profile_.packet_sizes) {
+                    const uint32_t bytes = std::clamp(size.bytes, HeaderBytes(ipv6, tcp), MAX_PACKET_BYTES);
+                    Template& packet = templates_.emplace_back();
+                    packet.data.assign(bytes, 0);
+                    uint8_t* data = packet.data.data();
+                    const uint8_t protocol = tcp ? IpProtocol::TCP : IpProtocol::UDP;
+
+                    if (ipv6) {
+                        data[0] = 0x60;
+                        StoreBe16(data + 4, static_cast<uint16_t>(bytes - 40));
+                        data[6] = protocol;
+                        data[7] = 64;
+                        packet.transport_offset = 40;
+                    }
+                    else {
+                        data[0] = 0x45;
+                        StoreBe16(data + 2, static_cast<uint16_t>(bytes));
+                        data[6] = 0x40;     // Don't fragment
+                        data[8] = 64;
+                        data[9] = protocol;
+                        packet.transport_offset = 20;
+                    }
+
+                    uint8_t* transport = data + packet.transport_offset;
+                    if (tcp) {
+                        transport[12] = 0x50;   // 20-byte header
+                        transport[13] = 0x18;   // PSH, ACK
+                        StoreBe16(transport + 14, 0xFFFF);
+                        packet.checksum_offset = static_cast<uint16_t>(packet.transport_offset + 16);
+                    }
+                    else {
+                        StoreBe16(transport + 4, static_cast<uint16_t>(bytes - packet.transport_offset));
+                        packet.checksum_offset = static_cast<uint16_t>(packet.transport_offset + 6);
+                    }
+                    packet.payload_bytes = bytes - HeaderBytes(ipv6, tcp);
+
+                    const std::span<uint8_t> span(packet.data);
+                    const PacketHeaders headers = ParseHeaders(span);
+                    Checksum::UpdateIPv4Header(span, headers);
+                    Checksum::UpdateTransport(span, headers);
+                    max_bytes_ = std::max<size_t>(max_bytes_, bytes);
+                }
+            }
+        }
+
+        const size_t shard_count = std::min<size_t>(MAX_SHARDS, profile_.flows);
+        for (size_t i = 0; i < shard_count; ++i) {
+            auto shard = std::make_unique<Shard>(i, profile_.seed);
+            shard->flows.resize(profile_.flows / shard_count + (i < profile_.flows % shard_count ? 1 : 0));
+            for (auto& flow : shard->flows) {
+                StartFlow(*shard, flow);
+            }
+            shards_.push_back(std::move(shard));
+        }
+    }
+
+    TrafficGenerator::~TrafficGenerator() = default;
+
+    std::expected<void, std::string> TrafficGenerator::Open(const std::string& filter) {
+        if (auto compiled = filter_.Compile(filter); !compiled) {
+            return compiled;
+        }
+        shutdown_.store(false);
+        opened_.store(Now());
+        open_.store(true);
+        return {};
+    }
+
+    void TrafficGenerator::StartFlow(Shard& shard, Flow& flow) {
+        RandomStream& rng = shard.rng;
+        flow.ip_version = Draw(rng, profile_.ipv6_share) ? 6 : 4;
+        flow.protocol = Draw(rng, profile_.tcp_share) ? IpProtocol::TCP : IpProtocol::UDP;
+        flow.outbound = Draw(rng, profile_.outbound_share);
+
+        // Pareto by inverse CDF, a few flows carry most of the packets
+        const double size = profile_.flow_size_min * std::pow(rng.Uniform(), -1.0 / profile_.flow_size_shape);
+        flow.remaining = static_cast<uint32_t>(std::min(std::ceil(size), static_cast<double>(UINT32_MAX)));
+        flow.tcp_sequence = rng();
+        flow.ip_id = static_cast<uint16_t>(rng());
+
+        // Local 10.0.0.0/16 or fd00::/64, remote 198.18.0.0/15 or 2001:db8::/32
+        const size_t address_bytes = flow.ip_version == 6 ? 16 : 4;
+        std::array<uint8_t, 16> local{};
+        std::array<uint8_t, 16> remote{};
+        if (flow.ip_version == 6) {
+            StoreBe16(local.data(), 0xFD00);
+            StoreBe16(remote.data(), 0x2001);
+            StoreBe16(remote.data() + 2, 0x0DB8);
+            for (size_t i = 8; i < 16; i += 4) {
+                StoreBe32(local.data() + i, rng());
+                StoreBe32(remote.data() + i, rng());
+            }
+        }
+        else {
+            StoreBe32(local.data(), 0x0A000000u | (rng() & 0xFFFFu));
+            StoreBe32(remote.data(), 0xC6120000u | (rng() & 0x1FFFFu));
+        }
+
+        const uint16_t local_port = static_cast<uint16_t>(rng.Between(49152, 65535));
+        const uint16_t remote_port = flow.protocol == IpProtocol::TCP ?
+            TCP_PORTS[rng.Between(0, std::size(TCP_PORTS) - 1)] : UDP_PORTS[rng.Between(0, std::size(UDP_PORTS) - 1)];
+
+        uint8_t* identity = flow.identity.data();
+        std::copy_n((flow.outbound ? local : remote).data(), address_bytes, identity);
+        std::copy_n((flow.outbound ? remote : local).data(), address_bytes, identity + address_bytes);
+        StoreBe16(identity + address_bytes * 2, flow.outbound ? local_port : remote_port);
+        StoreBe16(identity + address_bytes * 2 + 2, flow.outbound ? remote_port : local_port);
+
+        flow.address_sum = Checksum::Sum(std::span<const uint8_t>(identity, address_bytes * 2));
+        flow.port_sum = Checksum::Sum(std::span<const uint8_t>(identity + address_bytes * 2, 4));
+        flows_started_.fetch_add(1);
+    }
+
+    size_t TrafficGenerator::PickSize(RandomStream& rng) const {
+        const uint64_t total = size_weights_.back();
+        const uint64_t pick = std::min(static_cast<uint64_t>(rng.Uniform() * total), total - 1);
+        return std::ranges::upper_bound(size_weights_, pick) - size_weights_.begin();
+    }
+
+    const TrafficGenerator::Template& TrafficGenerator::GetTemplate(const Flow& flow, size_t size) const {
+        const size_t kind = (flow.ip_version == 6 ? 2 : 0) + (flow.protocol == IpProtocol::TCP ? 1 : 0);
+        return templates_[kind * profile_.packet_sizes.size() + size];
+    }
+
+    size_t TrafficGenerator::WritePacket(Flow& flow, size_t size, uint8_t* out) const {
+        const Template& packet = GetTemplate(flow, size);
+        std::copy(packet.data.begin(), packet.data.end(), out);
+
+        // The template's fields are zero, so each checksum just adds the words written in
+        const size_t address_bytes = flow.ip_version == 6 ? 16 : 4;
+        std::copy_n(flow.identity.data(), address_bytes * 2 + 4, out + (flow.ip_version == 6 ? 8 : 12));
+        if (flow.ip_version == 4) {
+            const uint16_t id = flow.ip_id++;
+            StoreBe16(out + 4, id);
+            const uint64_t sum = static_cast<uint16_t>(~LoadBe16(packet.data.data() + 10)) + flow.address_sum + id;
+            StoreBe16(out + 10, static_cast<uint16_t>(~Checksum::Fold(sum)));
+        }
+
+        uint64_t sum = static_cast<uint16_t>(~LoadBe16(packet.data.data() + packet.checksum_offset))
+            + flow.address_sum + flow.port_sum;
+        if (flow.protocol == IpProtocol::TCP) {
+            StoreBe32(out + packet.transport_offset + 4, flow.tcp_sequence);
+            sum += (flow.tcp_sequence >> 16) + (flow.tcp_sequence & 0xFFFF);
+            flow.tcp_sequence += packet.payload_bytes;
+        }
+        uint16_t checksum = static_cast<uint16_t>(~Checksum::Fold(sum));
+        if (checksum == 0 && flow.protocol == IpProtocol::UDP) {
+            checksum = 0xFFFF;  // Zero means no checksum in UDP
+        }
+        StoreBe16(out + packet.checksum_offset, checksum);
+
+        --flow.remaining;
+        return packet.data.size();
+    }
+
+    uint64_t TrafficGenerator::Available(Ticks now) const {
+        const uint64_t total = profile_.total_packets != 0 ? profile_.total_packets : UINT64_MAX;
+        if (profile_.packets_per_second <= 0) {
+            return total;
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::duration(now - opened_.load())).count();
+        return std::min<uint64_t>(total, static_cast<uint64_t>(elapsed * profile_.packets_per_second) + 1);
+    }
+
+    bool TrafficGenerator::Receive(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+        WINDIVERT_ADDRESS* addresses, UINT* address_length) {
+        // Keep generating until something passes the filter, like a driver blocking on matching traffic
+        const UINT address_capacity = *address_length;
+        do {
+            // An unpaced generator always has packets, only the shutdown ends a filter that rejects them all
+            if (shutdown_.load()) {
+                return false;
+            }
+            *address_length = address_capacity;
+            if (!Generate(buffer, buffer_length, received_length, addresses, address_length)) {
+                return false;
+            }
+            filter_.Apply(buffer, received_length, addresses, address_length);
+        } while (*address_length == 0);
+        return true;
+    }
+
+    bool TrafficGenerator::Generate(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+        WINDIVERT_ADDRESS* addresses, UINT* address_length) {
+        // As many packets as fit should every one be the largest size
+        const size_t capacity = std::min<size_t>(*address_length / sizeof(WINDIVERT_ADDRESS), buffer_length / max_bytes_);
+
+        // Claim the packets that are due, other workers claim theirs concurrently
+        uint64_t first = next_.load();
+        size_t count = 0;
+        while (true) {
+            const uint64_t available = Available(Now());
+            count = static_cast<size_t>(std::min<uint64_t>(capacity, available > first ? available - first : 0));
+            if (count != 0) {
+                if (next_.compare_exchange_weak(first, first + count)) {
+                    break;
+                }
+                continue;
+            }
+            const bool finished = profile_.total_packets != 0 && first >= profile_.total_packets;
+            if (capacity == 0 || finished || profile_.packets_per_second <= 0 || shutdown_.load()) {
+                break;
+            }
+
+            // Ahead of the rate: wait for the next packet like a driver waits for traffic
+            thread_local PreciseTimer timer;    // Workers call Receive concurrently, one timer each
+            const auto due = std::chrono::duration<double>(static_cast<double>(first) / profile_.packets_per_second);
+            timer.SleepUntil(std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(opened_.load())
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(due)));
+            first = next_.load();
+        }
+
+        // Out of packets, or the buffer cannot hold the largest: idle until the engine shuts down
+        if (count == 0) {
+            shutdown_.wait(false);
+            return false;
+        }
+
+        Shard& shard = *shards_[next_shard_.fetch_add(1) % shards_.size()];
+        std::lock_guard<ContendedMutex> lock(shard.mutex);
+
+        uint8_t* out = buffer;
+        for (size_t i = 0; i < count; ++i) {
+            Flow& flow = shard.flows[shard.rng.Between(0, static_cast<uint32_t>(shard.flows.size() - 1))];
+            if (flow.remaining == 0) {
+                StartFlow(shard, flow);
+            }
+
+            WINDIVERT_ADDRESS& addr = addresses[i];
+            addr = {};
+            addr.Layer = WINDIVERT_LAYER_NETWORK;
+            addr.Outbound = flow.outbound ? 1 : 0;
+            addr.IPv6 = flow.ip_version == 6 ? 1 : 0;
+            addr.IPChecksum = 1;
+            addr.TCPChecksum = flow.protocol == IpProtocol::TCP ? 1 : 0;
+            addr.UDPChecksum = flow.protocol == IpProtocol::UDP ? 1 : 0;
+            addr.Network.IfIdx = 1;
+
+            out += WritePacket(flow, PickSize(shard.rng), out);
+        }
+
+        *received_length = static_cast<UINT>(out - buffer);
+        *address_length = static_cast<UINT>(count * sizeof(WINDIVERT_ADDRESS));
+        return true;
+    }
+
+    bool TrafficGenerator::Send(const uint8_t*, UINT length, const WINDIVERT_ADDRESS*, UINT address_length) {
+        if (!open_.load()) {
+            return false;
+        }
+        sent_.fetch_add(address_length / sizeof(WINDIVERT_ADDRESS));
+        sent_bytes_.fetch_add(length);
+        return true;
+    }
+
+    void TrafficGenerator::Shutdown() {
+        shutdown_.store(true);
+        shutdown_.notify_all();
+    }
+
+}
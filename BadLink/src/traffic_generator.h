@@ -0,0 +1,132 @@
+#ifndef BADLINK_SRC_TRAFFIC_GENERATOR_H_
+#define BADLINK_SRC_TRAFFIC_GENERATOR_H_
+
+#include "capture_backend.h"
+#include "lock_stats.h"
+#include "random_utils.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BadLink {
+
+    // Share of generated packets that have one IP packet size
+    struct PacketSizeWeight {
+        uint32_t bytes = 0;
+        uint32_t weight = 0;
+    };
+
+    // Traffic the generator synthesizes
+    struct TrafficProfile {
+        double packets_per_second = 1e6;        // 0 generates as fast as the workers take packets
+        uint64_t total_packets = 0;             // 0 keeps going until the capture stops
+        uint32_t flows = 1000;                  // Active at once, a finished flow is replaced by a new one
+        double flow_size_shape = 1.2;           // Pareto shape of packets per flow, lower is heavier tailed
+        uint32_t flow_size_min = 4;             // Pareto scale, the smallest flow in packets
+        double ipv6_share = 0.3;
+        double tcp_share = 0.8;                 // The rest is UDP
+        double outbound_share = 0.5;            // Flows started by this host
+        std::vector<PacketSizeWeight> packet_sizes{ { 64, 7 }, { 576, 4 }, { 1500, 1 } };     // Simple IMIX
+        uint64_t seed = 1;
+    };
+
+    // Parses "64:7, 576:4, 1500:1", bytes:weight pairs; a bare size weighs 1
+    [[nodiscard]] std::expected<std::vector<PacketSizeWeight>, std::string> ParsePacketSizes(std::string_view text);
+    [[nodiscard]] std::string FormatPacketSizes(const std::vector<PacketSizeWeight>& sizes);
+
+    // Capture backend that synthesizes IPv4/IPv6 TCP/UDP traffic instead of capturing it,
+    // to load the engine without a driver or a network; what the engine sends is counted and dropped
+    // Every version, protocol and size has one packet built up front with valid checksums and
+    // zero addresses, ports and sequence fields. A generated packet is a copy of it with the
+    // flow's addresses and ports, the IPv4 ID and TCP sequence written in and the checksums
+    // adjusted by their sums, so the cost per packet does not grow with its size
+    // Flows are spread over shards with a lock each, concurrent workers rarely meet
+    // The filter given to Open is applied with BackendFilter, rejected packets are generated and dropped
+    // The engine's packet buffer must hold the largest size in the mix
+    class TrafficGenerator final : public CaptureBackend {
+    public:
+        explicit TrafficGenerator(const TrafficProfile& profile);
+        ~TrafficGenerator() override;
+
+        std::expected<void, std::string> Open(const std::string& filter) override;
+        bool IsOpen() const override { return open_.load(); }
+        bool Receive(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+            WINDIVERT_ADDRESS* addresses, UINT* address_length) override;
+        bool Send(const uint8_t* buffer, UINT length,
+            const WINDIVERT_ADDRESS* addresses, UINT address_length) override;
+        bool SetParam(WINDIVERT_PARAM, uint64_t) override { return true; }
+        bool GetParam(WINDIVERT_PARAM, uint64_t*) const override { return false; }
+        void Shutdown() override;
+        void Close() override { open_.store(false); }
+
+        uint64_t GetGenerated() const { return next_.load(); }
+        uint64_t GetFlowsStarted() const { return flows_started_.load(); }
+        uint64_t GetSent() const { return sent_.load(); }
+        uint64_t GetSentBytes() const { return sent_bytes_.load(); }
+
+    private:
+        // Pre-built packet of one version, protocol and size
+        struct Template {
+            std::vector<uint8_t> data;
+            uint16_t transport_offset = 0;
+            uint16_t checksum_offset = 0;       // Transport checksum
+            uint32_t payload_bytes = 0;
+        };
+
+        struct Flow {
+            std::array<uint8_t, 36> identity{};     // Addresses then ports, as they sit in the header
+            uint64_t address_sum = 0;               // Unfolded checksum sums of the identity
+            uint64_t port_sum = 0;
+            uint32_t remaining = 0;                 // Packets left before the flow ends
+            uint32_t tcp_sequence = 0;
+            uint16_t ip_id = 0;
+            uint8_t ip_version = 4;
+            uint8_t protocol = 0;
+            bool outbound = true;
+        };
+
+        struct Shard;
+
+        using Ticks = std::chrono::steady_clock::rep;
+
+        static Ticks Now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+        // Sequences the source has made available by `now`
+        uint64_t Available(Ticks now) const;
+
+        void StartFlow(Shard& shard, Flow& flow);
+        size_t PickSize(RandomStream& rng) const;
+        const Template& GetTemplate(const Flow& flow, size_t size) const;
+
+        // Writes the next packet of `flow` at `out`, returns its length
+        size_t WritePacket(Flow& flow, size_t size, uint8_t* out) const;
+
+        // Receive before the filter
+        bool Generate(uint8_t* buffer, UINT buffer_length, UINT* received_length,
+            WINDIVERT_ADDRESS* addresses, UINT* address_length);
+
+        TrafficProfile profile_;
+        BackendFilter filter_;
+        std::vector<Template> templates_;           // By version, protocol, then size
+        std::vector<uint64_t> size_weights_;        // Cumulative weights of profile_.packet_sizes
+        size_t max_bytes_ = 0;
+        std::vector<std::unique_ptr<Shard>> shards_;
+
+        std::atomic<bool> open_{ false };
+        std::atomic<bool> shutdown_{ false };
+        std::atomic<Ticks> opened_{ 0 };
+        std::atomic<uint64_t> next_{ 0 };           // Packets generated, stops at the total
+        std::atomic<uint64_t> next_shard_{ 0 };
+        std::atomic<uint64_t> flows_started_{ 0 };
+        std::atomic<uint64_t> sent_{ 0 };
+        std::atomic<uint64_t> sent_bytes_{ 0 };
+    };
+
+}
+#endif  // BADLINK_SRC_TRAFFIC_GENERATOR_H_
@@ -0,0 +1,76 @@
+#define NOMINMAX
+#include "traffic_policer.h"
+#include <algorithm>
+
+namespace BadLink {
+
+    void TrafficPolicer::Configure(uint32_t committed_kbps, const PolicerConfig& config) {
+        config_ = config;
+        committed_kbps_ = committed_kbps;
+        committed_rate_ = (committed_kbps * 1000.0) / 8.0;
+        peak_rate_ = (std::max(config.peak_kbps, committed_kbps) * 1000.0) / 8.0;
+        committed_tokens_ = config_.committed_burst;
+        excess_tokens_ = config_.excess_burst;
+        updated_.reset();
+    }
+
+    void TrafficPolicer::Refill(Clock::time_point now) {
+        if (updated_) {
+            const double elapsed = std::chrono::duration<double>(now - *updated_).count();
+            const double committed_burst = config_.committed_burst;
+            const double excess_burst = config_.excess_burst;
+
+            if (config_.mode == PolicerMode::SingleRate) {
+                // Tokens the committed bucket cannot hold spill into the excess bucket
+                const double committed = committed_tokens_ + elapsed * committed_rate_;
+                committed_tokens_ = std::min(committed, committed_burst);
+                excess_tokens_ = std::min(excess_tokens_ + (committed - committed_tokens_), excess_burst);
+            }
+            else {
+                committed_tokens_ = std::min(committed_tokens_ + elapsed * committed_rate_, committed_burst);
+                excess_tokens_ = std::min(excess_tokens_ + elapsed * peak_rate_, excess_burst);
+            }
+        }
+        updated_ = now;
+    }
+
+    PolicerColor TrafficPolicer::Mark(size_t bytes, Clock::time_point now) {
+        PolicerColor color = PolicerColor::Green;
+        if (committed_rate_ > 0) {
+            Refill(now);
+            const double size = static_cast<double>(bytes);
+
+            if (config_.mode == PolicerMode::SingleRate) {
+                if (committed_tokens_ >= size) {
+                    committed_tokens_ -= size;
+                }
+                else if (excess_tokens_ >= size) {
+                    excess_tokens_ -= size;
+                    color = PolicerColor::Yellow;
+                }
+                else {
+                    color = PolicerColor::Red;
+                }
+            }
+            else {
+                if (excess_tokens_ < size) {
+                    color = PolicerColor::Red;
+                }
+                else if (committed_tokens_ < size) {
+                    excess_tokens_ -= size;
+                    color = PolicerColor::Yellow;
+                }
+                else {
+                    excess_tokens_ -= size;
+                    committed_tokens_ -= size;
+                }
+            }
+        }
+
+        const size_t index = static_cast<size_t>(color);
+        ++counters_.packets[index];
+        counters_.bytes[index] += bytes;
+        return color;
+    }
+
+}
@@ -0,0 +1,78 @@
+#ifndef BADLINK_SRC_TRAFFIC_POLICER_H_
+#define BADLINK_SRC_TRAFFIC_POLICER_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace BadLink {
+
+    // How the bandwidth module enforces its rate
+    enum class BandwidthMode : uint8_t {
+        Shaper,         // Queue excess traffic and release it at the rate
+        Policer,        // Mark every packet on arrival and drop what is out of profile, nothing is queued
+    };
+
+    enum class PolicerMode : uint8_t {
+        SingleRate,     // RFC 2697 srTCM: committed rate, committed and excess burst
+        TwoRate,        // RFC 2698 trTCM: committed and peak rate, each with its burst
+    };
+
+    enum class PolicerColor : uint8_t { Green, Yellow, Red };
+
+    // Committed rate comes from the bandwidth limit
+    struct PolicerConfig {
+        PolicerMode mode = PolicerMode::SingleRate;
+        uint32_t committed_burst = 15000;   // CBS in bytes
+        uint32_t excess_burst = 30000;      // EBS (srTCM) or PBS (trTCM) in bytes
+        uint32_t peak_kbps = 2000;          // PIR, trTCM only
+        bool drop_exceeding = false;        // Drop yellow packets as well as red ones
+
+        bool operator==(const PolicerConfig&) const = default;
+    };
+
+    // Conform (green), exceed (yellow) and violate (red) counts, indexed by PolicerColor
+    struct PolicerCounters {
+        std::array<uint64_t, 3> packets{};
+        std::array<uint64_t, 3> bytes{};
+    };
+
+    // Color-blind three-color marker, the way an ISP edge router polices a subscriber
+    // Both buckets are refilled from the elapsed time on each packet, so the cost is a
+    // few multiplies per packet and the memory is four doubles, whatever the rate
+    // Not thread-safe, BandwidthModule calls it under its bucket lock
+    class TrafficPolicer {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // Buckets start full, so callers only reconfigure on an actual change
+        void Configure(uint32_t committed_kbps, const PolicerConfig& config);
+        uint32_t GetCommittedRate() const { return committed_kbps_; }
+        const PolicerConfig& GetConfig() const { return config_; }
+
+        // Color of a `bytes` long packet arriving at `now`, tokens are taken for it
+        PolicerColor Mark(size_t bytes, Clock::time_point now);
+
+        // Whether a packet of this color goes on
+        bool Passes(PolicerColor color) const {
+            return color == PolicerColor::Green || (color == PolicerColor::Yellow && !config_.drop_exceeding);
+        }
+
+        const PolicerCounters& GetCounters() const { return counters_; }
+
+    private:
+        PolicerConfig config_;
+        uint32_t committed_kbps_ = 0;
+        double committed_rate_ = 0;     // Bytes per second, 0 = unlimited
+        double peak_rate_ = 0;
+        double committed_tokens_ = 0;   // Tc
+        double excess_tokens_ = 0;      // Te (srTCM) or Tp (trTCM)
+        std::optional<Clock::time_point> updated_;     // Empty until the first packet
+        PolicerCounters counters_;
+
+        void Refill(Clock::time_point now);
+    };
+
+}
+#endif  // BADLINK_SRC_TRAFFIC_POLICER_H_